@@ -9,6 +9,7 @@
 #include "engine/vec.h"
 #include "renderer/model.h"
 #include "renderer/pose.h"
+#include "renderer/pose_simd.h"
 
 
 namespace Lumix
@@ -26,6 +27,8 @@ enum class Version
 
 
 static const ResourceType ANIMATION_TYPE("animation");
+// bones sampled at once, their keys are kept on the stack
+static const int SAMPLE_BATCH_SIZE = 64;
 
 
 Resource* AnimationManager::createResource(const Path& path)
@@ -58,59 +61,7 @@ void Animation::getRelativePose(float time, Pose& pose, Model& model, float weig
 
 	if (!model.isReady()) return;
 
-	int frame = (int)(time * m_fps);
-	float rcp_fps = 1.0f / m_fps;
-	frame = Math::clamp(frame, 0, m_frame_count - 1);
-	Vec3* pos = pose.positions;
-	Quat* rot = pose.rotations;
-
-	if (frame < m_frame_count)
-	{
-		for (Bone& bone : m_bones)
-		{
-			Model::BoneMap::iterator iter = model.getBoneIndex(bone.name);
-			if (!iter.isValid()) continue;
-
-			int idx = 1;
-			for (int c = bone.pos_count; idx < c; ++idx)
-			{
-				if (bone.pos_times[idx] > frame) break;
-			}
-
-			float t = float(time - bone.pos_times[idx - 1] * rcp_fps) /
-					  ((bone.pos_times[idx] - bone.pos_times[idx - 1]) * rcp_fps);
-
-			int model_bone_index = iter.value();
-			Vec3 anim_pos;
-			lerp(bone.pos[idx - 1], bone.pos[idx], &anim_pos, t);
-			lerp(pos[model_bone_index], anim_pos, &pos[model_bone_index], weight);
-
-			idx = 1;
-			for (int c = bone.rot_count; idx < c; ++idx)
-			{
-				if (bone.rot_times[idx] > frame) break;
-			}
-
-			t = float(time - bone.rot_times[idx - 1] * rcp_fps) /
-				((bone.rot_times[idx] - bone.rot_times[idx - 1]) * rcp_fps);
-
-			Quat anim_rot;
-			nlerp(bone.rot[idx - 1], bone.rot[idx], &anim_rot, t);
-			nlerp(rot[model_bone_index], anim_rot, &rot[model_bone_index], weight);
-		}
-	}
-	else
-	{
-		for (Bone& bone : m_bones)
-		{
-			Model::BoneMap::iterator iter = model.getBoneIndex(bone.name);
-			if (!iter.isValid()) continue;
-
-			int model_bone_index = iter.value();
-			lerp(pos[model_bone_index], bone.pos[bone.pos_count - 1], &pos[model_bone_index], weight);
-			nlerp(rot[model_bone_index], bone.rot[bone.rot_count - 1], &rot[model_bone_index], weight);
-		}
-	}
+	samplePose(time, pose, model, weight, true);
 }
 
 
@@ -170,58 +121,152 @@ void Animation::getRelativePose(float time, Pose& pose, Model& model) const
 
 	if (!model.isReady()) return;
 
+	samplePose(time, pose, model, 1, false);
+}
+
+
+// index of the first key after frame
+static int getNextKeyIndex(const u16* times, int count, int frame)
+{
+	int idx = 1;
+	for (; idx < count; ++idx)
+	{
+		if (times[idx] > frame) break;
+	}
+	return idx;
+}
+
+
+void Animation::samplePose(float time, Pose& pose, Model& model, float weight, bool is_blended) const
+{
 	int frame = (int)(time * m_fps);
 	float rcp_fps = 1.0f / m_fps;
 	frame = Math::clamp(frame, 0, m_frame_count - 1);
-	Vec3* pos = pose.positions;
-	Quat* rot = pose.rotations;
-
-	if (frame < m_frame_count)
+	float4 weight4 = f4Splat(weight);
+	// bones are written directly to the pose's arrays
+	++pose.version;
+
+	// keys are found bone by bone, then they are interpolated four bones at a time
+	LUMIX_ALIGN_BEGIN(16) float from[7][SAMPLE_BATCH_SIZE] LUMIX_ALIGN_END(16);
+	LUMIX_ALIGN_BEGIN(16) float to[7][SAMPLE_BATCH_SIZE] LUMIX_ALIGN_END(16);
+	LUMIX_ALIGN_BEGIN(16) float pos_t[SAMPLE_BATCH_SIZE] LUMIX_ALIGN_END(16);
+	LUMIX_ALIGN_BEGIN(16) float rot_t[SAMPLE_BATCH_SIZE] LUMIX_ALIGN_END(16);
+	int model_bone_indices[SAMPLE_BATCH_SIZE];
+
+	int bone_idx = 0;
+	int bone_count = m_bones.size();
+	while (bone_idx < bone_count)
 	{
-		for (Bone& bone : m_bones)
+		int batch_size = 0;
+		for (; bone_idx < bone_count && batch_size < SAMPLE_BATCH_SIZE; ++bone_idx)
 		{
+			const Bone& bone = m_bones[bone_idx];
 			Model::BoneMap::iterator iter = model.getBoneIndex(bone.name);
 			if (!iter.isValid()) continue;
 
-			int idx = 1;
-			for (int c = bone.pos_count; idx < c; ++idx)
+			model_bone_indices[batch_size] = iter.value();
+
+			int idx = getNextKeyIndex(bone.pos_times, bone.pos_count, frame);
+			const Vec3* pos_from = &bone.pos[idx - 1];
+			const Vec3* pos_to = pos_from;
+			pos_t[batch_size] = 0;
+			if (idx < bone.pos_count)
 			{
-				if (bone.pos_times[idx] > frame) break;
+				pos_to = &bone.pos[idx];
+				pos_t[batch_size] = float(time - bone.pos_times[idx - 1] * rcp_fps) /
+									((bone.pos_times[idx] - bone.pos_times[idx - 1]) * rcp_fps);
 			}
 
-			float t = float(time - bone.pos_times[idx - 1] * rcp_fps) /
-				((bone.pos_times[idx] - bone.pos_times[idx - 1]) * rcp_fps);
-			int model_bone_index = iter.value();
-			lerp(bone.pos[idx - 1], bone.pos[idx], &pos[model_bone_index], t);
-
-			idx = 1;
-			for (int c = bone.rot_count; idx < c; ++idx)
+			idx = getNextKeyIndex(bone.rot_times, bone.rot_count, frame);
+			const Quat* rot_from = &bone.rot[idx - 1];
+			const Quat* rot_to = rot_from;
+			rot_t[batch_size] = 0;
+			if (idx < bone.rot_count)
 			{
-				if (bone.rot_times[idx] > frame) break;
+				rot_to = &bone.rot[idx];
+				rot_t[batch_size] = float(time - bone.rot_times[idx - 1] * rcp_fps) /
+									((bone.rot_times[idx] - bone.rot_times[idx - 1]) * rcp_fps);
 			}
 
-			t = float(time - bone.rot_times[idx - 1] * rcp_fps) /
-				((bone.rot_times[idx] - bone.rot_times[idx - 1]) * rcp_fps);
-			nlerp(bone.rot[idx - 1], bone.rot[idx], &rot[model_bone_index], t);
+			from[0][batch_size] = pos_from->x;
+			from[1][batch_size] = pos_from->y;
+			from[2][batch_size] = pos_from->z;
+			from[3][batch_size] = rot_from->x;
+			from[4][batch_size] = rot_from->y;
+			from[5][batch_size] = rot_from->z;
+			from[6][batch_size] = rot_from->w;
+			to[0][batch_size] = pos_to->x;
+			to[1][batch_size] = pos_to->y;
+			to[2][batch_size] = pos_to->z;
+			to[3][batch_size] = rot_to->x;
+			to[4][batch_size] = rot_to->y;
+			to[5][batch_size] = rot_to->z;
+			to[6][batch_size] = rot_to->w;
+			++batch_size;
 		}
-	}
-	else
-	{
-		for (Bone& bone : m_bones)
+		if (batch_size == 0) break;
+
+		// unused lanes repeat the last bone
+		for (int i = batch_size; (i & 3) != 0; ++i)
 		{
-			Model::BoneMap::iterator iter = model.getBoneIndex(bone.name);
-			if (!iter.isValid()) continue;
+			for (int j = 0; j < 7; ++j)
+			{
+				from[j][i] = from[j][batch_size - 1];
+				to[j][i] = to[j][batch_size - 1];
+			}
+			pos_t[i] = pos_t[batch_size - 1];
+			rot_t[i] = rot_t[batch_size - 1];
+			model_bone_indices[i] = model_bone_indices[batch_size - 1];
+		}
 
-			int model_bone_index = iter.value();
-			pos[model_bone_index] = bone.pos[bone.pos_count - 1];
-			rot[model_bone_index] = bone.rot[bone.rot_count - 1];
+		for (int i = 0; i < batch_size; i += 4)
+		{
+			Vec3x4 pos = lerpVec3x4(loadVec3x4(from[0] + i, from[1] + i, from[2] + i),
+				loadVec3x4(to[0] + i, to[1] + i, to[2] + i),
+				f4Load(pos_t + i));
+			Quatx4 rot = nlerpQuatx4(loadQuatx4(from[3] + i, from[4] + i, from[5] + i, from[6] + i),
+				loadQuatx4(to[3] + i, to[4] + i, to[5] + i, to[6] + i),
+				f4Load(rot_t + i));
+
+			LUMIX_ALIGN_BEGIN(16) float lanes[7][4] LUMIX_ALIGN_END(16);
+			if (is_blended)
+			{
+				for (int j = 0; j < 4; ++j)
+				{
+					int model_bone_idx = model_bone_indices[i + j];
+					lanes[0][j] = pose.pos_x[model_bone_idx];
+					lanes[1][j] = pose.pos_y[model_bone_idx];
+					lanes[2][j] = pose.pos_z[model_bone_idx];
+					lanes[3][j] = pose.rot_x[model_bone_idx];
+					lanes[4][j] = pose.rot_y[model_bone_idx];
+					lanes[5][j] = pose.rot_z[model_bone_idx];
+					lanes[6][j] = pose.rot_w[model_bone_idx];
+				}
+				pos = lerpVec3x4(loadVec3x4(lanes[0], lanes[1], lanes[2]), pos, weight4);
+				rot = nlerpQuatx4(loadQuatx4(lanes[3], lanes[4], lanes[5], lanes[6]), rot, weight4);
+			}
+			storeVec3x4(pos, lanes[0], lanes[1], lanes[2]);
+			storeQuatx4(rot, lanes[3], lanes[4], lanes[5], lanes[6]);
+
+			for (int j = 0, c = Math::minimum(batch_size - i, 4); j < c; ++j)
+			{
+				int model_bone_idx = model_bone_indices[i + j];
+				pose.pos_x[model_bone_idx] = lanes[0][j];
+				pose.pos_y[model_bone_idx] = lanes[1][j];
+				pose.pos_z[model_bone_idx] = lanes[2][j];
+				pose.rot_x[model_bone_idx] = lanes[3][j];
+				pose.rot_y[model_bone_idx] = lanes[4][j];
+				pose.rot_z[model_bone_idx] = lanes[5][j];
+				pose.rot_w[model_bone_idx] = lanes[6][j];
+			}
 		}
 	}
 }
 
 
-bool Animation::load(FS::IFile& file)
+bool Animation::decode(FS::IFile& file)
 {
+	PROFILE_FUNCTION();
 	IAllocator& allocator = getAllocator();
 	m_bones.clear();
 	m_mem.clear();
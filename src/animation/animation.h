@@ -66,9 +66,11 @@ class Animation LUMIX_FINAL : public Resource
 
 	private:
 		IAllocator& getAllocator();
+		void samplePose(float time, Pose& pose, Model& model, float weight, bool is_blended) const;
 
 		void unload() override;
-		bool load(FS::IFile& file) override;
+		bool hasDecodePhase() const override { return true; }
+		bool decode(FS::IFile& file) override;
 
 	private:
 		int	m_frame_count;
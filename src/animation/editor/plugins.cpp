@@ -180,9 +180,11 @@ struct PropertyGridPlugin : PropertyGrid::IPlugin
 				{
 					ImGui::Text("%s", model->getBone(i).name.c_str());
 					ImGui::NextColumn();
-					ImGui::Text("%f; %f; %f", pose->positions[i].x, pose->positions[i].y, pose->positions[i].z);
+					Vec3 pos = pose->getPosition(i);
+					ImGui::Text("%f; %f; %f", pos.x, pos.y, pos.z);
 					ImGui::NextColumn();
-					ImGui::Text("%f; %f; %f; %f", pose->rotations[i].x, pose->rotations[i].y, pose->rotations[i].z, pose->rotations[i].w);
+					Quat rot = pose->getRotation(i);
+					ImGui::Text("%f; %f; %f; %f", rot.x, rot.y, rot.z, rot.w);
 					ImGui::NextColumn();
 				}
 				ImGui::Columns();
@@ -121,6 +121,11 @@ struct App
 		Lumix::copyString(m_startup_script_path, "startup.lua");
 		char cmd_line[1024];
 		Lumix::getCommandLine(cmd_line, Lumix::lengthOf(cmd_line));
+		#ifdef _DEBUG
+			bool record_prefetch = true;
+		#else
+			bool record_prefetch = false;
+		#endif
 		Lumix::CommandLineParser parser(cmd_line);
 		while (parser.next())
 		{
@@ -136,6 +141,10 @@ struct App
 
 				parser.getCurrent(m_startup_script_path, Lumix::lengthOf(m_startup_script_path));
 			}
+			else if (parser.currentEquals("-record_prefetch"))
+			{
+				record_prefetch = true;
+			}
 		}
 
 		// createWindow(); // TODO
@@ -160,6 +169,7 @@ struct App
 		m_file_system->setSaveGameDevice("memory:disk");
 
 		m_engine = Lumix::Engine::create("", "", m_file_system, m_allocator);
+		m_engine->getResourceManager().enablePrefetchRecording(record_prefetch);
 		Lumix::Engine::PlatformData platform_data;
 		// platform_data.window_handle = m_hwnd; // TODO
 		m_engine->setPlatformData(platform_data);
@@ -174,10 +184,11 @@ struct App
 		m_pipeline = Lumix::Pipeline::create(*renderer, Lumix::Path(m_pipeline_path), m_engine->getAllocator());
 		m_pipeline->load();
 
-		while (m_engine->getFileSystem().hasWork())
+		while (m_engine->getFileSystem().hasWork() || m_engine->getResourceManager().hasWork())
 		{
 			Lumix::MT::sleep(100);
 			m_engine->getFileSystem().updateAsyncTransactions();
+			m_engine->getResourceManager().update();
 		}
 
 		m_universe = &m_engine->createUniverse();
@@ -264,6 +275,8 @@ struct App
 
 	void loadUniverse(const char* path)
 	{
+		Lumix::StaticString<Lumix::MAX_PATH_LENGTH> manifest_path(path, ".prefetch");
+		m_engine->getResourceManager().beginPrefetch(Lumix::Path(manifest_path));
 		auto& fs = m_engine->getFileSystem();
 		Lumix::FS::ReadCallback file_read_cb;
 		file_read_cb.bind<App, &App::universeFileLoaded>(this);
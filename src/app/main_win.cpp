@@ -17,6 +17,7 @@
 #include "engine/profiler.h"
 #include "engine/resource_manager.h"
 #include "engine/resource_manager_base.h"
+#include "engine/string.h"
 #include "engine/system.h"
 #include "engine/timer.h"
 #include "engine/universe/universe.h"
@@ -195,6 +196,11 @@ public:
 		Lumix::copyString(m_startup_script_path, "startup.lua");
 		char cmd_line[1024];
 		Lumix::getCommandLine(cmd_line, Lumix::lengthOf(cmd_line));
+		#ifdef _DEBUG
+			bool record_prefetch = true;
+		#else
+			bool record_prefetch = false;
+		#endif
 		Lumix::CommandLineParser parser(cmd_line);
 		while (parser.next())
 		{
@@ -214,6 +220,10 @@ public:
 
 				parser.getCurrent(m_startup_script_path, Lumix::lengthOf(m_startup_script_path));
 			}
+			else if (parser.currentEquals("-record_prefetch"))
+			{
+				record_prefetch = true;
+			}
 		}
 
 		createWindow();
@@ -244,6 +254,7 @@ public:
 		m_file_system->setSaveGameDevice("memory:disk");
 
 		m_engine = Lumix::Engine::create(current_dir, "", m_file_system, m_allocator);
+		m_engine->getResourceManager().enablePrefetchRecording(record_prefetch);
 		Lumix::Engine::PlatformData platform_data;
 		platform_data.window_handle = m_hwnd;
 		m_engine->setPlatformData(platform_data);
@@ -261,10 +272,11 @@ public:
 		m_pipeline = Lumix::Pipeline::create(*renderer, Lumix::Path(m_pipeline_path), m_engine->getAllocator());
 		m_pipeline->load();
 
-		while (m_engine->getFileSystem().hasWork())
+		while (m_engine->getFileSystem().hasWork() || m_engine->getResourceManager().hasWork())
 		{
 			Lumix::MT::sleep(100);
 			m_engine->getFileSystem().updateAsyncTransactions();
+			m_engine->getResourceManager().update();
 		}
 
 		m_universe = &m_engine->createUniverse(true);
@@ -364,6 +376,8 @@ public:
 	void loadUniverse(const char* path)
 	{
 		Lumix::copyString(m_universe_path, path);
+		Lumix::StaticString<Lumix::MAX_PATH_LENGTH> manifest_path(path, ".prefetch");
+		m_engine->getResourceManager().beginPrefetch(Lumix::Path(manifest_path));
 		auto& fs = m_engine->getFileSystem();
 		Lumix::FS::ReadCallback file_read_cb;
 		file_read_cb.bind<App, &App::universeFileLoaded>(this);
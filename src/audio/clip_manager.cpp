@@ -19,7 +19,7 @@ void Clip::unload()
 }
 
 
-bool Clip::load(FS::IFile& file)
+bool Clip::decode(FS::IFile& file)
 {
 	PROFILE_FUNCTION();
 	short* output = nullptr;
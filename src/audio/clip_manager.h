@@ -20,7 +20,8 @@ public:
 	}
 
 	void unload(void) override;
-	bool load(FS::IFile& file) override;
+	bool hasDecodePhase() const override { return true; }
+	bool decode(FS::IFile& file) override;
 	int getChannels() const { return m_channels; }
 	int getSampleRate() const { return m_sample_rate; }
 	int getSize() const { return m_data.size() * sizeof(m_data[0]); }
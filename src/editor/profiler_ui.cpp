@@ -6,6 +6,7 @@
 #include "engine/math_utils.h"
 #include "engine/mt/atomic.h"
 #include "engine/mt/lock_free_fixed_queue.h"
+#include "engine/mt/sync.h"
 #include "engine/profiler.h"
 #include "engine/resource.h"
 #include "engine/resource_manager.h"
@@ -45,9 +46,12 @@ struct ProfilerUIImpl LUMIX_FINAL : public ProfilerUI
 		, m_resource_manager(engine.getResourceManager())
 		, m_logs(allocator)
 		, m_opened_files(allocator)
+		, m_opened_files_mutex(false)
 		, m_device(allocator)
 		, m_engine(engine)
 		, m_threads(allocator)
+		, m_load_phases(allocator)
+		, m_load_spans(allocator)
 	{
 		m_allocation_size_from = 0;
 		m_allocation_size_to = 1024 * 1024;
@@ -60,6 +64,7 @@ struct ProfilerUIImpl LUMIX_FINAL : public ProfilerUI
 		m_allocation_root = LUMIX_NEW(m_allocator, AllocationStackNode)(nullptr, 0, m_allocator);
 		m_filter[0] = 0;
 		m_resource_filter[0] = 0;
+		m_load_span_filter[0] = 0;
 
 		m_timer = Lumix::Timer::create(engine.getAllocator());
 		m_device.OnEvent.bind<ProfilerUIImpl, &ProfilerUIImpl::onFileSystemEvent>(this);
@@ -88,9 +93,10 @@ struct ProfilerUIImpl LUMIX_FINAL : public ProfilerUI
 
 	~ProfilerUIImpl()
 	{
-		while (m_engine.getFileSystem().hasWork())
+		while (m_engine.getFileSystem().hasWork() || m_engine.getResourceManager().hasWork())
 		{
 			m_engine.getFileSystem().updateAsyncTransactions();
+			m_engine.getResourceManager().update();
 		}
 
 		m_engine.getFileSystem().unMount(&m_device);
@@ -117,6 +123,8 @@ struct ProfilerUIImpl LUMIX_FINAL : public ProfilerUI
 
 	void onFileSystemEvent(const Lumix::FS::Event& event)
 	{
+		// events come from all I/O threads
+		Lumix::MT::SpinLock lock(m_opened_files_mutex);
 		if (event.type == Lumix::FS::EventType::OPEN_BEGIN)
 		{
 			auto& file = m_opened_files.emplace();
@@ -242,6 +250,18 @@ struct ProfilerUIImpl LUMIX_FINAL : public ProfilerUI
 			FLT_MAX,
 			ImVec2(0, 100));
 
+		auto stats = m_engine.getFileSystem().getStats();
+		ImGui::Text("Queued: %d high, %d normal, %d low | In flight: %d",
+			stats.queued[(int)Lumix::FS::FileSystem::Priority::HIGH],
+			stats.queued[(int)Lumix::FS::FileSystem::Priority::NORMAL],
+			stats.queued[(int)Lumix::FS::FileSystem::Priority::LOW],
+			stats.in_flight);
+		ImGui::Text("Completed: %d | Failed: %d | Canceled: %d | Bandwidth: %.1f kB/s",
+			stats.completed,
+			stats.failed,
+			stats.canceled,
+			stats.getBandwidth() / 1000.0f);
+
 		ImGui::InputText("filter###fs_filter", m_filter, Lumix::lengthOf(m_filter));
 
 		if(ImGui::Button("Clear")) m_logs.clear();
@@ -322,6 +342,7 @@ struct ProfilerUIImpl LUMIX_FINAL : public ProfilerUI
 			onGUIMemoryProfiler();
 			onGUIResources();
 			onGUIFileSystem();
+			onGUILoadTimeline();
 		}
 		ImGui::EndDock();
 	}
@@ -418,6 +439,7 @@ struct ProfilerUIImpl LUMIX_FINAL : public ProfilerUI
 	void onGUICPUProfiler();
 	void onGUIMemoryProfiler();
 	void onGUIResources();
+	void onGUILoadTimeline();
 	void onFrame();
 	void showProfileBlock(Block* block, int column);
 	void cloneBlock(Block* my_block, Lumix::Profiler::Block* remote_block);
@@ -446,7 +468,9 @@ struct ProfilerUIImpl LUMIX_FINAL : public ProfilerUI
 	bool m_is_paused;
 	char m_filter[100];
 	char m_resource_filter[100];
+	char m_load_span_filter[100];
 	Lumix::Array<OpenedFile> m_opened_files;
+	Lumix::MT::SpinMutex m_opened_files_mutex;
 	Lumix::MT::LockFreeFixedQueue<Log, 512> m_queue;
 	Lumix::Array<Log> m_logs;
 	Lumix::FS::FileEventsDevice m_device;
@@ -457,6 +481,8 @@ struct ProfilerUIImpl LUMIX_FINAL : public ProfilerUI
 	volatile int m_bytes_read;
 	float m_next_transfer_rate_time;
 	SortOrder m_sort_order;
+	Lumix::Array<Lumix::Profiler::LoadPhase> m_load_phases;
+	Lumix::Array<Lumix::Profiler::LoadSpan> m_load_spans;
 };
 
 
@@ -814,6 +840,14 @@ void ProfilerUIImpl::onGUIResources()
 		auto* resource_manager = m_resource_manager.get(resource_types[i]);
 		auto& resources = resource_manager->getResourceTable();
 
+		auto stats = resource_manager->getStats();
+		ImGui::Text("Resident: %.3fKB, cached: %.3fKB (%u), budget: %.3fKB",
+			stats.resident_bytes / 1024.0f,
+			stats.cached_bytes / 1024.0f,
+			stats.cached_count,
+			stats.budget / 1024.0f);
+		ImGui::Text("Hits: %u, misses: %u, evictions: %u", stats.hits, stats.misses, stats.evictions);
+
 		ImGui::Columns(4, "resc");
 		ImGui::Text("Path");
 		ImGui::NextColumn();
@@ -869,6 +903,107 @@ void ProfilerUIImpl::onGUIResources()
 }
 
 
+static Lumix::u64 getLoadSpanLength(const Lumix::Profiler::LoadSpan& span)
+{
+	Lumix::u64 start = ~(Lumix::u64)0;
+	Lumix::u64 end = 0;
+	for (int i = 0; i < (int)Lumix::Profiler::LoadStage::COUNT; ++i)
+	{
+		if (span.end[i] == 0) continue;
+		start = Lumix::Math::minimum(start, span.start[i]);
+		end = Lumix::Math::maximum(end, span.end[i]);
+	}
+	return end > start ? end - start : 0;
+}
+
+
+void ProfilerUIImpl::onGUILoadTimeline()
+{
+	if (!ImGui::CollapsingHeader("Load timeline")) return;
+
+	if (ImGui::Button("Refresh") || (m_load_phases.empty() && m_load_spans.empty()))
+	{
+		Lumix::Profiler::getLoadTimeline(m_load_phases, m_load_spans);
+		auto cmp = [](const void* a, const void* b) -> int {
+			Lumix::u64 len_a = getLoadSpanLength(*(const Lumix::Profiler::LoadSpan*)a);
+			Lumix::u64 len_b = getLoadSpanLength(*(const Lumix::Profiler::LoadSpan*)b);
+			return len_a < len_b ? 1 : (len_a > len_b ? -1 : 0);
+		};
+		if (!m_load_spans.empty()) qsort(&m_load_spans[0], m_load_spans.size(), sizeof(m_load_spans[0]), cmp);
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Clear"))
+	{
+		Lumix::Profiler::clearLoadTimeline();
+		Lumix::Profiler::getLoadTimeline(m_load_phases, m_load_spans);
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Save"))
+	{
+		if (!Lumix::Profiler::saveLoadTimeline("load_timeline.json"))
+		{
+			Lumix::g_log_error.log("Editor") << "Failed to save load timeline to load_timeline.json";
+		}
+	}
+
+	ImGui::Columns(2, "load_phases");
+	ImGui::Text("Phase");
+	ImGui::NextColumn();
+	ImGui::Text("Time (ms)");
+	ImGui::NextColumn();
+	ImGui::Separator();
+	for (const auto& phase : m_load_phases)
+	{
+		ImGui::Indent(phase.depth * 10.0f + 1);
+		ImGui::Text("%s", phase.name);
+		ImGui::Unindent(phase.depth * 10.0f + 1);
+		ImGui::NextColumn();
+		if (phase.end == 0)
+		{
+			ImGui::Text("running");
+		}
+		else
+		{
+			ImGui::Text("%.2f", Lumix::Profiler::toSeconds(phase.end - phase.start) * 1000);
+		}
+		ImGui::NextColumn();
+	}
+	ImGui::Columns(1);
+
+	ImGui::FilterInput("filter###load_span_filter", m_load_span_filter, Lumix::lengthOf(m_load_span_filter));
+	ImGui::Columns(6, "load_spans");
+	const char* headers[] = {"Path", "Queued (ms)", "I/O (ms)", "Decode (ms)", "Finalize (ms)", "Total (ms)"};
+	for (const char* header : headers)
+	{
+		ImGui::Text("%s", header);
+		ImGui::NextColumn();
+	}
+	ImGui::Separator();
+	for (const auto& span : m_load_spans)
+	{
+		if (m_load_span_filter[0] != '\0' && Lumix::stristr(span.path, m_load_span_filter) == nullptr) continue;
+
+		ImGui::Text("%s", span.path);
+		ImGui::NextColumn();
+		for (int i = 0; i < (int)Lumix::Profiler::LoadStage::COUNT; ++i)
+		{
+			if (span.end[i] == 0)
+			{
+				ImGui::Text("-");
+			}
+			else
+			{
+				ImGui::Text("%.2f", Lumix::Profiler::toSeconds(span.end[i] - span.start[i]) * 1000);
+			}
+			ImGui::NextColumn();
+		}
+		ImGui::Text("%.2f", Lumix::Profiler::toSeconds(getLoadSpanLength(span)) * 1000);
+		ImGui::NextColumn();
+	}
+	ImGui::Columns(1);
+}
+
+
 ProfilerUIImpl::AllocationStackNode* ProfilerUIImpl::getOrCreate(AllocationStackNode* my_node,
 	Lumix::Debug::StackNode* external_node,
 	size_t size)
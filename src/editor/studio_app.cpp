@@ -153,9 +153,11 @@ public:
 		saveSettings();
 		unloadIcons();
 
-		while (m_editor->getEngine().getFileSystem().hasWork())
+		auto& engine = m_editor->getEngine();
+		while (engine.getFileSystem().hasWork() || engine.getResourceManager().hasWork())
 		{
-			m_editor->getEngine().getFileSystem().updateAsyncTransactions();
+			engine.getFileSystem().updateAsyncTransactions();
+			engine.getResourceManager().update();
 		}
 
 		m_editor->newUniverse();
@@ -1113,7 +1115,10 @@ public:
 			viewMenu();
 
 			Lumix::StaticString<200> stats("");
-			if (m_engine->getFileSystem().hasWork()) stats << "Loading... | ";
+			if (m_engine->getFileSystem().hasWork() || m_engine->getResourceManager().hasWork())
+			{
+				stats << "Loading... | ";
+			}
 			stats << "FPS: ";
 			stats << m_engine->getFPS();
 			if ((SDL_GetWindowFlags(m_window) & SDL_WINDOW_INPUT_FOCUS) == 0) stats << " - inactive window";
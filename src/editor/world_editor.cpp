@@ -1696,9 +1696,21 @@ public:
 	}
 
 
+	void waitForResources()
+	{
+		auto& fs = m_engine->getFileSystem();
+		auto& rm = m_engine->getResourceManager();
+		while (fs.hasWork() || rm.hasWork())
+		{
+			fs.updateAsyncTransactions();
+			rm.update();
+		}
+	}
+
+
 	void save(FS::IFile& file)
 	{
-		while (m_engine->getFileSystem().hasWork()) m_engine->getFileSystem().updateAsyncTransactions();
+		waitForResources();
 
 		ASSERT(m_universe);
 
@@ -2238,6 +2250,8 @@ public:
 		createUniverse();
 		m_universe->setPath(path);
 		g_log_info.log("Editor") << "Loading universe " << path << "...";
+		StaticString<MAX_PATH_LENGTH> manifest_path(path.c_str(), ".prefetch");
+		m_engine->getResourceManager().beginPrefetch(Path(manifest_path));
 		FS::FileSystem& fs = m_engine->getFileSystem();
 		FS::ReadCallback file_read_cb;
 		file_read_cb.bind<WorldEditorImpl, &WorldEditorImpl::loadMap>(this);
@@ -2417,6 +2431,8 @@ public:
 		m_measure_tool = LUMIX_NEW(m_allocator, MeasureTool)();
 		addPlugin(*m_measure_tool);
 
+		m_engine->getResourceManager().enablePrefetchRecording(true);
+
 		const char* plugins[] = { "steam", "renderer", "animation", "audio", "physics", "navigation", "lua_script", "gui", "game" };
 
 		PluginManager& plugin_manager = m_engine->getPluginManager();
@@ -2955,10 +2971,10 @@ public:
 
 	bool runTest(const Path& undo_stack_path, const Path& result_universe_path) override
 	{
-		while (m_engine->getFileSystem().hasWork()) m_engine->getFileSystem().updateAsyncTransactions();
+		waitForResources();
 		newUniverse();
 		executeUndoStack(undo_stack_path);
-		while (m_engine->getFileSystem().hasWork()) m_engine->getFileSystem().updateAsyncTransactions();
+		waitForResources();
 
 		FS::IFile* file = m_engine->getFileSystem().open(
 			m_engine->getFileSystem().getMemoryDevice(), Path(""), FS::Mode::CREATE_AND_WRITE);
@@ -420,9 +420,11 @@ public:
 		, m_paused(false)
 		, m_next_frame(false)
 		, m_lifo_allocator(m_allocator, 10 * 1024 * 1024)
+		, m_is_first_update(true)
 	{
 		g_log_info.log("Core") << "Creating engine...";
 		Profiler::setThreadName("Main");
+		PROFILE_LOAD_PHASE("Engine create");
 		installUnhandledExceptionHandler();
 
 		g_is_error_file_opened = g_error_file.open("error.log", FS::Mode::CREATE_AND_WRITE, allocator);
@@ -433,10 +435,14 @@ public:
 		g_log_error.getCallback().bind<showLogInVS>();
 
 		m_platform_data = {};
-		m_state = lua_newstate(luaAllocator, &m_allocator);
-		luaL_openlibs(m_state);
-		registerLuaAPI();
+		{
+			PROFILE_LOAD_PHASE("Lua init");
+			m_state = lua_newstate(luaAllocator, &m_allocator);
+			luaL_openlibs(m_state);
+			registerLuaAPI();
+		}
 
+		Profiler::beginLoadPhase("Resource manager create");
 		m_mtjd_manager = MTJD::Manager::create(m_allocator);
 		if (!fs)
 		{
@@ -470,8 +476,9 @@ public:
 			m_patch_file_device = nullptr;
 		}
 
-		m_resource_manager.create(*m_file_system);
+		m_resource_manager.create(*m_file_system, *m_mtjd_manager);
 		m_prefab_resource_manager.create(PREFAB_TYPE, m_resource_manager);
+		Profiler::endLoadPhase();
 
 		m_timer = Timer::create(m_allocator);
 		m_fps_timer = Timer::create(m_allocator);
@@ -491,13 +498,14 @@ public:
 
 	static bool LUA_hasFilesystemWork(Engine* engine)
 	{
-		return engine->getFileSystem().hasWork();
+		return engine->getFileSystem().hasWork() || engine->getResourceManager().hasWork();
 	}
 
 
 	static void LUA_processFilesystemWork(Engine* engine)
 	{
 		engine->getFileSystem().updateAsyncTransactions();
+		engine->getResourceManager().update();
 	}
 
 
@@ -746,6 +754,14 @@ public:
 	}
 
 
+	static void LUA_setResourceBudget(EngineImpl* engine, const char* type, int megabytes)
+	{
+		ResourceManagerBase* res_manager = engine->getResourceManager().get(ResourceType(type));
+		if (!res_manager) return;
+		res_manager->setBudget((u64)megabytes * 1024 * 1024);
+	}
+
+
 	static void LUA_setEntityLocalRotation(IScene* scene,
 		Entity entity,
 		const Quat& rotation)
@@ -893,6 +909,7 @@ public:
 		REGISTER_FUNCTION(getSceneUniverse);
 		REGISTER_FUNCTION(loadResource);
 		REGISTER_FUNCTION(unloadResource);
+		REGISTER_FUNCTION(setResourceBudget);
 		REGISTER_FUNCTION(createComponent);
 		REGISTER_FUNCTION(createEntity);
 		REGISTER_FUNCTION(setEntityPosition);
@@ -1088,10 +1105,14 @@ public:
 
 	~EngineImpl()
 	{
+		// prefetched resources must be released while their managers still exist
+		m_resource_manager.cancelPrefetch();
 		for (Resource* res : m_lua_resources)
 		{
 			res->getResourceManager().unload(*res);
 		}
+		// finishes pending decodes, finalizing them needs their resource managers and the file system
+		m_resource_manager.destroy();
 
 		PropertyRegister::shutdown();
 		Timer::destroy(m_timer);
@@ -1107,7 +1128,6 @@ public:
 		}
 
 		m_prefab_resource_manager.destroy();
-		m_resource_manager.destroy();
 		MTJD::Manager::destroy(*m_mtjd_manager);
 		lua_close(m_state);
 
@@ -1268,6 +1288,8 @@ public:
 	void update(Universe& context) override
 	{
 		PROFILE_FUNCTION();
+		// first frame loads most of shaders and other resources needed for rendering
+		if (m_is_first_update) Profiler::beginLoadPhase("First update");
 		float dt;
 		++m_fps_frame;
 		if (m_fps_timer->getTimeSinceTick() > 0.5f)
@@ -1293,12 +1315,19 @@ public:
 		m_plugin_manager->update(dt, m_paused);
 		m_input_system->update(dt);
 		getFileSystem().updateAsyncTransactions();
+		m_resource_manager.update();
 
 		if (m_next_frame)
 		{
 			m_paused = true;
 			m_next_frame = false;
 		}
+
+		if (m_is_first_update)
+		{
+			m_is_first_update = false;
+			Profiler::endLoadPhase();
+		}
 	}
 
 
@@ -1401,6 +1430,7 @@ public:
 
 	bool deserialize(Universe& ctx, InputBlob& serializer) override
 	{
+		PROFILE_LOAD_PHASE("Universe deserialize");
 		SerializedEngineHeader header;
 		serializer.read(header);
 		if (header.m_magic != SERIALIZED_ENGINE_MAGIC)
@@ -1600,6 +1630,7 @@ public:
 private:
 	IAllocator& m_allocator;
 	LIFOAllocator m_lifo_allocator;
+	bool m_is_first_update;
 
 	FS::FileSystem* m_file_system;
 	FS::MemoryFileDevice* m_mem_file_device;
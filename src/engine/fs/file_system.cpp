@@ -5,13 +5,14 @@
 #include "engine/blob.h"
 #include "engine/fs/disk_file_device.h"
 #include "engine/fs/file_system.h"
-#include "engine/mt/lock_free_fixed_queue.h"
+#include "engine/math_utils.h"
+#include "engine/mt/sync.h"
 #include "engine/mt/task.h"
-#include "engine/mt/transaction.h"
+#include "engine/mt/thread.h"
 #include "engine/path.h"
 #include "engine/profiler.h"
-#include "engine/queue.h"
 #include "engine/string.h"
+#include "engine/timer.h"
 
 
 namespace Lumix
@@ -32,18 +33,22 @@ enum TransFlags
 struct AsyncItem
 {
 	IFile* m_file;
+	// ranged reads copy m_size bytes at m_offset from m_source to m_file
+	IFile* m_source;
+	size_t m_offset;
+	size_t m_size;
 	ReadCallback m_cb;
 	Mode m_mode;
 	u32 m_id;
 	char m_path[MAX_PATH_LENGTH];
 	u8 m_flags;
+	FileSystem::Priority m_priority;
+	u64 m_queued_time;
 };
 
-static const i32 C_MAX_TRANS = 16;
+static const int MAX_IO_THREADS = 4;
+static const size_t WHOLE_FILE = ~(size_t)0;
 
-typedef MT::Transaction<AsyncItem> AsynTrans;
-typedef MT::LockFreeFixedQueue<AsynTrans, C_MAX_TRANS> TransQueue;
-typedef Queue<AsynTrans*, C_MAX_TRANS> InProgressQueue;
 typedef Array<AsyncItem> ItemsTable;
 typedef Array<IFileDevice*> DevicesTable;
 
@@ -69,50 +74,194 @@ void IFile::getContents(OutputBlob& blob)
 }
 
 
+// reads in chunks, so a canceled item does not keep the I/O thread busy until the whole range is read
+static bool readRange(AsyncItem& item, const volatile bool& canceled)
+{
+	Path path(item.m_path);
+	if (!item.m_source->open(path, Mode::OPEN_AND_READ)) return false;
+
+	size_t size = item.m_size;
+	if (size == WHOLE_FILE) size = item.m_source->size() - Math::minimum(item.m_offset, item.m_source->size());
+	bool success = item.m_source->seek(SeekMode::BEGIN, item.m_offset) && item.m_file->open(path, Mode::WRITE);
+	u8 buffer[16 * 1024];
+	for (size_t remaining = size; success && remaining > 0;)
+	{
+		if (canceled) break;
+		size_t chunk = Math::minimum(remaining, sizeof(buffer));
+		success = item.m_source->read(buffer, chunk) && item.m_file->write(buffer, chunk);
+		remaining -= chunk;
+	}
+	item.m_source->close();
+	return success && item.m_file->seek(SeekMode::BEGIN, 0);
+}
+
+
+static void processItem(AsyncItem& item, const volatile bool& canceled)
+{
+	if ((item.m_flags & E_IS_OPEN) == E_IS_OPEN)
+	{
+		bool success;
+		if (item.m_source)
+		{
+			success = readRange(item, canceled);
+			item.m_source->release();
+			item.m_source = nullptr;
+		}
+		else
+		{
+			success = item.m_file->open(Path(item.m_path), item.m_mode);
+		}
+		item.m_flags |= success ? E_SUCCESS : E_FAIL;
+	}
+	else if ((item.m_flags & E_CLOSE) == E_CLOSE)
+	{
+		item.m_file->close();
+		item.m_file->release();
+		item.m_file = nullptr;
+	}
+}
+
+
+// state shared between the main thread and I/O threads, everything is guarded by m_mutex
+struct AsyncQueue
+{
+	explicit AsyncQueue(IAllocator& allocator)
+		: m_queued(allocator)
+		, m_finished(allocator)
+		, m_mutex(false)
+		, m_semaphore(0, 0x7fffFFFF)
+		, m_in_flight(0)
+		, m_aborted(false)
+	{
+		setMemory(&m_stats, 0, sizeof(m_stats));
+		for (int i = 0; i < lengthOf(m_current); ++i)
+		{
+			m_current[i] = FileSystem::INVALID_ASYNC;
+			m_current_file[i] = nullptr;
+			m_canceled[i] = false;
+		}
+	}
+
+
+	// highest priority first, FIFO within the same priority
+	bool pop(AsyncItem& item)
+	{
+		int best = -1;
+		for (int i = 0, c = m_queued.size(); i < c; ++i)
+		{
+			if (best < 0 || m_queued[i].m_priority < m_queued[best].m_priority)
+			{
+				best = i;
+				if (m_queued[i].m_priority == FileSystem::Priority::HIGH) break;
+			}
+		}
+		if (best < 0) return false;
+
+		item = m_queued[best];
+		m_queued.erase(best);
+		return true;
+	}
+
+
+	void finish(int thread_idx, AsyncItem& item, float io_time)
+	{
+		MT::SpinLock lock(m_mutex);
+		bool canceled = m_canceled[thread_idx];
+		m_current[thread_idx] = FileSystem::INVALID_ASYNC;
+		m_current_file[thread_idx] = nullptr;
+		m_canceled[thread_idx] = false;
+		m_stats.io_time += io_time;
+		--m_in_flight;
+		if ((item.m_flags & E_IS_OPEN) != E_IS_OPEN) return;
+
+		if (canceled)
+		{
+			// cancelAsync already passed the file to the callback, so it's released on the main thread
+			item.m_flags |= E_CANCELED;
+			++m_stats.canceled;
+		}
+		else if (item.m_flags & E_SUCCESS)
+		{
+			++m_stats.completed;
+			if (item.m_mode & Mode::READ) m_stats.bytes_read += item.m_file->size();
+		}
+		else
+		{
+			++m_stats.failed;
+		}
+		m_finished.push(item);
+	}
+
+
+	ItemsTable m_queued;
+	ItemsTable m_finished;
+	MT::SpinMutex m_mutex;
+	MT::Semaphore m_semaphore;
+	u32 m_current[MAX_IO_THREADS];
+	IFile* m_current_file[MAX_IO_THREADS];
+	ReadCallback m_current_cb[MAX_IO_THREADS];
+	// read by I/O threads without the lock between chunks
+	volatile bool m_canceled[MAX_IO_THREADS];
+	int m_in_flight;
+	bool m_aborted;
+	FileSystem::Stats m_stats;
+};
+
+
 #if !LUMIX_SINGLE_THREAD()
 
 
 class FSTask LUMIX_FINAL : public MT::Task
 {
 public:
-	FSTask(TransQueue* queue, IAllocator& allocator)
+	FSTask(AsyncQueue& queue, int thread_idx, IAllocator& allocator)
 		: MT::Task(allocator)
-		, m_trans_queue(queue)
+		, m_queue(queue)
+		, m_thread_idx(thread_idx)
 	{
+		m_timer = Timer::create(allocator);
 	}
 
 
-	~FSTask() {}
+	~FSTask() { Timer::destroy(m_timer); }
 
 
 	int task()
 	{
-		while (!m_trans_queue->isAborted())
+		for (;;)
 		{
-			PROFILE_BLOCK("transaction");
-			AsynTrans* tr = m_trans_queue->pop(true);
-			if (!tr) break;
+			m_queue.m_semaphore.wait();
 
-			if ((tr->data.m_flags & E_IS_OPEN) == E_IS_OPEN)
+			AsyncItem item;
 			{
-				tr->data.m_flags |=
-					tr->data.m_file->open(Path(tr->data.m_path), tr->data.m_mode) ? E_SUCCESS : E_FAIL;
+				MT::SpinLock lock(m_queue.m_mutex);
+				if (m_queue.m_aborted) break;
+				if (!m_queue.pop(item)) continue;
+				m_queue.m_current[m_thread_idx] = item.m_id;
+				m_queue.m_current_file[m_thread_idx] = item.m_file;
+				m_queue.m_current_cb[m_thread_idx] = item.m_cb;
+				m_queue.m_canceled[m_thread_idx] = false;
+				++m_queue.m_in_flight;
 			}
-			else if ((tr->data.m_flags & E_CLOSE) == E_CLOSE)
+
+			PROFILE_BLOCK("transaction");
+			m_timer->tick();
+			u64 io_start = Profiler::now();
+			processItem(item, m_queue.m_canceled[m_thread_idx]);
+			if ((item.m_flags & E_IS_OPEN) == E_IS_OPEN)
 			{
-				tr->data.m_file->close();
-				tr->data.m_file->release();
-				tr->data.m_file = nullptr;
+				Profiler::recordLoadStage(item.m_path, Profiler::LoadStage::QUEUED, item.m_queued_time, io_start);
+				Profiler::recordLoadStage(item.m_path, Profiler::LoadStage::IO, io_start, Profiler::now());
 			}
-			tr->setCompleted();
+			m_queue.finish(m_thread_idx, item, m_timer->tick());
 		}
 		return 0;
 	}
 
-	void stop() { m_trans_queue->abort(); }
-
 private:
-	TransQueue* m_trans_queue;
+	AsyncQueue& m_queue;
+	Timer* m_timer;
+	int m_thread_idx;
 };
 
 
@@ -124,9 +273,10 @@ class FileSystemImpl LUMIX_FINAL : public FileSystem
 public:
 	explicit FileSystemImpl(IAllocator& allocator)
 		: m_allocator(allocator)
-		, m_pending(m_allocator)
 		, m_devices(m_allocator)
-		, m_in_progress(m_allocator)
+		, m_queue(m_allocator)
+		, m_processing(m_allocator)
+		, m_kept_open(nullptr)
 		, m_last_id(0)
 	{
 		m_disk_device.m_devices[0] = nullptr;
@@ -134,34 +284,69 @@ public:
 		m_default_device.m_devices[0] = nullptr;
 		m_save_game_device.m_devices[0] = nullptr;
 		#if !LUMIX_SINGLE_THREAD()
-			m_task = LUMIX_NEW(m_allocator, FSTask)(&m_transaction_queue, m_allocator);
-			m_task->create("FSTask");
+			m_task_count = Math::clamp((int)MT::getCPUsCount(), 1, MAX_IO_THREADS);
+			for (int i = 0; i < m_task_count; ++i)
+			{
+				m_tasks[i] = LUMIX_NEW(m_allocator, FSTask)(m_queue, i, m_allocator);
+				m_tasks[i]->create("FSTask");
+			}
 		#endif
 	}
 
 	~FileSystemImpl()
 	{
 		#if !LUMIX_SINGLE_THREAD()
-			m_task->stop();
-			m_task->destroy();
-			LUMIX_DELETE(m_allocator, m_task);
+			{
+				MT::SpinLock lock(m_queue.m_mutex);
+				m_queue.m_aborted = true;
+			}
+			for (int i = 0; i < m_task_count; ++i) m_queue.m_semaphore.signal();
+			for (int i = 0; i < m_task_count; ++i)
+			{
+				m_tasks[i]->destroy();
+				LUMIX_DELETE(m_allocator, m_tasks[i]);
+			}
 		#endif
-		while (!m_in_progress.empty())
+		for (auto& i : m_queue.m_finished)
 		{
-			auto* trans = m_in_progress.front();
-			m_in_progress.pop();
-			if (trans->data.m_file) close(*trans->data.m_file);
+			if (i.m_file) close(*i.m_file);
 		}
-		for (auto& i : m_pending)
+		for (auto& i : m_queue.m_queued)
 		{
-			close(*i.m_file);
+			if ((i.m_flags & E_IS_OPEN) == E_IS_OPEN)
+			{
+				i.m_file->release();
+				if (i.m_source) i.m_source->release();
+			}
+			else
+			{
+				close(*i.m_file);
+			}
 		}
 	}
 
 	BaseProxyAllocator& getAllocator() { return m_allocator; }
 
 
-	bool hasWork() const override { return !m_in_progress.empty() || !m_pending.empty(); }
+	bool hasWork() const override
+	{
+		MT::SpinLock lock(m_queue.m_mutex);
+		return !m_queue.m_queued.empty() || !m_queue.m_finished.empty() || m_queue.m_in_flight > 0 ||
+			   !m_processing.empty();
+	}
+
+
+	Stats getStats() const override
+	{
+		MT::SpinLock lock(m_queue.m_mutex);
+		Stats stats = m_queue.m_stats;
+		for (const AsyncItem& item : m_queue.m_queued)
+		{
+			if ((item.m_flags & E_IS_OPEN) == E_IS_OPEN) ++stats.queued[(int)item.m_priority];
+		}
+		stats.in_flight = m_queue.m_in_flight;
+		return stats;
+	}
 
 
 	bool mount(IFileDevice* device) override
@@ -242,51 +427,197 @@ public:
 	u32 openAsync(const DeviceList& device_list,
 		const Path& file,
 		int mode,
-		const ReadCallback& call_back) override
+		const ReadCallback& call_back,
+		Priority priority) override
 	{
+		// the memory device would read the whole file in one call, which can not be canceled
+		if (mode == Mode::OPEN_AND_READ && device_list.m_devices[1] &&
+			hasDevice(device_list, m_memory_device.m_devices[0]))
+		{
+			return pushRead(device_list, file, 0, WHOLE_FILE, call_back, priority);
+		}
+
 		IFile* prev = createFile(device_list);
 
 		if (prev)
 		{
-			AsyncItem& item = m_pending.emplace();
-
+			AsyncItem item;
 			item.m_file = prev;
+			item.m_source = nullptr;
+			item.m_offset = item.m_size = 0;
 			item.m_cb = call_back;
 			item.m_mode = mode;
-			copyString(item.m_path, file.c_str());
-			item.m_flags = E_IS_OPEN;
-			item.m_id = m_last_id;
-			++m_last_id;
-			if (m_last_id == INVALID_ASYNC) m_last_id = 0;
-			return item.m_id;
+			return pushOpen(item, file, priority);
 		}
 
 		return INVALID_ASYNC;
 	}
 
 
+	u32 readAsync(const DeviceList& device_list,
+		const Path& file,
+		size_t offset,
+		size_t size,
+		const ReadCallback& call_back,
+		Priority priority) override
+	{
+		if (!m_memory_device.m_devices[0]) return INVALID_ASYNC;
+		return pushRead(device_list, file, offset, size, call_back, priority);
+	}
+
+
+	static bool hasDevice(const DeviceList& device_list, IFileDevice* device)
+	{
+		if (!device) return false;
+		for (int i = 0; i < lengthOf(device_list.m_devices) && device_list.m_devices[i]; ++i)
+		{
+			if (device_list.m_devices[i] == device) return true;
+		}
+		return false;
+	}
+
+
+	u32 pushRead(const DeviceList& device_list,
+		const Path& file,
+		size_t offset,
+		size_t size,
+		const ReadCallback& call_back,
+		Priority priority)
+	{
+		IFileDevice* memory_device = m_memory_device.m_devices[0];
+
+		DeviceList source_device_list;
+		int source_device_count = 0;
+		for (int i = 0; i < lengthOf(device_list.m_devices) && device_list.m_devices[i]; ++i)
+		{
+			if (device_list.m_devices[i] == memory_device) continue;
+			source_device_list.m_devices[source_device_count] = device_list.m_devices[i];
+			++source_device_count;
+		}
+		source_device_list.m_devices[source_device_count] = nullptr;
+		IFile* source = createFile(source_device_list);
+		if (!source) return INVALID_ASYNC;
+
+		AsyncItem item;
+		item.m_file = memory_device->createFile(nullptr);
+		item.m_source = source;
+		item.m_offset = offset;
+		item.m_size = size;
+		item.m_cb = call_back;
+		item.m_mode = Mode::READ;
+		return pushOpen(item, file, priority);
+	}
+
+
+	u32 pushOpen(AsyncItem& item, const Path& file, Priority priority)
+	{
+		copyString(item.m_path, file.c_str());
+		item.m_flags = E_IS_OPEN;
+		item.m_priority = priority;
+		item.m_queued_time = Profiler::now();
+		item.m_id = m_last_id;
+		++m_last_id;
+		if (m_last_id == INVALID_ASYNC) m_last_id = 0;
+		push(item);
+		return item.m_id;
+	}
+
+
+	void push(const AsyncItem& item)
+	{
+		{
+			MT::SpinLock lock(m_queue.m_mutex);
+			m_queue.m_queued.push(item);
+		}
+		#if !LUMIX_SINGLE_THREAD()
+			m_queue.m_semaphore.signal();
+		#endif
+	}
+
+
 	void cancelAsync(u32 id) override
 	{
 		if (id == INVALID_ASYNC) return;
 
-		for (int i = 0, c = m_pending.size(); i < c; ++i)
+		AsyncItem canceled;
+		canceled.m_file = nullptr;
+		bool is_started;
 		{
-			if (m_pending[i].m_id == id)
+			MT::SpinLock lock(m_queue.m_mutex);
+			is_started = cancelLocked(id, &canceled);
+		}
+		if (!canceled.m_file) return;
+
+		// report it now, while the owner is surely alive, the callback is not invoked again
+		canceled.m_cb.invoke(*canceled.m_file, false);
+		if (is_started) return;
+
+		// canceled before any I/O happened
+		canceled.m_file->release();
+		if (canceled.m_source) canceled.m_source->release();
+	}
+
+
+	// returns true if the item is already in the hands of an I/O thread or the main thread
+	bool cancelLocked(u32 id, AsyncItem* canceled)
+	{
+		for (int i = 0, c = m_queue.m_queued.size(); i < c; ++i)
+		{
+			AsyncItem& item = m_queue.m_queued[i];
+			if (item.m_id == id && (item.m_flags & E_IS_OPEN) == E_IS_OPEN)
 			{
-				m_pending[i].m_flags |= E_CANCELED;
-				return;
+				*canceled = item;
+				m_queue.m_queued.erase(i);
+				++m_queue.m_stats.canceled;
+				return false;
 			}
 		}
 
-		for (auto iter = m_in_progress.begin(), end = m_in_progress.end(); iter != end; ++iter)
+		for (int i = 0; i < lengthOf(m_queue.m_current); ++i)
 		{
-			if (iter.value()->data.m_id == id)
+			if (m_queue.m_current[i] == id)
 			{
-				iter.value()->data.m_flags |= E_CANCELED;
-				return;
+				// the I/O thread stops at the next chunk
+				m_queue.m_canceled[i] = true;
+				canceled->m_file = m_queue.m_current_file[i];
+				canceled->m_cb = m_queue.m_current_cb[i];
+				return true;
+			}
+		}
+
+		return cancelFinished(m_queue.m_finished, id, canceled) || cancelFinished(m_processing, id, canceled);
+	}
+
+
+	bool cancelFinished(ItemsTable& items, u32 id, AsyncItem* canceled)
+	{
+		for (auto& item : items)
+		{
+			if (item.m_id == id && (item.m_flags & E_IS_OPEN) == E_IS_OPEN && (item.m_flags & E_CANCELED) == 0)
+			{
+				item.m_flags |= E_CANCELED;
+				++m_queue.m_stats.canceled;
+				*canceled = item;
+				return true;
 			}
 		}
+		return false;
+	}
+
 
+	void setAsyncPriority(u32 id, Priority priority) override
+	{
+		if (id == INVALID_ASYNC) return;
+
+		MT::SpinLock lock(m_queue.m_mutex);
+		for (auto& item : m_queue.m_queued)
+		{
+			if (item.m_id == id && (item.m_flags & E_IS_OPEN) == E_IS_OPEN)
+			{
+				item.m_priority = priority;
+				return;
+			}
+		}
 	}
 
 
@@ -335,77 +666,73 @@ public:
 
 	void closeAsync(IFile& file) override
 	{
-		AsyncItem& item = m_pending.emplace();
-
+		AsyncItem item;
 		item.m_file = &file;
-		item.m_cb.bind<closeAsync>();
+		item.m_source = nullptr;
+		item.m_offset = item.m_size = 0;
 		item.m_mode = 0;
 		item.m_flags = E_CLOSE;
+		item.m_id = INVALID_ASYNC;
+		// closing releases memory and it's cheap, so do not let it wait behind prefetches
+		item.m_priority = Priority::HIGH;
+		push(item);
+	}
+
+
+	void keepOpen(IFile& file) override
+	{
+		ASSERT(!m_processing.empty());
+		m_kept_open = &file;
 	}
 
 
 	void updateAsyncTransactions() override
 	{
 		PROFILE_FUNCTION();
-		while (!m_in_progress.empty())
-		{
-			AsynTrans* tr = m_in_progress.front();
-			if (!tr->isCompleted()) break;
-
-			PROFILE_BLOCK("processAsyncTransaction");
-			m_in_progress.pop();
 
-			if ((tr->data.m_flags & E_CANCELED) == 0)
-			{
-				tr->data.m_cb.invoke(*tr->data.m_file, !!(tr->data.m_flags & E_SUCCESS));
-			}
-			if ((tr->data.m_flags & (E_SUCCESS | E_FAIL)) != 0)
+		#if LUMIX_SINGLE_THREAD()
+			AsyncItem item;
+			for (;;)
 			{
-				closeAsync(*tr->data.m_file);
+				{
+					MT::SpinLock lock(m_queue.m_mutex);
+					if (!m_queue.pop(item)) break;
+					m_queue.m_current[0] = item.m_id;
+					++m_queue.m_in_flight;
+				}
+				PROFILE_BLOCK("transaction");
+				processItem(item, m_queue.m_canceled[0]);
+				m_queue.finish(0, item, 0);
 			}
-			m_transaction_queue.dealoc(tr);
+		#endif
+
+		{
+			MT::SpinLock lock(m_queue.m_mutex);
+			ASSERT(m_processing.empty());
+			m_processing.swap(m_queue.m_finished);
 		}
 
-		i32 can_add = C_MAX_TRANS - m_in_progress.size();
-		while (can_add && !m_pending.empty())
+		// callbacks can cancel items which are still in m_processing, so do not cache anything here
+		for (int i = 0; i < m_processing.size(); ++i)
 		{
-			AsynTrans* tr = m_transaction_queue.alloc(false);
-			if (tr)
+			PROFILE_BLOCK("processAsyncTransaction");
+			AsyncItem& item = m_processing[i];
+			IFile* file = item.m_file;
+			m_kept_open = nullptr;
+			if ((item.m_flags & E_CANCELED) == 0)
 			{
-				AsyncItem& item = m_pending[0];
-				tr->data.m_file = item.m_file;
-				tr->data.m_cb = item.m_cb;
-				tr->data.m_id = item.m_id;
-				tr->data.m_mode = item.m_mode;
-				copyString(tr->data.m_path, sizeof(tr->data.m_path), item.m_path);
-				tr->data.m_flags = item.m_flags;
-				tr->reset();
-
-				m_transaction_queue.push(tr, true);
-				m_in_progress.push(tr);
-				m_pending.erase(0);
+				item.m_cb.invoke(*file, !!(item.m_flags & E_SUCCESS));
 			}
-			can_add--;
+			if (m_kept_open != file) closeAsync(*file);
+			m_kept_open = nullptr;
 		}
+		m_processing.clear();
 
-		#if LUMIX_SINGLE_THREAD()
-			while (AsynTrans* tr = m_transaction_queue.pop(false))
-			{
-				PROFILE_BLOCK("transaction");
-				if ((tr->data.m_flags & E_IS_OPEN) == E_IS_OPEN)
-				{
-					tr->data.m_flags |=
-						tr->data.m_file->open(Path(tr->data.m_path), tr->data.m_mode) ? E_SUCCESS : E_FAIL;
-				}
-				else if ((tr->data.m_flags & E_CLOSE) == E_CLOSE)
-				{
-					tr->data.m_file->close();
-					tr->data.m_file->release();
-					tr->data.m_file = nullptr;
-				}
-				tr->setCompleted();
-			}
-		#endif
+		Stats stats = getStats();
+		PROFILE_INT("queued high", stats.queued[(int)Priority::HIGH]);
+		PROFILE_INT("queued normal", stats.queued[(int)Priority::NORMAL]);
+		PROFILE_INT("queued low", stats.queued[(int)Priority::LOW]);
+		PROFILE_INT("in flight", stats.in_flight);
 	}
 
 	const DeviceList& getDefaultDevice() const override { return m_default_device; }
@@ -422,18 +749,17 @@ public:
 		return nullptr;
 	}
 
-	static void closeAsync(IFile&, bool) {}
-
 private:
 	BaseProxyAllocator m_allocator;
 	#if !LUMIX_SINGLE_THREAD()
-		FSTask* m_task;
+		FSTask* m_tasks[MAX_IO_THREADS];
+		int m_task_count;
 	#endif
 	DevicesTable m_devices;
 
-	ItemsTable m_pending;
-	TransQueue m_transaction_queue;
-	InProgressQueue m_in_progress;
+	mutable AsyncQueue m_queue;
+	ItemsTable m_processing;
+	IFile* m_kept_open;
 
 	DeviceList m_disk_device;
 	DeviceList m_memory_device;
@@ -97,6 +97,29 @@ class LUMIX_ENGINE_API FileSystem
 {
 public:
 	static const u32 INVALID_ASYNC = 0xffffFFFF;
+
+	enum class Priority : u8
+	{
+		HIGH, // needed for the current frame
+		NORMAL,
+		LOW, // prefetch
+
+		COUNT
+	};
+
+	struct Stats
+	{
+		u64 bytes_read;
+		float io_time; // summed over all I/O threads
+		u32 completed;
+		u32 failed;
+		u32 canceled;
+		u32 queued[(int)Priority::COUNT];
+		u32 in_flight;
+
+		float getBandwidth() const { return io_time > 0 ? float(bytes_read / io_time) : 0; }
+	};
+
 	static FileSystem* create(IAllocator& allocator);
 	static void destroy(FileSystem* fs);
 
@@ -110,11 +133,26 @@ public:
 	virtual u32 openAsync(const DeviceList& device_list,
 						   const Path& file,
 						   int mode,
-						   const ReadCallback& call_back) = 0;
+						   const ReadCallback& call_back,
+						   Priority priority = Priority::NORMAL) = 0;
+	// reads size bytes at offset, the file passed to the callback holds only them; memory devices
+	// would read the whole file, so they are skipped in device_list
+	virtual u32 readAsync(const DeviceList& device_list,
+						   const Path& file,
+						   size_t offset,
+						   size_t size,
+						   const ReadCallback& call_back,
+						   Priority priority = Priority::NORMAL) = 0;
+	// invokes the callback right away with success == false and never again, the file passed to it
+	// must not be accessed; reads already in progress are aborted at the next chunk
 	virtual void cancelAsync(u32 id) = 0;
+	virtual void setAsyncPriority(u32 id, Priority priority) = 0;
 
 	virtual void close(IFile& file) = 0;
 	virtual void closeAsync(IFile& file) = 0;
+	// call from ReadCallback to keep the file opened after the callback returns,
+	// the caller is then responsible for closing it with closeAsync
+	virtual void keepOpen(IFile& file) = 0;
 
 	virtual void updateAsyncTransactions() = 0;
 
@@ -128,6 +166,7 @@ public:
 	virtual void setDefaultDevice(const char* dev) = 0;
 	virtual void setSaveGameDevice(const char* dev) = 0;
 	virtual bool hasWork() const = 0;
+	virtual Stats getStats() const = 0;
 };
 
 
@@ -1,5 +1,6 @@
 #include "engine/fs/file_system.h"
 #include "engine/iallocator.h"
+#include "engine/mt/sync.h"
 #include "engine/path.h"
 #include "engine/string.h"
 #include "pack_file_device.h"
@@ -28,12 +29,16 @@ public:
 		if (iter == m_device.m_files.end()) return false;
 		m_file = iter.value();
 		m_local_offset = 0;
+		MT::SpinLock lock(m_device.m_mutex);
+		m_device.m_offset = (size_t)m_file.offset;
 		return m_device.m_file.seek(SeekMode::BEGIN, (size_t)m_file.offset);
 	}
 
 
 	bool read(void* buffer, size_t size) override
 	{
+		// files are read from multiple I/O threads, but they share one OS file
+		MT::SpinLock lock(m_device.m_mutex);
 		if (m_device.m_offset != m_file.offset + m_local_offset)
 		{
 			if (!m_device.m_file.seek(FS::SeekMode::BEGIN, size_t(m_file.offset + m_local_offset)))
@@ -42,13 +47,16 @@ public:
 			}
 		}
 		m_local_offset += size;
+		m_device.m_offset = size_t(m_file.offset + m_local_offset);
 		return m_device.m_file.read(buffer, size);
 	}
 
 
 	bool seek(SeekMode base, size_t pos) override
 	{
+		MT::SpinLock lock(m_device.m_mutex);
 		m_local_offset = pos;
+		m_device.m_offset = size_t(m_file.offset + pos);
 		return m_device.m_file.seek(SeekMode::BEGIN, size_t(m_file.offset + pos));
 	}
 
@@ -73,6 +81,7 @@ private:
 PackFileDevice::PackFileDevice(IAllocator& allocator)
 	: m_allocator(allocator)
 	, m_files(allocator)
+	, m_mutex(false)
 {
 }
 
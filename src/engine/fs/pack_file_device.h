@@ -4,6 +4,7 @@
 #include "engine/fs/os_file.h"
 #include "engine/hash_map.h"
 #include "engine/lumix.h"
+#include "engine/mt/sync.h"
 
 
 namespace Lumix
@@ -37,6 +38,7 @@ private:
 	HashMap<u32, PackFileInfo> m_files;
 	size_t m_offset;
 	OsFile m_file;
+	MT::SpinMutex m_mutex;
 	IAllocator& m_allocator;
 };
 
@@ -1,10 +1,16 @@
 #include "engine/fs/tcp_file_device.h"
+#include "engine/array.h"
 #include "engine/iallocator.h"
 #include "engine/blob.h"
 #include "engine/fs/file_system.h"
+#include "engine/math_utils.h"
+#include "engine/mt/atomic.h"
 #include "engine/mt/sync.h"
+#include "engine/mt/task.h"
 #include "engine/path.h"
+#include "engine/profiler.h"
 #include "engine/network.h"
+#include "engine/string.h"
 
 
 namespace Lumix
@@ -13,14 +19,158 @@ namespace Lumix
 	{
 		static const u32 INVALID_FILE = 0xffffFFFF;
 
+
+		// request waiting for its response, it lives on the stack of the thread which sent it
+		struct TCPPendingRequest
+		{
+			explicit TCPPendingRequest(IAllocator& allocator)
+				: data(allocator)
+				, semaphore(0, 1)
+				, result(-1)
+			{
+			}
+
+			u32 id;
+			Array<u8> data;
+			MT::Semaphore semaphore;
+			i32 result;
+		};
+
+
+		class TCPReceiverTask LUMIX_FINAL : public MT::Task
+		{
+		public:
+			TCPReceiverTask(TCPImpl& impl, IAllocator& allocator)
+				: MT::Task(allocator)
+				, m_impl(impl)
+			{
+			}
+
+			int task() override;
+
+		private:
+			TCPImpl& m_impl;
+		};
+
+
+		struct TCPImpl
+		{
+			explicit TCPImpl(IAllocator& allocator)
+				: m_allocator(allocator)
+				, m_connector(m_allocator)
+				, m_stream(nullptr)
+				, m_spin_mutex(false)
+				, m_pending_mutex(false)
+				, m_pending(allocator)
+				, m_receiver(*this, allocator)
+				, m_last_request_id(0)
+				, m_is_connected(false)
+			{}
+
+
+			bool send(TCPRequestHeader& header, const void* data, size_t size, TCPPendingRequest* request)
+			{
+				header.id = (u32)MT::atomicIncrement(&m_last_request_id);
+				if (request)
+				{
+					request->id = header.id;
+					MT::SpinLock lock(m_pending_mutex);
+					if (!m_is_connected) return false;
+					m_pending.push(request);
+				}
+
+				bool success;
+				{
+					MT::SpinLock lock(m_spin_mutex);
+					success = m_stream->write(header);
+					if (size > 0) success = success && m_stream->write(data, size);
+				}
+				if (!success && request)
+				{
+					MT::SpinLock lock(m_pending_mutex);
+					m_pending.eraseItemFast(request);
+				}
+				return success;
+			}
+
+
+			bool call(TCPRequestHeader& header, const void* data, size_t size, TCPPendingRequest& request)
+			{
+				if (!send(header, data, size, &request)) return false;
+				request.semaphore.wait();
+				return true;
+			}
+
+
+			IAllocator& m_allocator;
+			Net::TCPConnector m_connector;
+			Net::TCPStream* m_stream;
+			// guards writing to m_stream, only the receiver task reads from it
+			MT::SpinMutex m_spin_mutex;
+			MT::SpinMutex m_pending_mutex;
+			Array<TCPPendingRequest*> m_pending;
+			TCPReceiverTask m_receiver;
+			volatile i32 m_last_request_id;
+			bool m_is_connected;
+		};
+
+
+		int TCPReceiverTask::task()
+		{
+			for (;;)
+			{
+				TCPResponseHeader header;
+				if (!m_impl.m_stream->read(header)) break;
+
+				TCPPendingRequest* request = nullptr;
+				{
+					MT::SpinLock lock(m_impl.m_pending_mutex);
+					for (int i = 0; i < m_impl.m_pending.size(); ++i)
+					{
+						if (m_impl.m_pending[i]->id == header.id)
+						{
+							request = m_impl.m_pending[i];
+							m_impl.m_pending.eraseFast(i);
+							break;
+						}
+					}
+				}
+				ASSERT(request);
+				if (!request) break;
+
+				request->data.resize((int)header.size);
+				if (header.size > 0 && !m_impl.m_stream->read(&request->data[0], header.size))
+				{
+					request->semaphore.signal();
+					break;
+				}
+				request->result = header.result;
+				request->semaphore.signal();
+			}
+
+			// connection is closed, nobody is going to answer pending requests
+			MT::SpinLock lock(m_impl.m_pending_mutex);
+			m_impl.m_is_connected = false;
+			for (TCPPendingRequest* request : m_impl.m_pending)
+			{
+				request->semaphore.signal();
+			}
+			m_impl.m_pending.clear();
+			return 0;
+		}
+
+
 		class TCPFile LUMIX_FINAL : public IFile
 		{
 		public:
-			TCPFile(Net::TCPStream* stream, TCPFileDevice& device, MT::SpinMutex& spin_mutex) 
+			TCPFile(TCPImpl& impl, TCPFileDevice& device)
 				: m_device(device)
-				, m_stream(stream)
-				, m_spin_mutex(spin_mutex)
+				, m_impl(impl)
+				, m_data(impl.m_allocator)
 				, m_file(INVALID_FILE)
+				, m_pos(0)
+				, m_size(0)
+				, m_is_remote(false)
 			{}
 
 			~TCPFile() {}
@@ -32,113 +182,120 @@ namespace Lumix
 
 			bool open(const Path& path, Mode mode) override
 			{
-				if (!m_stream)
+				PROFILE_FUNCTION();
+				TCPPendingRequest request(m_impl.m_allocator);
+				TCPRequestHeader header;
+				header.command = TCPCommand::OpenFile;
+				header.file = INVALID_FILE;
+				header.mode = mode;
+				header.size = path.length() + 1;
+				if (!m_impl.call(header, path.c_str(), path.length() + 1, request)) return false;
+				if (request.result < 0) return false;
+
+				m_pos = 0;
+				m_is_remote = (mode & Mode::WRITE) != 0;
+				if (m_is_remote)
 				{
-					return false;
+					m_file = (u32)request.result;
+					m_size = 0;
 				}
-
-				i32 op = TCPCommand::OpenFile;
-
-				MT::SpinLock lock(m_spin_mutex);
-				m_stream->write(op);
-				m_stream->write(mode);
-				m_stream->writeString(path.c_str());
-				m_stream->read(m_file);
-
-				return INVALID_FILE != m_file;
+				else
+				{
+					// the whole file is prefetched, the server has already closed it
+					m_data.swap(request.data);
+					m_size = m_data.size();
+				}
+				return true;
 			}
 
 			void close() override
 			{
-				if (INVALID_FILE != m_file)
+				if (m_is_remote && INVALID_FILE != m_file)
 				{
-					i32 op = TCPCommand::Close;
-
-					MT::SpinLock lock(m_spin_mutex);
-					m_stream->write(op);
-					m_stream->write(m_file);
+					TCPPendingRequest request(m_impl.m_allocator);
+					TCPRequestHeader header;
+					header.command = TCPCommand::Close;
+					header.file = m_file;
+					header.mode = 0;
+					header.size = 0;
+					m_impl.call(header, nullptr, 0, request);
 				}
+				m_file = INVALID_FILE;
+				m_is_remote = false;
+				m_data.clear();
 			}
 
 			bool read(void* buffer, size_t size) override
 			{
-				i32 op = TCPCommand::Read;
-
-				MT::SpinLock lock(m_spin_mutex);
-				m_stream->write(op);
-				m_stream->write(m_file);
-				m_stream->write((u64)size);
-
-				m_stream->read(buffer, size);
-				bool successful = false;
-				m_stream->read(successful);
+				if (m_is_remote) return false;
+				if (m_pos + size > m_size)
+				{
+					size_t available = m_size - m_pos;
+					copyMemory(buffer, m_data.begin() + m_pos, available);
+					m_pos = m_size;
+					return false;
+				}
 
-				return successful;
+				copyMemory(buffer, m_data.begin() + m_pos, size);
+				m_pos += size;
+				return true;
 			}
 
+			// writes are not acknowledged, failures are reported by the server in the log
 			bool write(const void* buffer, size_t size) override
 			{
-				i32 op = TCPCommand::Write;
-
-				MT::SpinLock lock(m_spin_mutex);
-				m_stream->write(op);
-				m_stream->write(m_file);
-				m_stream->write((u64)size);
-				m_stream->write(buffer, size);
-
-				bool successful = false;
-				m_stream->read(successful);
-
-				return successful;
+				if (!m_is_remote) return false;
+
+				TCPRequestHeader header;
+				header.command = TCPCommand::Write;
+				header.file = m_file;
+				header.mode = 0;
+				header.size = size;
+				if (!m_impl.send(header, buffer, size, nullptr)) return false;
+
+				m_pos += size;
+				m_size = Math::maximum(m_size, m_pos);
+				return true;
 			}
 
 			const void* getBuffer() const override
 			{
-				return nullptr;
+				return m_is_remote ? nullptr : m_data.begin();
 			}
 
 			size_t size() override
 			{
-				i32 op = TCPCommand::Size;
-				u32 size = 0;
-
-				MT::SpinLock lock(m_spin_mutex);
-				m_stream->write(op);
-				m_stream->write(m_file);
-
-				m_stream->read(size);
-
-				return (size_t)size;
+				return m_size;
 			}
 
 			bool seek(SeekMode base, size_t pos) override
 			{
-				i32 op = TCPCommand::Seek;
-
-				MT::SpinLock lock(m_spin_mutex);
-				m_stream->write(op);
-				m_stream->write(m_file);
-				m_stream->write(base);
-				m_stream->write((u64)pos);
-
-				u8 res = 0;
-				m_stream->read(res);
+				size_t new_pos = 0;
+				switch (base)
+				{
+					case SeekMode::BEGIN: new_pos = pos; break;
+					case SeekMode::CURRENT: new_pos = m_pos + pos; break;
+					case SeekMode::END: new_pos = m_size - pos; break;
+					default: ASSERT(false); break;
+				}
+				if (new_pos > m_size) return false;
 
-				return res != 0;
+				if (m_is_remote)
+				{
+					TCPRequestHeader header;
+					header.command = TCPCommand::Seek;
+					header.file = m_file;
+					header.mode = SeekMode::BEGIN;
+					header.size = new_pos;
+					if (!m_impl.send(header, nullptr, 0, nullptr)) return false;
+				}
+				m_pos = new_pos;
+				return true;
 			}
 
 			size_t pos() override
 			{
-				i32 op = TCPCommand::Seek;
-				i32 pos = 0;
-
-				MT::SpinLock lock(m_spin_mutex);
-				m_stream->write(op);
-				m_stream->write(m_file);
-
-				m_stream->read(pos);
-
-				return (size_t)pos;
+				return m_pos;
 			}
 
 		private:
@@ -146,25 +303,14 @@ namespace Lumix
 			TCPFile(const TCPFile&);
 
 			TCPFileDevice& m_device;
-			Net::TCPStream* m_stream;
-			MT::SpinMutex& m_spin_mutex;
+			TCPImpl& m_impl;
+			Array<u8> m_data;
 			u32 m_file;
+			size_t m_pos;
+			size_t m_size;
+			bool m_is_remote;
 		};
 
-		struct TCPImpl
-		{
-			explicit TCPImpl(IAllocator& allocator)
-				: m_spin_mutex(false)
-				, m_allocator(allocator)
-				, m_connector(m_allocator)
-				, m_stream(nullptr)
-			{}
-
-			IAllocator& m_allocator;
-			Net::TCPConnector m_connector;
-			Net::TCPStream* m_stream;
-			MT::SpinMutex m_spin_mutex;
-		};
 
 		TCPFileDevice::TCPFileDevice()
 			: m_impl(nullptr)
@@ -173,7 +319,7 @@ namespace Lumix
 
 		IFile* TCPFileDevice::createFile(IFile*)
 		{
-			return LUMIX_NEW(m_impl->m_allocator, TCPFile)(m_impl->m_stream, *this, m_impl->m_spin_mutex);
+			return LUMIX_NEW(m_impl->m_allocator, TCPFile)(*m_impl, *this);
 		}
 
 		void TCPFileDevice::destroyFile(IFile* file)
@@ -181,17 +327,33 @@ namespace Lumix
 			LUMIX_DELETE(m_impl->m_allocator, file);
 		}
 
-		void TCPFileDevice::connect(const char* ip, u16 port, IAllocator& allocator)
+		bool TCPFileDevice::connect(const char* ip, u16 port, IAllocator& allocator)
 		{
 			m_impl = LUMIX_NEW(allocator, TCPImpl)(allocator);
 			m_impl->m_stream = m_impl->m_connector.connect(ip, port);
+			if (!m_impl->m_stream) return false;
+
+			m_impl->m_is_connected = true;
+			m_impl->m_receiver.create("TCP File Device Receiver");
+			return true;
 		}
 
 		void TCPFileDevice::disconnect()
 		{
-			m_impl->m_stream->write(TCPCommand::Disconnect);
-			m_impl->m_connector.close(m_impl->m_stream);
+			if (m_impl->m_stream)
+			{
+				TCPRequestHeader header;
+				header.command = TCPCommand::Disconnect;
+				header.file = INVALID_FILE;
+				header.mode = 0;
+				header.size = 0;
+				m_impl->send(header, nullptr, 0, nullptr);
+				// the server closes the connection, which ends the receiver task
+				m_impl->m_receiver.destroy();
+				m_impl->m_connector.close(m_impl->m_stream);
+			}
 			LUMIX_DELETE(m_impl->m_allocator, m_impl);
+			m_impl = nullptr;
 		}
 	} // namespace FS
 } // ~namespace Lumix
@@ -39,6 +39,32 @@ namespace Lumix
 			i32 value;
 		};
 
+
+		// every request starts with this header, the client does not wait for a response before sending
+		// the next request, responses are matched to requests by id and can come in any order
+		struct TCPRequestHeader
+		{
+			u32 id;
+			TCPCommand command;
+			u32 file;
+			i32 mode;
+			u64 size;
+		};
+
+
+		// OpenFile in read mode returns the whole file in one response, so reads, seeks and size queries
+		// are served locally without any roundtrip; only OpenFile and Close (in write mode) have responses
+		struct TCPResponseHeader
+		{
+			u32 id;
+			i32 result;
+			u64 size;
+		};
+
+
+		static const u16 TCP_FILE_SERVER_PORT = 10001;
+
+
 		class LUMIX_ENGINE_API TCPFileDevice LUMIX_FINAL : public IFileDevice
 		{
 		public:
@@ -48,7 +74,7 @@ namespace Lumix
 			IFile* createFile(IFile* child) override;
 			const char* name() const override { return "tcp"; }
 
-			void connect(const char* ip, u16 port, IAllocator& allocator);
+			bool connect(const char* ip, u16 port, IAllocator& allocator);
 			void disconnect();
 
 			Net::TCPStream* getStream();
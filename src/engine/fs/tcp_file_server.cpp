@@ -4,7 +4,11 @@
 #include "engine/free_list.h"
 #include "engine/fs/os_file.h"
 #include "engine/fs/tcp_file_device.h"
+#include "engine/log.h"
+#include "engine/math_utils.h"
+#include "engine/mt/sync.h"
 #include "engine/mt/task.h"
+#include "engine/mt/thread.h"
 #include "engine/path.h"
 #include "engine/profiler.h"
 #include "engine/string.h"
@@ -22,12 +26,55 @@ namespace FS
 {
 
 
+static const int MAX_WORKERS = 4;
+
+
+// prefetch request waiting for a worker
+struct TCPFileServerRequest
+{
+	u32 id;
+	char path[MAX_PATH_LENGTH];
+};
+
+
+class TCPFileServerTask;
+
+
+// opens and reads whole files requested in read mode, so slow disk I/O of one file does not block others
+class TCPFileServerWorker LUMIX_FINAL : public MT::Task
+{
+public:
+	TCPFileServerWorker(TCPFileServerTask& server, IAllocator& allocator)
+		: MT::Task(allocator)
+		, m_server(server)
+		, m_data(allocator)
+	{
+	}
+
+	int task() override;
+
+private:
+	TCPFileServerTask& m_server;
+	Array<u8> m_data;
+};
+
+
+// reads requests from the connection, requests on files opened for writing are processed right here
+// to keep them in order, read requests are passed to workers
 class TCPFileServerTask LUMIX_FINAL : public MT::Task
 {
+friend class TCPFileServerWorker;
 public:
 	explicit TCPFileServerTask(IAllocator& allocator)
 		: MT::Task(allocator)
 		, m_acceptor(allocator)
+		, m_stream(nullptr)
+		, m_write_semaphore(1, 1)
+		, m_queue_mutex(false)
+		, m_queue(allocator)
+		, m_semaphore(0, 0x7fffFFFF)
+		, m_aborted(false)
+		, m_worker_count(0)
 	{
 		setMemory(m_buffer, 0, sizeof(m_buffer));
 		setMemory(m_files, 0, sizeof(m_files));
@@ -39,11 +86,55 @@ public:
 	}
 
 
-	void openFile(Net::TCPStream* stream)
+	bool listen() { return m_acceptor.start("127.0.0.1", TCP_FILE_SERVER_PORT); }
+
+
+	void getFullPath(const char* path, char (&out)[MAX_PATH_LENGTH]) const
+	{
+		if (compareStringN(path, m_base_path.c_str(), m_base_path.length()) != 0)
+		{
+			copyString(out, m_base_path.c_str());
+			catString(out, path);
+		}
+		else
+		{
+			copyString(out, path);
+		}
+	}
+
+
+	bool respond(u32 id, i32 result, const void* data, u64 size)
+	{
+		TCPResponseHeader header;
+		header.id = id;
+		header.result = result;
+		header.size = size;
+
+		// responses can be megabytes, so threads waiting for the stream sleep instead of spinning
+		m_write_semaphore.wait();
+		bool success = m_stream->write(header);
+		if (size > 0) success = success && m_stream->write(data, size);
+		m_write_semaphore.signal();
+		return success;
+	}
+
+
+	bool openFile(const TCPRequestHeader& header)
 	{
-		i32 mode = 0;
-		stream->read(mode);
-		stream->readString(m_buffer, lengthOf(m_buffer));
+		if (header.size > MAX_PATH_LENGTH) return false;
+
+		TCPFileServerRequest request;
+		request.id = header.id;
+		if (!m_stream->read(request.path, header.size)) return false;
+		request.path[MAX_PATH_LENGTH - 1] = '\0';
+
+		if ((header.mode & Mode::WRITE) == 0)
+		{
+			MT::SpinLock lock(m_queue_mutex);
+			m_queue.push(request);
+			m_semaphore.signal();
+			return true;
+		}
 
 		i32 ret = -2;
 		i32 id = m_ids.alloc();
@@ -53,168 +144,142 @@ public:
 			m_files[id] = file;
 
 			char path[MAX_PATH_LENGTH];
-			if (compareStringN(m_buffer, m_base_path.c_str(), m_base_path.length()) != 0)
-			{
-				copyString(path, m_base_path.c_str());
-				catString(path, m_buffer);
-			}
-			else
-			{
-				copyString(path, m_buffer);
-			}
-			ret = file->open(path, mode, getAllocator()) ? id : -1;
+			getFullPath(request.path, path);
+			ret = file->open(path, header.mode, getAllocator()) ? id : -1;
 			if (ret == -1)
 			{
 				m_ids.release(id);
-				file->close();
+				m_files[id] = nullptr;
 				LUMIX_DELETE(getAllocator(), file);
 			}
 		}
-		stream->write(ret);
+		return respond(header.id, ret, nullptr, 0);
 	}
 
 
-	void read(Net::TCPStream* stream)
+	OsFile* getFile(u32 id)
 	{
-		bool read_successful = true;
-		u32 id = 0xffffFFFF;
-		stream->read(id);
-		OsFile* file = m_files[id];
-
-		u32 size = 0;
-		stream->read(size);
-
-		while (size > 0)
-		{
-			i32 read = (i32)size > lengthOf(m_buffer) ? lengthOf(m_buffer)
-														   : (i32)size;
-			read_successful &= file->read((void*)m_buffer, read);
-			stream->write((const void*)m_buffer, read);
-			size -= read;
-		}
-
-		stream->write(read_successful);
+		if (id >= (u32)lengthOf(m_files)) return nullptr;
+		return m_files[id];
 	}
 
 
-	void close(Net::TCPStream* stream)
+	bool close(const TCPRequestHeader& header)
 	{
-		u32 id = 0xffffFFFF;
-		stream->read(id);
-		OsFile* file = m_files[id];
-		m_ids.release(id);
+		OsFile* file = getFile(header.file);
+		if (!file) return respond(header.id, -1, nullptr, 0);
 
+		m_ids.release(header.file);
+		m_files[header.file] = nullptr;
 		file->close();
 		LUMIX_DELETE(getAllocator(), file);
+		return respond(header.id, 0, nullptr, 0);
 	}
 
 
-	void write(Net::TCPStream* stream)
+	bool write(const TCPRequestHeader& header)
 	{
-		bool write_successful = true;
-		u32 id = 0xffffFFFF;
-		stream->read(id);
-		OsFile* file = m_files[id];
-
-		u32 size = 0;
-		stream->read(size);
+		OsFile* file = getFile(header.file);
+		bool write_successful = file != nullptr;
 
+		u64 size = header.size;
 		while (size > 0)
 		{
-			i32 read = (i32)size > lengthOf(m_buffer) ? lengthOf(m_buffer)
-														   : (i32)size;
-			write_successful &= stream->read((void*)m_buffer, read);
-			file->write(m_buffer, read);
+			i32 read = size > sizeof(m_buffer) ? sizeof(m_buffer) : (i32)size;
+			if (!m_stream->read((void*)m_buffer, read)) return false;
+			write_successful = write_successful && file->write(m_buffer, read);
 			size -= read;
 		}
 
-		stream->write(write_successful);
+		if (!write_successful) g_log_error.log("Engine") << "TCP file server failed to write a file";
+		return true;
 	}
 
 
-	void seek(Net::TCPStream* stream)
+	void seek(const TCPRequestHeader& header)
 	{
-		u32 id = 0xffffFFFF;
-		stream->read(id);
-		OsFile* file = m_files[id];
-
-		u32 base = 0;
-		i32 offset = 0;
-		stream->read(base);
-		stream->read(offset);
-
-		u32 res = (u8)file->seek((SeekMode)base, offset);
-		stream->write(res);
+		OsFile* file = getFile(header.file);
+		if (file) file->seek((SeekMode)(u32)header.mode, (size_t)header.size);
 	}
 
 
-	void size(Net::TCPStream* stream)
+	void startWorkers()
 	{
-		u32 id = 0xffffFFFF;
-		stream->read(id);
-		OsFile* file = m_files[id];
-
-		u32 size = (u32)file->size();
-		stream->write(size);
+		m_aborted = false;
+		m_worker_count = Math::clamp((int)MT::getCPUsCount(), 1, MAX_WORKERS);
+		for (int i = 0; i < m_worker_count; ++i)
+		{
+			m_workers[i] = LUMIX_NEW(getAllocator(), TCPFileServerWorker)(*this, getAllocator());
+			m_workers[i]->create("TCP File Server Worker");
+		}
 	}
 
 
-	void pos(Net::TCPStream* stream)
+	// workers finish all queued requests before they exit
+	void stopWorkers()
 	{
-		u32 id = 0xffffFFFF;
-		stream->read(id);
-		OsFile* file = m_files[id];
-
-		u32 pos = (u32)file->pos();
-		stream->write(pos);
+		{
+			MT::SpinLock lock(m_queue_mutex);
+			m_aborted = true;
+		}
+		for (int i = 0; i < m_worker_count; ++i) m_semaphore.signal();
+		for (int i = 0; i < m_worker_count; ++i)
+		{
+			m_workers[i]->destroy();
+			LUMIX_DELETE(getAllocator(), m_workers[i]);
+		}
+		m_worker_count = 0;
 	}
 
 
-	int task()
+	int task() override
 	{
-		bool quit = false;
-
-		m_acceptor.start("127.0.0.1", 10001);
-		Net::TCPStream* stream = m_acceptor.accept();
+		m_stream = m_acceptor.accept();
+		if (!m_stream) return 0;
 
+		startWorkers();
+		bool quit = false;
 		while (!quit)
 		{
+			TCPRequestHeader header;
+			if (!m_stream->read(header)) break;
+
 			PROFILE_BLOCK("File server operation")
-			i32 op = 0;
-			stream->read(op);
-			switch (op)
+			switch (header.command)
 			{
 				case TCPCommand::OpenFile:
-					openFile(stream);
+					quit = !openFile(header);
 					break;
 				case TCPCommand::Close:
-					close(stream);
-					break;
-				case TCPCommand::Read:
-					read(stream);
+					quit = !close(header);
 					break;
 				case TCPCommand::Write:
-					write(stream);
-					break;
-				case TCPCommand::Size:
-					size(stream);
+					quit = !write(header);
 					break;
 				case TCPCommand::Seek:
-					seek(stream);
-					break;
-				case TCPCommand::Pos:
-					pos(stream);
+					seek(header);
 					break;
 				case TCPCommand::Disconnect:
 					quit = true;
 					break;
 				default:
 					ASSERT(0);
+					quit = true;
 					break;
 			}
 		}
+		stopWorkers();
+
+		for (int i = 0; i < lengthOf(m_files); ++i)
+		{
+			if (!m_files[i]) continue;
+			m_files[i]->close();
+			LUMIX_DELETE(getAllocator(), m_files[i]);
+			m_files[i] = nullptr;
+		}
 
-		m_acceptor.close(stream);
+		m_acceptor.close(m_stream);
+		m_stream = nullptr;
 		return 0;
 	}
 
@@ -245,6 +310,15 @@ public:
 
 private:
 	Net::TCPAcceptor m_acceptor;
+	Net::TCPStream* m_stream;
+	// used as a blocking mutex
+	MT::Semaphore m_write_semaphore;
+	MT::SpinMutex m_queue_mutex;
+	Array<TCPFileServerRequest> m_queue;
+	MT::Semaphore m_semaphore;
+	bool m_aborted;
+	TCPFileServerWorker* m_workers[MAX_WORKERS];
+	int m_worker_count;
 	char m_buffer[0x50000];
 	OsFile* m_files[0x50000];
 	FreeList<i32, 0x50000> m_ids;
@@ -252,6 +326,43 @@ private:
 };
 
 
+int TCPFileServerWorker::task()
+{
+	for (;;)
+	{
+		m_server.m_semaphore.wait();
+
+		TCPFileServerRequest request;
+		{
+			MT::SpinLock lock(m_server.m_queue_mutex);
+			if (m_server.m_queue.empty())
+			{
+				if (m_server.m_aborted) break;
+				continue;
+			}
+			request = m_server.m_queue[0];
+			m_server.m_queue.erase(0);
+		}
+
+		PROFILE_BLOCK("File server read");
+		char path[MAX_PATH_LENGTH];
+		m_server.getFullPath(request.path, path);
+
+		OsFile file;
+		i32 result = -1;
+		if (file.open(path, Mode::OPEN_AND_READ, getAllocator()))
+		{
+			m_data.resize((int)file.size());
+			result = m_data.empty() || file.read(&m_data[0], m_data.size()) ? 0 : -1;
+			file.close();
+		}
+		if (result < 0) m_data.clear();
+		m_server.respond(request.id, result, m_data.begin(), m_data.size());
+	}
+	return 0;
+}
+
+
 struct TCPFileServerImpl
 {
 	explicit TCPFileServerImpl(IAllocator& allocator)
@@ -280,11 +391,20 @@ TCPFileServer::~TCPFileServer()
 }
 
 
-void TCPFileServer::start(const char* base_path, IAllocator& allocator)
+bool TCPFileServer::start(const char* base_path, IAllocator& allocator)
 {
 	m_impl = LUMIX_NEW(allocator, TCPFileServerImpl)(allocator);
 	m_impl->m_task.setBasePath(base_path);
+	// listen before returning, so clients can connect right away
+	if (!m_impl->m_task.listen())
+	{
+		g_log_error.log("Engine") << "TCP file server failed to listen on port " << TCP_FILE_SERVER_PORT;
+		LUMIX_DELETE(allocator, m_impl);
+		m_impl = nullptr;
+		return false;
+	}
 	m_impl->m_task.create("TCP File Server Task");
+	return true;
 }
 
 
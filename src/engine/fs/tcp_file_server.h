@@ -19,7 +19,7 @@ namespace Lumix
 			TCPFileServer();
 			~TCPFileServer();
 
-			void start(const char* base_path, IAllocator& allocator);
+			bool start(const char* base_path, IAllocator& allocator);
 			void stop();
 			const char* getBasePath() const;
 
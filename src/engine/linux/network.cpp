@@ -2,6 +2,12 @@
 #include "engine/iallocator.h"
 #include "engine/string.h"
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
 
 namespace Lumix
 {
@@ -9,42 +15,45 @@ namespace Net
 {
 
 
+static const uintptr INVALID_SOCKET = ~(uintptr)0;
+
+
 TCPAcceptor::TCPAcceptor(IAllocator& allocator)
 	: m_allocator(allocator)
+	, m_socket(INVALID_SOCKET)
 {
 }
 
 
 TCPAcceptor::~TCPAcceptor()
 {
-//	::closesocket(m_socket);
+	if (m_socket != INVALID_SOCKET) ::close((int)m_socket);
 }
 
 
 bool TCPAcceptor::start(const char* ip, u16 port)
 {
-/*	WORD sockVer;
-	WSADATA wsaData;
-	sockVer = 2 | (2 << 8);
-	if (WSAStartup(sockVer, &wsaData) != 0) return false;
+	int socket = ::socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (socket < 0) return false;
 
-	SOCKET socket = ::socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (socket == INVALID_SOCKET) return false;
+	int reuse = 1;
+	::setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
-	SOCKADDR_IN sin;
+	sockaddr_in sin;
 	setMemory(&sin, 0, sizeof(sin));
 	sin.sin_family = AF_INET;
 	sin.sin_port = htons(port);
 	sin.sin_addr.s_addr = ip ? ::inet_addr(ip) : INADDR_ANY;
 
-	int retVal = ::bind(socket, (LPSOCKADDR)&sin, sizeof(sin));
-	if (retVal == SOCKET_ERROR) return false;
+	if (::bind(socket, (sockaddr*)&sin, sizeof(sin)) != 0)
+	{
+		::close(socket);
+		return false;
+	}
 
-	m_socket = socket;
+	m_socket = (uintptr)socket;
 
-	return ::listen(socket, 10) == 0;*/
-	ASSERT(false);
-	return false;
+	return ::listen(socket, 10) == 0;
 }
 
 
@@ -56,126 +65,112 @@ void TCPAcceptor::close(TCPStream* stream)
 
 TCPStream* TCPAcceptor::accept()
 {
-	/*SOCKET socket = ::accept(m_socket, nullptr, nullptr);
-	return LUMIX_NEW(m_allocator, TCPStream)(socket);*/
-	ASSERT(false);
-	return nullptr;
+	int socket = ::accept((int)m_socket, nullptr, nullptr);
+	if (socket < 0) return nullptr;
+
+	int no_delay = 1;
+	::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+	return LUMIX_NEW(m_allocator, TCPStream)((uintptr)socket);
 }
 
 
 TCPConnector::TCPConnector(IAllocator& allocator)
 	: m_allocator(allocator)
-	, m_socket(0)
+	, m_socket(INVALID_SOCKET)
 {
 }
 
 
 TCPConnector::~TCPConnector()
 {
-	//::closesocket(m_socket);
-	ASSERT(false);
 }
 
 
 TCPStream* TCPConnector::connect(const char* ip, u16 port)
 {
-	/*WORD sockVer;
-	WSADATA wsaData;
-	sockVer = 2 | (2 << 8);
-	if (WSAStartup(sockVer, &wsaData) != 0) return nullptr;
-
-	SOCKET socket = ::socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (socket == INVALID_SOCKET) return nullptr;
-
-	SOCKADDR_IN sin;
+	int socket = ::socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (socket < 0) return nullptr;
 
+	sockaddr_in sin;
 	setMemory(&sin, 0, sizeof(sin));
 	sin.sin_family = AF_INET;
 	sin.sin_port = htons(port);
 	sin.sin_addr.s_addr = ip ? ::inet_addr(ip) : INADDR_ANY;
 
-	if (::connect(socket, (LPSOCKADDR)&sin, sizeof(sin)) != 0) return nullptr;
-
-	m_socket = socket;
-	return LUMIX_NEW(m_allocator, TCPStream)(socket);*/
-	ASSERT(false);
-	return nullptr;
+	if (::connect(socket, (sockaddr*)&sin, sizeof(sin)) != 0)
+	{
+		::close(socket);
+		return nullptr;
+	}
+
+	int no_delay = 1;
+	::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+	m_socket = (uintptr)socket;
+	return LUMIX_NEW(m_allocator, TCPStream)((uintptr)socket);
 }
 
+
 void TCPConnector::close(TCPStream* stream)
 {
 	LUMIX_DELETE(m_allocator, stream);
+	m_socket = INVALID_SOCKET;
 }
 
 
 TCPStream::~TCPStream()
 {
-//	::closesocket(m_socket);
-	ASSERT(false);
+	::close((int)m_socket);
 }
 
 
 bool TCPStream::readString(char* string, u32 max_size)
 {
-	/*u32 len = 0;
+	u32 len = 0;
 	bool ret = true;
 	ret &= read(len);
 	ASSERT(len < max_size);
+	if (!ret || len > max_size) return false;
 	ret &= read((void*)string, len);
 
-	return ret;*/
-	ASSERT(false);
-	return false;
+	return ret;
 }
 
 
 bool TCPStream::writeString(const char* string)
 {
-	/*u32 len = (u32)stringLength(string) + 1;
+	u32 len = (u32)stringLength(string) + 1;
 	bool ret = write(len);
 	ret &= write((const void*)string, len);
 
-	return ret;*/
-	ASSERT(false);
-	return false;
+	return ret;
 }
 
 
 bool TCPStream::read(void* buffer, size_t size)
 {
-	/*i32 to_receive = (i32)size;
 	char* ptr = static_cast<char*>(buffer);
-
-	do
+	while (size > 0)
 	{
-		int received = ::recv(m_socket, ptr, to_receive, 0);
+		ssize_t received = ::recv((int)m_socket, ptr, size, 0);
+		if (received <= 0) return false;
 		ptr += received;
-		to_receive -= received;
-		if (received <= 0)
-		{
-			if (WSAGetLastError() == WSAEWOULDBLOCK)
-			{
-				ptr -= received;
-				to_receive += received;
-			}
-			else
-			{
-				return false;
-			}
-		}
-	} while (to_receive > 0);
-	return true;*/
-	ASSERT(false);
-	return false;
+		size -= received;
+	}
+	return true;
 }
 
 
 bool TCPStream::write(const void* buffer, size_t size)
 {
-	/*int send = ::send(m_socket, static_cast<const char*>(buffer), (int)size, 0);
-	return (size_t)send == size;*/
-	ASSERT(false);
-	return false;
+	const char* ptr = static_cast<const char*>(buffer);
+	while (size > 0)
+	{
+		ssize_t sent = ::send((int)m_socket, ptr, size, MSG_NOSIGNAL);
+		if (sent <= 0) return false;
+		ptr += sent;
+		size -= sent;
+	}
+	return true;
 }
 
 
@@ -5,6 +5,7 @@
 #include "engine/matrix.h"
 #include <lua.hpp>
 #include <lauxlib.h> // must be after lua.hpp
+#include <cfloat>
 
 
 namespace Lumix
@@ -465,6 +466,71 @@ inline void checkTableArg(lua_State* L, int index)
 	}
 }
 
+
+// rays are {origin = {x, y, z}, dir = {x, y, z}, max_distance = d, ignored = {entities}}, max_distance
+// and ignored are optional; raises an error unless the argument is an array of rays with nonzero dirs,
+// so it must be called before anything with a destructor is created; returns the number of rays
+// and the number of all their ignored entities in out_ignored_count
+inline int checkRaysArg(lua_State* L, int index, int* out_ignored_count)
+{
+	checkTableArg(L, index);
+	int count = (int)lua_rawlen(L, index);
+	*out_ignored_count = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		lua_rawgeti(L, index, i + 1);
+		bool is_valid = lua_istable(L, -1) != 0;
+		if (is_valid)
+		{
+			lua_getfield(L, -1, "origin");
+			lua_getfield(L, -2, "dir");
+			lua_getfield(L, -3, "ignored");
+			is_valid = isType<Vec3>(L, -3) && isType<Vec3>(L, -2) && (lua_isnil(L, -1) || lua_istable(L, -1)) &&
+					   toType<Vec3>(L, -2).squaredLength() > 0;
+			if (lua_istable(L, -1)) *out_ignored_count += (int)lua_rawlen(L, -1);
+			lua_pop(L, 3);
+		}
+		lua_pop(L, 1);
+		if (!is_valid)
+		{
+			luaL_argerror(L, index, "array of {origin, dir, max_distance, ignored} with nonzero dir expected");
+		}
+	}
+	return count;
+}
+
+
+// i-th ray of an array checked by checkRaysArg, dir is normalized and max_distance is FLT_MAX if it's not set;
+// ignored entities are written to out_ignored, returns their count
+inline int toRay(lua_State* L, int index, int i, Vec3* origin, Vec3* dir, float* max_distance, Entity* out_ignored)
+{
+	lua_rawgeti(L, index, i + 1);
+	lua_getfield(L, -1, "origin");
+	*origin = toType<Vec3>(L, -1);
+	lua_getfield(L, -2, "dir");
+	*dir = toType<Vec3>(L, -1);
+	dir->normalize();
+	lua_getfield(L, -3, "max_distance");
+	*max_distance = lua_isnumber(L, -1) ? (float)lua_tonumber(L, -1) : FLT_MAX;
+	lua_getfield(L, -4, "ignored");
+	int ignored_count = 0;
+	if (lua_istable(L, -1))
+	{
+		for (int j = 0, c = (int)lua_rawlen(L, -1); j < c; ++j)
+		{
+			lua_rawgeti(L, -1, j + 1);
+			if (isType<Entity>(L, -1))
+			{
+				out_ignored[ignored_count] = toType<Entity>(L, -1);
+				++ignored_count;
+			}
+			lua_pop(L, 1);
+		}
+	}
+	lua_pop(L, 5);
+	return ignored_count;
+}
+
 template <class _Ty> struct remove_reference
 {
 	typedef _Ty type;
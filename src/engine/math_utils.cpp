@@ -128,6 +128,24 @@ float getLineSegmentDistance(const Vec3& origin, const Vec3& dir, const Vec3& a,
 }
 
 
+u64 getRaySortKey(const Vec3& origin, const Vec3& dir)
+{
+	static const float CELL_SIZE = 8.0f;
+	u64 octant = (dir.x < 0 ? 1 : 0) | (dir.y < 0 ? 2 : 0) | (dir.z < 0 ? 4 : 0);
+	u64 key = octant << 30;
+	// 10 bits per axis
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		u32 cell = u32(int(floorf((&origin.x)[axis] / CELL_SIZE))) & 0x3ff;
+		for (int bit = 0; bit < 10; ++bit)
+		{
+			key |= u64((cell >> bit) & 1) << (bit * 3 + axis);
+		}
+	}
+	return key;
+}
+
+
 bool getRayTriangleIntersection(const Vec3& origin,
 	const Vec3& dir,
 	const Vec3& p0,
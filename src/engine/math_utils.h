@@ -45,6 +45,9 @@ LUMIX_ENGINE_API bool getSphereTriangleIntersection(const Vec3& center,
 	const Vec3& v0,
 	const Vec3& v1,
 	const Vec3& v2);
+// octant of the direction and Morton code of the origin's cell, similar rays have close keys,
+// so batches of rays sorted by it visit the same parts of acceleration structures one after another
+LUMIX_ENGINE_API u64 getRaySortKey(const Vec3& origin, const Vec3& dir);
 
 template <typename T> LUMIX_FORCE_INLINE void swap(T& a, T& b)
 {
@@ -2,6 +2,7 @@
 #include "engine/array.h"
 #include "engine/log.h"
 #include "engine/profiler.h"
+#include "engine/string.h"
 #include "engine/system.h"
 #include "engine/debug/debug.h"
 #include "engine/engine.h"
@@ -104,6 +105,8 @@ class PluginManagerImpl LUMIX_FINAL : public PluginManager
 
 		IPlugin* load(const char* path) override
 		{
+			StaticString<64> phase_name("Plugin ", path);
+			PROFILE_LOAD_PHASE(phase_name.data);
 			char path_with_ext[MAX_PATH_LENGTH];
 			copyString(path_with_ext, path);
 			#ifdef _WIN32
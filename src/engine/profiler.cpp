@@ -1,6 +1,10 @@
 #include "profiler.h"
+#include "engine/crc32.h"
+#include "engine/fs/os_file.h"
 #include "engine/hash_map.h"
 #include "engine/log.h"
+#include "engine/math_utils.h"
+#include "engine/string.h"
 #include "engine/timer.h"
 #include "engine/mt/sync.h"
 #include "engine/mt/thread.h"
@@ -140,6 +144,11 @@ struct Instance
 		: threads(allocator)
 		, frame_listeners(allocator)
 		, m_mutex(false)
+		, load_phases(allocator)
+		, load_spans(allocator)
+		, load_span_map(allocator)
+		, load_mutex(false)
+		, load_phase_depth(0)
 	{
 		threads.insert(MT::getCurrentThreadID(), &main_thread);
 		timer = Timer::create(allocator);
@@ -162,6 +171,11 @@ struct Instance
 	ThreadData main_thread;
 	Timer* timer;
 	MT::SpinMutex m_mutex;
+	Array<LoadPhase> load_phases;
+	Array<LoadSpan> load_spans;
+	HashMap<u32, int> load_span_map;
+	MT::SpinMutex load_mutex;
+	int load_phase_depth;
 };
 
 
@@ -390,6 +404,159 @@ DelegateList<void()>& getFrameListeners()
 }
 
 
+static const int MAX_LOAD_SPANS = 16 * 1024;
+
+
+void beginLoadPhase(const char* name)
+{
+	MT::SpinLock lock(g_instance.load_mutex);
+	LoadPhase& phase = g_instance.load_phases.emplace();
+	copyString(phase.name, name);
+	phase.start = now();
+	phase.end = 0;
+	phase.depth = g_instance.load_phase_depth;
+	++g_instance.load_phase_depth;
+}
+
+
+void endLoadPhase()
+{
+	MT::SpinLock lock(g_instance.load_mutex);
+	ASSERT(g_instance.load_phase_depth > 0);
+	--g_instance.load_phase_depth;
+	for (int i = g_instance.load_phases.size() - 1; i >= 0; --i)
+	{
+		LoadPhase& phase = g_instance.load_phases[i];
+		if (phase.depth == g_instance.load_phase_depth && phase.end == 0)
+		{
+			phase.end = now();
+			return;
+		}
+	}
+	ASSERT(false);
+}
+
+
+void recordLoadStage(const char* path, LoadStage stage, u64 start, u64 end)
+{
+	u32 hash = crc32(path);
+	MT::SpinLock lock(g_instance.load_mutex);
+	auto iter = g_instance.load_span_map.find(hash);
+	LoadSpan* span;
+	if (iter.isValid())
+	{
+		span = &g_instance.load_spans[iter.value()];
+	}
+	else
+	{
+		if (g_instance.load_spans.size() >= MAX_LOAD_SPANS) return;
+		g_instance.load_span_map.insert(hash, g_instance.load_spans.size());
+		span = &g_instance.load_spans.emplace();
+		copyString(span->path, path);
+		setMemory(span->start, 0, sizeof(span->start));
+		setMemory(span->end, 0, sizeof(span->end));
+	}
+	// keep the first load of each file, reloads would hide it
+	if (span->end[(int)stage] != 0) return;
+	span->start[(int)stage] = start;
+	span->end[(int)stage] = Math::maximum(start + 1, end);
+}
+
+
+void getLoadTimeline(Array<LoadPhase>& phases, Array<LoadSpan>& spans)
+{
+	MT::SpinLock lock(g_instance.load_mutex);
+	phases.resize(g_instance.load_phases.size());
+	if (!phases.empty()) copyMemory(&phases[0], &g_instance.load_phases[0], sizeof(phases[0]) * phases.size());
+	spans.resize(g_instance.load_spans.size());
+	if (!spans.empty()) copyMemory(&spans[0], &g_instance.load_spans[0], sizeof(spans[0]) * spans.size());
+}
+
+
+void clearLoadTimeline()
+{
+	MT::SpinLock lock(g_instance.load_mutex);
+	Array<LoadPhase> open_phases(g_instance.allocator);
+	for (const LoadPhase& phase : g_instance.load_phases)
+	{
+		if (phase.end == 0) open_phases.push(phase);
+	}
+	g_instance.load_phases.clear();
+	for (const LoadPhase& phase : open_phases) g_instance.load_phases.push(phase);
+	g_instance.load_spans.clear();
+	g_instance.load_span_map.clear();
+}
+
+
+float toSeconds(u64 time)
+{
+	return float(time / (double)g_instance.timer->getFrequency());
+}
+
+
+static u64 toMicroseconds(u64 time)
+{
+	return u64(time * 1000000.0 / g_instance.timer->getFrequency());
+}
+
+
+static void writeTraceEvent(FS::OsFile& file, const char* name, int tid, u64 start, u64 end, bool& is_first)
+{
+	char tmp[32];
+	file << (is_first ? "\n" : ",\n") << "{\"name\": \"";
+	for (const char* c = name; *c; ++c)
+	{
+		if (*c == '"' || *c == '\\') file << '\\';
+		file << *c;
+	}
+	file << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << (i32)tid << ", \"ts\": ";
+	toCString(toMicroseconds(start), tmp, lengthOf(tmp));
+	file << tmp << ", \"dur\": ";
+	toCString(toMicroseconds(end - start), tmp, lengthOf(tmp));
+	file << tmp << "}";
+	is_first = false;
+}
+
+
+bool saveLoadTimeline(const char* path)
+{
+	DefaultAllocator allocator;
+	Array<LoadPhase> phases(allocator);
+	Array<LoadSpan> spans(allocator);
+	getLoadTimeline(phases, spans);
+
+	FS::OsFile file;
+	if (!file.open(path, FS::Mode::CREATE_AND_WRITE, allocator)) return false;
+
+	// phases are in thread 0, every load stage has its own thread so spans do not overlap
+	static const char* STAGE_NAMES[] = { "queued", "io", "decode", "finalize" };
+	file << "{\"traceEvents\": [";
+	bool is_first = true;
+	for (int i = 0; i < (int)LoadStage::COUNT; ++i)
+	{
+		file << (is_first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": "
+			 << (i32)(i + 1) << ", \"args\": {\"name\": \"" << STAGE_NAMES[i] << "\"}}";
+		is_first = false;
+	}
+	u64 end = now();
+	for (const LoadPhase& phase : phases)
+	{
+		writeTraceEvent(file, phase.name, 0, phase.start, phase.end ? phase.end : end, is_first);
+	}
+	for (const LoadSpan& span : spans)
+	{
+		for (int i = 0; i < (int)LoadStage::COUNT; ++i)
+		{
+			if (span.end[i] == 0) continue;
+			writeTraceEvent(file, span.path, i + 1, span.start[i], span.end[i], is_first);
+		}
+	}
+	file << "\n]}\n";
+	file.close();
+	return true;
+}
+
+
 } // namespace Lumix
 
 
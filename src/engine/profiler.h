@@ -2,6 +2,7 @@
 
 
 #include "engine/lumix.h"
+#include "engine/array.h"
 #include "engine/delegate_list.h"
 #include "engine/default_allocator.h"
 #include "engine/hash_map.h"
@@ -56,12 +57,62 @@ struct Scope
 };
 
 
+// Load timeline - unlike blocks, it's not reset every frame. It collects named phases of startup
+// and level loads and per file spans of resource loading.
+enum class LoadStage
+{
+	QUEUED,
+	IO,
+	DECODE,
+	FINALIZE,
+
+	COUNT
+};
+
+
+struct LoadPhase
+{
+	char name[64];
+	u64 start;
+	u64 end;
+	int depth;
+};
+
+
+struct LoadSpan
+{
+	char path[MAX_PATH_LENGTH];
+	u64 start[(int)LoadStage::COUNT];
+	u64 end[(int)LoadStage::COUNT];
+};
+
+
+// main thread only
+LUMIX_ENGINE_API void beginLoadPhase(const char* name);
+LUMIX_ENGINE_API void endLoadPhase();
+// can be called from any thread, start and end are from now()
+LUMIX_ENGINE_API void recordLoadStage(const char* path, LoadStage stage, u64 start, u64 end);
+LUMIX_ENGINE_API void getLoadTimeline(Array<LoadPhase>& phases, Array<LoadSpan>& spans);
+LUMIX_ENGINE_API void clearLoadTimeline();
+// Chrome tracing JSON, can be opened in chrome://tracing
+LUMIX_ENGINE_API bool saveLoadTimeline(const char* path);
+LUMIX_ENGINE_API float toSeconds(u64 time);
+
+
+struct LoadPhaseScope
+{
+	explicit LoadPhaseScope(const char* name) { beginLoadPhase(name); }
+	~LoadPhaseScope() { endLoadPhase(); }
+};
+
+
 } // namespace Profiler
 
 
 #define PROFILE_INT(name, x) Lumix::Profiler::record((name), (x));
 #define PROFILE_FUNCTION() Lumix::Profiler::Scope profile_scope(__FUNCTION__);
 #define PROFILE_BLOCK(name) Lumix::Profiler::Scope profile_scope(name);
+#define PROFILE_LOAD_PHASE(name) Lumix::Profiler::LoadPhaseScope profile_load_phase_scope(name);
 
 
 } // namespace Lumix
@@ -0,0 +1,228 @@
+#include "engine/radix_sort.h"
+#include "engine/math_utils.h"
+#include "engine/profiler.h"
+#include "engine/string.h"
+#include "engine/mtjd/generic_job.h"
+#include "engine/mtjd/group.h"
+#include "engine/mtjd/manager.h"
+
+
+namespace Lumix
+{
+
+
+static const int RADIX_BITS = 8;
+static const int RADIX_SIZE = 1 << RADIX_BITS;
+static const int RADIX_PASSES = 64 / RADIX_BITS;
+// smaller inputs are sorted faster on one thread than it takes to sync the jobs
+static const int MIN_PARALLEL_SORT_SIZE = 64 * 1024;
+static const int MAX_SORT_JOBS = 16;
+
+
+typedef u32 RadixHistogram[RADIX_SIZE];
+
+
+static LUMIX_FORCE_INLINE int getDigit(u64 key, int pass)
+{
+	return int(key >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1);
+}
+
+
+// histograms of all digits, they do not depend on the order of keys so they are computed in one pass
+static void computeHistograms(const u64* keys, int size, RadixHistogram* histograms)
+{
+	setMemory(histograms, 0, sizeof(RadixHistogram) * RADIX_PASSES);
+	for (int i = 0; i < size; ++i)
+	{
+		u64 key = keys[i];
+		for (int pass = 0; pass < RADIX_PASSES; ++pass)
+		{
+			++histograms[pass][getDigit(key, pass)];
+		}
+	}
+}
+
+
+static bool isPassNeeded(const u64* keys, int size, const RadixHistogram& histogram, int pass)
+{
+	return histogram[getDigit(keys[0], pass)] != (u32)size;
+}
+
+
+static void scatter(const u64* LUMIX_RESTRICT src_keys,
+	const u32* LUMIX_RESTRICT src_values,
+	u64* LUMIX_RESTRICT dst_keys,
+	u32* LUMIX_RESTRICT dst_values,
+	int from,
+	int to,
+	int pass,
+	u32* LUMIX_RESTRICT offsets)
+{
+	for (int i = from; i < to; ++i)
+	{
+		u64 key = src_keys[i];
+		u32 dst = offsets[getDigit(key, pass)]++;
+		dst_keys[dst] = key;
+		dst_values[dst] = src_values[i];
+	}
+}
+
+
+template <typename T>
+static void runJobs(MTJD::Manager& manager, MTJD::Group& sync_point, IAllocator& allocator, int count, T& function)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		MTJD::Job* job = MTJD::makeJob(manager, [&function, i]() { function(i); }, allocator);
+		job->addDependency(&sync_point);
+		manager.schedule(job);
+	}
+	sync_point.sync();
+}
+
+
+void radixSort(u64* keys, u32* values, u64* tmp_keys, u32* tmp_values, int size)
+{
+	PROFILE_FUNCTION();
+	if (size < 2) return;
+
+	RadixHistogram histograms[RADIX_PASSES];
+	computeHistograms(keys, size, histograms);
+
+	u64* src_keys = keys;
+	u32* src_values = values;
+	u64* dst_keys = tmp_keys;
+	u32* dst_values = tmp_values;
+	for (int pass = 0; pass < RADIX_PASSES; ++pass)
+	{
+		if (!isPassNeeded(src_keys, size, histograms[pass], pass)) continue;
+
+		u32 offsets[RADIX_SIZE];
+		u32 offset = 0;
+		for (int i = 0; i < RADIX_SIZE; ++i)
+		{
+			offsets[i] = offset;
+			offset += histograms[pass][i];
+		}
+		scatter(src_keys, src_values, dst_keys, dst_values, 0, size, pass, offsets);
+
+		u64* tmp_k = src_keys;
+		src_keys = dst_keys;
+		dst_keys = tmp_k;
+		u32* tmp_v = src_values;
+		src_values = dst_values;
+		dst_values = tmp_v;
+	}
+
+	if (src_keys != keys)
+	{
+		copyMemory(keys, src_keys, sizeof(keys[0]) * size);
+		copyMemory(values, src_values, sizeof(values[0]) * size);
+	}
+}
+
+
+void radixSort(u64* keys,
+	u32* values,
+	u64* tmp_keys,
+	u32* tmp_values,
+	int size,
+	MTJD::Manager& mtjd_manager,
+	IAllocator& allocator)
+{
+	int job_count = Math::minimum((int)mtjd_manager.getCpuThreadsCount(), MAX_SORT_JOBS);
+	if (size < MIN_PARALLEL_SORT_SIZE || job_count < 2)
+	{
+		radixSort(keys, values, tmp_keys, tmp_values, size);
+		return;
+	}
+
+	PROFILE_FUNCTION();
+	MTJD::Group sync_point(true, allocator);
+	int chunk_size = (size + job_count - 1) / job_count;
+	auto getChunkEnd = [chunk_size, size](int job) { return Math::minimum(size, (job + 1) * chunk_size); };
+
+	RadixHistogram* job_histograms =
+		(RadixHistogram*)allocator.allocate(sizeof(RadixHistogram) * RADIX_PASSES * job_count);
+	auto histograms_job = [&](int job) {
+		computeHistograms(
+			keys + job * chunk_size, getChunkEnd(job) - job * chunk_size, job_histograms + job * RADIX_PASSES);
+	};
+	runJobs(mtjd_manager, sync_point, allocator, job_count, histograms_job);
+
+	RadixHistogram histograms[RADIX_PASSES];
+	setMemory(histograms, 0, sizeof(histograms));
+	for (int job = 0; job < job_count; ++job)
+	{
+		for (int pass = 0; pass < RADIX_PASSES; ++pass)
+		{
+			for (int i = 0; i < RADIX_SIZE; ++i)
+			{
+				histograms[pass][i] += job_histograms[job * RADIX_PASSES + pass][i];
+			}
+		}
+	}
+	allocator.deallocate(job_histograms);
+
+	u64* src_keys = keys;
+	u32* src_values = values;
+	u64* dst_keys = tmp_keys;
+	u32* dst_values = tmp_values;
+	RadixHistogram job_offsets[MAX_SORT_JOBS];
+	for (int pass = 0; pass < RADIX_PASSES; ++pass)
+	{
+		if (!isPassNeeded(src_keys, size, histograms[pass], pass)) continue;
+
+		// chunks are not sorted by previous passes the same way as the whole array,
+		// so histograms of chunks are computed again for each pass
+		auto pass_histogram_job = [&](int job) {
+			RadixHistogram& histogram = job_offsets[job];
+			setMemory(histogram, 0, sizeof(histogram));
+			for (int i = job * chunk_size, end = getChunkEnd(job); i < end; ++i)
+			{
+				++histogram[getDigit(src_keys[i], pass)];
+			}
+		};
+		runJobs(mtjd_manager, sync_point, allocator, job_count, pass_histogram_job);
+
+		// keys with the same digit are placed by chunks in order, which keeps the sort stable
+		u32 offset = 0;
+		for (int i = 0; i < RADIX_SIZE; ++i)
+		{
+			for (int job = 0; job < job_count; ++job)
+			{
+				u32 count = job_offsets[job][i];
+				job_offsets[job][i] = offset;
+				offset += count;
+			}
+		}
+
+		auto scatter_job = [&](int job) {
+			scatter(src_keys,
+				src_values,
+				dst_keys,
+				dst_values,
+				job * chunk_size,
+				getChunkEnd(job),
+				pass,
+				job_offsets[job]);
+		};
+		runJobs(mtjd_manager, sync_point, allocator, job_count, scatter_job);
+
+		u64* tmp_k = src_keys;
+		src_keys = dst_keys;
+		dst_keys = tmp_k;
+		u32* tmp_v = src_values;
+		src_values = dst_values;
+		dst_values = tmp_v;
+	}
+
+	if (src_keys != keys)
+	{
+		copyMemory(keys, src_keys, sizeof(keys[0]) * size);
+		copyMemory(values, src_values, sizeof(values[0]) * size);
+	}
+}
+
+
+} // namespace Lumix
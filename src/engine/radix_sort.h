@@ -0,0 +1,32 @@
+#pragma once
+
+
+#include "engine/lumix.h"
+
+
+namespace Lumix
+{
+
+
+class IAllocator;
+namespace MTJD
+{
+class Manager;
+}
+
+
+// stable LSD radix sort of keys together with their values, the result is in `keys` and `values`;
+// `tmp_keys` and `tmp_values` are scratch buffers of the same size, bytes which are the same in all keys
+// are skipped, so keys which do not use all 64 bits are cheaper to sort
+LUMIX_ENGINE_API void radixSort(u64* keys, u32* values, u64* tmp_keys, u32* tmp_values, int size);
+// large inputs are sorted on all worker threads, small ones the same way as above
+LUMIX_ENGINE_API void radixSort(u64* keys,
+	u32* values,
+	u64* tmp_keys,
+	u32* tmp_values,
+	int size,
+	MTJD::Manager& mtjd_manager,
+	IAllocator& allocator);
+
+
+} // namespace Lumix
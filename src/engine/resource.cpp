@@ -4,6 +4,7 @@
 #include "engine/log.h"
 #include "engine/lumix.h"
 #include "engine/path.h"
+#include "engine/profiler.h"
 #include "engine/resource.h"
 #include "engine/resource_manager.h"
 #include "engine/resource_manager_base.h"
@@ -31,6 +32,14 @@ Resource::Resource(const Path& path, ResourceManagerBase& resource_manager, IAll
 	, m_cb(allocator)
 	, m_resource_manager(resource_manager)
 	, m_async_op(FS::FileSystem::INVALID_ASYNC)
+	, m_async_priority(FS::FileSystem::Priority::NORMAL)
+	, m_decoding_file(nullptr)
+	, m_is_decoded(false)
+	, m_is_decode_canceled(false)
+	, m_resident_size(0)
+	, m_cache_prev(nullptr)
+	, m_cache_next(nullptr)
+	, m_is_cached(false)
 {
 }
 
@@ -86,10 +95,23 @@ void Resource::fileLoaded(FS::IFile& file, bool success)
 		return;
 	}
 
+	if (hasDecodePhase())
+	{
+		FS::FileSystem& fs = m_resource_manager.getOwner().getFileSystem();
+		fs.keepOpen(file);
+		m_decoding_file = &file;
+		m_is_decode_canceled = false;
+		m_resource_manager.getOwner().decodeAsync(*this);
+		return;
+	}
+
+	u64 load_start = Profiler::now();
 	if (!load(file))
 	{
 		++m_failed_dep_count;
 	}
+	Profiler::recordLoadStage(m_path.c_str(), Profiler::LoadStage::FINALIZE, load_start, Profiler::now());
+	updateResidentSize();
 
 	--m_empty_dep_count;
 	checkState();
@@ -97,8 +119,51 @@ void Resource::fileLoaded(FS::IFile& file, bool success)
 }
 
 
+void Resource::onDecoded()
+{
+	ASSERT(m_decoding_file);
+	FS::FileSystem& fs = m_resource_manager.getOwner().getFileSystem();
+	size_t file_size = m_decoding_file->size();
+	fs.closeAsync(*m_decoding_file);
+	m_decoding_file = nullptr;
+
+	if (m_is_decode_canceled)
+	{
+		// unload was postponed because the decode job was writing into the staging data
+		unload();
+		m_size = 0;
+		updateResidentSize();
+		if (m_desired_state == State::READY)
+		{
+			m_desired_state = State::EMPTY;
+			doLoad();
+		}
+		return;
+	}
+
+	u64 finalize_start = Profiler::now();
+	bool is_finalized = m_is_decoded && finalize();
+	Profiler::recordLoadStage(m_path.c_str(), Profiler::LoadStage::FINALIZE, finalize_start, Profiler::now());
+	if (!is_finalized)
+	{
+		g_log_warning.log("Core") << "Could not load " << getPath().c_str();
+		++m_failed_dep_count;
+	}
+	else if (m_size == 0)
+	{
+		m_size = file_size;
+	}
+	updateResidentSize();
+
+	--m_empty_dep_count;
+	checkState();
+}
+
+
 void Resource::doUnload()
 {
+	// before canceling, so fileLoaded called by cancelAsync does not take it as a failure
+	m_desired_state = State::EMPTY;
 	if (m_async_op != FS::FileSystem::INVALID_ASYNC)
 	{
 		FS::FileSystem& fs = m_resource_manager.getOwner().getFileSystem();
@@ -106,17 +171,32 @@ void Resource::doUnload()
 		m_async_op = FS::FileSystem::INVALID_ASYNC;
 	}
 
-	m_desired_state = State::EMPTY;
-	unload();
+	if (isDecoding())
+	{
+		m_is_decode_canceled = true;
+	}
+	else
+	{
+		unload();
+	}
 	ASSERT(m_empty_dep_count <= 1);
 
 	m_size = 0;
+	updateResidentSize();
 	m_empty_dep_count = 1;
 	m_failed_dep_count = 0;
 	checkState();
 }
 
 
+void Resource::updateResidentSize()
+{
+	m_resource_manager.m_resident_bytes -= m_resident_size;
+	m_resource_manager.m_resident_bytes += m_size;
+	m_resident_size = m_size;
+}
+
+
 void Resource::onCreated(State state)
 {
 	ASSERT(m_empty_dep_count == 1);
@@ -126,19 +206,32 @@ void Resource::onCreated(State state)
 	m_desired_state = State::READY;
 	m_failed_dep_count = state == State::FAILURE ? 1 : 0;
 	m_empty_dep_count = 0;
+	updateResidentSize();
 }
 
 
-void Resource::doLoad()
+void Resource::doLoad(FS::FileSystem::Priority priority)
 {
-	if (m_desired_state == State::READY) return;
+	FS::FileSystem& fs = m_resource_manager.getOwner().getFileSystem();
+	if (m_desired_state == State::READY)
+	{
+		// e.g. a prefetched resource is requested by the level itself
+		if (m_async_op != FS::FileSystem::INVALID_ASYNC && priority < m_async_priority)
+		{
+			m_async_priority = priority;
+			fs.setAsyncPriority(m_async_op, priority);
+		}
+		return;
+	}
 	m_desired_state = State::READY;
 
 	if (m_async_op != FS::FileSystem::INVALID_ASYNC) return;
-	FS::FileSystem& fs = m_resource_manager.getOwner().getFileSystem();
+	// the resource is reloaded from onDecoded
+	if (isDecoding()) return;
 	FS::ReadCallback cb;
 	cb.bind<Resource, &Resource::fileLoaded>(this);
-	m_async_op = fs.openAsync(fs.getDefaultDevice(), m_path, FS::Mode::OPEN_AND_READ, cb);
+	m_async_priority = priority;
+	m_async_op = fs.openAsync(fs.getDefaultDevice(), m_path, FS::Mode::OPEN_AND_READ, cb, priority);
 }
 
 
@@ -29,6 +29,7 @@ const ResourceType INVALID_RESOURCE_TYPE("");
 class LUMIX_ENGINE_API Resource
 {
 public:
+	friend class ResourceManager;
 	friend class ResourceManagerBase;
 
 	enum class State : u32
@@ -67,10 +68,21 @@ protected:
 
 	virtual void onBeforeReady() {}
 	virtual void unload(void) = 0;
-	virtual bool load(FS::IFile& file) = 0;
+	virtual bool load(FS::IFile& file) { return decode(file) && finalize(); }
+
+	// Resources returning true from hasDecodePhase are loaded in two phases instead of load().
+	// decode() runs on a worker thread and must touch only the resource's own staging data,
+	// finalize() runs on the main thread and creates GPU objects and dependencies.
+	// unload() must release the staging data too.
+	virtual bool hasDecodePhase() const { return false; }
+	virtual bool decode(FS::IFile& file) { return false; }
+	virtual bool finalize() { return true; }
 
 	void onCreated(State state);
 	void doUnload();
+	// must be called on the main thread whenever m_size changes
+	void updateResidentSize();
+	bool isDecoding() const { return m_decoding_file != nullptr; }
 
 	void addDependency(Resource& dependent_resource);
 	void removeDependency(Resource& dependent_resource);
@@ -85,8 +97,9 @@ protected:
 	void checkState();
 
 private:
-	void doLoad();
+	void doLoad(FS::FileSystem::Priority priority = FS::FileSystem::Priority::NORMAL);
 	void fileLoaded(FS::IFile& file, bool success);
+	void onDecoded();
 	void onStateChanged(State old_state, State new_state, Resource&);
 	u32 addRef(void) { return ++m_ref_count; }
 	u32 remRef(void) { return --m_ref_count; }
@@ -101,6 +114,16 @@ private:
 	u16 m_failed_dep_count;
 	State m_current_state;
 	u32 m_async_op;
+	FS::FileSystem::Priority m_async_priority;
+	FS::IFile* m_decoding_file;
+	bool m_is_decoded;
+	bool m_is_decode_canceled;
+	// m_size as counted in the manager's resident bytes
+	size_t m_resident_size;
+	// unreferenced resources kept loaded by the manager are in a list, the least recently used first
+	Resource* m_cache_prev;
+	Resource* m_cache_next;
+	bool m_is_cached;
 }; // class Resource
 
 
@@ -1,15 +1,71 @@
 #include "engine/lumix.h"
+#include "engine/fs/file_system.h"
+#include "engine/log.h"
+#include "engine/mt/atomic.h"
+#include "engine/mt/thread.h"
+#include "engine/mtjd/job.h"
+#include "engine/mtjd/manager.h"
 #include "engine/path.h"
+#include "engine/profiler.h"
 #include "engine/resource.h"
 #include "engine/resource_manager.h"
 #include "engine/resource_manager_base.h"
+#include "engine/timer.h"
+#include <cfloat>
 
 namespace Lumix
 {
+	struct PrefetchManifestHeader
+	{
+		static const u32 MAGIC = 0x5f4c4650; // == '_LFP'
+		static const u32 VERSION = 0;
+
+		u32 magic;
+		u32 version;
+		u32 count;
+	};
+
+
+	class DecodeJob LUMIX_FINAL : public MTJD::Job
+	{
+	public:
+		DecodeJob(Resource& resource, ResourceManager& owner, MTJD::Manager& manager, IAllocator& allocator)
+			: Job(Job::AUTO_DESTROY, MTJD::Priority::Low, manager, allocator, allocator)
+			, m_resource(resource)
+			, m_owner(owner)
+		{
+			setJobName("DecodeJob");
+		}
+
+		void execute() override
+		{
+			PROFILE_BLOCK("decode");
+			m_owner.onDecoded(m_resource);
+		}
+
+	private:
+		Resource& m_resource;
+		ResourceManager& m_owner;
+	};
+
+
 	ResourceManager::ResourceManager(IAllocator& allocator) 
 		: m_resource_managers(allocator)
 		, m_allocator(allocator)
 		, m_file_system(nullptr)
+		, m_mtjd_manager(nullptr)
+		, m_timer(nullptr)
+		, m_decoded(allocator)
+		, m_to_finalize(allocator)
+		, m_decoded_mutex(false)
+		, m_decoding_count(0)
+		, m_finalize_budget(0.002f)
+		, m_recorded(allocator)
+		, m_recorded_map(allocator)
+		, m_prefetched(allocator)
+		, m_is_recording(false)
+		, m_is_issuing_prefetch(false)
+		, m_is_prefetch_recording_enabled(false)
 	{
 	}
 
@@ -17,15 +73,202 @@ namespace Lumix
 	{
 	}
 
-	void ResourceManager::create(FS::FileSystem& fs)
+	void ResourceManager::create(FS::FileSystem& fs, MTJD::Manager& mtjd_manager)
 	{
 		m_file_system = &fs;
+		m_mtjd_manager = &mtjd_manager;
+		m_timer = Timer::create(m_allocator);
 	}
 
 	void ResourceManager::destroy()
 	{
+		cancelPrefetch();
+		flush();
+		if (m_timer) Timer::destroy(m_timer);
+		m_timer = nullptr;
+	}
+
+	void ResourceManager::decodeAsync(Resource& resource)
+	{
+		ASSERT(resource.m_decoding_file);
+		MT::atomicIncrement(&m_decoding_count);
+		auto* job = LUMIX_NEW(m_allocator, DecodeJob)(
+			resource, *this, *m_mtjd_manager, m_allocator);
+		m_mtjd_manager->schedule(job);
+	}
+
+	// worker thread
+	void ResourceManager::onDecoded(Resource& resource)
+	{
+		u64 decode_start = Profiler::now();
+		resource.m_is_decoded = resource.decode(*resource.m_decoding_file);
+		Profiler::recordLoadStage(
+			resource.getPath().c_str(), Profiler::LoadStage::DECODE, decode_start, Profiler::now());
+
+		MT::SpinLock lock(m_decoded_mutex);
+		m_decoded.push(&resource);
+		MT::atomicDecrement(&m_decoding_count);
+	}
+
+	void ResourceManager::update()
+	{
+		PROFILE_FUNCTION();
+		{
+			MT::SpinLock lock(m_decoded_mutex);
+			for (Resource* res : m_decoded) m_to_finalize.push(res);
+			m_decoded.clear();
+		}
+
+		// finalize at least one resource per frame, so loading always progresses
+		m_timer->tick();
+		int finalized = 0;
+		while (finalized < m_to_finalize.size())
+		{
+			m_to_finalize[finalized]->onDecoded();
+			++finalized;
+			if (m_timer->getTimeSinceTick() > m_finalize_budget) break;
+		}
+		// the finalized resources are a prefix, the rest is moved to the front at once
+		int remaining = m_to_finalize.size() - finalized;
+		if (finalized > 0 && remaining > 0)
+		{
+			moveMemory(&m_to_finalize[0], &m_to_finalize[finalized], remaining * sizeof(m_to_finalize[0]));
+		}
+		m_to_finalize.resize(remaining);
+		PROFILE_INT("finalized resources", finalized);
+		PROFILE_INT("resources waiting for finalize", m_to_finalize.size());
+
+		for (auto* manager : m_resource_managers)
+		{
+			manager->update();
+		}
+
+		if (m_is_recording && !hasWork() && !m_file_system->hasWork()) endPrefetch();
+	}
+
+	bool ResourceManager::hasWork() const
+	{
+		if (m_decoding_count > 0 || !m_to_finalize.empty()) return true;
+		MT::SpinLock lock(m_decoded_mutex);
+		return !m_decoded.empty();
+	}
+
+	void ResourceManager::flush()
+	{
+		if (!m_timer) return;
+		float budget = m_finalize_budget;
+		m_finalize_budget = FLT_MAX;
+		while (hasWork())
+		{
+			if (m_decoding_count > 0) MT::yield();
+			update();
+		}
+		m_finalize_budget = budget;
 	}
 	
+	void ResourceManager::beginPrefetch(const Path& manifest_path)
+	{
+		PROFILE_FUNCTION();
+		cancelPrefetch();
+		m_manifest_path = manifest_path;
+		m_is_recording = true;
+
+		FS::IFile* file = m_file_system->open(m_file_system->getDefaultDevice(), manifest_path, FS::Mode::OPEN_AND_READ);
+		if (!file) return;
+
+		PrefetchManifestHeader header;
+		if (!file->read(&header, sizeof(header)) || header.magic != PrefetchManifestHeader::MAGIC ||
+			header.version != PrefetchManifestHeader::VERSION)
+		{
+			g_log_warning.log("Engine") << "Invalid prefetch manifest " << manifest_path;
+			m_file_system->close(*file);
+			return;
+		}
+
+		// requests must not be recorded, otherwise stale entries would stay in the manifest forever
+		m_is_issuing_prefetch = true;
+		for (u32 i = 0; i < header.count; ++i)
+		{
+			u32 type;
+			u32 len;
+			char path[MAX_PATH_LENGTH];
+			if (!file->read(&type, sizeof(type)) || !file->read(&len, sizeof(len))) break;
+			if (len >= sizeof(path) || !file->read(path, len)) break;
+			path[len] = '\0';
+
+			auto iter = m_resource_managers.find(type);
+			if (iter == m_resource_managers.end()) continue;
+			// requests of the level itself are served first, they raise the priority of their prefetches
+			m_prefetched.push(iter.value()->load(Path(path), FS::FileSystem::Priority::LOW));
+		}
+		m_is_issuing_prefetch = false;
+		m_file_system->close(*file);
+		PROFILE_INT("prefetched resources", m_prefetched.size());
+	}
+
+	void ResourceManager::recordLoad(u32 type, const Path& path)
+	{
+		if (!m_is_recording || m_is_issuing_prefetch || !m_is_prefetch_recording_enabled) return;
+		if (m_recorded_map.find(path.getHash()) != m_recorded_map.end()) return;
+
+		m_recorded_map.insert(path.getHash(), m_recorded.size());
+		PrefetchEntry& entry = m_recorded.emplace();
+		entry.type = type;
+		entry.path = path;
+	}
+
+	void ResourceManager::endPrefetch()
+	{
+		g_log_info.log("Engine") << "Level load finished, " << m_prefetched.size() << " resources prefetched, "
+								 << m_recorded.size() << " recorded";
+		if (m_is_prefetch_recording_enabled) saveManifest();
+		releasePrefetched();
+	}
+
+	void ResourceManager::cancelPrefetch()
+	{
+		releasePrefetched();
+	}
+
+	void ResourceManager::saveManifest()
+	{
+		if (m_recorded.empty()) return;
+
+		FS::IFile* file =
+			m_file_system->open(m_file_system->getDefaultDevice(), m_manifest_path, FS::Mode::CREATE_AND_WRITE);
+		if (!file)
+		{
+			g_log_warning.log("Engine") << "Could not save prefetch manifest " << m_manifest_path;
+			return;
+		}
+
+		PrefetchManifestHeader header;
+		header.magic = PrefetchManifestHeader::MAGIC;
+		header.version = PrefetchManifestHeader::VERSION;
+		header.count = m_recorded.size();
+		file->write(&header, sizeof(header));
+		for (const PrefetchEntry& entry : m_recorded)
+		{
+			u32 len = entry.path.length();
+			file->write(&entry.type, sizeof(entry.type));
+			file->write(&len, sizeof(len));
+			file->write(entry.path.c_str(), len);
+		}
+		m_file_system->close(*file);
+	}
+
+	void ResourceManager::releasePrefetched()
+	{
+		for (Resource* resource : m_prefetched)
+		{
+			resource->getResourceManager().unload(*resource);
+		}
+		m_prefetched.clear();
+		m_recorded.clear();
+		m_recorded_map.clear();
+		m_is_recording = false;
+	}
+
 	ResourceManagerBase* ResourceManager::get(ResourceType type)
 	{
 		return m_resource_managers[type.type]; 
@@ -1,16 +1,19 @@
 #pragma once
 
 
+#include "engine/array.h"
 #include "engine/hash_map.h"
+#include "engine/mt/sync.h"
+#include "engine/path.h"
 
 
 namespace Lumix
 {
 
 
-class Path;
 class Resource;
 struct ResourceType;
+class Timer;
 
 
 namespace FS
@@ -19,6 +22,12 @@ class FileSystem;
 }
 
 
+namespace MTJD
+{
+class Manager;
+}
+
+
 class ResourceManagerBase;
 
 
@@ -30,8 +39,11 @@ public:
 	explicit ResourceManager(IAllocator& allocator);
 	~ResourceManager();
 
-	void create(FS::FileSystem& fs);
+	void create(FS::FileSystem& fs, MTJD::Manager& mtjd_manager);
 	void destroy();
+	void update();
+	bool hasWork() const;
+	void flush();
 
 	IAllocator& getAllocator() { return m_allocator; }
 	ResourceManagerBase* get(ResourceType type);
@@ -44,11 +56,51 @@ public:
 	void enableUnload(bool enable);
 
 	FS::FileSystem& getFileSystem() { return *m_file_system; }
+	void decodeAsync(Resource& resource);
+	void onDecoded(Resource& resource);
+	void setFinalizeBudget(float seconds) { m_finalize_budget = seconds; }
+	float getFinalizeBudget() const { return m_finalize_budget; }
+
+	// Requests all resources listed in the manifest at once, instead of letting them be discovered
+	// one dependency level at a time. Prefetched resources are released when all loading finishes.
+	// If recording is enabled, resources loaded until then are saved as the new manifest.
+	void beginPrefetch(const Path& manifest_path);
+	// only the editor and development builds record manifests, shipped data can be read-only
+	void enablePrefetchRecording(bool enable) { m_is_prefetch_recording_enabled = enable; }
+	bool isPrefetchRecordingEnabled() const { return m_is_prefetch_recording_enabled; }
+	void cancelPrefetch();
+	bool isPrefetching() const { return m_is_recording; }
+	void recordLoad(u32 type, const Path& path);
+
+private:
+	struct PrefetchEntry
+	{
+		u32 type;
+		Path path;
+	};
+
+	void endPrefetch();
+	void saveManifest();
+	void releasePrefetched();
 
 private:
 	IAllocator& m_allocator;
 	ResourceManagerTable m_resource_managers;
 	FS::FileSystem* m_file_system;
+	MTJD::Manager* m_mtjd_manager;
+	Timer* m_timer;
+	Array<Resource*> m_decoded;
+	Array<Resource*> m_to_finalize;
+	mutable MT::SpinMutex m_decoded_mutex;
+	volatile i32 m_decoding_count;
+	float m_finalize_budget;
+	Path m_manifest_path;
+	Array<PrefetchEntry> m_recorded;
+	HashMap<u32, int> m_recorded_map;
+	Array<Resource*> m_prefetched;
+	bool m_is_recording;
+	bool m_is_issuing_prefetch;
+	bool m_is_prefetch_recording_enabled;
 };
 
 
@@ -14,10 +14,19 @@ namespace Lumix
 	{
 		owner.add(type, this);
 		m_owner = &owner;
+		m_type = type.type;
 	}
 
 	void ResourceManagerBase::destroy(void)
 	{
+		if (m_owner) m_owner->flush();
+		while (m_cache_head)
+		{
+			Resource* resource = m_cache_head;
+			removeFromCache(*resource);
+			resource->doUnload();
+		}
+
 		for (auto iter = m_resources.begin(), end = m_resources.end(); iter != end; ++iter)
 		{
 			Resource* resource = iter.value();
@@ -28,6 +37,7 @@ namespace Lumix
 			destroyResource(*resource);
 		}
 		m_resources.clear();
+		m_resident_bytes = 0;
 	}
 
 	Resource* ResourceManagerBase::get(const Path& path)
@@ -42,7 +52,7 @@ namespace Lumix
 		return nullptr;
 	}
 
-	Resource* ResourceManagerBase::load(const Path& path)
+	Resource* ResourceManagerBase::load(const Path& path, FS::FileSystem::Priority priority)
 	{
 		Resource* resource = get(path);
 
@@ -52,12 +62,7 @@ namespace Lumix
 			m_resources.insert(path.getHash(), resource);
 		}
 		
-		if(resource->isEmpty())
-		{
-			resource->doLoad();
-		}
-
-		resource->addRef();
+		load(*resource, priority);
 		return resource;
 	}
 
@@ -68,21 +73,28 @@ namespace Lumix
 		Array<Resource*> to_remove(m_allocator);
 		for (auto* i : m_resources)
 		{
-			if (i->getRefCount() == 0) to_remove.push(i);
+			if (i->getRefCount() == 0 && !i->isDecoding()) to_remove.push(i);
 		}
 
 		for (auto* i : to_remove)
 		{
+			if (removeFromCache(*i)) i->doUnload();
 			m_resources.erase(i->getPath().getHash());
 			destroyResource(*i);
 		}
 	}
 
-	void ResourceManagerBase::load(Resource& resource)
+	void ResourceManagerBase::load(Resource& resource, FS::FileSystem::Priority priority)
 	{
-		if(resource.isEmpty())
+		if (m_owner) m_owner->recordLoad(m_type, resource.getPath());
+		if (resource.getRefCount() == 0 && removeFromCache(resource))
+		{
+			++m_hits;
+		}
+		else if(resource.isEmpty())
 		{
-			resource.doLoad();
+			++m_misses;
+			resource.doLoad(priority);
 		}
 
 		resource.addRef();
@@ -100,7 +112,15 @@ namespace Lumix
 		ASSERT(new_ref_count >= 0);
 		if(new_ref_count == 0 && m_is_unload_enabled)
 		{
-			resource.doUnload();
+			if (m_budget > 0 && resource.isReady())
+			{
+				// evicted in update() if we are over budget
+				addToCache(resource);
+			}
+			else
+			{
+				resource.doUnload();
+			}
 		}
 	}
 
@@ -123,11 +143,78 @@ namespace Lumix
 
 		for (auto* resource : m_resources)
 		{
-			if (resource->getRefCount() == 0)
+			// cached resources are left to evict()
+			if (resource->getRefCount() == 0 && !resource->m_is_cached)
 			{
 				resource->doUnload();
 			}
 		}
+		evict();
+	}
+
+	void ResourceManagerBase::update()
+	{
+		if (!m_cache_head) return;
+		evict();
+	}
+
+	void ResourceManagerBase::setBudget(u64 budget)
+	{
+		m_budget = budget;
+		evict();
+	}
+
+	void ResourceManagerBase::addToCache(Resource& resource)
+	{
+		ASSERT(!resource.m_is_cached);
+		resource.m_is_cached = true;
+		resource.m_cache_prev = m_cache_tail;
+		resource.m_cache_next = nullptr;
+		if (m_cache_tail) m_cache_tail->m_cache_next = &resource;
+		else m_cache_head = &resource;
+		m_cache_tail = &resource;
+		++m_cached_count;
+	}
+
+	bool ResourceManagerBase::removeFromCache(Resource& resource)
+	{
+		if (!resource.m_is_cached) return false;
+		if (resource.m_cache_prev) resource.m_cache_prev->m_cache_next = resource.m_cache_next;
+		else m_cache_head = resource.m_cache_next;
+		if (resource.m_cache_next) resource.m_cache_next->m_cache_prev = resource.m_cache_prev;
+		else m_cache_tail = resource.m_cache_prev;
+		resource.m_cache_prev = resource.m_cache_next = nullptr;
+		resource.m_is_cached = false;
+		--m_cached_count;
+		return true;
+	}
+
+	void ResourceManagerBase::evict()
+	{
+		while (m_cache_head && (m_budget == 0 || m_resident_bytes > m_budget))
+		{
+			Resource* resource = m_cache_head;
+			removeFromCache(*resource);
+			resource->doUnload();
+			++m_evictions;
+		}
+	}
+
+	ResourceManagerBase::Stats ResourceManagerBase::getStats() const
+	{
+		Stats stats;
+		stats.resident_bytes = m_resident_bytes;
+		stats.cached_bytes = 0;
+		for (Resource* resource = m_cache_head; resource; resource = resource->m_cache_next)
+		{
+			stats.cached_bytes += resource->size();
+		}
+		stats.budget = m_budget;
+		stats.cached_count = m_cached_count;
+		stats.hits = m_hits;
+		stats.misses = m_misses;
+		stats.evictions = m_evictions;
+		return stats;
 	}
 
 	ResourceManagerBase::ResourceManagerBase(IAllocator& allocator)
@@ -135,7 +222,16 @@ namespace Lumix
 		, m_resources(allocator)
 		, m_allocator(allocator)
 		, m_owner(nullptr)
+		, m_type(0)
 		, m_is_unload_enabled(true)
+		, m_budget(0)
+		, m_resident_bytes(0)
+		, m_cache_head(nullptr)
+		, m_cache_tail(nullptr)
+		, m_cached_count(0)
+		, m_hits(0)
+		, m_misses(0)
+		, m_evictions(0)
 	{ }
 
 	ResourceManagerBase::~ResourceManagerBase()
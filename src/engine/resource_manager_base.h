@@ -1,6 +1,8 @@
 #pragma once
 
 
+#include "engine/array.h"
+#include "engine/fs/file_system.h"
 #include "engine/hash_map.h"
 
 
@@ -8,12 +10,6 @@ namespace Lumix
 {
 
 
-namespace FS
-{
-class FileSystem;
-}
-
-
 class Path;
 class Resource;
 struct ResourceType;
@@ -26,15 +22,28 @@ class LUMIX_ENGINE_API ResourceManagerBase
 public:
 	typedef HashMap<u32, Resource*> ResourceTable;
 
+	struct Stats
+	{
+		u64 resident_bytes;
+		u64 cached_bytes;
+		u64 budget;
+		u32 cached_count;
+		u32 hits;
+		u32 misses;
+		u32 evictions;
+	};
+
 public:
 	void create(ResourceType type, ResourceManager& owner);
 	void destroy();
 
 	void enableUnload(bool enable);
 
-	Resource* load(const Path& path);
-	void load(Resource& resource);
+	// prefetches load with a low priority, the priority is raised when the resource is loaded normally
+	Resource* load(const Path& path, FS::FileSystem::Priority priority = FS::FileSystem::Priority::NORMAL);
+	void load(Resource& resource, FS::FileSystem::Priority priority = FS::FileSystem::Priority::NORMAL);
 	void removeUnreferenced();
+	virtual void update();
 
 	void unload(const Path& path);
 	void unload(Resource& resource);
@@ -43,6 +52,13 @@ public:
 	void reload(Resource& resource);
 	ResourceTable& getResourceTable() { return m_resources; }
 
+	// Unreferenced ready resources are kept loaded until resources of this type
+	// use more than budget bytes, then the least recently used ones are unloaded.
+	// 0 = unreferenced resources are unloaded immediately
+	void setBudget(u64 budget);
+	u64 getBudget() const { return m_budget; }
+	Stats getStats() const;
+
 	ResourceManagerBase(IAllocator& allocator);
 	virtual ~ResourceManagerBase();
 	ResourceManager& getOwner() const { return *m_owner; }
@@ -52,12 +68,28 @@ protected:
 	virtual void destroyResource(Resource& resource) = 0;
 	Resource* get(const Path& path);
 
+private:
+	void evict();
+	void addToCache(Resource& resource);
+	bool removeFromCache(Resource& resource);
+
 private:
 	IAllocator& m_allocator;
 	u32 m_size;
 	ResourceTable m_resources;
 	ResourceManager* m_owner;
+	u32 m_type;
 	bool m_is_unload_enabled;
+	u64 m_budget;
+	// sum of sizes of loaded resources, kept up to date by the resources
+	u64 m_resident_bytes;
+	// unreferenced ready resources, from the least recently used one
+	Resource* m_cache_head;
+	Resource* m_cache_tail;
+	u32 m_cached_count;
+	u32 m_hits;
+	u32 m_misses;
+	u32 m_evictions;
 };
 
 
@@ -4,17 +4,20 @@
 #include "engine/lumix.h"
 
 
-#ifdef _WIN32
+#if defined(_WIN32) || defined(__SSE2__)
 	#include <xmmintrin.h>
 #else
 	#include <cmath>
 #endif
+#ifdef __AVX__
+	#include <immintrin.h>
+#endif
 
 namespace Lumix
 {
 
 
-#ifdef _WIN32
+#if defined(_WIN32) || defined(__SSE2__)
 	typedef __m128 float4;
 
 
@@ -101,6 +104,20 @@ namespace Lumix
 		return _mm_max_ps(a, b);
 	}
 
+
+	// lanes where a < b have all bits set, so their sign bit is set too
+	LUMIX_FORCE_INLINE float4 f4CmpLT(float4 a, float4 b)
+	{
+		return _mm_cmplt_ps(a, b);
+	}
+
+
+	// a in lanes where mask is set by a comparison, b elsewhere
+	LUMIX_FORCE_INLINE float4 f4Select(float4 mask, float4 a, float4 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
 #else 
 	struct float4
 	{
@@ -239,8 +256,108 @@ namespace Lumix
 		};
 	}
 
+
+	// lanes where a < b are negative, the same as the sign bit set by SSE comparisons
+	LUMIX_FORCE_INLINE float4 f4CmpLT(float4 a, float4 b)
+	{
+		return{
+			a.x < b.x ? -1.0f : 0.0f,
+			a.y < b.y ? -1.0f : 0.0f,
+			a.z < b.z ? -1.0f : 0.0f,
+			a.w < b.w ? -1.0f : 0.0f
+		};
+	}
+
+
+	LUMIX_FORCE_INLINE float4 f4Select(float4 mask, float4 a, float4 b)
+	{
+		return{
+			mask.x < 0 ? a.x : b.x,
+			mask.y < 0 ? a.y : b.y,
+			mask.z < 0 ? a.z : b.z,
+			mask.w < 0 ? a.w : b.w
+		};
+	}
+
 #endif
 
 
+#ifdef __AVX__
+	typedef __m256 float8;
+
+
+	LUMIX_FORCE_INLINE float8 f8LoadUnaligned(const void* src)
+	{
+		return _mm256_loadu_ps((const float*)(src));
+	}
+
+
+	LUMIX_FORCE_INLINE float8 f8Splat(float value)
+	{
+		return _mm256_set1_ps(value);
+	}
+
+
+	LUMIX_FORCE_INLINE void f8StoreUnaligned(void* dest, float8 src)
+	{
+		_mm256_storeu_ps((float*)dest, src);
+	}
+
+
+	LUMIX_FORCE_INLINE int f8MoveMask(float8 a)
+	{
+		return _mm256_movemask_ps(a);
+	}
+
+
+	LUMIX_FORCE_INLINE float8 f8Add(float8 a, float8 b)
+	{
+		return _mm256_add_ps(a, b);
+	}
+
+
+	LUMIX_FORCE_INLINE float8 f8Sub(float8 a, float8 b)
+	{
+		return _mm256_sub_ps(a, b);
+	}
+
+
+	LUMIX_FORCE_INLINE float8 f8Mul(float8 a, float8 b)
+	{
+		return _mm256_mul_ps(a, b);
+	}
+
+
+	LUMIX_FORCE_INLINE float8 f8Div(float8 a, float8 b)
+	{
+		return _mm256_div_ps(a, b);
+	}
+
+
+	LUMIX_FORCE_INLINE float8 f8Sqrt(float8 a)
+	{
+		return _mm256_sqrt_ps(a);
+	}
+
+
+	LUMIX_FORCE_INLINE float8 f8Min(float8 a, float8 b)
+	{
+		return _mm256_min_ps(a, b);
+	}
+
+
+	LUMIX_FORCE_INLINE float8 f8CmpLT(float8 a, float8 b)
+	{
+		return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+	}
+
+
+	// a in lanes where mask is set by a comparison, b elsewhere
+	LUMIX_FORCE_INLINE float8 f8Select(float8 mask, float8 a, float8 b)
+	{
+		return _mm256_blendv_ps(b, a, mask);
+	}
+#endif
+
 
 } // namespace Lumix
\ No newline at end of file
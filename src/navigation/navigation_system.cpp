@@ -303,8 +303,9 @@ struct NavigationSceneImpl LUMIX_FINAL : public NavigationScene
 			model_aabb.transform(mtx);
 			if (!model_aabb.overlaps(aabb)) continue;
 
-			auto lod = model->getLODMeshIndices(0);
-			for (int mesh_idx = lod.from; mesh_idx <= lod.to; ++mesh_idx)
+			// CPU geometry of all LODs is always available, even if not streamed to GPU
+			const Model::LOD& lod = model->getLODs()[0];
+			for (int mesh_idx = lod.from_mesh; mesh_idx <= lod.to_mesh; ++mesh_idx)
 			{
 				auto& mesh = model->getMesh(mesh_idx);
 				if (mesh.material->isCustomFlag(no_navigation_flag)) continue;
@@ -8,9 +8,13 @@
 #include "engine/log.h"
 #include "engine/lua_wrapper.h"
 #include "engine/matrix.h"
+#include "engine/mtjd/generic_job.h"
+#include "engine/mtjd/group.h"
+#include "engine/mtjd/manager.h"
 #include "engine/path.h"
 #include "engine/profiler.h"
 #include "engine/property_register.h"
+#include "engine/radix_sort.h"
 #include "engine/resource_manager.h"
 #include "engine/resource_manager_base.h"
 #include "engine/universe/universe.h"
@@ -45,6 +49,8 @@ static const ComponentType D6_JOINT_TYPE = PropertyRegister::getComponentType("d
 static const ResourceType TEXTURE_TYPE("texture");
 static const ResourceType PHYSICS_TYPE("physics");
 static const u32 RENDERER_HASH = crc32("renderer");
+// with fewer rays, a batch of ray casts runs on one thread
+static const int MIN_RAYS_PER_RAYCAST_JOB = 32;
 
 
 enum class PhysicsSceneVersion : int
@@ -295,6 +301,12 @@ struct PhysicsSceneImpl LUMIX_FINAL : public PhysicsScene
 		, m_script_scene(nullptr)
 		, m_debug_visualization_flags(0)
 		, m_is_updating_ragdoll(false)
+		, m_raycast_jobs(m_allocator)
+		, m_raycast_sync_point(true, m_allocator)
+		, m_ray_sort_keys(m_allocator)
+		, m_ray_sort_values(m_allocator)
+		, m_tmp_ray_sort_keys(m_allocator)
+		, m_tmp_ray_sort_values(m_allocator)
 	{
 		setMemory(m_layers_names, 0, sizeof(m_layers_names));
 		for (int i = 0; i < lengthOf(m_layers_names); ++i)
@@ -2084,7 +2096,7 @@ struct PhysicsSceneImpl LUMIX_FINAL : public PhysicsScene
 	{
 		if (!bone) return;
 		
-		Transform bone_transform(Transform(pose->positions[bone->pose_bone_idx], pose->rotations[bone->pose_bone_idx]));
+		Transform bone_transform(Transform(pose->getPosition(bone->pose_bone_idx), pose->getRotation(bone->pose_bone_idx)));
 		bone->actor->setGlobalPose(toPhysx(root_transform * bone_transform * bone->inv_bind_transform));
 
 		setSkeletonPose(root_transform, bone->next, pose);
@@ -2098,15 +2110,15 @@ struct PhysicsSceneImpl LUMIX_FINAL : public PhysicsScene
 			
 		if (bone->is_kinematic)
 		{
-			Transform bone_transform(Transform(pose->positions[bone->pose_bone_idx], pose->rotations[bone->pose_bone_idx]));
+			Transform bone_transform(Transform(pose->getPosition(bone->pose_bone_idx), pose->getRotation(bone->pose_bone_idx)));
 			bone->actor->setKinematicTarget(toPhysx(root_transform * bone_transform * bone->inv_bind_transform));
 		}
 		else
 		{
 			PxTransform bone_pose = bone->actor->getGlobalPose();
 			auto tr = inv_root * Transform(fromPhysx(bone_pose.p), fromPhysx(bone_pose.q)) * bone->bind_transform;
-			pose->rotations[bone->pose_bone_idx] = tr.rot;
-			pose->positions[bone->pose_bone_idx] = tr.pos;
+			pose->setRotation(bone->pose_bone_idx, tr.rot);
+			pose->setPosition(bone->pose_bone_idx, tr.pos);
 		}
 
 		updateBone(root_transform, inv_root, bone->next, pose);
@@ -2296,6 +2308,56 @@ struct PhysicsSceneImpl LUMIX_FINAL : public PhysicsScene
 		return INVALID_ENTITY;
 	}
 
+	// rays is an array of {origin = {x, y, z}, dir = {x, y, z}, max_distance = d, ignored = {entities}},
+	// max_distance and ignored are optional; returns an array with {entity = e, position = {x, y, z},
+	// normal = {x, y, z}} for rays which hit something and false for the others
+	static int LUA_raycastBatch(lua_State* L)
+	{
+		auto* scene = LuaWrapper::checkArg<PhysicsSceneImpl*>(L, 1);
+		int ignored_count;
+		int count = LuaWrapper::checkRaysArg(L, 2, &ignored_count);
+
+		Array<RaycastQuery> queries(scene->m_allocator);
+		Array<RaycastHit> hits(scene->m_allocator);
+		Array<Entity> ignored(scene->m_allocator);
+		queries.resize(count);
+		hits.resize(count);
+		ignored.resize(ignored_count);
+		Entity* ignored_entities = ignored.begin();
+		for (int i = 0; i < count; ++i)
+		{
+			RaycastQuery& query = queries[i];
+			query.ignored_entities = ignored_entities;
+			query.ignored_entity_count =
+				LuaWrapper::toRay(L, 2, i, &query.origin, &query.dir, &query.distance, ignored_entities);
+			ignored_entities += query.ignored_entity_count;
+		}
+		if (count > 0) scene->raycastBatch(&queries[0], &hits[0], count);
+
+		lua_createtable(L, count, 0);
+		for (int i = 0; i < count; ++i)
+		{
+			const RaycastHit& hit = hits[i];
+			if (hit.entity != INVALID_ENTITY)
+			{
+				lua_createtable(L, 0, 3);
+				LuaWrapper::push(L, hit.entity);
+				lua_setfield(L, -2, "entity");
+				LuaWrapper::push(L, hit.position);
+				lua_setfield(L, -2, "position");
+				LuaWrapper::push(L, hit.normal);
+				lua_setfield(L, -2, "normal");
+			}
+			else
+			{
+				lua_pushboolean(L, 0);
+			}
+			lua_rawseti(L, -2, i + 1);
+		}
+		return 1;
+	}
+
+
 	struct Filter : public PxQueryFilterCallback
 	{
 		PxQueryHitType::Enum preFilter(const PxFilterData& filterData,
@@ -2303,7 +2365,10 @@ struct PhysicsSceneImpl LUMIX_FINAL : public PhysicsScene
 			const PxRigidActor* actor,
 			PxHitFlags& queryFlags) override
 		{
-			if(entity.index == (int)(intptr_t)actor->userData) return PxQueryHitType::eNONE;
+			for (int i = 0; i < ignored_count; ++i)
+			{
+				if (ignored[i].index == (int)(intptr_t)actor->userData) return PxQueryHitType::eNONE;
+			}
 			return PxQueryHitType::eBLOCK;
 		}
 
@@ -2313,22 +2378,36 @@ struct PhysicsSceneImpl LUMIX_FINAL : public PhysicsScene
 			return PxQueryHitType::eBLOCK;
 		}
 
-		Entity entity;
+		const Entity* ignored;
+		int ignored_count;
 	};
 
 
 	bool raycastEx(const Vec3& origin, const Vec3& dir, float distance, RaycastHit& result, Entity ignored) override
 	{
-		PxVec3 physx_origin(origin.x, origin.y, origin.z);
-		PxVec3 unit_dir(dir.x, dir.y, dir.z);
-		PxReal max_distance = distance;
+		RaycastQuery query;
+		query.origin = origin;
+		query.dir = dir;
+		query.distance = distance;
+		query.ignored_entities = &ignored;
+		query.ignored_entity_count = 1;
+		return raycast(query, result);
+	}
+
+
+	bool raycast(const RaycastQuery& query, RaycastHit& result)
+	{
+		PxVec3 physx_origin(query.origin.x, query.origin.y, query.origin.z);
+		PxVec3 unit_dir(query.dir.x, query.dir.y, query.dir.z);
+		PxReal max_distance = query.distance;
 
 		const PxHitFlags flags =
 			PxHitFlag::eDISTANCE | PxHitFlag::ePOSITION | PxHitFlag::eNORMAL;
 		PxRaycastBuffer hit;
 		
 		Filter filter;
-		filter.entity = ignored;
+		filter.ignored = query.ignored_entities;
+		filter.ignored_count = query.ignored_entity_count;
 		PxQueryFilterData filter_data;
 		filter_data.flags = PxQueryFlag::eDYNAMIC | PxQueryFlag::eSTATIC | PxQueryFlag::ePREFILTER;
 		bool status =
@@ -2349,6 +2428,61 @@ struct PhysicsSceneImpl LUMIX_FINAL : public PhysicsScene
 	}
 
 
+	// rays are cast one at a time rather than by PxBatchQuery, its filter shaders see only shapes' filter data,
+	// so they can not skip actors of the ignored entities
+	void raycastBatch(const RaycastQuery* queries, RaycastHit* hits, int count) override
+	{
+		PROFILE_FUNCTION();
+		if (count <= 0) return;
+
+		// similar rays visit the same parts of the scene's query structure, so they are cast one after another
+		m_ray_sort_keys.resize(count);
+		m_ray_sort_values.resize(count);
+		m_tmp_ray_sort_keys.resize(count);
+		m_tmp_ray_sort_values.resize(count);
+		for (int i = 0; i < count; ++i)
+		{
+			m_ray_sort_keys[i] = Math::getRaySortKey(queries[i].origin, queries[i].dir);
+			m_ray_sort_values[i] = i;
+		}
+		radixSort(&m_ray_sort_keys[0], &m_ray_sort_values[0], &m_tmp_ray_sort_keys[0], &m_tmp_ray_sort_values[0], count);
+
+		auto castJobRays = [this, queries, hits](int begin, int end) {
+			PROFILE_BLOCK("Raycast Job");
+			for (int i = begin; i < end; ++i)
+			{
+				u32 query_idx = m_ray_sort_values[i];
+				if (!raycast(queries[query_idx], hits[query_idx])) hits[query_idx].entity = INVALID_ENTITY;
+			}
+		};
+		MTJD::Manager& mtjd_manager = m_engine->getMTJDManager();
+		int job_count = Math::clamp(count / MIN_RAYS_PER_RAYCAST_JOB, 1, (int)mtjd_manager.getCpuThreadsCount());
+		if (job_count == 1)
+		{
+			castJobRays(0, count);
+			return;
+		}
+
+		// otherwise the first query of each thread waits for the one updating the query structure
+		m_scene->flushQueryUpdates();
+		int rays_per_job = (count + job_count - 1) / job_count;
+		m_raycast_jobs.clear();
+		for (int i = 0; i < job_count; ++i)
+		{
+			int begin = i * rays_per_job;
+			int end = Math::minimum(count, begin + rays_per_job);
+			MTJD::Job* job = MTJD::makeJob(mtjd_manager, [&castJobRays, begin, end]() { castJobRays(begin, end); }, m_allocator);
+			job->addDependency(&m_raycast_sync_point);
+			m_raycast_jobs.push(job);
+		}
+		for (auto* job : m_raycast_jobs)
+		{
+			mtjd_manager.schedule(job);
+		}
+		m_raycast_sync_point.sync();
+	}
+
+
 	void onEntityMoved(Entity entity)
 	{
 		int ctrl_idx = m_controllers.find(entity);
@@ -3624,6 +3758,12 @@ struct PhysicsSceneImpl LUMIX_FINAL : public PhysicsScene
 	u32 m_collision_filter[32];
 	char m_layers_names[32][30];
 	int m_layers_count;
+	Array<MTJD::Job*> m_raycast_jobs;
+	Array<u64> m_ray_sort_keys;
+	Array<u32> m_ray_sort_values;
+	Array<u64> m_tmp_ray_sort_keys;
+	Array<u32> m_tmp_ray_sort_values;
+	MTJD::Group m_raycast_sync_point;
 };
 
 
@@ -3798,6 +3938,7 @@ void PhysicsScene::registerLuaAPI(lua_State* L)
 	REGISTER_FUNCTION(addForceAtPos);
 	
 	LuaWrapper::createSystemFunction(L, "Physics", "raycast", &PhysicsSceneImpl::LUA_raycast);
+	LuaWrapper::createSystemFunction(L, "Physics", "raycastBatch", &PhysicsSceneImpl::LUA_raycastBatch);
 
 	#undef REGISTER_FUNCTION
 }
@@ -46,6 +46,18 @@ struct RaycastHit
 };
 
 
+struct RaycastQuery
+{
+	Vec3 origin;
+	// normalized
+	Vec3 dir;
+	float distance;
+	// the ray goes through actors of these entities, they can be null if there are none
+	const Entity* ignored_entities;
+	int ignored_entity_count;
+};
+
+
 class LUMIX_PHYSICS_API PhysicsScene : public IScene
 {
 public:
@@ -71,6 +83,9 @@ public:
 	virtual void render() = 0;
 	virtual Entity raycast(const Vec3& origin, const Vec3& dir) = 0;
 	virtual bool raycastEx(const Vec3& origin, const Vec3& dir, float distance, RaycastHit& result, Entity ignored) = 0;
+	// independent rays cast on all worker threads, hits[i] is the nearest hit of queries[i], its entity
+	// is INVALID_ENTITY if there is none; the scene must not change until it returns
+	virtual void raycastBatch(const RaycastQuery* queries, RaycastHit* hits, int count) = 0;
 	virtual PhysicsSystem& getSystem() const = 0;
 
 	virtual ComponentHandle getActorComponent(Entity entity) = 0;
@@ -4,11 +4,13 @@
 #include "engine/binary_array.h"
 #include "engine/free_list.h"
 #include "engine/geometry.h"
+#include "engine/math_utils.h"
 #include "engine/profiler.h"
 
 #include "engine/mtjd/group.h"
 #include "engine/mtjd/manager.h"
 #include "engine/mtjd/job.h"
+#include <cfloat>
 
 namespace Lumix
 {
@@ -17,108 +19,356 @@ typedef Array<int> ModelInstancetoSphereMap;
 typedef Array<ComponentHandle> SphereToModelInstanceMap;
 
 static const int MIN_ENTITIES_PER_THREAD = 50;
+// the hierarchy is not worth building for small scenes
+static const int MIN_HIERARCHY_SPHERES = 2048;
+static const int MAX_SPHERES_PER_LEAF = 32;
+static const int MIN_SUBTREES_PER_THREAD = 4;
+static const int CULLING_CHUNK_SIZE = 256;
+static const int MAX_CULLING_VIEWS = 16;
+// frustums a view remembers, leaves tested in older frames are tested again
+static const int CULLING_VIEW_HISTORY = 16;
+// a view is reused only if its planes moved less than this fraction of the scene size, otherwise it is a camera cut
+static const float CAMERA_CUT_RATIO = 0.1f;
 
-static void doCulling(int start_index,
-	const Sphere* LUMIX_RESTRICT start,
-	const Sphere* LUMIX_RESTRICT end,
-	const Frustum* LUMIX_RESTRICT frustum,
-	const u64* LUMIX_RESTRICT layer_masks,
-	const ComponentHandle* LUMIX_RESTRICT sphere_to_model_instance_map,
+
+// leaves own contiguous ranges of the sphere arrays, inner nodes have two children at `first` and `first + 1`
+struct CullingNode
+{
+	AABB aabb;
+	u64 layer_mask;
+	int parent;
+	int first;
+	int count;
+	bool is_dirty;
+
+	bool isLeaf() const { return count > 0; }
+};
+
+
+// visibility of a leaf's spheres for a view, valid as long as no plane moves by more than `margin` inside the leaf
+struct CullingViewLeaf
+{
+	float margin;
+	u32 visible;
+	int frame;
+};
+
+
+struct CullingView
+{
+	explicit CullingView(IAllocator& allocator)
+		: leaves(allocator)
+	{
+	}
+
+	Frustum frustums[CULLING_VIEW_HISTORY];
+	Array<CullingViewLeaf> leaves;
+	u64 layer_mask;
+	int frame;
+	u32 last_used;
+};
+
+
+// upper bound of how much the distance to any plane of `frustum` differs from `reference` inside `aabb`
+static float getPlanesShift(const Frustum& reference, const Frustum& frustum, const AABB& aabb, float max_shift)
+{
+	Vec3 center = (aabb.min + aabb.max) * 0.5f;
+	Vec3 half = (aabb.max - aabb.min) * 0.5f;
+	float shift = 0;
+	for (int i = 0; i < (int)Frustum::Planes::COUNT; ++i)
+	{
+		float dx = frustum.xs[i] - reference.xs[i];
+		float dy = frustum.ys[i] - reference.ys[i];
+		float dz = frustum.zs[i] - reference.zs[i];
+		float dd = frustum.ds[i] - reference.ds[i];
+		float plane_shift = Math::abs(dx * center.x + dy * center.y + dz * center.z + dd) +
+							Math::abs(dx) * half.x + Math::abs(dy) * half.y + Math::abs(dz) * half.z;
+		shift = Math::maximum(shift, plane_shift);
+		if (shift >= max_shift) break;
+	}
+	return shift;
+}
+
+
+enum class FrustumTest
+{
+	OUTSIDE,
+	INTERSECT,
+	INSIDE
+};
+
+
+static FrustumTest testAABB(const Frustum& frustum, const AABB& aabb)
+{
+	const Vec3& min = aabb.min;
+	const Vec3& max = aabb.max;
+	FrustumTest res = FrustumTest::INSIDE;
+	for (int i = 0; i < (int)Frustum::Planes::COUNT; ++i)
+	{
+		float nx = frustum.xs[i];
+		float ny = frustum.ys[i];
+		float nz = frustum.zs[i];
+		float far_dist = (nx > 0 ? max.x : min.x) * nx + (ny > 0 ? max.y : min.y) * ny +
+						 (nz > 0 ? max.z : min.z) * nz + frustum.ds[i];
+		if (far_dist < 0) return FrustumTest::OUTSIDE;
+		float near_dist = (nx > 0 ? min.x : max.x) * nx + (ny > 0 ? min.y : max.y) * ny +
+						  (nz > 0 ? min.z : max.z) * nz + frustum.ds[i];
+		if (near_dist < 0) res = FrustumTest::INTERSECT;
+	}
+	return res;
+}
+
+
+// spheres are stored as SoA so they can be tested several at once against all the planes
+struct CullingSpheres
+{
+	const float* LUMIX_RESTRICT xs;
+	const float* LUMIX_RESTRICT ys;
+	const float* LUMIX_RESTRICT zs;
+	const float* LUMIX_RESTRICT radiuses;
+	const u64* LUMIX_RESTRICT layer_masks;
+	const ComponentHandle* LUMIX_RESTRICT model_instances;
+};
+
+
+// plane coefficients splatted across all lanes, x, y, z and d for every plane
+struct CullingPlanes4
+{
+	float4 planes[(int)Frustum::Planes::COUNT][4];
+};
+
+
+LUMIX_FORCE_INLINE static float4 planeDistance(float4 x, float4 y, float4 z, const float4* plane)
+{
+	return f4Add(f4Add(f4Mul(x, plane[0]), f4Mul(y, plane[1])), f4Add(f4Mul(z, plane[2]), plane[3]));
+}
+
+
+#ifdef __AVX__
+struct CullingPlanes8
+{
+	float8 planes[(int)Frustum::Planes::COUNT][4];
+};
+
+
+LUMIX_FORCE_INLINE static float8 planeDistance(float8 x, float8 y, float8 z, const float8* plane)
+{
+	return f8Add(f8Add(f8Mul(x, plane[0]), f8Mul(y, plane[1])), f8Add(f8Mul(z, plane[2]), plane[3]));
+}
+#endif
+
+
+static void flushCullingChunk(const ComponentHandle* chunk, int count, CullingSystem::Subresults& results)
+{
+	if (count == 0) return;
+	int result_count = results.size();
+	results.resize(result_count + count);
+	copyMemory(&results[result_count], chunk, count * sizeof(chunk[0]));
+}
+
+
+// culls spheres [from, to) in chunks, visible ones are compacted to a local buffer without branching,
+// every candidate is written and the output position advances only if it is visible;
+// the radius is the same for all planes, so it is added only to the minimal distance
+static void doCulling(const CullingSpheres& spheres,
+	int from,
+	int to,
+	const Frustum& frustum,
 	u64 layer_mask,
 	CullingSystem::Subresults& results)
 {
-	PROFILE_FUNCTION();
-	int i = start_index;
-	ASSERT(results.empty());
-	PROFILE_INT("objects", int(end - start));
-	float4 px = f4Load(frustum->xs);
-	float4 py = f4Load(frustum->ys);
-	float4 pz = f4Load(frustum->zs);
-	float4 pd = f4Load(frustum->ds);
-	float4 px2 = f4Load(&frustum->xs[4]);
-	float4 py2 = f4Load(&frustum->ys[4]);
-	float4 pz2 = f4Load(&frustum->zs[4]);
-	float4 pd2 = f4Load(&frustum->ds[4]);
-	
-	for (const Sphere *sphere = start; sphere <= end; sphere++, ++i)
-	{
-		float4 cx = f4Splat(sphere->position.x);
-		float4 cy = f4Splat(sphere->position.y);
-		float4 cz = f4Splat(sphere->position.z);
-		float4 r = f4Splat(-sphere->radius);
-
-		float4 t = f4Mul(cx, px);
-		t = f4Add(t, f4Mul(cy, py));
-		t = f4Add(t, f4Mul(cz, pz));
-		t = f4Add(t, pd);
-		t = f4Sub(t, r);
-		if (f4MoveMask(t)) continue;
-
-		t = f4Mul(cx, px2);
-		t = f4Add(t, f4Mul(cy, py2));
-		t = f4Add(t, f4Mul(cz, pz2));
-		t = f4Add(t, pd2);
-		t = f4Sub(t, r);
-		if (f4MoveMask(t)) continue;
-
-		if(layer_masks[i] & layer_mask) results.push(sphere_to_model_instance_map[i]);
+	const int PLANE_COUNT = (int)Frustum::Planes::COUNT;
+	ComponentHandle out[CULLING_CHUNK_SIZE];
+	int out_count = 0;
+	int i = from;
+
+#ifdef __AVX__
+	CullingPlanes8 planes8;
+	for (int p = 0; p < PLANE_COUNT; ++p)
+	{
+		planes8.planes[p][0] = f8Splat(frustum.xs[p]);
+		planes8.planes[p][1] = f8Splat(frustum.ys[p]);
+		planes8.planes[p][2] = f8Splat(frustum.zs[p]);
+		planes8.planes[p][3] = f8Splat(frustum.ds[p]);
+	}
+	for (; i + 8 <= to; i += 8)
+	{
+		if (out_count > CULLING_CHUNK_SIZE - 8)
+		{
+			flushCullingChunk(out, out_count, results);
+			out_count = 0;
+		}
+		float8 x = f8LoadUnaligned(spheres.xs + i);
+		float8 y = f8LoadUnaligned(spheres.ys + i);
+		float8 z = f8LoadUnaligned(spheres.zs + i);
+		float8 r = f8LoadUnaligned(spheres.radiuses + i);
+		float8 dist = f8Min(f8Min(planeDistance(x, y, z, planes8.planes[0]), planeDistance(x, y, z, planes8.planes[1])),
+			f8Min(planeDistance(x, y, z, planes8.planes[2]), planeDistance(x, y, z, planes8.planes[3])));
+		if (f8MoveMask(f8Add(dist, r)) == 0xff) continue;
+		dist = f8Min(dist,
+			f8Min(f8Min(planeDistance(x, y, z, planes8.planes[4]), planeDistance(x, y, z, planes8.planes[5])),
+				f8Min(planeDistance(x, y, z, planes8.planes[6]), planeDistance(x, y, z, planes8.planes[7]))));
+		int visible = ~f8MoveMask(f8Add(dist, r)) & 0xff;
+		for (int j = 0; j < 8; ++j)
+		{
+			out[out_count] = spheres.model_instances[i + j];
+			out_count += (visible >> j) & (int)((spheres.layer_masks[i + j] & layer_mask) != 0);
+		}
+	}
+#endif
+
+	CullingPlanes4 planes4;
+	for (int p = 0; p < PLANE_COUNT; ++p)
+	{
+		planes4.planes[p][0] = f4Splat(frustum.xs[p]);
+		planes4.planes[p][1] = f4Splat(frustum.ys[p]);
+		planes4.planes[p][2] = f4Splat(frustum.zs[p]);
+		planes4.planes[p][3] = f4Splat(frustum.ds[p]);
+	}
+	for (; i + 4 <= to; i += 4)
+	{
+		if (out_count > CULLING_CHUNK_SIZE - 4)
+		{
+			flushCullingChunk(out, out_count, results);
+			out_count = 0;
+		}
+		float4 x = f4LoadUnaligned(spheres.xs + i);
+		float4 y = f4LoadUnaligned(spheres.ys + i);
+		float4 z = f4LoadUnaligned(spheres.zs + i);
+		float4 r = f4LoadUnaligned(spheres.radiuses + i);
+		float4 dist = f4Min(f4Min(planeDistance(x, y, z, planes4.planes[0]), planeDistance(x, y, z, planes4.planes[1])),
+			f4Min(planeDistance(x, y, z, planes4.planes[2]), planeDistance(x, y, z, planes4.planes[3])));
+		if (f4MoveMask(f4Add(dist, r)) == 0xf) continue;
+		dist = f4Min(dist,
+			f4Min(f4Min(planeDistance(x, y, z, planes4.planes[4]), planeDistance(x, y, z, planes4.planes[5])),
+				f4Min(planeDistance(x, y, z, planes4.planes[6]), planeDistance(x, y, z, planes4.planes[7]))));
+		int visible = ~f4MoveMask(f4Add(dist, r)) & 0xf;
+		for (int j = 0; j < 4; ++j)
+		{
+			out[out_count] = spheres.model_instances[i + j];
+			out_count += (visible >> j) & (int)((spheres.layer_masks[i + j] & layer_mask) != 0);
+		}
+	}
+
+	for (; i < to; ++i)
+	{
+		if (out_count == CULLING_CHUNK_SIZE)
+		{
+			flushCullingChunk(out, out_count, results);
+			out_count = 0;
+		}
+		float min_dist = FLT_MAX;
+		for (int p = 0; p < PLANE_COUNT; ++p)
+		{
+			float dist = spheres.xs[i] * frustum.xs[p] + spheres.ys[i] * frustum.ys[p] +
+						 spheres.zs[i] * frustum.zs[p] + frustum.ds[p];
+			min_dist = Math::minimum(min_dist, dist);
+		}
+		out[out_count] = spheres.model_instances[i];
+		out_count += (int)(min_dist + spheres.radiuses[i] >= 0) & (int)((spheres.layer_masks[i] & layer_mask) != 0);
+	}
+
+	flushCullingChunk(out, out_count, results);
+}
+
+
+// like doCulling but for a single leaf, it also remembers which spheres are visible
+// and how far the closest one is from changing its visibility
+static void doCachedCulling(const CullingSpheres& spheres,
+	int from,
+	int to,
+	const Frustum& frustum,
+	u64 layer_mask,
+	CullingViewLeaf& leaf,
+	CullingSystem::Subresults& results)
+{
+	ASSERT(to - from <= MAX_SPHERES_PER_LEAF);
+	CullingPlanes4 planes4;
+	for (int p = 0; p < (int)Frustum::Planes::COUNT; ++p)
+	{
+		planes4.planes[p][0] = f4Splat(frustum.xs[p]);
+		planes4.planes[p][1] = f4Splat(frustum.ys[p]);
+		planes4.planes[p][2] = f4Splat(frustum.zs[p]);
+		planes4.planes[p][3] = f4Splat(frustum.ds[p]);
+	}
+
+	float LUMIX_ALIGN_BEGIN(16) margins[MAX_SPHERES_PER_LEAF + 4] LUMIX_ALIGN_END(16);
+	for (int i = from; i < to; i += 4)
+	{
+		// the last block repeats its last sphere instead of reading past `to`
+		int count = Math::minimum(4, to - i);
+		float LUMIX_ALIGN_BEGIN(16) tmp[4][4] LUMIX_ALIGN_END(16);
+		for (int j = 0; j < 4; ++j)
+		{
+			int idx = i + Math::minimum(j, count - 1);
+			tmp[0][j] = spheres.xs[idx];
+			tmp[1][j] = spheres.ys[idx];
+			tmp[2][j] = spheres.zs[idx];
+			tmp[3][j] = spheres.radiuses[idx];
+		}
+		float4 x = f4Load(tmp[0]);
+		float4 y = f4Load(tmp[1]);
+		float4 z = f4Load(tmp[2]);
+		float4 dist = planeDistance(x, y, z, planes4.planes[0]);
+		for (int p = 1; p < (int)Frustum::Planes::COUNT; ++p)
+		{
+			dist = f4Min(dist, planeDistance(x, y, z, planes4.planes[p]));
+		}
+		f4Store(&margins[i - from], f4Add(dist, f4Load(tmp[3])));
+	}
+
+	leaf.margin = FLT_MAX;
+	leaf.visible = 0;
+	for (int i = from; i < to; ++i)
+	{
+		if ((spheres.layer_masks[i] & layer_mask) == 0) continue;
+		float margin = margins[i - from];
+		leaf.margin = Math::minimum(leaf.margin, Math::abs(margin));
+		if (margin < 0) continue;
+		leaf.visible |= 1u << (i - from);
+		results.push(spheres.model_instances[i]);
 	}
 }
 
+
+class CullingSystemImpl;
+
+
 class CullingJob LUMIX_FINAL : public MTJD::Job
 {
 public:
-	CullingJob(const CullingSystem::InputSpheres& spheres,
-		const LayerMasks& layer_masks,
-		const SphereToModelInstanceMap& sphere_to_model_instance_map,
+	CullingJob(CullingSystemImpl& system,
 		u64 layer_mask,
 		CullingSystem::Subresults& results,
-		int start,
-		int end,
+		int job_index,
+		int job_count,
 		const Frustum& frustum,
 		MTJD::Manager& manager,
 		IAllocator& allocator,
 		IAllocator& job_allocator)
 		: Job(Job::AUTO_DESTROY, MTJD::Priority::Default, manager, allocator, job_allocator)
-		, m_spheres(spheres)
+		, m_system(system)
 		, m_results(results)
-		, m_start(start)
-		, m_end(end)
-		, m_frustum(frustum)
-		, m_layer_masks(layer_masks)
 		, m_layer_mask(layer_mask)
-		, m_sphere_to_model_instance_map(sphere_to_model_instance_map)
+		, m_job_index(job_index)
+		, m_job_count(job_count)
+		, m_frustum(frustum)
 	{
 		setJobName("CullingJob");
-		m_results.reserve(end - start);
 		ASSERT(m_results.empty());
 		m_is_executed = false;
 	}
 
 	~CullingJob() {}
 
-	void execute() override
-	{
-		ASSERT(m_results.empty() && !m_is_executed);
-		doCulling(m_start,
-			&m_spheres[m_start],
-			&m_spheres[m_end],
-			&m_frustum,
-			&m_layer_masks[0],
-			&m_sphere_to_model_instance_map[0],
-			m_layer_mask,
-			m_results);
-		m_is_executed = true;
-	}
+	void execute() override;
 
 private:
-	const CullingSystem::InputSpheres& m_spheres;
+	CullingSystemImpl& m_system;
 	CullingSystem::Subresults& m_results;
-	const LayerMasks& m_layer_masks;
-	const SphereToModelInstanceMap& m_sphere_to_model_instance_map;
 	u64 m_layer_mask;
-	int m_start;
-	int m_end;
+	int m_job_index;
+	int m_job_count;
 	const Frustum& m_frustum;
 	bool m_is_executed;
 };
@@ -129,18 +379,36 @@ public:
 	CullingSystemImpl(MTJD::Manager& mtjd_manager, IAllocator& allocator)
 		: m_allocator(allocator)
 		, m_job_allocator(allocator)
-		, m_spheres(allocator)
+		, m_xs(allocator)
+		, m_ys(allocator)
+		, m_zs(allocator)
+		, m_radiuses(allocator)
 		, m_result(allocator)
 		, m_sync_point(true, allocator)
 		, m_mtjd_manager(mtjd_manager)
 		, m_layer_masks(m_allocator)
 		, m_sphere_to_model_instance_map(m_allocator)
 		, m_model_instance_to_sphere_map(m_allocator)
+		, m_nodes(m_allocator)
+		, m_subtrees(m_allocator)
+		, m_dirty_leaves(m_allocator)
+		, m_sphere_to_leaf(m_allocator)
+		, m_indexed_count(0)
+		, m_removed_count(0)
+		, m_is_hierarchy_enabled(true)
+		, m_views(m_allocator)
+		, m_view(nullptr)
+		, m_cull_count(0)
+		, m_is_cache_enabled(false)
+		, m_is_async_result(false)
 	{
 		m_result.emplace(m_allocator);
 		m_model_instance_to_sphere_map.reserve(5000);
 		m_sphere_to_model_instance_map.reserve(5000);
-		m_spheres.reserve(5000);
+		m_xs.reserve(5000);
+		m_ys.reserve(5000);
+		m_zs.reserve(5000);
+		m_radiuses.reserve(5000);
 		int cpu_count = (int)m_mtjd_manager.getCpuThreadsCount();
 		while (m_result.size() < cpu_count)
 		{
@@ -151,10 +419,15 @@ public:
 
 	void clear() override
 	{
-		m_spheres.clear();
+		m_xs.clear();
+		m_ys.clear();
+		m_zs.clear();
+		m_radiuses.clear();
 		m_layer_masks.clear();
 		m_model_instance_to_sphere_map.clear();
 		m_sphere_to_model_instance_map.clear();
+		clearHierarchy();
+		m_views.clear();
 	}
 
 
@@ -177,24 +450,16 @@ public:
 		{
 			m_result[i].clear();
 		}
-		if (!m_spheres.empty())
-		{
-			doCulling(0,
-				&m_spheres[0],
-				&m_spheres.back(),
-				&frustum,
-				&m_layer_masks[0],
-				&m_sphere_to_model_instance_map[0],
-				layer_mask,
-				m_result[0]);
-		}
+		updateHierarchy();
+		m_view = getView(frustum, layer_mask);
+		cull(frustum, layer_mask, 0, 1, m_result[0]);
 		m_is_async_result = false;
 	}
 
 
 	void cullToFrustumAsync(const Frustum& frustum, u64 layer_mask) override
 	{
-		int count = m_spheres.size();
+		int count = m_xs.size();
 		for(auto& i : m_result)
 		{
 			i.clear();
@@ -211,23 +476,20 @@ public:
 			cullToFrustum(frustum, layer_mask);
 			return;
 		}
+		updateHierarchy();
+		m_view = getView(frustum, layer_mask);
 		m_is_async_result = true;
 
 		int cpu_count = m_mtjd_manager.getCpuThreadsCount();
-		int step = count / cpu_count;
-		int i = 0;
 		CullingJob* jobs[16];
 		ASSERT(lengthOf(jobs) >= cpu_count);
-		for (; i < cpu_count - 1; i++)
+		for (int i = 0; i < cpu_count; i++)
 		{
-			m_result[i].clear();
-			CullingJob* cj = LUMIX_NEW(m_job_allocator, CullingJob)(m_spheres,
-				m_layer_masks,
-				m_sphere_to_model_instance_map,
+			CullingJob* cj = LUMIX_NEW(m_job_allocator, CullingJob)(*this,
 				layer_mask,
 				m_result[i],
-				i * step,
-				(i + 1) * step - 1,
+				i,
+				cpu_count,
 				frustum,
 				m_mtjd_manager,
 				m_allocator,
@@ -236,31 +498,71 @@ public:
 			jobs[i] = cj;
 		}
 
-		m_result[i].clear();
-		CullingJob* cj = LUMIX_NEW(m_job_allocator, CullingJob)(m_spheres,
-			m_layer_masks,
-			m_sphere_to_model_instance_map,
-			layer_mask,
-			m_result[i],
-			i * step,
-			count - 1,
-			frustum,
-			m_mtjd_manager,
-			m_allocator,
-			m_job_allocator);
-		cj->addDependency(&m_sync_point);
-		jobs[i] = cj;
-
-		for (i = 0; i < cpu_count; ++i)
+		for (int i = 0; i < cpu_count; ++i)
 		{
 			m_mtjd_manager.schedule(jobs[i]);
 		}
 	}
 
 
+	// culls every `job_count`-th subtree starting at `job_index` and the matching slice of spheres
+	// which are not in the hierarchy yet
+	void cull(const Frustum& frustum, u64 layer_mask, int job_index, int job_count, Subresults& results)
+	{
+		PROFILE_FUNCTION();
+		PROFILE_INT("objects", m_xs.size() / job_count);
+		int cache_hits = 0;
+		int cache_misses = 0;
+		for (int i = job_index; i < m_subtrees.size(); i += job_count)
+		{
+			cullSubtree(frustum, layer_mask, m_subtrees[i], cache_hits, cache_misses, results);
+		}
+		if (m_view)
+		{
+			PROFILE_INT("cache hits", cache_hits);
+			PROFILE_INT("cache misses", cache_misses);
+		}
+
+		int unindexed_count = m_xs.size() - m_indexed_count;
+		if (unindexed_count <= 0) return;
+		int step = unindexed_count / job_count;
+		int start = m_indexed_count + job_index * step;
+		int end = job_index == job_count - 1 ? m_xs.size() : start + step;
+		if (end <= start) return;
+		doCulling(getCullingSpheres(), start, end, frustum, layer_mask, results);
+	}
+
+
+	void enableHierarchy(bool enable) override
+	{
+		m_is_hierarchy_enabled = enable;
+	}
+
+
+	bool isHierarchyEnabled() const override
+	{
+		return m_is_hierarchy_enabled;
+	}
+
+
+	void enableCache(bool enable) override
+	{
+		m_is_cache_enabled = enable;
+		if (!enable) m_views.clear();
+	}
+
+
+	bool isCacheEnabled() const override
+	{
+		return m_is_cache_enabled;
+	}
+
+
 	void setLayerMask(ComponentHandle model_instance, u64 layer) override
 	{
-		m_layer_masks[m_model_instance_to_sphere_map[model_instance.index]] = layer;
+		int index = m_model_instance_to_sphere_map[model_instance.index];
+		m_layer_masks[index] = layer;
+		if (index < m_indexed_count) markDirty(index);
 	}
 
 
@@ -285,13 +587,13 @@ public:
 			return;
 		}
 
-		m_spheres.push(sphere);
+		pushSphere(sphere);
 		m_sphere_to_model_instance_map.push(model_instance);
 		while(model_instance.index >= m_model_instance_to_sphere_map.size())
 		{
 			m_model_instance_to_sphere_map.push(-1);
 		}
-		m_model_instance_to_sphere_map[model_instance.index] = m_spheres.size() - 1;
+		m_model_instance_to_sphere_map[model_instance.index] = m_xs.size() - 1;
 		m_layer_masks.push(layer_mask);
 	}
 
@@ -300,14 +602,28 @@ public:
 	{
 		int index = m_model_instance_to_sphere_map[model_instance.index];
 		if (index < 0) return;
-		ASSERT(index < m_spheres.size());
+		ASSERT(index < m_xs.size());
+
+		if (index < m_indexed_count)
+		{
+			// keep leaf ranges intact, the hole is compacted on the next rebuild
+			m_layer_masks[index] = 0;
+			m_sphere_to_model_instance_map[index] = INVALID_COMPONENT;
+			m_model_instance_to_sphere_map[model_instance.index] = -1;
+			++m_removed_count;
+			markDirty(index);
+			return;
+		}
 
 		m_model_instance_to_sphere_map[m_sphere_to_model_instance_map.back().index] = index;
-		m_spheres[index] = m_spheres.back();
+		copySphere(m_xs.size() - 1, index);
 		m_sphere_to_model_instance_map[index] = m_sphere_to_model_instance_map.back();
 		m_layer_masks[index] = m_layer_masks.back();
 
-		m_spheres.pop();
+		m_xs.pop();
+		m_ys.pop();
+		m_zs.pop();
+		m_radiuses.pop();
 		m_sphere_to_model_instance_map.pop();
 		m_layer_masks.pop();
 		m_model_instance_to_sphere_map[model_instance.index] = -1;
@@ -317,7 +633,9 @@ public:
 	void updateBoundingSphere(const Sphere& sphere, ComponentHandle model_instance) override
 	{
 		int idx = m_model_instance_to_sphere_map[model_instance.index];
-		if (idx >= 0) m_spheres[idx] = sphere;
+		if (idx < 0) return;
+		setSphere(idx, sphere);
+		if (idx < m_indexed_count) markDirty(idx);
 	}
 
 
@@ -325,39 +643,473 @@ public:
 	{
 		for (int i = 0; i < spheres.size(); i++)
 		{
-			m_spheres.push(spheres[i]);
+			pushSphere(spheres[i]);
 			while(m_model_instance_to_sphere_map.size() <= model_instances[i].index)
 			{
 				m_model_instance_to_sphere_map.push(-1);
 			}
-			m_model_instance_to_sphere_map[model_instances[i].index] = m_spheres.size() - 1;
+			m_model_instance_to_sphere_map[model_instances[i].index] = m_xs.size() - 1;
 			m_sphere_to_model_instance_map.push(model_instances[i]);
 			m_layer_masks.push(1);
 		}
 	}
 
 
-	const Sphere& getSphere(ComponentHandle model_instance) override
+	Sphere getSphere(ComponentHandle model_instance) override
 	{
-		return m_spheres[m_model_instance_to_sphere_map[model_instance.index]];
+		return getSphereAt(m_model_instance_to_sphere_map[model_instance.index]);
+	}
+
+
+private:
+	CullingSpheres getCullingSpheres() const
+	{
+		return {m_xs.begin(),
+			m_ys.begin(),
+			m_zs.begin(),
+			m_radiuses.begin(),
+			m_layer_masks.begin(),
+			m_sphere_to_model_instance_map.begin()};
+	}
+
+
+	Sphere getSphereAt(int index) const
+	{
+		return Sphere(m_xs[index], m_ys[index], m_zs[index], m_radiuses[index]);
+	}
+
+
+	void setSphere(int index, const Sphere& sphere)
+	{
+		m_xs[index] = sphere.position.x;
+		m_ys[index] = sphere.position.y;
+		m_zs[index] = sphere.position.z;
+		m_radiuses[index] = sphere.radius;
+	}
+
+
+	void pushSphere(const Sphere& sphere)
+	{
+		m_xs.push(sphere.position.x);
+		m_ys.push(sphere.position.y);
+		m_zs.push(sphere.position.z);
+		m_radiuses.push(sphere.radius);
+	}
+
+
+	void copySphere(int from, int to)
+	{
+		m_xs[to] = m_xs[from];
+		m_ys[to] = m_ys[from];
+		m_zs[to] = m_zs[from];
+		m_radiuses[to] = m_radiuses[from];
+	}
+
+
+
+	void cullSubtree(const Frustum& frustum,
+		u64 layer_mask,
+		int root,
+		int& cache_hits,
+		int& cache_misses,
+		Subresults& results)
+	{
+		int stack[64];
+		int stack_size = 0;
+		stack[stack_size++] = root;
+		while (stack_size > 0)
+		{
+			int node_index = stack[--stack_size];
+			const CullingNode& node = m_nodes[node_index];
+			if ((node.layer_mask & layer_mask) == 0) continue;
+
+			FrustumTest test = testAABB(frustum, node.aabb);
+			if (test == FrustumTest::OUTSIDE) continue;
+
+			if (!node.isLeaf())
+			{
+				// nodes are split at the median, so the stack is deep enough for any int sphere count;
+				// should that ever change, deeper subtrees are culled recursively instead of overflowing
+				if (stack_size + 2 > lengthOf(stack))
+				{
+					cullSubtree(frustum, layer_mask, node.first, cache_hits, cache_misses, results);
+					cullSubtree(frustum, layer_mask, node.first + 1, cache_hits, cache_misses, results);
+					continue;
+				}
+				stack[stack_size++] = node.first;
+				stack[stack_size++] = node.first + 1;
+				continue;
+			}
+
+			if (test == FrustumTest::INSIDE)
+			{
+				for (int i = node.first, c = node.first + node.count; i < c; ++i)
+				{
+					if (m_layer_masks[i] & layer_mask) results.push(m_sphere_to_model_instance_map[i]);
+				}
+				continue;
+			}
+
+			if (!m_view)
+			{
+				doCulling(getCullingSpheres(), node.first, node.first + node.count, frustum, layer_mask, results);
+				continue;
+			}
+
+			// only leaves intersecting planes need per sphere tests, reuse them if the planes barely moved
+			CullingViewLeaf& leaf = m_view->leaves[node_index];
+			if (leaf.frame >= 0 && m_view->frame - leaf.frame < CULLING_VIEW_HISTORY)
+			{
+				const Frustum& reference = m_view->frustums[leaf.frame % CULLING_VIEW_HISTORY];
+				if (getPlanesShift(reference, frustum, node.aabb, leaf.margin) < leaf.margin)
+				{
+					for (int i = 0; i < node.count; ++i)
+					{
+						if (leaf.visible & (1u << i)) results.push(m_sphere_to_model_instance_map[node.first + i]);
+					}
+					++cache_hits;
+					continue;
+				}
+			}
+			doCachedCulling(getCullingSpheres(), node.first, node.first + node.count, frustum, layer_mask, leaf, results);
+			leaf.frame = m_view->frame;
+			++cache_misses;
+		}
+	}
+
+
+	CullingView* getView(const Frustum& frustum, u64 layer_mask)
+	{
+		if (!m_is_cache_enabled || m_indexed_count == 0) return nullptr;
+
+		++m_cull_count;
+		const AABB& scene_aabb = m_nodes[0].aabb;
+		float max_shift = (scene_aabb.max - scene_aabb.min).length() * CAMERA_CUT_RATIO;
+		CullingView* best = nullptr;
+		float best_shift = max_shift;
+		for (CullingView& view : m_views)
+		{
+			if (view.layer_mask != layer_mask) continue;
+			const Frustum& last_frustum = view.frustums[view.frame % CULLING_VIEW_HISTORY];
+			float shift = getPlanesShift(last_frustum, frustum, scene_aabb, best_shift);
+			if (shift < best_shift)
+			{
+				best = &view;
+				best_shift = shift;
+			}
+		}
+
+		if (!best)
+		{
+			// camera cut or a new view, start with a full cull in the least recently used view
+			PROFILE_BLOCK("culling cache reset");
+			if (m_views.size() < MAX_CULLING_VIEWS)
+			{
+				best = &m_views.emplace(m_allocator);
+			}
+			else
+			{
+				best = &m_views[0];
+				for (CullingView& view : m_views)
+				{
+					if (view.last_used < best->last_used) best = &view;
+				}
+			}
+			best->layer_mask = layer_mask;
+			best->frame = 0;
+			best->leaves.resize(m_nodes.size());
+			for (CullingViewLeaf& leaf : best->leaves) leaf.frame = -1;
+		}
+		else
+		{
+			++best->frame;
+		}
+		best->last_used = m_cull_count;
+		best->frustums[best->frame % CULLING_VIEW_HISTORY] = frustum;
+		return best;
+	}
+
+
+	void markDirty(int sphere_index)
+	{
+		CullingNode& leaf = m_nodes[m_sphere_to_leaf[sphere_index]];
+		if (leaf.is_dirty) return;
+		leaf.is_dirty = true;
+		m_dirty_leaves.push(m_sphere_to_leaf[sphere_index]);
+	}
+
+
+	void refitLeaf(CullingNode& node)
+	{
+		node.aabb.set(Vec3(FLT_MAX, FLT_MAX, FLT_MAX), Vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+		node.layer_mask = 0;
+		for (int i = node.first, c = node.first + node.count; i < c; ++i)
+		{
+			if (!isValid(m_sphere_to_model_instance_map[i])) continue;
+			Sphere sphere = getSphereAt(i);
+			Vec3 r(sphere.radius, sphere.radius, sphere.radius);
+			node.aabb.addPoint(sphere.position - r);
+			node.aabb.addPoint(sphere.position + r);
+			node.layer_mask |= m_layer_masks[i];
+		}
+	}
+
+
+	void refitInner(CullingNode& node)
+	{
+		const CullingNode& a = m_nodes[node.first];
+		const CullingNode& b = m_nodes[node.first + 1];
+		// children without visible spheres have inverted bounds
+		if (a.layer_mask == 0) node.aabb = b.aabb;
+		else if (b.layer_mask == 0) node.aabb = a.aabb;
+		else
+		{
+			node.aabb = a.aabb;
+			node.aabb.merge(b.aabb);
+		}
+		node.layer_mask = a.layer_mask | b.layer_mask;
+	}
+
+
+	void refit()
+	{
+		PROFILE_FUNCTION();
+		PROFILE_INT("dirty leaves", m_dirty_leaves.size());
+		for (int leaf_index : m_dirty_leaves)
+		{
+			CullingNode& leaf = m_nodes[leaf_index];
+			leaf.is_dirty = false;
+			refitLeaf(leaf);
+			for (CullingView& view : m_views)
+			{
+				view.leaves[leaf_index].frame = -1;
+			}
+			for (int i = leaf.parent; i >= 0; i = m_nodes[i].parent)
+			{
+				refitInner(m_nodes[i]);
+			}
+		}
+		m_dirty_leaves.clear();
+	}
+
+
+	void updateHierarchy()
+	{
+		int unindexed_count = m_xs.size() - m_indexed_count;
+		bool needs_rebuild = m_is_hierarchy_enabled
+			? m_xs.size() - m_removed_count >= MIN_HIERARCHY_SPHERES &&
+				  (unindexed_count > m_indexed_count / 4 || m_removed_count > m_indexed_count / 4)
+			: m_indexed_count > 0;
+		if (needs_rebuild)
+		{
+			rebuild();
+			return;
+		}
+		if (!m_dirty_leaves.empty()) refit();
+	}
+
+
+	void clearHierarchy()
+	{
+		m_nodes.clear();
+		m_subtrees.clear();
+		m_dirty_leaves.clear();
+		m_sphere_to_leaf.clear();
+		m_indexed_count = 0;
+		m_removed_count = 0;
+	}
+
+
+	void compact()
+	{
+		int count = 0;
+		for (int i = 0, c = m_xs.size(); i < c; ++i)
+		{
+			if (!isValid(m_sphere_to_model_instance_map[i])) continue;
+			copySphere(i, count);
+			m_layer_masks[count] = m_layer_masks[i];
+			m_sphere_to_model_instance_map[count] = m_sphere_to_model_instance_map[i];
+			m_model_instance_to_sphere_map[m_sphere_to_model_instance_map[count].index] = count;
+			++count;
+		}
+		m_xs.resize(count);
+		m_ys.resize(count);
+		m_zs.resize(count);
+		m_radiuses.resize(count);
+		m_layer_masks.resize(count);
+		m_sphere_to_model_instance_map.resize(count);
+	}
+
+
+	void swapSpheres(int a, int b)
+	{
+		Sphere tmp_sphere = getSphereAt(a);
+		copySphere(b, a);
+		setSphere(b, tmp_sphere);
+		u64 tmp_mask = m_layer_masks[a];
+		m_layer_masks[a] = m_layer_masks[b];
+		m_layer_masks[b] = tmp_mask;
+		ComponentHandle tmp_cmp = m_sphere_to_model_instance_map[a];
+		m_sphere_to_model_instance_map[a] = m_sphere_to_model_instance_map[b];
+		m_sphere_to_model_instance_map[b] = tmp_cmp;
+	}
+
+
+	// reorders spheres in [from, to) so the one at `nth` is in its sorted position along `axis`
+	void selectNth(int from, int to, int nth, int axis)
+	{
+		while (to - from > 1)
+		{
+			const float* coords = axis == 0 ? m_xs.begin() : (axis == 1 ? m_ys.begin() : m_zs.begin());
+			float pivot = coords[(from + to) >> 1];
+			int i = from;
+			int j = to - 1;
+			while (i <= j)
+			{
+				while (coords[i] < pivot) ++i;
+				while (coords[j] > pivot) --j;
+				if (i <= j)
+				{
+					swapSpheres(i, j);
+					++i;
+					--j;
+				}
+			}
+			if (nth <= j) to = j + 1;
+			else if (nth >= i) from = i;
+			else return;
+		}
+	}
+
+
+	void rebuild()
+	{
+		PROFILE_FUNCTION();
+		compact();
+		clearHierarchy();
+		m_views.clear();
+		if (!m_is_hierarchy_enabled || m_xs.size() < MIN_HIERARCHY_SPHERES) return;
+
+		PROFILE_INT("spheres", m_xs.size());
+		m_indexed_count = m_xs.size();
+		m_sphere_to_leaf.resize(m_indexed_count);
+
+		CullingNode& root = m_nodes.emplace();
+		root.parent = -1;
+		root.first = 0;
+		root.count = m_indexed_count;
+		root.is_dirty = false;
+
+		// nodes are split top-down at the median of the longest axis, the tree is balanced
+		// so its depth is bounded by log2(sphere count / MAX_SPHERES_PER_LEAF)
+		for (int node_index = 0; node_index < m_nodes.size(); ++node_index)
+		{
+			CullingNode& node = m_nodes[node_index];
+			refitLeaf(node);
+			if (node.count <= MAX_SPHERES_PER_LEAF) continue;
+
+			Vec3 size = node.aabb.max - node.aabb.min;
+			int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+			int first = node.first;
+			int count = node.count;
+			int half = count >> 1;
+			selectNth(first, first + count, first + half, axis);
+
+			int child_index = m_nodes.size();
+			node.first = child_index;
+			node.count = 0;
+			CullingNode& left = m_nodes.emplace();
+			left.parent = node_index;
+			left.first = first;
+			left.count = half;
+			left.is_dirty = false;
+			CullingNode& right = m_nodes.emplace();
+			right.parent = node_index;
+			right.first = first + half;
+			right.count = count - half;
+			right.is_dirty = false;
+		}
+
+		for (int i = 0, c = m_nodes.size(); i < c; ++i)
+		{
+			const CullingNode& node = m_nodes[i];
+			if (!node.isLeaf()) continue;
+			for (int j = node.first, cj = node.first + node.count; j < cj; ++j)
+			{
+				m_sphere_to_leaf[j] = i;
+			}
+		}
+		for (int i = 0; i < m_indexed_count; ++i)
+		{
+			m_model_instance_to_sphere_map[m_sphere_to_model_instance_map[i].index] = i;
+		}
+
+		// nodes are stored breadth first, so the first level with enough nodes is a contiguous range
+		int min_subtrees = m_result.size() * MIN_SUBTREES_PER_THREAD;
+		int level_first = 0;
+		int level_count = 1;
+		while (level_count < min_subtrees && !m_nodes[level_first].isLeaf())
+		{
+			int next_first = m_nodes[level_first].first;
+			int next_count = 0;
+			bool all_inner = true;
+			for (int i = level_first; i < level_first + level_count; ++i)
+			{
+				if (m_nodes[i].isLeaf()) all_inner = false;
+				else next_count += 2;
+			}
+			if (!all_inner) break;
+			level_first = next_first;
+			level_count = next_count;
+		}
+		for (int i = level_first; i < level_first + level_count; ++i)
+		{
+			m_subtrees.push(i);
+		}
 	}
 
 
 private:
 	IAllocator& m_allocator;
 	FreeList<CullingJob, 16> m_job_allocator;
-	InputSpheres m_spheres;
+	Array<float> m_xs;
+	Array<float> m_ys;
+	Array<float> m_zs;
+	Array<float> m_radiuses;
 	Results m_result;
 	LayerMasks m_layer_masks;
 	ModelInstancetoSphereMap m_model_instance_to_sphere_map;
 	SphereToModelInstanceMap m_sphere_to_model_instance_map;
 
+	// spheres [0, m_indexed_count) are in the hierarchy, the rest is culled linearly
+	Array<CullingNode> m_nodes;
+	Array<int> m_subtrees;
+	Array<int> m_dirty_leaves;
+	Array<int> m_sphere_to_leaf;
+	int m_indexed_count;
+	int m_removed_count;
+	bool m_is_hierarchy_enabled;
+
+	// per view visibility of spheres in the hierarchy from previous frames
+	Array<CullingView> m_views;
+	CullingView* m_view;
+	u32 m_cull_count;
+	bool m_is_cache_enabled;
+
 	MTJD::Manager& m_mtjd_manager;
 	MTJD::Group m_sync_point;
 	bool m_is_async_result;
 };
 
 
+void CullingJob::execute()
+{
+	ASSERT(m_results.empty() && !m_is_executed);
+	m_system.cull(m_frustum, m_layer_mask, m_job_index, m_job_count, m_results);
+	m_is_executed = true;
+}
+
+
 CullingSystem* CullingSystem::create(MTJD::Manager& mtjd_manager, IAllocator& allocator)
 {
 	return LUMIX_NEW(allocator, CullingSystemImpl)(mtjd_manager, allocator);
@@ -368,4 +1120,4 @@ void CullingSystem::destroy(CullingSystem& culling_system)
 {
 	LUMIX_DELETE(static_cast<CullingSystemImpl&>(culling_system).getAllocator(), &culling_system);
 }
-}
\ No newline at end of file
+}
@@ -37,6 +37,16 @@ namespace Lumix
 		virtual void cullToFrustum(const Frustum& frustum, u64 layer_mask) = 0;
 		virtual void cullToFrustumAsync(const Frustum& frustum, u64 layer_mask) = 0;
 
+		// bounding volume hierarchy over the spheres, it lets culling reject whole groups of spheres at once;
+		// it is built only for large scenes and refitted incrementally when spheres move
+		virtual void enableHierarchy(bool enable) = 0;
+		virtual bool isHierarchyEnabled() const = 0;
+
+		// remembers what was visible in each view, objects are tested again only if the frustum moved enough
+		// to change their visibility or if they changed; it needs the hierarchy
+		virtual void enableCache(bool enable) = 0;
+		virtual bool isCacheEnabled() const = 0;
+
 		virtual bool isAdded(ComponentHandle model_instance) = 0;
 		virtual void addStatic(ComponentHandle model_instance, const Sphere& sphere, u64 layer_mask) = 0;
 		virtual void removeStatic(ComponentHandle model_instance) = 0;
@@ -47,6 +57,6 @@ namespace Lumix
 		virtual void updateBoundingSphere(const Sphere& sphere, ComponentHandle model_instance) = 0;
 
 		virtual void insert(const InputSpheres& spheres, const Array<ComponentHandle>& model_instances) = 0;
-		virtual const Sphere& getSphere(ComponentHandle model_instance) = 0;
+		virtual Sphere getSphere(ComponentHandle model_instance) = 0;
 	};
 } // ~namespace Lux
\ No newline at end of file
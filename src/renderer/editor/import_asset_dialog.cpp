@@ -21,6 +21,7 @@
 #include "engine/mt/thread.h"
 #include "engine/path_utils.h"
 #include "engine/property_register.h"
+#include "engine/resource_manager.h"
 #include "engine/system.h"
 #include "engine/debug/floating_points.h"
 #include "engine/engine.h"
@@ -1904,7 +1905,8 @@ struct ConvertTask LUMIX_FINAL : public MT::Task
 	}
 
 
-	void writeGeometry(FS::OsFile& file) const
+	// returns the file offset of the vertices
+	u32 writeGeometry(FS::OsFile& file) const
 	{
 		i32 indices_count = 0;
 		i32 vertices_size = 0;
@@ -1925,7 +1927,9 @@ struct ConvertTask LUMIX_FINAL : public MT::Task
 		writeIndices(file);
 
 		file.write((const char*)&vertices_size, sizeof(vertices_size));
+		u32 vertices_file_offset = (u32)file.pos();
 		writeVertices(file);
+		return vertices_file_offset;
 	}
 
 
@@ -2036,11 +2040,11 @@ struct ConvertTask LUMIX_FINAL : public MT::Task
 	}
 
 
-	void writeLods(FS::OsFile& file) const
+	// fills the last mesh of each LOD, returns the number of LODs
+	int getLODs(i32 (&lods)[8]) const
 	{
 		i32 lod_count = 1;
 		i32 last_mesh_idx = -1;
-		i32 lods[8] = {};
 		for (auto& mesh : m_dialog.m_meshes)
 		{
 			if (!mesh.import) continue;
@@ -2056,7 +2060,14 @@ struct ConvertTask LUMIX_FINAL : public MT::Task
 			lods[lod_count] = last_mesh_idx + 1;
 			++lod_count;
 		}
+		return lod_count;
+	}
+
 
+	void writeLods(FS::OsFile& file) const
+	{
+		i32 lods[8] = {};
+		i32 lod_count = getLODs(lods);
 		file.write((const char*)&lod_count, sizeof(lod_count));
 
 		for (int i = 0; i < lod_count; ++i)
@@ -2069,6 +2080,35 @@ struct ConvertTask LUMIX_FINAL : public MT::Task
 	}
 
 
+	// file offset and size of each LOD's vertices, so LODs can be streamed without reading the whole file
+	void writeLODSections(FS::OsFile& file, u32 vertices_file_offset) const
+	{
+		Array<u32> mesh_offsets(m_dialog.m_editor.getAllocator());
+		mesh_offsets.push(vertices_file_offset);
+		for (auto& mesh : m_dialog.m_meshes)
+		{
+			if (!mesh.import) continue;
+			mesh_offsets.push(mesh_offsets.back() + mesh.map_to_input.size() * getVertexSize(mesh.mesh));
+		}
+		if (m_dialog.m_model.create_billboard_lod)
+		{
+			mesh_offsets.push(mesh_offsets.back() + 16 * sizeof(BillboardVertex));
+		}
+
+		i32 lods[8] = {};
+		i32 lod_count = getLODs(lods);
+		for (int i = 0; i < lod_count; ++i)
+		{
+			int from_mesh = i > 0 ? lods[i - 1] + 1 : 0;
+			int to_mesh = Math::maximum(lods[i], from_mesh - 1);
+			u32 offset = mesh_offsets[from_mesh];
+			u32 size = mesh_offsets[to_mesh + 1] - offset;
+			file.write((const char*)&offset, sizeof(offset));
+			file.write((const char*)&size, sizeof(size));
+		}
+	}
+
+
 	aiMatrix4x4 getGlobalTransform(aiNode* node) const
 	{
 		aiMatrix4x4 mtx;
@@ -2445,9 +2485,10 @@ struct ConvertTask LUMIX_FINAL : public MT::Task
 
 		writeModelHeader(file);
 		writeMeshes(file);
-		writeGeometry(file);
+		u32 vertices_file_offset = writeGeometry(file);
 		writeSkeleton(file);
 		writeLods(file);
+		writeLODSections(file, vertices_file_offset);
 
 		file.close();
 		return true;
@@ -3132,7 +3173,11 @@ static bool createBillboard(ImportAssetDialog& dialog,
 	auto light_cmp = render_scene->createComponent(GLOBAL_LIGHT_TYPE, light_entity);
 	render_scene->setGlobalLightIntensity(light_cmp, 0);
 
-	while (engine.getFileSystem().hasWork()) engine.getFileSystem().updateAsyncTransactions();
+	while (engine.getFileSystem().hasWork() || engine.getResourceManager().hasWork())
+	{
+		engine.getFileSystem().updateAsyncTransactions();
+		engine.getResourceManager().update();
+	}
 
 	auto* model = render_scene->getModelInstanceModel(mesh_cmp);
 	int width = 640, height = 480;
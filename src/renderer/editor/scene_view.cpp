@@ -505,6 +505,7 @@ void SceneView::onGUI()
 			const auto& stats = m_pipeline->getStats();
 			ImGui::LabelText("Draw calls", "%d", stats.draw_call_count);
 			ImGui::LabelText("Instances", "%d", stats.instance_count);
+			ImGui::LabelText("State changes", "%d (%d saved)", stats.state_change_count, stats.state_changes_saved);
 			char buf[30];
 			Lumix::toCStringPretty(stats.triangle_count, buf, Lumix::lengthOf(buf));
 			ImGui::LabelText("Triangles", "%s", buf);
@@ -573,11 +573,14 @@ private:
 			}
 		}
 		texture->onDataUpdated(m_x, m_y, m_width, m_height);
-		static_cast<Lumix::RenderScene*>(m_terrain.scene)->forceGrassUpdate(m_terrain.handle);
+		auto* render_scene = static_cast<Lumix::RenderScene*>(m_terrain.scene);
+		render_scene->forceGrassUpdate(m_terrain.handle);
 
 		if (m_action_type != TerrainEditor::LAYER && m_action_type != TerrainEditor::COLOR &&
 			m_action_type != TerrainEditor::ADD_GRASS && m_action_type != TerrainEditor::REMOVE_GRASS)
 		{
+			render_scene->onTerrainHeightmapChanged(m_terrain.handle, m_x, m_y, m_width, m_height);
+
 			Lumix::IScene* scene = m_world_editor.getUniverse()->getScene(Lumix::crc32("physics"));
 			if (!scene) return;
 
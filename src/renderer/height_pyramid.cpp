@@ -0,0 +1,303 @@
+#include "height_pyramid.h"
+#include "engine/math_utils.h"
+#include "engine/profiler.h"
+#include <cfloat>
+
+
+namespace Lumix
+{
+
+
+static const int MAX_STACK_SIZE = 128;
+
+
+// t of the ray entering and leaving the slab min <= origin + dir * t <= max; a ray parallel to the slab
+// is in it for any t or for none, even on its boundary
+static bool getRaySlabIntersection(float origin, float dir, float inv_dir, float min, float max, float* t0, float* t1)
+{
+	if (dir == 0)
+	{
+		*t0 = -FLT_MAX;
+		*t1 = FLT_MAX;
+		return origin >= min && origin <= max;
+	}
+	float a = (min - origin) * inv_dir;
+	float b = (max - origin) * inv_dir;
+	*t0 = Math::minimum(a, b);
+	*t1 = Math::maximum(a, b);
+	return true;
+}
+
+
+static bool getRayAABBIntersection(const Vec3& origin,
+	const Vec3& dir,
+	const Vec3& inv_dir,
+	const AABB& aabb,
+	float max_t,
+	float* t)
+{
+	float tx0, tx1, ty0, ty1, tz0, tz1;
+	if (!getRaySlabIntersection(origin.x, dir.x, inv_dir.x, aabb.min.x, aabb.max.x, &tx0, &tx1)) return false;
+	if (!getRaySlabIntersection(origin.y, dir.y, inv_dir.y, aabb.min.y, aabb.max.y, &ty0, &ty1)) return false;
+	if (!getRaySlabIntersection(origin.z, dir.z, inv_dir.z, aabb.min.z, aabb.max.z, &tz0, &tz1)) return false;
+	float t_enter = Math::maximum(Math::maximum(0.0f, tx0), Math::maximum(ty0, tz0));
+	float t_exit = Math::minimum(Math::minimum(max_t, tx1), Math::minimum(ty1, tz1));
+	*t = t_enter;
+	return t_enter <= t_exit;
+}
+
+
+HeightPyramid::HeightPyramid(IAllocator& allocator)
+	: m_heights(nullptr)
+	, m_width(0)
+	, m_height(0)
+	, m_ranges(allocator)
+	, m_levels(allocator)
+{
+}
+
+
+void HeightPyramid::clear()
+{
+	m_heights = nullptr;
+	m_width = 0;
+	m_height = 0;
+	m_ranges.clear();
+	m_levels.clear();
+}
+
+
+void HeightPyramid::build(const u16* heights, int width, int height)
+{
+	PROFILE_FUNCTION();
+	clear();
+	if (!heights || width < 2 || height < 2) return;
+
+	m_heights = heights;
+	m_width = width;
+	m_height = height;
+	int level_width = (width - 1 + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	int level_height = (height - 1 + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	int offset = 0;
+	for (;;)
+	{
+		Level& level = m_levels.emplace();
+		level.offset = offset;
+		level.width = level_width;
+		level.height = level_height;
+		offset += level_width * level_height;
+		if (level_width == 1 && level_height == 1) break;
+		level_width = (level_width + 1) / 2;
+		level_height = (level_height + 1) / 2;
+	}
+	m_ranges.resize(offset);
+
+	updateRanges(0, 0, m_levels[0].width - 1, m_levels[0].height - 1);
+}
+
+
+void HeightPyramid::update(int x, int z, int width, int height)
+{
+	if (isEmpty() || width <= 0 || height <= 0) return;
+
+	// a sample is shared by the cells on both its sides
+	int cell_count_x = m_width - 1;
+	int cell_count_z = m_height - 1;
+	int from_x = Math::clamp(x - 1, 0, cell_count_x - 1) / BLOCK_SIZE;
+	int from_z = Math::clamp(z - 1, 0, cell_count_z - 1) / BLOCK_SIZE;
+	int to_x = Math::clamp(x + width - 1, 0, cell_count_x - 1) / BLOCK_SIZE;
+	int to_z = Math::clamp(z + height - 1, 0, cell_count_z - 1) / BLOCK_SIZE;
+	updateRanges(from_x, from_z, to_x, to_z);
+}
+
+
+void HeightPyramid::getHeightRange(u16* min, u16* max) const
+{
+	ASSERT(!isEmpty());
+	// the last level has one block
+	const HeightRange& range = m_ranges[m_levels.back().offset];
+	*min = range.min;
+	*max = range.max;
+}
+
+
+// block coordinates are inclusive
+void HeightPyramid::updateRanges(int from_x, int from_z, int to_x, int to_z)
+{
+	const Level& level = m_levels[0];
+	from_x = Math::clamp(from_x, 0, level.width - 1);
+	from_z = Math::clamp(from_z, 0, level.height - 1);
+	to_x = Math::clamp(to_x, 0, level.width - 1);
+	to_z = Math::clamp(to_z, 0, level.height - 1);
+	for (int z = from_z; z <= to_z; ++z)
+	{
+		for (int x = from_x; x <= to_x; ++x)
+		{
+			// samples of the block's cells, including the far edges
+			int sample_from_x = x * BLOCK_SIZE;
+			int sample_from_z = z * BLOCK_SIZE;
+			int sample_to_x = Math::minimum(sample_from_x + BLOCK_SIZE, m_width - 1);
+			int sample_to_z = Math::minimum(sample_from_z + BLOCK_SIZE, m_height - 1);
+			HeightRange range = {0xffff, 0};
+			for (int j = sample_from_z; j <= sample_to_z; ++j)
+			{
+				const u16* row = m_heights + j * m_width;
+				for (int i = sample_from_x; i <= sample_to_x; ++i)
+				{
+					range.min = Math::minimum(range.min, row[i]);
+					range.max = Math::maximum(range.max, row[i]);
+				}
+			}
+			m_ranges[level.offset + x + z * level.width] = range;
+		}
+	}
+
+	for (int i = 1; i < m_levels.size(); ++i)
+	{
+		const Level& child_level = m_levels[i - 1];
+		const Level& level = m_levels[i];
+		from_x >>= 1;
+		from_z >>= 1;
+		to_x >>= 1;
+		to_z >>= 1;
+		for (int z = from_z; z <= to_z; ++z)
+		{
+			for (int x = from_x; x <= to_x; ++x)
+			{
+				HeightRange range = {0xffff, 0};
+				for (int child_z = z * 2; child_z < Math::minimum(z * 2 + 2, child_level.height); ++child_z)
+				{
+					for (int child_x = x * 2; child_x < Math::minimum(x * 2 + 2, child_level.width); ++child_x)
+					{
+						const HeightRange& child = m_ranges[child_level.offset + child_x + child_z * child_level.width];
+						range.min = Math::minimum(range.min, child.min);
+						range.max = Math::maximum(range.max, child.max);
+					}
+				}
+				m_ranges[level.offset + x + z * level.width] = range;
+			}
+		}
+	}
+}
+
+
+float HeightPyramid::getHeight(int x, int z, float height_scale) const
+{
+	return height_scale * m_heights[x + z * m_width];
+}
+
+
+AABB HeightPyramid::getBlockAABB(int level_index, int x, int z, const Vec3& scale) const
+{
+	const Level& level = m_levels[level_index];
+	const HeightRange& range = m_ranges[level.offset + x + z * level.width];
+	int block_size = BLOCK_SIZE << level_index;
+	float height_scale = scale.y / 65535.0f;
+	Vec3 min(x * block_size * scale.x, range.min * height_scale, z * block_size * scale.z);
+	Vec3 max(Math::minimum((x + 1) * block_size, m_width - 1) * scale.x,
+		range.max * height_scale,
+		Math::minimum((z + 1) * block_size, m_height - 1) * scale.z);
+	return AABB(min, max);
+}
+
+
+// tests the triangles of cells in a level 0 block, t is the nearest hit so far
+void HeightPyramid::castRayCells(int block_x,
+	int block_z,
+	const Vec3& origin,
+	const Vec3& dir,
+	const Vec3& inv_dir,
+	const Vec3& scale,
+	float* t) const
+{
+	float height_scale = scale.y / 65535.0f;
+	int from_x = block_x * BLOCK_SIZE;
+	int from_z = block_z * BLOCK_SIZE;
+	int to_x = Math::minimum(from_x + BLOCK_SIZE, m_width - 1);
+	int to_z = Math::minimum(from_z + BLOCK_SIZE, m_height - 1);
+	for (int j = from_z; j < to_z; ++j)
+	{
+		for (int i = from_x; i < to_x; ++i)
+		{
+			float x = i * scale.x;
+			float z = j * scale.z;
+			Vec3 p0(x, getHeight(i, j, height_scale), z);
+			Vec3 p1(x + scale.x, getHeight(i + 1, j, height_scale), z);
+			Vec3 p2(x + scale.x, getHeight(i + 1, j + 1, height_scale), z + scale.z);
+			Vec3 p3(x, getHeight(i, j + 1, height_scale), z + scale.z);
+
+			AABB aabb(Vec3(x, Math::minimum(Math::minimum(p0.y, p1.y), Math::minimum(p2.y, p3.y)), z),
+				Vec3(p2.x, Math::maximum(Math::maximum(p0.y, p1.y), Math::maximum(p2.y, p3.y)), p2.z));
+			float cell_t;
+			if (!getRayAABBIntersection(origin, dir, inv_dir, aabb, *t, &cell_t)) continue;
+
+			float triangle_t;
+			if (Math::getRayTriangleIntersection(origin, dir, p0, p1, p2, &triangle_t) && triangle_t < *t)
+			{
+				*t = triangle_t;
+			}
+			if (Math::getRayTriangleIntersection(origin, dir, p0, p2, p3, &triangle_t) && triangle_t < *t)
+			{
+				*t = triangle_t;
+			}
+		}
+	}
+}
+
+
+bool HeightPyramid::castRay(const Vec3& origin, const Vec3& dir, const Vec3& scale, float* t) const
+{
+	PROFILE_FUNCTION();
+	if (isEmpty()) return false;
+
+	// zero components are handled by getRaySlabIntersection
+	Vec3 inv_dir(dir.x == 0 ? 0 : 1 / dir.x, dir.y == 0 ? 0 : 1 / dir.y, dir.z == 0 ? 0 : 1 / dir.z);
+
+	// blocks are visited nearer first, blocks whose height range the ray misses are skipped
+	// together with all their cells
+	struct StackItem
+	{
+		int level;
+		int x;
+		int z;
+	};
+	StackItem stack[MAX_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = {m_levels.size() - 1, 0, 0};
+	int near_x = dir.x < 0 ? 1 : 0;
+	int near_z = dir.z < 0 ? 1 : 0;
+	float nearest_t = FLT_MAX;
+	while (stack_size > 0)
+	{
+		StackItem item = stack[--stack_size];
+		float block_t;
+		AABB aabb = getBlockAABB(item.level, item.x, item.z, scale);
+		if (!getRayAABBIntersection(origin, dir, inv_dir, aabb, nearest_t, &block_t))
+		{
+			continue;
+		}
+
+		if (item.level == 0)
+		{
+			castRayCells(item.x, item.z, origin, dir, inv_dir, scale, &nearest_t);
+			continue;
+		}
+
+		const Level& child_level = m_levels[item.level - 1];
+		for (int i = 3; i >= 0; --i)
+		{
+			int x = item.x * 2 + ((i & 1) ^ near_x);
+			int z = item.z * 2 + ((i >> 1) ^ near_z);
+			if (x >= child_level.width || z >= child_level.height) continue;
+			ASSERT(stack_size < MAX_STACK_SIZE);
+			stack[stack_size++] = {item.level - 1, x, z};
+		}
+	}
+
+	if (nearest_t == FLT_MAX) return false;
+	*t = nearest_t;
+	return true;
+}
+
+
+} // namespace Lumix
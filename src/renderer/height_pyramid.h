@@ -0,0 +1,69 @@
+#pragma once
+
+
+#include "engine/array.h"
+#include "engine/geometry.h"
+
+
+namespace Lumix
+{
+	class IAllocator;
+
+
+	// min and max heights over blocks of heightmap cells, each level halving the resolution down to a single block;
+	// rays skip whole blocks whose height box they miss
+	class LUMIX_RENDERER_API HeightPyramid
+	{
+	public:
+		// level 0 blocks have BLOCK_SIZE x BLOCK_SIZE cells
+		static const int BLOCK_SIZE = 4;
+
+		explicit HeightPyramid(IAllocator& allocator);
+
+		// heights has width x height samples, it must stay valid until the next build or clear
+		void build(const u16* heights, int width, int height);
+		void clear();
+		bool isEmpty() const { return m_levels.empty(); }
+		// heightmap samples in the rectangle were changed
+		void update(int x, int z, int width, int height);
+		// range of the whole heightmap
+		void getHeightRange(u16* min, u16* max) const;
+
+		// cells are scale.x x scale.z big, a sample of 65535 is scale.y high; finds the nearest hit
+		// of origin + dir * t, t >= 0, with the cells' triangles
+		bool castRay(const Vec3& origin, const Vec3& dir, const Vec3& scale, float* t) const;
+
+	private:
+		struct HeightRange
+		{
+			u16 min;
+			u16 max;
+		};
+
+		// blocks of one level are twice as big as blocks of the level below
+		struct Level
+		{
+			int offset;
+			int width;
+			int height;
+		};
+
+		void updateRanges(int from_x, int from_z, int to_x, int to_z);
+		float getHeight(int x, int z, float height_scale) const;
+		AABB getBlockAABB(int level, int x, int z, const Vec3& scale) const;
+		void castRayCells(int block_x,
+			int block_z,
+			const Vec3& origin,
+			const Vec3& dir,
+			const Vec3& inv_dir,
+			const Vec3& scale,
+			float* t) const;
+
+	private:
+		const u16* m_heights;
+		int m_width;
+		int m_height;
+		Array<HeightRange> m_ranges;
+		Array<Level> m_levels;
+	};
+} // namespace Lumix
@@ -0,0 +1,302 @@
+#include "instance_bvh.h"
+#include "engine/math_utils.h"
+
+
+namespace Lumix
+{
+
+
+static float getArea(const AABB& aabb)
+{
+	Vec3 size = aabb.max - aabb.min;
+	return 2 * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+
+static AABB getUnion(const AABB& a, const AABB& b)
+{
+	AABB aabb = a;
+	aabb.merge(b);
+	return aabb;
+}
+
+
+static bool contains(const AABB& outer, const AABB& inner)
+{
+	return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+		   outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+
+static AABB getSphereAABB(const Sphere& sphere, float margin)
+{
+	Vec3 extents(sphere.radius + margin, sphere.radius + margin, sphere.radius + margin);
+	return AABB(sphere.position - extents, sphere.position + extents);
+}
+
+
+InstanceBVH::InstanceBVH(IAllocator& allocator)
+	: m_nodes(allocator)
+	, m_root(-1)
+	, m_free_node(-1)
+	, m_leaves(allocator)
+{
+}
+
+
+bool InstanceBVH::getRayIntersection(const Vec3& origin,
+	const Vec3& inv_dir,
+	const AABB& aabb,
+	float max_t,
+	float* t)
+{
+	float tx1 = (aabb.min.x - origin.x) * inv_dir.x;
+	float tx2 = (aabb.max.x - origin.x) * inv_dir.x;
+	float ty1 = (aabb.min.y - origin.y) * inv_dir.y;
+	float ty2 = (aabb.max.y - origin.y) * inv_dir.y;
+	float tz1 = (aabb.min.z - origin.z) * inv_dir.z;
+	float tz2 = (aabb.max.z - origin.z) * inv_dir.z;
+	float t_enter = Math::maximum(Math::maximum(0.0f, Math::minimum(tx1, tx2)),
+		Math::maximum(Math::minimum(ty1, ty2), Math::minimum(tz1, tz2)));
+	float t_exit = Math::minimum(Math::minimum(max_t, Math::maximum(tx1, tx2)),
+		Math::minimum(Math::maximum(ty1, ty2), Math::maximum(tz1, tz2)));
+	*t = t_enter;
+	return t_enter <= t_exit;
+}
+
+
+void InstanceBVH::clear()
+{
+	m_nodes.clear();
+	m_leaves.clear();
+	m_root = -1;
+	m_free_node = -1;
+}
+
+
+bool InstanceBVH::isAdded(ComponentHandle model_instance) const
+{
+	return model_instance.index < m_leaves.size() && m_leaves[model_instance.index] >= 0;
+}
+
+
+void InstanceBVH::add(ComponentHandle model_instance, const Sphere& sphere)
+{
+	ASSERT(!isAdded(model_instance));
+	while (m_leaves.size() <= model_instance.index) m_leaves.push(-1);
+
+	int leaf = allocateNode();
+	Node& node = m_nodes[leaf];
+	node.aabb = getSphereAABB(sphere, sphere.radius * 0.1f + 0.1f);
+	node.height = 0;
+	node.model_instance = model_instance;
+	m_leaves[model_instance.index] = leaf;
+	insertLeaf(leaf);
+}
+
+
+void InstanceBVH::remove(ComponentHandle model_instance)
+{
+	if (!isAdded(model_instance)) return;
+
+	int leaf = m_leaves[model_instance.index];
+	removeLeaf(leaf);
+	freeNode(leaf);
+	m_leaves[model_instance.index] = -1;
+}
+
+
+void InstanceBVH::update(ComponentHandle model_instance, const Sphere& sphere)
+{
+	if (isAdded(model_instance))
+	{
+		int leaf = m_leaves[model_instance.index];
+		if (contains(m_nodes[leaf].aabb, getSphereAABB(sphere, 0))) return;
+
+		removeLeaf(leaf);
+		m_nodes[leaf].aabb = getSphereAABB(sphere, sphere.radius * 0.1f + 0.1f);
+		insertLeaf(leaf);
+		return;
+	}
+	add(model_instance, sphere);
+}
+
+
+int InstanceBVH::allocateNode()
+{
+	int node;
+	if (m_free_node >= 0)
+	{
+		node = m_free_node;
+		m_free_node = m_nodes[node].parent;
+	}
+	else
+	{
+		node = m_nodes.size();
+		m_nodes.emplace();
+	}
+	Node& n = m_nodes[node];
+	n.parent = -1;
+	n.children[0] = n.children[1] = -1;
+	n.height = 0;
+	n.model_instance = INVALID_COMPONENT;
+	return node;
+}
+
+
+void InstanceBVH::freeNode(int node)
+{
+	m_nodes[node].parent = m_free_node;
+	m_nodes[node].height = -1;
+	m_free_node = node;
+}
+
+
+void InstanceBVH::insertLeaf(int leaf)
+{
+	if (m_root < 0)
+	{
+		m_root = leaf;
+		m_nodes[leaf].parent = -1;
+		return;
+	}
+
+	// find the cheapest sibling, the cost is the surface area the tree gains
+	AABB leaf_aabb = m_nodes[leaf].aabb;
+	int sibling = m_root;
+	while (!m_nodes[sibling].isLeaf())
+	{
+		const Node& node = m_nodes[sibling];
+		float area = getArea(node.aabb);
+		float combined_area = getArea(getUnion(node.aabb, leaf_aabb));
+		float cost = 2 * combined_area;
+		float inheritance_cost = 2 * (combined_area - area);
+
+		float child_costs[2];
+		for (int i = 0; i < 2; ++i)
+		{
+			const Node& child = m_nodes[node.children[i]];
+			float child_area = getArea(getUnion(child.aabb, leaf_aabb));
+			if (!child.isLeaf()) child_area -= getArea(child.aabb);
+			child_costs[i] = child_area + inheritance_cost;
+		}
+
+		if (cost < child_costs[0] && cost < child_costs[1]) break;
+		sibling = child_costs[0] < child_costs[1] ? node.children[0] : node.children[1];
+	}
+
+	int old_parent = m_nodes[sibling].parent;
+	int new_parent = allocateNode();
+	Node& parent = m_nodes[new_parent];
+	parent.parent = old_parent;
+	parent.aabb = getUnion(leaf_aabb, m_nodes[sibling].aabb);
+	parent.height = m_nodes[sibling].height + 1;
+	parent.children[0] = sibling;
+	parent.children[1] = leaf;
+	if (old_parent >= 0)
+	{
+		int* children = m_nodes[old_parent].children;
+		children[children[0] == sibling ? 0 : 1] = new_parent;
+	}
+	else
+	{
+		m_root = new_parent;
+	}
+	m_nodes[sibling].parent = new_parent;
+	m_nodes[leaf].parent = new_parent;
+
+	refit(new_parent);
+}
+
+
+void InstanceBVH::removeLeaf(int leaf)
+{
+	if (leaf == m_root)
+	{
+		m_root = -1;
+		return;
+	}
+
+	int parent = m_nodes[leaf].parent;
+	int grand_parent = m_nodes[parent].parent;
+	const int* parent_children = m_nodes[parent].children;
+	int sibling = parent_children[0] == leaf ? parent_children[1] : parent_children[0];
+
+	m_nodes[sibling].parent = grand_parent;
+	freeNode(parent);
+	if (grand_parent >= 0)
+	{
+		int* children = m_nodes[grand_parent].children;
+		children[children[0] == parent ? 0 : 1] = sibling;
+		refit(grand_parent);
+	}
+	else
+	{
+		m_root = sibling;
+	}
+}
+
+
+void InstanceBVH::refit(int node)
+{
+	while (node >= 0)
+	{
+		node = balance(node);
+		Node& n = m_nodes[node];
+		const Node& child0 = m_nodes[n.children[0]];
+		const Node& child1 = m_nodes[n.children[1]];
+		n.height = 1 + Math::maximum(child0.height, child1.height);
+		n.aabb = getUnion(child0.aabb, child1.aabb);
+		node = n.parent;
+	}
+}
+
+
+// if one child of a is higher than the other by more than one, the higher child is rotated up,
+// returns the node in a's place
+int InstanceBVH::balance(int a)
+{
+	Node& node_a = m_nodes[a];
+	if (node_a.isLeaf() || node_a.height < 2) return a;
+
+	int b = node_a.children[0];
+	int c = node_a.children[1];
+	int diff = m_nodes[c].height - m_nodes[b].height;
+	if (diff >= -1 && diff <= 1) return a;
+
+	// up is the higher child, stays is the other one
+	int up_slot = diff > 1 ? 1 : 0;
+	int up = node_a.children[up_slot];
+	int stays = node_a.children[1 - up_slot];
+	Node& node_up = m_nodes[up];
+	int f = node_up.children[0];
+	int g = node_up.children[1];
+
+	node_up.children[0] = a;
+	node_up.parent = node_a.parent;
+	node_a.parent = up;
+	if (node_up.parent >= 0)
+	{
+		int* children = m_nodes[node_up.parent].children;
+		children[children[0] == a ? 0 : 1] = up;
+	}
+	else
+	{
+		m_root = up;
+	}
+
+	// the higher grandchild stays in up, the other one moves to a
+	if (m_nodes[f].height < m_nodes[g].height) Math::swap(f, g);
+	node_up.children[1] = f;
+	node_a.children[up_slot] = g;
+	m_nodes[g].parent = a;
+
+	node_a.aabb = getUnion(m_nodes[stays].aabb, m_nodes[g].aabb);
+	node_a.height = 1 + Math::maximum(m_nodes[stays].height, m_nodes[g].height);
+	node_up.aabb = getUnion(node_a.aabb, m_nodes[f].aabb);
+	node_up.height = 1 + Math::maximum(node_a.height, m_nodes[f].height);
+	return up;
+}
+
+
+} // namespace Lumix
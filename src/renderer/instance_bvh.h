@@ -0,0 +1,125 @@
+#pragma once
+
+
+#include "engine/array.h"
+#include "engine/geometry.h"
+
+
+namespace Lumix
+{
+	class IAllocator;
+
+
+	// dynamic bounding volume hierarchy of model instances' bounding spheres; leaves have slightly
+	// bigger boxes than the spheres, so small moves do not change the tree
+	class LUMIX_RENDERER_API InstanceBVH
+	{
+	public:
+		explicit InstanceBVH(IAllocator& allocator);
+
+		void clear();
+		bool isAdded(ComponentHandle model_instance) const;
+		void add(ComponentHandle model_instance, const Sphere& sphere);
+		void remove(ComponentHandle model_instance);
+		void update(ComponentHandle model_instance, const Sphere& sphere);
+		int getHeight() const { return m_root < 0 ? 0 : m_nodes[m_root].height; }
+
+		// calls float callback(ComponentHandle model_instance, float max_t) for model instances whose boxes
+		// are hit by origin + dir * t, 0 <= t <= max_t, nearer boxes first; the callback returns the new max_t,
+		// e.g. t of a hit it found, so boxes further away are skipped
+		template <typename T> void castRay(const Vec3& origin, const Vec3& dir, float max_t, const T& callback) const
+		{
+			if (m_root < 0) return;
+
+			Vec3 inv_dir(1 / (dir.x == 0 ? 0.00000001f : dir.x),
+				1 / (dir.y == 0 ? 0.00000001f : dir.y),
+				1 / (dir.z == 0 ? 0.00000001f : dir.z));
+			float t;
+			if (!getRayIntersection(origin, inv_dir, m_nodes[m_root].aabb, max_t, &t)) return;
+			castRay(origin, inv_dir, m_root, t, max_t, callback);
+		}
+
+	private:
+		static const int MAX_STACK_SIZE = 128;
+
+		// returns the new max_t
+		template <typename T>
+		float castRay(const Vec3& origin, const Vec3& inv_dir, int root, float root_t, float max_t, const T& callback) const
+		{
+			struct StackItem
+			{
+				int node;
+				float t;
+			};
+			StackItem stack[MAX_STACK_SIZE];
+			int stack_size = 0;
+			stack[stack_size++] = {root, root_t};
+
+			while (stack_size > 0)
+			{
+				StackItem item = stack[--stack_size];
+				if (item.t > max_t) continue;
+
+				const Node& node = m_nodes[item.node];
+				if (node.isLeaf())
+				{
+					max_t = callback(node.model_instance, max_t);
+					continue;
+				}
+
+				int near_child = node.children[0];
+				int far_child = node.children[1];
+				float near_t, far_t;
+				bool is_near_hit = getRayIntersection(origin, inv_dir, m_nodes[near_child].aabb, max_t, &near_t);
+				bool is_far_hit = getRayIntersection(origin, inv_dir, m_nodes[far_child].aabb, max_t, &far_t);
+				if (is_near_hit && is_far_hit && far_t < near_t)
+				{
+					Math::swap(near_child, far_child);
+					Math::swap(near_t, far_t);
+				}
+				// the stack holds a balanced tree of any size, subtrees of a degenerate one are cast recursively
+				if (stack_size + 2 > MAX_STACK_SIZE)
+				{
+					if (is_near_hit) max_t = castRay(origin, inv_dir, near_child, near_t, max_t, callback);
+					if (is_far_hit && far_t <= max_t) max_t = castRay(origin, inv_dir, far_child, far_t, max_t, callback);
+					continue;
+				}
+				if (is_far_hit) stack[stack_size++] = {far_child, far_t};
+				if (is_near_hit) stack[stack_size++] = {near_child, near_t};
+			}
+			return max_t;
+		}
+
+		struct Node
+		{
+			bool isLeaf() const { return children[0] < 0; }
+
+			AABB aabb;
+			// the next free node when the node is not used
+			int parent;
+			int children[2];
+			// leaves are 0
+			int height;
+			ComponentHandle model_instance;
+		};
+
+		static bool getRayIntersection(const Vec3& origin,
+			const Vec3& inv_dir,
+			const AABB& aabb,
+			float max_t,
+			float* t);
+
+		int allocateNode();
+		void freeNode(int node);
+		void insertLeaf(int leaf);
+		void removeLeaf(int leaf);
+		void refit(int node);
+		int balance(int node);
+
+		Array<Node> m_nodes;
+		int m_root;
+		int m_free_node;
+		// indexed by model instance, -1 if the model instance is not in the tree
+		Array<int> m_leaves;
+	};
+} // namespace Lumix
@@ -0,0 +1,225 @@
+#include "light_clusters.h"
+#include "engine/array.h"
+#include "engine/geometry.h"
+#include "engine/math_utils.h"
+#include "engine/profiler.h"
+#include "engine/string.h"
+#include "engine/vec.h"
+
+#include "engine/mtjd/generic_job.h"
+#include "engine/mtjd/group.h"
+#include "engine/mtjd/manager.h"
+#include <cmath>
+
+
+namespace Lumix
+{
+
+
+// with fewer lights, light clusters are computed on one thread
+static const int MIN_LIGHTS_PER_CLUSTER_JOB = 64;
+static const int TILE_COUNT = LightClusters::SIZE_X * LightClusters::SIZE_Y;
+
+
+// screen tiles covered by a view space sphere clipped to [z_near, z_far]
+static bool getLightClusterTiles(const Sphere& sphere,
+	float z_near,
+	float z_far,
+	float tan_x,
+	float tan_y,
+	int* min_x,
+	int* min_y,
+	int* max_x,
+	int* max_y)
+{
+	const Vec3& center = sphere.position;
+	float radius = sphere.radius;
+	if (center.z + radius < z_near || center.z - radius > z_far) return false;
+
+	// x / z of any point in the sphere's bounding box is between the values at the box's corners
+	float min_z = Math::maximum(center.z - radius, z_near);
+	float max_z = Math::minimum(center.z + radius, z_far);
+	float left = Math::minimum((center.x - radius) / min_z, (center.x - radius) / max_z);
+	float right = Math::maximum((center.x + radius) / min_z, (center.x + radius) / max_z);
+	float bottom = Math::minimum((center.y - radius) / min_z, (center.y - radius) / max_z);
+	float top = Math::maximum((center.y + radius) / min_z, (center.y + radius) / max_z);
+	if (left > tan_x || right < -tan_x || bottom > tan_y || top < -tan_y) return false;
+
+	auto toTile = [](float v, float tan, int size) {
+		return Math::clamp(int((v / tan + 1) * 0.5f * size), 0, size - 1);
+	};
+	*min_x = toTile(left, tan_x, LightClusters::SIZE_X);
+	*max_x = toTile(right, tan_x, LightClusters::SIZE_X);
+	*min_y = toTile(bottom, tan_y, LightClusters::SIZE_Y);
+	*max_y = toTile(top, tan_y, LightClusters::SIZE_Y);
+	return true;
+}
+
+
+class LightClusterBuilderImpl LUMIX_FINAL : public LightClusterBuilder
+{
+public:
+	LightClusterBuilderImpl(MTJD::Manager& mtjd_manager, IAllocator& allocator)
+		: m_allocator(allocator)
+		, m_mtjd_manager(mtjd_manager)
+		, m_sync_point(true, allocator)
+		, m_jobs(allocator)
+		, m_clusters(allocator)
+		, m_indices(allocator)
+		, m_job_indices(allocator)
+	{
+	}
+
+
+	IAllocator& getAllocator() { return m_allocator; }
+
+
+	void computeSlice(int slice, const Frustum& frustum, const Sphere* spheres, int count, Array<u16>& indices)
+	{
+		float far_near_ratio = frustum.far_distance / frustum.near_distance;
+		float z_near = frustum.near_distance * powf(far_near_ratio, slice / (float)LightClusters::SIZE_Z);
+		float z_far = frustum.near_distance * powf(far_near_ratio, (slice + 1) / (float)LightClusters::SIZE_Z);
+		float tan_y = tanf(frustum.fov * 0.5f);
+		float tan_x = tan_y * frustum.ratio;
+
+		u32 counts[TILE_COUNT];
+		setMemory(counts, 0, sizeof(counts));
+		for (int light_idx = 0; light_idx < count; ++light_idx)
+		{
+			int min_x, min_y, max_x, max_y;
+			if (!getLightClusterTiles(spheres[light_idx], z_near, z_far, tan_x, tan_y, &min_x, &min_y, &max_x, &max_y))
+			{
+				continue;
+			}
+			for (int y = min_y; y <= max_y; ++y)
+			{
+				for (int x = min_x; x <= max_x; ++x)
+				{
+					++counts[x + y * LightClusters::SIZE_X];
+				}
+			}
+		}
+
+		LightClusters::Cluster* clusters = &m_clusters[slice * TILE_COUNT];
+		for (int i = 0; i < TILE_COUNT; ++i)
+		{
+			clusters[i].offset = indices.size();
+			clusters[i].count = 0;
+			indices.resize(indices.size() + Math::minimum(counts[i], (u32)LightClusters::MAX_LIGHTS_PER_CLUSTER));
+		}
+
+		for (int light_idx = 0; light_idx < count; ++light_idx)
+		{
+			int min_x, min_y, max_x, max_y;
+			if (!getLightClusterTiles(spheres[light_idx], z_near, z_far, tan_x, tan_y, &min_x, &min_y, &max_x, &max_y))
+			{
+				continue;
+			}
+			for (int y = min_y; y <= max_y; ++y)
+			{
+				for (int x = min_x; x <= max_x; ++x)
+				{
+					LightClusters::Cluster& cluster = clusters[x + y * LightClusters::SIZE_X];
+					if (cluster.count == LightClusters::MAX_LIGHTS_PER_CLUSTER) continue;
+					indices[cluster.offset + cluster.count] = (u16)light_idx;
+					++cluster.count;
+				}
+			}
+		}
+	}
+
+
+	void build(const Frustum& frustum, const Sphere* spheres, int count, LightClusters* clusters) override
+	{
+		PROFILE_FUNCTION();
+		ASSERT(count <= 0xffff);
+		int job_count = Math::clamp(count / MIN_LIGHTS_PER_CLUSTER_JOB,
+			1,
+			Math::minimum((int)m_mtjd_manager.getCpuThreadsCount(), LightClusters::SIZE_Z));
+		int slices_per_job = (LightClusters::SIZE_Z + job_count - 1) / job_count;
+		while (m_job_indices.size() < job_count) m_job_indices.emplace(m_allocator);
+		m_clusters.resize(LightClusters::CLUSTER_COUNT);
+
+		// each job fills its own slices, with offsets into its own index array
+		auto computeSlices = [this, &frustum, spheres, count, slices_per_job](int job) {
+			PROFILE_BLOCK("Light Clusters Job");
+			Array<u16>& indices = m_job_indices[job];
+			indices.clear();
+			for (int slice = job * slices_per_job, end = Math::minimum(LightClusters::SIZE_Z, (job + 1) * slices_per_job);
+				 slice < end;
+				 ++slice)
+			{
+				computeSlice(slice, frustum, spheres, count, indices);
+			}
+		};
+		if (job_count == 1)
+		{
+			computeSlices(0);
+		}
+		else
+		{
+			m_jobs.clear();
+			for (int i = 0; i < job_count; ++i)
+			{
+				MTJD::Job* job = MTJD::makeJob(m_mtjd_manager, [&computeSlices, i]() { computeSlices(i); }, m_allocator);
+				job->addDependency(&m_sync_point);
+				m_jobs.push(job);
+			}
+			for (MTJD::Job* job : m_jobs)
+			{
+				m_mtjd_manager.schedule(job);
+			}
+			m_sync_point.sync();
+		}
+
+		m_indices.clear();
+		for (int job = 0; job < job_count; ++job)
+		{
+			u32 job_offset = m_indices.size();
+			const Array<u16>& indices = m_job_indices[job];
+			for (int slice = job * slices_per_job, end = Math::minimum(LightClusters::SIZE_Z, (job + 1) * slices_per_job);
+				 slice < end;
+				 ++slice)
+			{
+				for (int i = 0; i < TILE_COUNT; ++i)
+				{
+					m_clusters[slice * TILE_COUNT + i].offset += job_offset;
+				}
+			}
+			if (indices.empty()) continue;
+			m_indices.resize(job_offset + indices.size());
+			copyMemory(&m_indices[job_offset], &indices[0], indices.size() * sizeof(indices[0]));
+		}
+
+		clusters->clusters = &m_clusters[0];
+		clusters->light_indices = m_indices.empty() ? nullptr : &m_indices[0];
+		clusters->light_index_count = m_indices.size();
+		clusters->near_distance = frustum.near_distance;
+		clusters->far_distance = frustum.far_distance;
+	}
+
+
+private:
+	IAllocator& m_allocator;
+	MTJD::Manager& m_mtjd_manager;
+	MTJD::Group m_sync_point;
+	Array<MTJD::Job*> m_jobs;
+	Array<LightClusters::Cluster> m_clusters;
+	Array<u16> m_indices;
+	Array<Array<u16>> m_job_indices;
+};
+
+
+LightClusterBuilder* LightClusterBuilder::create(MTJD::Manager& mtjd_manager, IAllocator& allocator)
+{
+	return LUMIX_NEW(allocator, LightClusterBuilderImpl)(mtjd_manager, allocator);
+}
+
+
+void LightClusterBuilder::destroy(LightClusterBuilder& builder)
+{
+	LUMIX_DELETE(static_cast<LightClusterBuilderImpl&>(builder).getAllocator(), &builder);
+}
+
+
+} // namespace Lumix
@@ -0,0 +1,63 @@
+#pragma once
+
+
+#include "engine/lumix.h"
+
+
+namespace Lumix
+{
+	class IAllocator;
+	struct Frustum;
+	struct Sphere;
+
+
+	namespace MTJD
+	{
+		class Manager;
+	}
+
+
+	// point lights assigned to cells of a grid in view space; cells are 2D screen tiles split into slices,
+	// which are exponentially thicker with the distance from the camera
+	struct LightClusters
+	{
+		static const int SIZE_X = 16;
+		static const int SIZE_Y = 8;
+		static const int SIZE_Z = 24;
+		static const int CLUSTER_COUNT = SIZE_X * SIZE_Y * SIZE_Z;
+		// bounds the cost of shading a pixel, lights over the limit are dropped from the cluster
+		static const int MAX_LIGHTS_PER_CLUSTER = 64;
+
+		struct Cluster
+		{
+			u32 offset;
+			u32 count;
+		};
+
+		// CLUSTER_COUNT clusters, index is x + (y + z * SIZE_Y) * SIZE_X
+		const Cluster* clusters;
+		// indices into lights
+		const u16* light_indices;
+		int light_index_count;
+		const ComponentHandle* lights;
+		int light_count;
+		float near_distance;
+		float far_distance;
+	};
+
+
+	// assigns view space spheres of lights to LightClusters' cells, slices are split between worker threads
+	class LUMIX_RENDERER_API LightClusterBuilder
+	{
+	public:
+		LightClusterBuilder() { }
+		virtual ~LightClusterBuilder() { }
+
+		static LightClusterBuilder* create(MTJD::Manager& mtjd_manager, IAllocator& allocator);
+		static void destroy(LightClusterBuilder& builder);
+
+		// spheres are in view space, x to the right, y up and z in the frustum's direction; at most 0xffff of them;
+		// fills clusters except lights and light_count, clusters' arrays are valid until the next build
+		virtual void build(const Frustum& frustum, const Sphere* spheres, int count, LightClusters* clusters) = 0;
+	};
+} // namespace Lumix
@@ -6,6 +6,7 @@
 #include "engine/fs/file_system.h"
 #include "engine/log.h"
 #include "engine/lua_wrapper.h"
+#include "engine/mt/atomic.h"
 #include "engine/path_utils.h"
 #include "engine/profiler.h"
 #include "engine/resource_manager.h"
@@ -16,6 +17,7 @@
 #include "renderer/pose.h"
 
 #include <cfloat>
+#include <climits>
 #include <cmath>
 
 
@@ -60,6 +62,7 @@ Model::Model(const Path& path, ResourceManagerBase& resource_manager, IAllocator
 	, m_bone_map(m_allocator)
 	, m_meshes(m_allocator)
 	, m_bones(m_allocator)
+	, m_bone_parents(m_allocator)
 	, m_indices(m_allocator)
 	, m_vertices(m_allocator)
 	, m_uvs(m_allocator)
@@ -67,11 +70,28 @@ Model::Model(const Path& path, ResourceManagerBase& resource_manager, IAllocator
 	, m_indices_handle(BGFX_INVALID_HANDLE)
 	, m_first_nonroot_bone_index(0)
 	, m_flags(0)
+	, m_material_paths(m_allocator)
+	, m_staging_vertices(m_allocator)
+	, m_lod_count(0)
+	, m_has_lod_sections(false)
+	, m_is_lod_streaming(false)
+	, m_vertices_file_offset(0)
+	, m_stream_async(FS::FileSystem::INVALID_ASYNC)
+	, m_stream_lod(0)
+	, m_ray_cast_mutex(false)
+	, m_is_ray_cast_bvh_ready(false)
+	, m_ray_cast_bvh(m_allocator)
 {
 	m_lods[0] = { 0, -1, FLT_MAX };
 	m_lods[1] = { 0, -1, FLT_MAX };
 	m_lods[2] = { 0, -1, FLT_MAX };
 	m_lods[3] = { 0, -1, FLT_MAX };
+	for (auto& geometry : m_lod_geometry)
+	{
+		setMemory(&geometry, 0, sizeof(geometry));
+		geometry.vertices_handle = BGFX_INVALID_HANDLE;
+		geometry.indices_handle = BGFX_INVALID_HANDLE;
+	}
 }
 
 
@@ -81,6 +101,21 @@ Model::~Model()
 }
 
 
+void Model::buildRayCastBVH()
+{
+	Array<RayCastBVH::Mesh> meshes(m_allocator);
+	u32 vertex_offset = 0;
+	for (int i = 0; i <= m_lods[0].to_mesh; ++i)
+	{
+		const Mesh& mesh = m_meshes[i];
+		if (i >= m_lods[0].from_mesh) meshes.push({mesh.indices_offset, mesh.indices_count, vertex_offset});
+		vertex_offset += mesh.attribute_array_size / m_vertex_decl.getStride();
+	}
+	if (meshes.empty()) return;
+	m_ray_cast_bvh.build(&m_vertices[0], &m_indices[0], areIndices16(), &meshes[0], meshes.size());
+}
+
+
 RayCastModelHit Model::castRay(const Vec3& origin,
 							   const Vec3& dir,
 							   const Matrix& model_transform)
@@ -89,80 +124,244 @@ RayCastModelHit Model::castRay(const Vec3& origin,
 	hit.m_is_hit = false;
 	if (!isReady()) return hit;
 
+	// ray casts can run on worker threads, so only one of them builds the tree
+	if (!m_is_ray_cast_bvh_ready)
+	{
+		MT::SpinLock lock(m_ray_cast_mutex);
+		if (!m_is_ray_cast_bvh_ready)
+		{
+			buildRayCastBVH();
+			MT::memoryBarrier();
+			m_is_ray_cast_bvh_ready = true;
+		}
+	}
+	hit.m_origin = origin;
+	hit.m_dir = dir;
+	if (m_ray_cast_bvh.empty()) return hit;
+
 	Matrix inv = model_transform;
 	inv.inverse();
 	Vec3 local_origin = inv.transform(origin);
 	Vec3 local_dir = static_cast<Vec3>(inv * Vec4(dir.x, dir.y, dir.z, 0));
+	float t;
+	int mesh = m_ray_cast_bvh.castRay(local_origin, local_dir, &t);
+	if (mesh >= 0)
+	{
+		hit.m_is_hit = true;
+		hit.m_t = t;
+		hit.m_mesh = &m_meshes[m_lods[0].from_mesh + mesh];
+	}
+	return hit;
+}
+
 
-	const Array<Vec3>& vertices = m_vertices;
-	u16* indices16 = (u16*)&m_indices[0];
-	u32* indices32 = (u32*)&m_indices[0];
-	int vertex_offset = 0;
-	bool is16 = m_flags & (u32)Model::Flags::INDICES_16BIT;
-	for (int mesh_index = m_lods[0].from_mesh; mesh_index <= m_lods[0].to_mesh; ++mesh_index)
+LODMeshIndices Model::getLODMeshIndices(float squared_distance) const
+{
+	int i = 0;
+	while (squared_distance >= m_lods[i].distance) ++i;
+	if (m_is_lod_streaming && i < m_lod_count)
 	{
-		int indices_end = m_meshes[mesh_index].indices_offset + m_meshes[mesh_index].indices_count;
-		for(int i = m_meshes[mesh_index].indices_offset; i < indices_end; i += 3)
+		if (!isLODResident(i))
 		{
-			Vec3 p0, p1, p2;
-			if(is16)
-			{
-				p0 = vertices[vertex_offset + indices16[i]];
-				p1 = vertices[vertex_offset + indices16[i + 1]];
-				p2 = vertices[vertex_offset + indices16[i + 2]];
-			}
-			else
+			m_lod_geometry[i].is_requested = 1;
+			int requested = i;
+			// the coarsest LOD is always resident
+			while (i < m_lod_count - 1 && !isLODResident(i)) ++i;
+			if (!isLODResident(i))
 			{
-				p0 = vertices[vertex_offset + indices32[i]];
-				p1 = vertices[vertex_offset + indices32[i + 1]];
-				p2 = vertices[vertex_offset + indices32[i + 2]];
+				i = requested;
+				while (i > 0 && !isLODResident(i)) --i;
 			}
-			Vec3 normal = crossProduct(p1 - p0, p2 - p0);
-			float q = dotProduct(normal, local_dir);
-			if (q == 0)	continue;
+		}
+		m_lod_geometry[i].is_used = 1;
+	}
+	return {m_lods[i].from_mesh, m_lods[i].to_mesh};
+}
+
+
+int Model::getMeshLOD(const Mesh& mesh) const
+{
+	for (int i = 0; i < m_lod_count; ++i)
+	{
+		const LODGeometry& geometry = m_lod_geometry[i];
+		if (mesh.indices_offset >= geometry.indices_offset &&
+			mesh.indices_offset < geometry.indices_offset + geometry.indices_count)
+		{
+			return i;
+		}
+	}
+	ASSERT(false);
+	return 0;
+}
+
+
+bool Model::setMeshBuffers(const Mesh& mesh) const
+{
+	int stride = m_vertex_decl.getStride();
+	if (!m_has_lod_sections)
+	{
+		bgfx::setVertexBuffer(m_vertices_handle, mesh.attribute_array_offset / stride, mesh.attribute_array_size / stride);
+		bgfx::setIndexBuffer(m_indices_handle, mesh.indices_offset, mesh.indices_count);
+		return true;
+	}
+
+	int lod = getMeshLOD(mesh);
+	LODGeometry& geometry = m_lod_geometry[lod];
+	if (!isLODResident(lod))
+	{
+		geometry.is_requested = 1;
+		return false;
+	}
+	geometry.is_used = 1;
+	bgfx::setVertexBuffer(geometry.vertices_handle,
+		(mesh.attribute_array_offset - geometry.vertices_offset) / stride,
+		mesh.attribute_array_size / stride);
+	bgfx::setIndexBuffer(
+		geometry.indices_handle, mesh.indices_offset - geometry.indices_offset, mesh.indices_count);
+	return true;
+}
 
-			float d = -dotProduct(normal, p0);
-			float t = -(dotProduct(normal, local_origin) + d) / q;
-			if (t < 0) continue;
 
-			Vec3 hit_point = local_origin + local_dir * t;
+int Model::getResidentLODCount() const
+{
+	if (!m_has_lod_sections) return m_lod_count;
 
-			Vec3 edge0 = p1 - p0;
-			Vec3 VP0 = hit_point - p0;
-			if (dotProduct(normal, crossProduct(edge0, VP0)) < 0) continue;
+	int count = 0;
+	for (int i = 0; i < m_lod_count; ++i)
+	{
+		if (isLODResident(i)) ++count;
+	}
+	return count;
+}
 
-			Vec3 edge1 = p2 - p1;
-			Vec3 VP1 = hit_point - p1;
-			if (dotProduct(normal, crossProduct(edge1, VP1)) < 0) continue;
 
-			Vec3 edge2 = p0 - p2;
-			Vec3 VP2 = hit_point - p2;
-			if (dotProduct(normal, crossProduct(edge2, VP2)) < 0) continue;
+void Model::computeLODSections()
+{
+	// meshes of a LOD must be stored in a continuous range, not overlapping with other LODs,
+	// otherwise the geometry is kept in one piece
+	m_has_lod_sections = false;
+	int stride = m_vertex_decl.getStride();
+	for (int i = 0; i < m_lod_count; ++i)
+	{
+		LODGeometry& geometry = m_lod_geometry[i];
+		const LOD& lod = m_lods[i];
+		if (lod.from_mesh > lod.to_mesh || lod.to_mesh >= m_meshes.size()) return;
+
+		int vertices_end = 0, indices_end = 0;
+		geometry.vertices_offset = INT_MAX;
+		geometry.indices_offset = INT_MAX;
+		for (int j = lod.from_mesh; j <= lod.to_mesh; ++j)
+		{
+			const Mesh& mesh = m_meshes[j];
+			geometry.vertices_offset = Math::minimum(geometry.vertices_offset, mesh.attribute_array_offset);
+			geometry.indices_offset = Math::minimum(geometry.indices_offset, mesh.indices_offset);
+			vertices_end = Math::maximum(vertices_end, mesh.attribute_array_offset + mesh.attribute_array_size);
+			indices_end = Math::maximum(indices_end, mesh.indices_offset + mesh.indices_count);
+		}
+		geometry.vertices_size = vertices_end - geometry.vertices_offset;
+		geometry.indices_count = indices_end - geometry.indices_offset;
+		if (geometry.vertices_offset % stride != 0) return;
 
-			if (!hit.m_is_hit || hit.m_t > t)
+		for (int j = 0; j < i; ++j)
+		{
+			const LODGeometry& prev = m_lod_geometry[j];
+			if (geometry.vertices_offset < prev.vertices_offset + prev.vertices_size &&
+				prev.vertices_offset < vertices_end)
 			{
-				hit.m_is_hit = true;
-				hit.m_t = t;
-				hit.m_mesh = &m_meshes[mesh_index];
+				return;
+			}
+			if (geometry.indices_offset < prev.indices_offset + prev.indices_count &&
+				prev.indices_offset < indices_end)
+			{
+				return;
 			}
 		}
-		vertex_offset += m_meshes[mesh_index].attribute_array_size / m_vertex_decl.getStride();
 	}
-	hit.m_origin = origin;
-	hit.m_dir = dir;
-	return hit;
+	m_has_lod_sections = m_lod_count > 0;
+}
+
+
+void Model::createLODBuffers(int lod, const u8* lod_vertices)
+{
+	LODGeometry& geometry = m_lod_geometry[lod];
+	ASSERT(!bgfx::isValid(geometry.vertices_handle));
+
+	const bgfx::Memory* vertices_mem = bgfx::copy(lod_vertices, geometry.vertices_size);
+	geometry.vertices_handle = bgfx::createVertexBuffer(vertices_mem, m_vertex_decl);
+
+	int index_size = areIndices16() ? 2 : 4;
+	const bgfx::Memory* indices_mem =
+		bgfx::copy(&m_indices[geometry.indices_offset * index_size], geometry.indices_count * index_size);
+	geometry.indices_handle = bgfx::createIndexBuffer(indices_mem, index_size == 4 ? BGFX_BUFFER_INDEX32 : 0);
+}
+
+
+void Model::destroyLODBuffers(int lod)
+{
+	LODGeometry& geometry = m_lod_geometry[lod];
+	if (bgfx::isValid(geometry.vertices_handle)) bgfx::destroyVertexBuffer(geometry.vertices_handle);
+	if (bgfx::isValid(geometry.indices_handle)) bgfx::destroyIndexBuffer(geometry.indices_handle);
+	geometry.vertices_handle = BGFX_INVALID_HANDLE;
+	geometry.indices_handle = BGFX_INVALID_HANDLE;
+}
+
+
+// reads only the vertices of one requested LOD, indices are always resident
+void Model::streamLODs()
+{
+	ASSERT(m_stream_async == FS::FileSystem::INVALID_ASYNC);
+
+	m_stream_lod = -1;
+	for (int i = 0; i < m_lod_count; ++i)
+	{
+		if (m_lod_geometry[i].is_requested && !isLODResident(i))
+		{
+			m_stream_lod = i;
+			break;
+		}
+	}
+	if (m_stream_lod < 0) return;
+
+	const LODGeometry& geometry = m_lod_geometry[m_stream_lod];
+	FS::FileSystem& fs = m_resource_manager.getOwner().getFileSystem();
+	FS::ReadCallback cb;
+	cb.bind<Model, &Model::onLODLoaded>(this);
+	m_stream_async = fs.readAsync(fs.getDefaultDevice(),
+		getPath(),
+		geometry.file_offset,
+		geometry.vertices_size,
+		cb,
+		FS::FileSystem::Priority::LOW);
+}
+
+
+void Model::onLODLoaded(FS::IFile& file, bool success)
+{
+	m_stream_async = FS::FileSystem::INVALID_ASYNC;
+	if (!success || !isReady()) return;
+
+	PROFILE_FUNCTION();
+	LODGeometry& geometry = m_lod_geometry[m_stream_lod];
+	geometry.is_requested = 0;
+	if (isLODResident(m_stream_lod)) return;
+	if (file.size() != (size_t)geometry.vertices_size)
+	{
+		g_log_error.log("Renderer") << "Model " << getPath().c_str() << " changed on disk, can not stream LODs";
+		return;
+	}
+
+	createLODBuffers(m_stream_lod, (const u8*)file.getBuffer());
+	geometry.last_used_frame = static_cast<ModelManager&>(m_resource_manager).getFrame();
 }
 
 
 void Model::getPose(Pose& pose)
 {
 	ASSERT(pose.count == getBoneCount());
-	Vec3* pos = pose.positions;
-	Quat* rot = pose.rotations;
 	for (int i = 0, c = getBoneCount(); i < c; ++i)
 	{
-		pos[i] = m_bones[i].transform.pos;
-		rot[i] = m_bones[i].transform.rot;
+		pose.setPosition(i, m_bones[i].transform.pos);
+		pose.setRotation(i, m_bones[i].transform.rot);
 	}
 	pose.is_absolute = true;
 }
@@ -303,6 +502,7 @@ void Model::create(const bgfx::VertexDecl& vertex_decl,
 	lod.from_mesh = 0;
 	lod.to_mesh = 0;
 	m_lods[0] = lod;
+	m_lod_count = 1;
 
 	m_indices.resize(indices_size);
 	copyMemory(&m_indices[0], indices_data, indices_size);
@@ -317,6 +517,9 @@ void Model::create(const bgfx::VertexDecl& vertex_decl,
 
 void Model::computeRuntimeData(const u8* vertices)
 {
+	m_is_ray_cast_bvh_ready = false;
+	m_ray_cast_bvh.clear();
+
 	int index = 0;
 	float bounding_radius_squared = 0;
 	Vec3 min_vertex(0, 0, 0);
@@ -351,7 +554,7 @@ void Model::computeRuntimeData(const u8* vertices)
 }
 
 
-bool Model::parseGeometry(FS::IFile& file)
+bool Model::parseGeometry(FS::IFile& file, int* vertices_size)
 {
 	i32 indices_count = 0;
 	file.read(&indices_count, sizeof(indices_count));
@@ -361,19 +564,33 @@ bool Model::parseGeometry(FS::IFile& file)
 	m_indices.resize(indices_count * index_size);
 	file.read(&m_indices[0], index_size * indices_count);
 
-	i32 vertices_size = 0;
-	file.read(&vertices_size, sizeof(vertices_size));
-	if (vertices_size <= 0) return false;
+	*vertices_size = 0;
+	file.read(vertices_size, sizeof(*vertices_size));
+	if (*vertices_size <= 0) return false;
 
-	ASSERT(!bgfx::isValid(m_vertices_handle));
-	const bgfx::Memory* vertices_mem = bgfx::alloc(vertices_size);
-	file.read(vertices_mem->data, vertices_size);
-	m_vertices_handle = bgfx::createVertexBuffer(vertices_mem, m_vertex_decl);
+	// vertices are staged by stageVertices, once it's known which LODs are resident
+	m_vertices_file_offset = (u32)file.pos();
+	if (m_vertices_file_offset + *vertices_size > file.size()) return false;
+	return file.seek(FS::SeekMode::CURRENT, *vertices_size);
+}
 
-	ASSERT(!bgfx::isValid(m_indices_handle));
-	int indices_size = index_size * indices_count;
-	const bgfx::Memory* mem = bgfx::copy(&m_indices[0], indices_size);
-	m_indices_handle = bgfx::createIndexBuffer(mem, index_size == 4 ? BGFX_BUFFER_INDEX32 : 0);
+
+bool Model::stageVertices(FS::IFile& file, int vertices_size)
+{
+	// files from the memory device are not copied, the staging array gets only what is uploaded
+	const u8* vertices = (const u8*)file.getBuffer();
+	bool is_read = !vertices;
+	if (is_read)
+	{
+		m_staging_vertices.resize(vertices_size);
+		if (!file.seek(FS::SeekMode::BEGIN, m_vertices_file_offset)) return false;
+		if (!file.read(&m_staging_vertices[0], vertices_size)) return false;
+		vertices = &m_staging_vertices[0];
+	}
+	else
+	{
+		vertices += m_vertices_file_offset;
+	}
 
 	int vertex_count = 0;
 	for (int i = 0; i < m_meshes.size(); ++i)
@@ -383,8 +600,27 @@ bool Model::parseGeometry(FS::IFile& file)
 	m_vertices.resize(vertex_count);
 	m_uvs.resize(vertex_count);
 
-	computeRuntimeData(vertices_mem->data);
+	computeRuntimeData(vertices);
 
+	// only the coarsest LOD is uploaded when streaming, the rest is read from the file on request
+	const u8* staged = vertices;
+	int staged_size = vertices_size;
+	if (m_is_lod_streaming)
+	{
+		const LODGeometry& coarsest = m_lod_geometry[m_lod_count - 1];
+		staged = vertices + coarsest.vertices_offset;
+		staged_size = coarsest.vertices_size;
+	}
+	if (is_read)
+	{
+		moveMemory(&m_staging_vertices[0], staged, staged_size);
+		m_staging_vertices.resize(staged_size);
+	}
+	else
+	{
+		m_staging_vertices.resize(staged_size);
+		copyMemory(&m_staging_vertices[0], staged, staged_size);
+	}
 	return true;
 }
 
@@ -451,9 +687,11 @@ bool Model::parseBones(FS::IFile& file)
 			}
 		}
 	}
+	m_bone_parents.resize(m_bones.size());
 	for (int i = 0; i < m_bones.size(); ++i)
 	{
 		m_bones[i].inv_bind_transform = m_bones[i].transform.inverted();
+		m_bone_parents[i] = m_bones[i].parent_idx;
 	}
 	return true;
 }
@@ -493,9 +731,7 @@ bool Model::parseMeshes(FS::IFile& file, FileVersion version)
 		copyString(material_path, model_dir);
 		catString(material_path, material_name);
 		catString(material_path, ".mat");
-
-		auto* material_manager = m_resource_manager.getOwner().get(MATERIAL_TYPE);
-		Material* material = static_cast<Material*>(material_manager->load(Path(material_path)));
+		m_material_paths.emplace(material_path);
 
 		i32 attribute_array_offset = 0;
 		file.read(&attribute_array_offset, sizeof(attribute_array_offset));
@@ -507,11 +743,7 @@ bool Model::parseMeshes(FS::IFile& file, FileVersion version)
 		file.read(&mesh_tri_count, sizeof(mesh_tri_count));
 
 		file.read(&str_size, sizeof(str_size));
-		if (str_size >= MAX_PATH_LENGTH)
-		{
-			material_manager->unload(*material);
-			return false;
-		}
+		if (str_size >= MAX_PATH_LENGTH) return false;
 
 		char mesh_name[MAX_PATH_LENGTH];
 		mesh_name[str_size] = 0;
@@ -529,14 +761,14 @@ bool Model::parseMeshes(FS::IFile& file, FileVersion version)
 			if(i == 0) m_vertex_decl = vertex_decl;
 		}
 
-		m_meshes.emplace(material,
+		// material is loaded in finalize, it can not be done on a worker thread
+		m_meshes.emplace(nullptr,
 						 attribute_array_offset,
 						 attribute_array_size,
 						 indices_offset,
 						 mesh_tri_count * 3,
 						 mesh_name,
 						 m_allocator);
-		addDependency(*material);
 	}
 	return true;
 }
@@ -556,11 +788,28 @@ bool Model::parseLODs(FS::IFile& file)
 		file.read(&m_lods[i].distance, sizeof(m_lods[i].distance));
 		m_lods[i].from_mesh = i > 0 ? m_lods[i - 1].to_mesh + 1 : 0;
 	}
+	m_lod_count = lod_count;
 	return true;
 }
 
 
-bool Model::load(FS::IFile& file)
+bool Model::parseLODSections(FS::IFile& file)
+{
+	for (int i = 0; i < m_lod_count; ++i)
+	{
+		u32 offset = 0, size = 0;
+		file.read(&offset, sizeof(offset));
+		if (!file.read(&size, sizeof(size))) return false;
+		LODGeometry& geometry = m_lod_geometry[i];
+		// the importer and computeLODSections must agree, the file can not be streamed otherwise
+		if (m_has_lod_sections && size != (u32)geometry.vertices_size) m_has_lod_sections = false;
+		geometry.file_offset = offset;
+	}
+	return true;
+}
+
+
+bool Model::decode(FS::IFile& file)
 {
 	PROFILE_FUNCTION();
 	FileHeader header;
@@ -586,10 +835,27 @@ bool Model::load(FS::IFile& file)
 
 	if (header.version > (u32)FileVersion::SINGLE_VERTEX_DECL) parseVertexDeclEx(file, &m_vertex_decl);
 
-	if (parseMeshes(file, (FileVersion)header.version) && parseGeometry(file) && parseBones(file) && parseLODs(file))
+	int vertices_size;
+	if (parseMeshes(file, (FileVersion)header.version) && parseGeometry(file, &vertices_size) && parseBones(file) &&
+		parseLODs(file))
 	{
-		m_size = file.size();
-		return true;
+		computeLODSections();
+		bool has_file_sections = header.version > (u32)FileVersion::GLOBAL_VERTEX_DECL;
+		if (has_file_sections ? parseLODSections(file) : true)
+		{
+			// older files have the same layout, only without the section table
+			for (int i = 0; !has_file_sections && i < m_lod_count; ++i)
+			{
+				m_lod_geometry[i].file_offset = m_vertices_file_offset + m_lod_geometry[i].vertices_offset;
+			}
+			auto& manager = static_cast<ModelManager&>(m_resource_manager);
+			m_is_lod_streaming = m_has_lod_sections && manager.isLODStreamingEnabled() && m_lod_count > 1;
+			if (stageVertices(file, vertices_size))
+			{
+				m_size = file.size();
+				return true;
+			}
+		}
 	}
 
 	g_log_warning.log("Renderer") << "Error loading model " << getPath().c_str();
@@ -597,6 +863,53 @@ bool Model::load(FS::IFile& file)
 }
 
 
+bool Model::finalize()
+{
+	PROFILE_FUNCTION();
+	ASSERT(m_material_paths.size() == m_meshes.size());
+
+	if (m_has_lod_sections)
+	{
+		// only the coarsest LOD is staged when streaming, ModelManager loads the rest on request
+		auto& manager = static_cast<ModelManager&>(m_resource_manager);
+		for (int i = 0; i < m_lod_count; ++i)
+		{
+			if (!m_is_lod_streaming)
+			{
+				createLODBuffers(i, &m_staging_vertices[m_lod_geometry[i].vertices_offset]);
+			}
+			else if (i == m_lod_count - 1)
+			{
+				createLODBuffers(i, &m_staging_vertices[0]);
+			}
+			m_lod_geometry[i].last_used_frame = manager.getFrame();
+		}
+	}
+	else
+	{
+		ASSERT(!bgfx::isValid(m_vertices_handle));
+		const bgfx::Memory* vertices_mem = bgfx::copy(&m_staging_vertices[0], m_staging_vertices.size());
+		m_vertices_handle = bgfx::createVertexBuffer(vertices_mem, m_vertex_decl);
+
+		ASSERT(!bgfx::isValid(m_indices_handle));
+		const bgfx::Memory* mem = bgfx::copy(&m_indices[0], m_indices.size());
+		m_indices_handle = bgfx::createIndexBuffer(mem, areIndices16() ? 0 : BGFX_BUFFER_INDEX32);
+	}
+	m_staging_vertices.clear();
+
+	auto* material_manager = m_resource_manager.getOwner().get(MATERIAL_TYPE);
+	for (int i = 0; i < m_meshes.size(); ++i)
+	{
+		Material* material = static_cast<Material*>(material_manager->load(m_material_paths[i]));
+		m_meshes[i].material = material;
+		addDependency(*material);
+	}
+	m_material_paths.clear();
+
+	return true;
+}
+
+
 static Vec3 getBonePosition(Model* model, int bone_index)
 {
 	return model->getBone(bone_index).transform.pos;
@@ -640,18 +953,40 @@ void Model::unload(void)
 	auto* material_manager = m_resource_manager.getOwner().get(MATERIAL_TYPE);
 	for (int i = 0; i < m_meshes.size(); ++i)
 	{
+		// meshes of a model, which failed to decode, do not have materials
+		if (!m_meshes[i].material) continue;
 		removeDependency(*m_meshes[i].material);
 		material_manager->unload(*m_meshes[i].material);
 	}
 	m_meshes.clear();
+	m_material_paths.clear();
+	m_staging_vertices.clear();
 	m_bones.clear();
+	m_bone_parents.clear();
 	m_uvs.clear();
 	m_vertices.clear();
+	m_is_ray_cast_bvh_ready = false;
+	m_ray_cast_bvh.clear();
 
 	if(bgfx::isValid(m_vertices_handle)) bgfx::destroyVertexBuffer(m_vertices_handle);
 	if(bgfx::isValid(m_indices_handle)) bgfx::destroyIndexBuffer(m_indices_handle);
 	m_indices_handle = BGFX_INVALID_HANDLE;
 	m_vertices_handle = BGFX_INVALID_HANDLE;
+
+	if (m_stream_async != FS::FileSystem::INVALID_ASYNC)
+	{
+		m_resource_manager.getOwner().getFileSystem().cancelAsync(m_stream_async);
+		m_stream_async = FS::FileSystem::INVALID_ASYNC;
+	}
+	for (int i = 0; i < MAX_LOD_COUNT; ++i)
+	{
+		destroyLODBuffers(i);
+		m_lod_geometry[i].is_requested = 0;
+		m_lod_geometry[i].is_used = 0;
+	}
+	m_lod_count = 0;
+	m_has_lod_sections = false;
+	m_is_lod_streaming = false;
 }
 
 
@@ -5,10 +5,13 @@
 #include "engine/geometry.h"
 #include "engine/hash_map.h"
 #include "engine/matrix.h"
+#include "engine/mt/sync.h"
+#include "engine/path.h"
 #include "engine/quat.h"
 #include "engine/string.h"
 #include "engine/vec.h"
 #include "engine/resource.h"
+#include "renderer/ray_cast_bvh.h"
 #include <bgfx/bgfx.h>
 
 
@@ -77,6 +80,8 @@ struct LODMeshIndices
 
 class LUMIX_RENDERER_API Model LUMIX_FINAL : public Resource
 {
+	friend class ModelManager;
+
 public:
 	typedef HashMap<u32, int> BoneMap;
 
@@ -93,6 +98,7 @@ public:
 		FIRST,
 		WITH_FLAGS,
 		SINGLE_VERTEX_DECL,
+		GLOBAL_VERTEX_DECL,
 
 		LATEST // keep this last
 	};
@@ -136,22 +142,23 @@ public:
 		const void* attributes_data,
 		int attributes_size);
 
-	LODMeshIndices getLODMeshIndices(float squared_distance) const
-	{
-		int i = 0;
-		while (squared_distance >= m_lods[i].distance) ++i;
-		return {m_lods[i].from_mesh, m_lods[i].to_mesh};
-	}
+	// can be called from any thread, if the LOD's geometry is not resident, it's requested
+	// and the closest resident LOD is returned instead
+	LODMeshIndices getLODMeshIndices(float squared_distance) const;
+	// sets vertex and index buffers for rendering the mesh, returns false if the mesh's geometry
+	// is not resident, in that case it's requested and nothing is set
+	bool setMeshBuffers(const Mesh& mesh) const;
+	int getResidentLODCount() const;
 
 	Mesh& getMesh(int index) { return m_meshes[index]; }
-	bgfx::VertexBufferHandle getVerticesHandle() const { return m_vertices_handle; }
-	bgfx::IndexBufferHandle getIndicesHandle() const { return m_indices_handle; }
 	bgfx::VertexDecl getVertexDecl() const { return m_vertex_decl; }
 	const Mesh& getMesh(int index) const { return m_meshes[index]; }
 	const Mesh* getMeshPtr(int index) const { return &m_meshes[index]; }
 	int getMeshCount() const { return m_meshes.size(); }
 	int getBoneCount() const { return m_bones.size(); }
 	const Bone& getBone(int i) const { return m_bones[i]; }
+	// parent index of each bone, next to each other so poses can read them four at a time
+	const int* getBoneParents() const { return m_bone_parents.empty() ? nullptr : &m_bone_parents[0]; }
 	int getFirstNonrootBoneIndex() const { return m_first_nonroot_bone_index; }
 	BoneMap::iterator getBoneIndex(u32 hash) { return m_bone_map.find(hash); }
 	void getPose(Pose& pose);
@@ -159,6 +166,7 @@ public:
 	RayCastModelHit castRay(const Vec3& origin, const Vec3& dir, const Matrix& model_transform);
 	const AABB& getAABB() const { return m_aabb; }
 	LOD* getLODs() { return m_lods; }
+	int getLODCount() const { return m_lod_count; }
 	const u16* getIndices16() const { return areIndices16() ? (u16*)&m_indices[0] : nullptr; }
 	const u32* getIndices32() const { return areIndices16() ? nullptr : (u32*)&m_indices[0]; }
 	bool areIndices16() const { return (m_flags & (u32)Flags::INDICES_16BIT) != 0; }
@@ -179,15 +187,44 @@ private:
 
 	bool parseVertexDecl(FS::IFile& file, bgfx::VertexDecl* vertex_decl);
 	bool parseVertexDeclEx(FS::IFile& file, bgfx::VertexDecl* vertex_decl);
-	bool parseGeometry(FS::IFile& file);
+	bool parseGeometry(FS::IFile& file, int* vertices_size);
 	bool parseBones(FS::IFile& file);
 	bool parseMeshes(FS::IFile& file, FileVersion version);
 	bool parseLODs(FS::IFile& file);
+	bool parseLODSections(FS::IFile& file);
+	bool stageVertices(FS::IFile& file, int vertices_size);
 	int getBoneIdx(const char* name);
 	void computeRuntimeData(const u8* vertices);
+	void computeLODSections();
+	int getMeshLOD(const Mesh& mesh) const;
+	bool isLODResident(int lod) const { return bgfx::isValid(m_lod_geometry[lod].vertices_handle); }
+	void createLODBuffers(int lod, const u8* lod_vertices);
+	void destroyLODBuffers(int lod);
+	void streamLODs();
+	void onLODLoaded(FS::IFile& file, bool success);
+	void buildRayCastBVH();
 
 	void unload(void) override;
-	bool load(FS::IFile& file) override;
+	bool hasDecodePhase() const override { return true; }
+	bool decode(FS::IFile& file) override;
+	bool finalize() override;
+
+private:
+	// geometry of a LOD, it's a contiguous section of model's vertices and indices
+	struct LODGeometry
+	{
+		bgfx::VertexBufferHandle vertices_handle;
+		bgfx::IndexBufferHandle indices_handle;
+		int vertices_offset;
+		int vertices_size;
+		int indices_offset;
+		int indices_count;
+		// where the LOD's vertices are in the file, streaming reads only them
+		u32 file_offset;
+		u32 last_used_frame;
+		volatile i32 is_requested;
+		volatile i32 is_used;
+	};
 
 private:
 	IAllocator& m_allocator;
@@ -196,6 +233,7 @@ private:
 	bgfx::VertexBufferHandle m_vertices_handle;
 	Array<Mesh> m_meshes;
 	Array<Bone> m_bones;
+	Array<int> m_bone_parents;
 	Array<u8> m_indices;
 	Array<Vec3> m_vertices;
 	Array<Vec2> m_uvs;
@@ -205,6 +243,19 @@ private:
 	AABB m_aabb;
 	u32 m_flags;
 	int m_first_nonroot_bone_index;
+	Array<Path> m_material_paths;
+	Array<u8> m_staging_vertices;
+	mutable LODGeometry m_lod_geometry[MAX_LOD_COUNT];
+	int m_lod_count;
+	bool m_has_lod_sections;
+	bool m_is_lod_streaming;
+	u32 m_vertices_file_offset;
+	u32 m_stream_async;
+	int m_stream_lod;
+	// LOD0 triangles, built by the first ray cast
+	MT::SpinMutex m_ray_cast_mutex;
+	volatile bool m_is_ray_cast_bvh_ready;
+	RayCastBVH m_ray_cast_bvh;
 };
 
 
@@ -1,6 +1,8 @@
 #include "engine/lumix.h"
 #include "renderer/model_manager.h"
 
+#include "engine/fs/file_system.h"
+#include "engine/profiler.h"
 #include "engine/resource.h"
 #include "renderer/model.h"
 
@@ -15,4 +17,59 @@ namespace Lumix
 	{
 		LUMIX_DELETE(m_allocator, static_cast<Model*>(&resource));
 	}
+
+	void ModelManager::update()
+	{
+		PROFILE_FUNCTION();
+		ResourceManagerBase::update();
+
+		++m_frame;
+		int pending = 0;
+		int streamed_models = 0;
+		int resident_lods = 0;
+		for (Resource* resource : getResourceTable())
+		{
+			Model* model = static_cast<Model*>(resource);
+			if (model->m_stream_async != FS::FileSystem::INVALID_ASYNC) ++pending;
+		}
+
+		for (Resource* resource : getResourceTable())
+		{
+			Model* model = static_cast<Model*>(resource);
+			if (!model->isReady() || !model->m_is_lod_streaming) continue;
+
+			++streamed_models;
+			bool is_any_requested = false;
+			// the last LOD is the coarsest one and it's never dropped
+			for (int i = 0; i < model->m_lod_count; ++i)
+			{
+				auto& geometry = model->m_lod_geometry[i];
+				if (geometry.is_used)
+				{
+					geometry.is_used = 0;
+					geometry.last_used_frame = m_frame;
+				}
+				bool is_resident = model->isLODResident(i);
+				if (is_resident && i < model->m_lod_count - 1 && m_frame - geometry.last_used_frame > LOD_GRACE_FRAMES)
+				{
+					model->destroyLODBuffers(i);
+					is_resident = false;
+				}
+				if (geometry.is_requested && is_resident) geometry.is_requested = 0;
+				is_any_requested = is_any_requested || geometry.is_requested;
+				if (is_resident) ++resident_lods;
+			}
+
+			if (is_any_requested && model->m_stream_async == FS::FileSystem::INVALID_ASYNC &&
+				pending < MAX_PENDING_STREAMS)
+			{
+				model->streamLODs();
+				++pending;
+			}
+		}
+
+		PROFILE_INT("streamed models", streamed_models);
+		PROFILE_INT("resident model LODs", resident_lods);
+		PROFILE_INT("pending model LOD streams", pending);
+	}
 }
\ No newline at end of file
@@ -10,19 +10,33 @@ namespace Lumix
 
 	class LUMIX_RENDERER_API ModelManager LUMIX_FINAL : public ResourceManagerBase
 	{
+	public:
+		static const u32 LOD_GRACE_FRAMES = 300;
+		static const int MAX_PENDING_STREAMS = 4;
+
 	public:
 		ModelManager(IAllocator& allocator)
 			: ResourceManagerBase(allocator)
 			, m_allocator(allocator)
+			, m_is_lod_streaming_enabled(true)
+			, m_frame(0)
 		{}
 
 		~ModelManager() {}
 
+		void update() override;
+		// affects only models loaded afterwards
+		void enableLODStreaming(bool enable) { m_is_lod_streaming_enabled = enable; }
+		bool isLODStreamingEnabled() const { return m_is_lod_streaming_enabled; }
+		u32 getFrame() const { return m_frame; }
+
 	protected:
 		Resource* createResource(const Path& path) override;
 		void destroyResource(Resource& resource) override;
 
 	private:
 		IAllocator& m_allocator;
+		bool m_is_lod_streaming_enabled;
+		u32 m_frame;
 	};
 }
\ No newline at end of file
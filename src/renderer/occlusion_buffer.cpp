@@ -0,0 +1,361 @@
+#include "occlusion_buffer.h"
+#include "engine/array.h"
+#include "engine/geometry.h"
+#include "engine/math_utils.h"
+#include "engine/matrix.h"
+#include "engine/profiler.h"
+#include "engine/simd.h"
+#include "engine/string.h"
+#include "engine/vec.h"
+
+#include "engine/mtjd/group.h"
+#include "engine/mtjd/job.h"
+#include "engine/mtjd/manager.h"
+#include <cmath>
+
+
+namespace Lumix
+{
+
+
+static const int BAND_HEIGHT = 16;
+static const int BAND_COUNT = OcclusionBuffer::HEIGHT / BAND_HEIGHT;
+// occluders should be simple, anything above this is ignored
+static const int MAX_OCCLUDER_TRIANGLES = 64 * 1024;
+
+
+// screen space triangle, edge functions are a * x + b * y + c; they are moved inwards by half of a pixel,
+// so they are non negative in a pixel's center only if the whole pixel is inside the triangle
+struct OcclusionTriangle
+{
+	float edge_a[3];
+	float edge_b[3];
+	float edge_c[3];
+	// inverse view depth, unlike depth it is affine in screen space; moved by half of a pixel too,
+	// so it's the farthest depth inside a pixel
+	float depth_a;
+	float depth_b;
+	float depth_c;
+	int min_x;
+	int min_y;
+	int max_x;
+	int max_y;
+};
+
+
+class OcclusionBufferImpl;
+
+
+class OcclusionJob LUMIX_FINAL : public MTJD::Job
+{
+public:
+	OcclusionJob(OcclusionBufferImpl& buffer,
+		int band,
+		MTJD::Manager& manager,
+		IAllocator& allocator)
+		: Job(Job::AUTO_DESTROY, MTJD::Priority::Default, manager, allocator, allocator)
+		, m_buffer(buffer)
+		, m_band(band)
+	{
+		setJobName("OcclusionJob");
+	}
+
+	void execute() override;
+
+private:
+	OcclusionBufferImpl& m_buffer;
+	int m_band;
+};
+
+
+class OcclusionBufferImpl LUMIX_FINAL : public OcclusionBuffer
+{
+public:
+	OcclusionBufferImpl(MTJD::Manager& mtjd_manager, IAllocator& allocator)
+		: m_allocator(allocator)
+		, m_mtjd_manager(mtjd_manager)
+		, m_sync_point(true, allocator)
+		, m_triangles(allocator)
+	{
+		m_depth = (float*)m_allocator.allocate_aligned(sizeof(float) * WIDTH * HEIGHT, 16);
+		setMemory(m_depth, 0, sizeof(float) * WIDTH * HEIGHT);
+		m_position.set(0, 0, 0);
+		m_direction.set(0, 0, -1);
+		m_right.set(1, 0, 0);
+		m_up.set(0, 1, 0);
+		m_scale_x = m_scale_y = 1;
+		m_near = 0.1f;
+	}
+
+
+	~OcclusionBufferImpl()
+	{
+		m_allocator.deallocate_aligned(m_depth);
+	}
+
+
+	IAllocator& getAllocator() { return m_allocator; }
+
+
+	void begin(const Frustum& frustum) override
+	{
+		ASSERT(frustum.fov > 0);
+		m_triangles.clear();
+		setMemory(m_depth, 0, sizeof(float) * WIDTH * HEIGHT);
+
+		m_position = frustum.position;
+		m_direction = frustum.direction;
+		m_direction.normalize();
+		m_right = crossProduct(m_direction, frustum.up);
+		m_right.normalize();
+		m_up = crossProduct(m_right, m_direction);
+		float tang = tanf(frustum.fov * 0.5f);
+		m_scale_x = WIDTH * 0.5f / (tang * frustum.ratio);
+		m_scale_y = HEIGHT * 0.5f / tang;
+		m_near = frustum.near_distance;
+	}
+
+
+	void addOccluder(const Vec3* vertices, const u16* indices, int index_count, const Matrix& mtx) override
+	{
+		addTriangles(vertices, indices, index_count, mtx);
+	}
+
+
+	void addOccluder(const Vec3* vertices, const u32* indices, int index_count, const Matrix& mtx) override
+	{
+		addTriangles(vertices, indices, index_count, mtx);
+	}
+
+
+	void rasterize() override
+	{
+		PROFILE_FUNCTION();
+		PROFILE_INT("triangles", m_triangles.size());
+		if (m_triangles.empty()) return;
+
+		// a job is deleted by the worker after it releases m_sync_point, i.e. possibly after sync() returns,
+		// so the jobs must not come from memory owned by the buffer
+		OcclusionJob* jobs[BAND_COUNT];
+		for (int i = 0; i < BAND_COUNT; ++i)
+		{
+			jobs[i] = LUMIX_NEW(m_allocator, OcclusionJob)(*this, i, m_mtjd_manager, m_allocator);
+			jobs[i]->addDependency(&m_sync_point);
+		}
+		for (auto* job : jobs)
+		{
+			m_mtjd_manager.schedule(job);
+		}
+		m_sync_point.sync();
+	}
+
+
+	void rasterizeBand(int band)
+	{
+		PROFILE_FUNCTION();
+		static const float LANE_OFFSETS[] = { 0.5f, 1.5f, 2.5f, 3.5f };
+		const float4 lane_offsets = f4LoadUnaligned(LANE_OFFSETS);
+		const float4 zero = f4Splat(0);
+		int band_min_y = band * BAND_HEIGHT;
+		int band_max_y = band_min_y + BAND_HEIGHT - 1;
+
+		for (const OcclusionTriangle& tri : m_triangles)
+		{
+			if (tri.max_y < band_min_y || tri.min_y > band_max_y) continue;
+
+			const float4 a0 = f4Splat(tri.edge_a[0]);
+			const float4 a1 = f4Splat(tri.edge_a[1]);
+			const float4 a2 = f4Splat(tri.edge_a[2]);
+			const float4 depth_a = f4Splat(tri.depth_a);
+			int min_y = Math::maximum(tri.min_y, band_min_y);
+			int max_y = Math::minimum(tri.max_y, band_max_y);
+			int min_x = tri.min_x & ~3;
+			for (int y = min_y; y <= max_y; ++y)
+			{
+				float center_y = y + 0.5f;
+				const float4 row0 = f4Splat(tri.edge_b[0] * center_y + tri.edge_c[0]);
+				const float4 row1 = f4Splat(tri.edge_b[1] * center_y + tri.edge_c[1]);
+				const float4 row2 = f4Splat(tri.edge_b[2] * center_y + tri.edge_c[2]);
+				const float4 row_depth = f4Splat(tri.depth_b * center_y + tri.depth_c);
+				float* LUMIX_RESTRICT row = m_depth + y * WIDTH;
+				for (int x = min_x; x <= tri.max_x; x += 4)
+				{
+					float4 center_x = f4Add(f4Splat((float)x), lane_offsets);
+					float4 e0 = f4Add(f4Mul(a0, center_x), row0);
+					float4 e1 = f4Add(f4Mul(a1, center_x), row1);
+					float4 e2 = f4Add(f4Mul(a2, center_x), row2);
+					float4 min_e = f4Min(e0, f4Min(e1, e2));
+					if (f4MoveMask(min_e) == 0xf) continue;
+
+					// partially covered pixels keep their depth, otherwise the buffer would not be conservative
+					float4 outside = f4CmpLT(min_e, zero);
+					float4 old_depth = f4Load(row + x);
+					float4 depth = f4Max(old_depth, f4Add(f4Mul(depth_a, center_x), row_depth));
+					f4Store(row + x, f4Select(outside, old_depth, depth));
+				}
+			}
+		}
+	}
+
+
+	bool isVisible(const Sphere& sphere) const override
+	{
+		if (m_triangles.empty()) return true;
+
+		Vec3 rel = sphere.position - m_position;
+		float r = sphere.radius;
+		float view_z = dotProduct(rel, m_direction);
+		float near_z = view_z - r;
+		if (near_z <= m_near) return true;
+
+		float far_z = view_z + r;
+		float view_x = dotProduct(rel, m_right);
+		float view_y = dotProduct(rel, m_up);
+		// x / z is monotonic in both x and z, so the extremes of the sphere's box are in its corners
+		float left = Math::minimum((view_x - r) / near_z, (view_x - r) / far_z) * m_scale_x + WIDTH * 0.5f;
+		float right = Math::maximum((view_x + r) / near_z, (view_x + r) / far_z) * m_scale_x + WIDTH * 0.5f;
+		float top = HEIGHT * 0.5f - Math::maximum((view_y + r) / near_z, (view_y + r) / far_z) * m_scale_y;
+		float bottom = HEIGHT * 0.5f - Math::minimum((view_y - r) / near_z, (view_y - r) / far_z) * m_scale_y;
+		if (right < 0 || bottom < 0 || left >= WIDTH || top >= HEIGHT) return true;
+
+		int min_x = (int)Math::maximum(left, 0.0f);
+		int max_x = (int)Math::minimum(right, WIDTH - 1.0f);
+		int min_y = (int)Math::maximum(top, 0.0f);
+		int max_y = (int)Math::minimum(bottom, HEIGHT - 1.0f);
+		float nearest = 1 / near_z;
+		const float4 nearest4 = f4Splat(nearest);
+		for (int y = min_y; y <= max_y; ++y)
+		{
+			const float* LUMIX_RESTRICT row = m_depth + y * WIDTH;
+			int x = min_x;
+			for (; x + 3 <= max_x; x += 4)
+			{
+				if (f4MoveMask(f4Sub(f4LoadUnaligned(row + x), nearest4)) != 0) return true;
+			}
+			for (; x <= max_x; ++x)
+			{
+				if (row[x] < nearest) return true;
+			}
+		}
+		return false;
+	}
+
+
+	int getTriangleCount() const override { return m_triangles.size(); }
+	const float* getDepth() const override { return m_depth; }
+
+
+private:
+	// x, y in pixels, z is inverse view depth or 0 if the vertex is closer than the near plane
+	Vec3 project(const Vec3& world_pos) const
+	{
+		Vec3 rel = world_pos - m_position;
+		float view_z = dotProduct(rel, m_direction);
+		if (view_z < m_near) return Vec3(0, 0, 0);
+
+		float inv_z = 1 / view_z;
+		return Vec3(WIDTH * 0.5f + dotProduct(rel, m_right) * inv_z * m_scale_x,
+			HEIGHT * 0.5f - dotProduct(rel, m_up) * inv_z * m_scale_y,
+			inv_z);
+	}
+
+
+	template <typename T>
+	void addTriangles(const Vec3* vertices, const T* indices, int index_count, const Matrix& mtx)
+	{
+		PROFILE_FUNCTION();
+		for (int i = 0; i + 2 < index_count; i += 3)
+		{
+			if (m_triangles.size() >= MAX_OCCLUDER_TRIANGLES) return;
+
+			Vec3 p0 = project(mtx.transform(vertices[indices[i]]));
+			Vec3 p1 = project(mtx.transform(vertices[indices[i + 1]]));
+			Vec3 p2 = project(mtx.transform(vertices[indices[i + 2]]));
+			// there is no clipping, triangles crossing the near plane are not used, which is conservative
+			if (p0.z == 0 || p1.z == 0 || p2.z == 0) continue;
+
+			float area = (p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y);
+			if (Math::abs(area) < 1e-6f) continue;
+			// occluders are rasterized from both sides
+			if (area < 0)
+			{
+				Vec3 tmp = p1;
+				p1 = p2;
+				p2 = tmp;
+				area = -area;
+			}
+
+			float min_x = Math::minimum(p0.x, Math::minimum(p1.x, p2.x));
+			float max_x = Math::maximum(p0.x, Math::maximum(p1.x, p2.x));
+			float min_y = Math::minimum(p0.y, Math::minimum(p1.y, p2.y));
+			float max_y = Math::maximum(p0.y, Math::maximum(p1.y, p2.y));
+			if (max_x < 0 || max_y < 0 || min_x >= WIDTH || min_y >= HEIGHT) continue;
+
+			OcclusionTriangle tri;
+			// pixels whose centers are inside the bounds, fully covered pixels are a subset of them
+			tri.min_x = (int)ceilf(Math::maximum(min_x, 0.0f) - 0.5f);
+			tri.max_x = (int)floorf(Math::minimum(max_x, (float)WIDTH) - 0.5f);
+			tri.min_y = (int)ceilf(Math::maximum(min_y, 0.0f) - 0.5f);
+			tri.max_y = (int)floorf(Math::minimum(max_y, (float)HEIGHT) - 0.5f);
+			if (tri.min_x > tri.max_x || tri.min_y > tri.max_y) continue;
+
+			const Vec3* points[] = { &p0, &p1, &p2 };
+			for (int j = 0; j < 3; ++j)
+			{
+				const Vec3& a = *points[j];
+				const Vec3& b = *points[(j + 1) % 3];
+				tri.edge_a[j] = a.y - b.y;
+				tri.edge_b[j] = b.x - a.x;
+				tri.edge_c[j] = a.x * b.y - b.x * a.y;
+			}
+			// edge j is opposite to vertex (j + 2) % 3, normalized edge functions are barycentric coordinates
+			float inv_area = 1 / area;
+			tri.depth_a = (tri.edge_a[1] * p0.z + tri.edge_a[2] * p1.z + tri.edge_a[0] * p2.z) * inv_area;
+			tri.depth_b = (tri.edge_b[1] * p0.z + tri.edge_b[2] * p1.z + tri.edge_b[0] * p2.z) * inv_area;
+			tri.depth_c = (tri.edge_c[1] * p0.z + tri.edge_c[2] * p1.z + tri.edge_c[0] * p2.z) * inv_area;
+			// an affine function's minimum over a pixel is in one of its corners
+			tri.depth_c -= 0.5f * (Math::abs(tri.depth_a) + Math::abs(tri.depth_b));
+			for (int j = 0; j < 3; ++j)
+			{
+				tri.edge_c[j] -= 0.5f * (Math::abs(tri.edge_a[j]) + Math::abs(tri.edge_b[j]));
+			}
+			m_triangles.push(tri);
+		}
+	}
+
+
+private:
+	IAllocator& m_allocator;
+	MTJD::Manager& m_mtjd_manager;
+	MTJD::Group m_sync_point;
+	Array<OcclusionTriangle> m_triangles;
+	float* m_depth;
+	Vec3 m_position;
+	Vec3 m_direction;
+	Vec3 m_right;
+	Vec3 m_up;
+	float m_scale_x;
+	float m_scale_y;
+	float m_near;
+};
+
+
+void OcclusionJob::execute()
+{
+	m_buffer.rasterizeBand(m_band);
+}
+
+
+OcclusionBuffer* OcclusionBuffer::create(MTJD::Manager& mtjd_manager, IAllocator& allocator)
+{
+	return LUMIX_NEW(allocator, OcclusionBufferImpl)(mtjd_manager, allocator);
+}
+
+
+void OcclusionBuffer::destroy(OcclusionBuffer& buffer)
+{
+	LUMIX_DELETE(static_cast<OcclusionBufferImpl&>(buffer).getAllocator(), &buffer);
+}
+
+
+} // namespace Lumix
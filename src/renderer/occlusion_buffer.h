@@ -0,0 +1,50 @@
+#pragma once
+
+
+#include "engine/lumix.h"
+
+
+namespace Lumix
+{
+	class IAllocator;
+	struct Frustum;
+	struct Matrix;
+	struct Sphere;
+	struct Vec3;
+
+
+	namespace MTJD
+	{
+		class Manager;
+	}
+
+
+	// low resolution depth buffer rasterized on the CPU, big occluders hide what is behind them
+	// before anything is sent to the GPU; a pixel is written only if a single triangle covers all of it,
+	// so pixels on edges shared by two triangles stay empty and occluders should have few big triangles
+	class LUMIX_RENDERER_API OcclusionBuffer
+	{
+	public:
+		static const int WIDTH = 256;
+		static const int HEIGHT = 128;
+
+		OcclusionBuffer() { }
+		virtual ~OcclusionBuffer() { }
+
+		static OcclusionBuffer* create(MTJD::Manager& mtjd_manager, IAllocator& allocator);
+		static void destroy(OcclusionBuffer& buffer);
+
+		// clears the buffer and the occluders, only perspective frustums are supported
+		virtual void begin(const Frustum& frustum) = 0;
+		virtual void addOccluder(const Vec3* vertices, const u16* indices, int index_count, const Matrix& mtx) = 0;
+		virtual void addOccluder(const Vec3* vertices, const u32* indices, int index_count, const Matrix& mtx) = 0;
+		// rasterizes all occluders on worker threads, returns when the buffer is complete
+		virtual void rasterize() = 0;
+		// conservative, false only if the whole sphere is behind occluders; thread safe after rasterize()
+		virtual bool isVisible(const Sphere& sphere) const = 0;
+
+		virtual int getTriangleCount() const = 0;
+		// WIDTH * HEIGHT inverse view depths of the closest occluders, 0 where there is no occluder
+		virtual const float* getDepth() const = 0;
+	};
+} // namespace Lumix
@@ -7,7 +7,11 @@
 #include "engine/lifo_allocator.h"
 #include "engine/log.h"
 #include "engine/lua_wrapper.h"
+#include "engine/mtjd/generic_job.h"
+#include "engine/mtjd/group.h"
+#include "engine/mtjd/manager.h"
 #include "engine/profiler.h"
+#include "engine/radix_sort.h"
 #include "engine/engine.h"
 #include "imgui/imgui.h"
 #include "lua_script/lua_script_system.h"
@@ -34,6 +38,9 @@ namespace Lumix
 
 static const float SHADOW_CAM_NEAR = 50.0f;
 static const float SHADOW_CAM_FAR = 5000.0f;
+// draw packets of fewer meshes are generated faster on one thread than it takes to sync the jobs
+static const int MIN_MESHES_PER_PACKET_JOB = 256;
+static const int LIGHT_CLUSTERS_TEXTURE_WIDTH = 1024;
 static bool is_opengl = false;
 
 
@@ -48,6 +55,90 @@ struct InstanceData
 };
 
 
+// textures and uniforms of material's and view's command buffers, decoded on worker threads
+// into DrawPacketStream::textures and DrawPacketStream::uniforms
+struct DrawState
+{
+	int first_texture;
+	int texture_count;
+	int first_uniform;
+	int uniform_count;
+	// value of HAS_SHADOWMAP define set by the view, -1 if the view does not set it
+	i8 shadowmap_define;
+};
+
+
+struct DrawTexture
+{
+	u8 stage;
+	bgfx::UniformHandle uniform;
+	bgfx::TextureHandle texture;
+};
+
+
+struct DrawUniform
+{
+	bgfx::UniformHandle uniform;
+	// points into a command buffer or to the pipeline, both live until the packet is submitted
+	const void* value;
+	u16 count;
+};
+
+
+// everything needed to submit one draw call, packets are generated on worker threads
+// and replayed to bgfx on the main thread
+struct DrawPacket
+{
+	static const int MAX_BONE_COUNT = 128;
+
+	enum Type : u8
+	{
+		INSTANCED,
+		SKINNED,
+		MULTILAYER
+	};
+
+	Type type;
+	u8 view_idx;
+	// instances of INSTANCED packets, bones of the others
+	int matrix_count;
+	// into DrawPacketStream::instance_matrices for INSTANCED packets, into DrawPacketStream::bone_matrices
+	// for the others, where the model matrix is followed by bone matrices if they are not cached
+	int matrices_offset;
+	// the scene's per-frame skinning matrices cache, nullptr if bone matrices are in the stream
+	const Matrix* bone_matrices;
+	const Model* model;
+	const Mesh* mesh;
+	u64 render_state;
+	bgfx::ProgramHandle program;
+	DrawState state;
+	// MULTILAYER packets are rendered in the default view too
+	DrawState default_view_state;
+};
+
+
+struct DrawPacketStream
+{
+	explicit DrawPacketStream(IAllocator& allocator)
+		: packets(allocator)
+		, instance_matrices(allocator)
+		, bone_matrices(allocator)
+		, textures(allocator)
+		, uniforms(allocator)
+		, first_instance(0)
+	{
+	}
+
+	Array<DrawPacket> packets;
+	Array<Matrix> instance_matrices;
+	Array<Matrix> bone_matrices;
+	Array<DrawTexture> textures;
+	Array<DrawUniform> uniforms;
+	// index of instance_matrices[0] in the instance buffer shared by all streams
+	int first_instance;
+};
+
+
 struct View
 {
 	u8 bgfx_id;
@@ -55,6 +146,8 @@ struct View
 	u64 render_state;
 	u32 stencil;
 	int pass_idx;
+	// draw calls keep the order of the render queue, bgfx does not sort them again
+	bool is_sequential;
 	CommandBufferGenerator command_buffer;
 };
 
@@ -255,6 +348,16 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 	};
 
 
+	// per frame data for shaders, uploaded in rows of LIGHT_CLUSTERS_TEXTURE_WIDTH texels
+	struct LightClustersTexture
+	{
+		bgfx::TextureHandle handle;
+		bgfx::TextureFormat::Enum format;
+		int texel_size;
+		int height;
+	};
+
+
 	struct BaseVertex
 	{
 		float x, y, z;
@@ -277,6 +380,14 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 		, m_default_cubemap(nullptr)
 		, m_debug_flags(BGFX_DEBUG_TEXT)
 		, m_point_light_shadowmaps(allocator)
+		, m_render_queue(allocator)
+		, m_sort_keys(allocator)
+		, m_sort_values(allocator)
+		, m_skinned_instances(allocator)
+		, m_tmp_sort_keys(allocator)
+		, m_tmp_sort_values(allocator)
+		, m_packet_streams(allocator)
+		, m_packets_sync_point(true, allocator)
 		, m_is_rendering_in_shadowmap(false)
 		, m_is_ready(false)
 		, m_debug_index_buffer(BGFX_INVALID_HANDLE)
@@ -290,6 +401,14 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 		{
 			handle = BGFX_INVALID_HANDLE;
 		}
+		for (auto& handle : m_instance_buffers)
+		{
+			handle = BGFX_INVALID_HANDLE;
+		}
+		m_instance_buffer_idx = 0;
+		m_light_clusters_texture = {BGFX_INVALID_HANDLE, bgfx::TextureFormat::RG32F, sizeof(float) * 2, 0};
+		m_light_cluster_indices_texture = {BGFX_INVALID_HANDLE, bgfx::TextureFormat::R32F, sizeof(float), 0};
+		m_clustered_lights_texture = {BGFX_INVALID_HANDLE, bgfx::TextureFormat::RGBA32F, sizeof(float) * 4, 0};
 		is_opengl = renderer.isOpenGL();
 		m_deferred_point_light_vertex_decl.begin()
 			.add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
@@ -301,6 +420,14 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 			.add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Float)
 			.end();
 
+		// a model matrix per instance, only the stride matters for instance data
+		m_instance_decl.begin()
+			.add(bgfx::Attrib::TexCoord7, 4, bgfx::AttribType::Float)
+			.add(bgfx::Attrib::TexCoord6, 4, bgfx::AttribType::Float)
+			.add(bgfx::Attrib::TexCoord5, 4, bgfx::AttribType::Float)
+			.add(bgfx::Attrib::TexCoord4, 4, bgfx::AttribType::Float)
+			.end();
+
 		m_has_shadowmap_define_idx = m_renderer.getShaderDefineIdx("HAS_SHADOWMAP");
 
 		createUniforms();
@@ -390,6 +517,7 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 			return;
 		}
 
+		PROFILE_LOAD_PHASE("Pipeline load");
 		cleanup();
 
 		m_lua_state = lua_newthread(m_renderer.getEngine().getState());
@@ -498,6 +626,7 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 		m_terrain_matrix_uniform = bgfx::createUniform("u_terrainMatrix", bgfx::UniformType::Mat4);
 		m_decal_matrix_uniform = bgfx::createUniform("u_decalMatrix", bgfx::UniformType::Mat4);
 		m_emitter_matrix_uniform = bgfx::createUniform("u_emitterMatrix", bgfx::UniformType::Mat4);
+		m_light_clusters_params_uniform = bgfx::createUniform("u_lightClustersParams", bgfx::UniformType::Vec4);
 	}
 
 
@@ -526,6 +655,7 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 		bgfx::destroyUniform(m_texture_size_uniform);
 		bgfx::destroyUniform(m_decal_matrix_uniform);
 		bgfx::destroyUniform(m_emitter_matrix_uniform);
+		bgfx::destroyUniform(m_light_clusters_params_uniform);
 	}
 
 
@@ -559,10 +689,20 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 		bgfx::destroyIndexBuffer(m_particle_index_buffer);
 		bgfx::destroyVertexBuffer(m_particle_vertex_buffer);
 		if (bgfx::isValid(m_debug_index_buffer)) bgfx::destroyDynamicIndexBuffer(m_debug_index_buffer);
+		if (bgfx::isValid(m_light_clusters_texture.handle)) bgfx::destroyTexture(m_light_clusters_texture.handle);
+		if (bgfx::isValid(m_light_cluster_indices_texture.handle))
+		{
+			bgfx::destroyTexture(m_light_cluster_indices_texture.handle);
+		}
+		if (bgfx::isValid(m_clustered_lights_texture.handle)) bgfx::destroyTexture(m_clustered_lights_texture.handle);
 		for (auto& handle : m_debug_vertex_buffers)
 		{
 			if (bgfx::isValid(handle)) bgfx::destroyDynamicVertexBuffer(handle);
 		}
+		for (auto& handle : m_instance_buffers)
+		{
+			if (bgfx::isValid(handle)) bgfx::destroyDynamicVertexBuffer(handle);
+		}
 	}
 
 
@@ -736,7 +876,6 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 		Mesh& mesh = *data.mesh;
 		const Model& model = *data.model;
 		Material* material = mesh.material;
-		const u16 stride = model.getVertexDecl().getStride();
 
 		int view_idx = m_layer_to_view_map[material->getRenderLayer()];
 		ASSERT(view_idx >= 0);
@@ -745,20 +884,21 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 		executeCommandBuffer(material->getCommandBuffer(), material);
 		executeCommandBuffer(view.command_buffer.buffer, material);
 
-		bgfx::setVertexBuffer(model.getVerticesHandle(),
-							  mesh.attribute_array_offset / stride,
-							  mesh.attribute_array_size / stride);
-		bgfx::setIndexBuffer(model.getIndicesHandle(),
-							 mesh.indices_offset,
-							 mesh.indices_count);
-		bgfx::setStencil(view.stencil, BGFX_STENCIL_NONE);
-		bgfx::setState(view.render_state | material->getRenderStates());
-		bgfx::setInstanceDataBuffer(data.buffer, data.instance_count);
-		ShaderInstance& shader_instance = mesh.material->getShaderInstance();
-		++m_stats.draw_call_count;
-		m_stats.instance_count += data.instance_count;
-		m_stats.triangle_count += data.instance_count * mesh.indices_count / 3;
-		bgfx::submit(view.bgfx_id, shader_instance.getProgramHandle(view.pass_idx));
+		if (model.setMeshBuffers(mesh))
+		{
+			bgfx::setStencil(view.stencil, BGFX_STENCIL_NONE);
+			bgfx::setState(view.render_state | material->getRenderStates());
+			bgfx::setInstanceDataBuffer(data.buffer, data.instance_count);
+			ShaderInstance& shader_instance = mesh.material->getShaderInstance();
+			++m_stats.draw_call_count;
+			m_stats.instance_count += data.instance_count;
+			m_stats.triangle_count += data.instance_count * mesh.indices_count / 3;
+			bgfx::submit(view.bgfx_id, shader_instance.getProgramHandle(view.pass_idx));
+		}
+		else
+		{
+			bgfx::discard();
+		}
 
 		data.buffer = nullptr;
 		data.instance_count = 0;
@@ -892,6 +1032,8 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 		m_current_view->stencil = BGFX_STENCIL_NONE;
 		m_current_view->render_state = BGFX_STATE_RGB_WRITE | BGFX_STATE_ALPHA_WRITE | BGFX_STATE_DEPTH_WRITE | BGFX_STATE_MSAA;
 		m_current_view->pass_idx = m_pass_idx;
+		m_current_view->is_sequential = false;
+		bgfx::setViewSeq(m_current_view->bgfx_id, false);
 		m_current_view->command_buffer.clear();
 		m_global_textures_count = 0;
 		if (layer_mask != 0)
@@ -1017,6 +1159,103 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 	}
 
 
+	// position and radius, color and attenuation, direction and fov, specular color
+	void getPointLightData(ComponentHandle light_cmp, Vec4* data)
+	{
+		Universe& universe = m_scene->getUniverse();
+		Entity entity = m_scene->getPointLightEntity(light_cmp);
+		Vec3 light_dir = universe.getRotation(entity).rotate(Vec3(0, 0, -1));
+		float intensity = m_scene->getPointLightIntensity(light_cmp);
+		intensity *= intensity;
+		Vec3 color = m_scene->getPointLightColor(light_cmp) * intensity;
+		float specular_intensity = m_scene->getPointLightSpecularIntensity(light_cmp);
+		data[0].set(universe.getPosition(entity), m_scene->getLightRange(light_cmp));
+		data[1].set(color, m_scene->getLightAttenuation(light_cmp));
+		data[2].set(light_dir, m_scene->getLightFOV(light_cmp));
+		data[3].set(m_scene->getPointLightSpecularColor(light_cmp) * specular_intensity * specular_intensity, 1);
+	}
+
+
+	// returns zeroed memory for texel_count texels, the texture is recreated if it is too small
+	const bgfx::Memory* allocLightClustersTexture(LightClustersTexture& texture, int texel_count, int* rows)
+	{
+		*rows = Math::maximum(1, (texel_count + LIGHT_CLUSTERS_TEXTURE_WIDTH - 1) / LIGHT_CLUSTERS_TEXTURE_WIDTH);
+		if (!bgfx::isValid(texture.handle) || texture.height < *rows)
+		{
+			if (bgfx::isValid(texture.handle)) bgfx::destroyTexture(texture.handle);
+			texture.height = *rows;
+			texture.handle = bgfx::createTexture2D(LIGHT_CLUSTERS_TEXTURE_WIDTH,
+				(u16)texture.height,
+				false,
+				1,
+				texture.format,
+				BGFX_TEXTURE_MIN_POINT | BGFX_TEXTURE_MAG_POINT | BGFX_TEXTURE_MIP_POINT | BGFX_TEXTURE_U_CLAMP |
+					BGFX_TEXTURE_V_CLAMP);
+		}
+		const bgfx::Memory* mem = bgfx::alloc(LIGHT_CLUSTERS_TEXTURE_WIDTH * *rows * texture.texel_size);
+		setMemory(mem->data, 0, mem->size);
+		return mem;
+	}
+
+
+	// point lights in the camera frustum assigned to view space clusters, see LightClusters
+	void bindLightClusters(int clusters_uniform_idx, int light_indices_uniform_idx, int lights_uniform_idx)
+	{
+		PROFILE_FUNCTION();
+		if (m_applied_camera == INVALID_COMPONENT) return;
+
+		LightClusters clusters;
+		if (!m_scene->getLightClusters(m_camera_frustum, &clusters)) return;
+
+		int rows;
+		const bgfx::Memory* mem =
+			allocLightClustersTexture(m_light_clusters_texture, LightClusters::CLUSTER_COUNT, &rows);
+		float* cluster_data = (float*)mem->data;
+		for (int i = 0; i < LightClusters::CLUSTER_COUNT; ++i)
+		{
+			cluster_data[i * 2] = (float)clusters.clusters[i].offset;
+			cluster_data[i * 2 + 1] = (float)clusters.clusters[i].count;
+		}
+		bgfx::updateTexture2D(m_light_clusters_texture.handle, 0, 0, 0, 0, LIGHT_CLUSTERS_TEXTURE_WIDTH, rows, mem);
+
+		mem = allocLightClustersTexture(m_light_cluster_indices_texture, clusters.light_index_count, &rows);
+		float* index_data = (float*)mem->data;
+		for (int i = 0; i < clusters.light_index_count; ++i)
+		{
+			index_data[i] = (float)clusters.light_indices[i];
+		}
+		bgfx::updateTexture2D(
+			m_light_cluster_indices_texture.handle, 0, 0, 0, 0, LIGHT_CLUSTERS_TEXTURE_WIDTH, rows, mem);
+
+		mem = allocLightClustersTexture(m_clustered_lights_texture, clusters.light_count * 4, &rows);
+		Vec4* light_data = (Vec4*)mem->data;
+		for (int i = 0; i < clusters.light_count; ++i)
+		{
+			getPointLightData(clusters.lights[i], &light_data[i * 4]);
+		}
+		bgfx::updateTexture2D(m_clustered_lights_texture.handle, 0, 0, 0, 0, LIGHT_CLUSTERS_TEXTURE_WIDTH, rows, mem);
+
+		// z slice of a view space position is log(z / params.x) * params.y
+		Vec4 params(clusters.near_distance,
+			LightClusters::SIZE_Z / logf(clusters.far_distance / clusters.near_distance),
+			(float)LIGHT_CLUSTERS_TEXTURE_WIDTH,
+			(float)clusters.light_count);
+		m_current_view->command_buffer.beginAppend();
+		m_current_view->command_buffer.setUniform(m_light_clusters_params_uniform, params);
+		m_current_view->command_buffer.setTexture(
+			15 - m_global_textures_count, m_uniforms[clusters_uniform_idx], m_light_clusters_texture.handle);
+		++m_global_textures_count;
+		m_current_view->command_buffer.setTexture(15 - m_global_textures_count,
+			m_uniforms[light_indices_uniform_idx],
+			m_light_cluster_indices_texture.handle);
+		++m_global_textures_count;
+		m_current_view->command_buffer.setTexture(
+			15 - m_global_textures_count, m_uniforms[lights_uniform_idx], m_clustered_lights_texture.handle);
+		++m_global_textures_count;
+		m_current_view->command_buffer.end();
+	}
+
+
 	void renderLightVolumes(int material_index)
 	{
 		PROFILE_FUNCTION();
@@ -1045,12 +1284,6 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 		{
 			auto entity = m_scene->getPointLightEntity(light_cmp);
 			float range = m_scene->getLightRange(light_cmp);
-			Vec3 light_dir = universe.getRotation(entity).rotate(Vec3(0, 0, -1));
-			float attenuation = m_scene->getLightAttenuation(light_cmp);
-			float fov = m_scene->getLightFOV(light_cmp);
-			float intensity = m_scene->getPointLightIntensity(light_cmp);
-			intensity *= intensity;
-			Vec3 color = m_scene->getPointLightColor(light_cmp) * intensity;
 
 			int max_instance_count = 128;
 			PointLightShadowmap* shadowmap = nullptr;
@@ -1078,12 +1311,7 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 			auto* id = instance_data[buffer_idx];
 			id->mtx = universe.getPositionAndRotation(entity);
 			id->mtx.multiply3x3(range);
-			id->pos_radius.set(pos, range);
-			id->color_attenuation.set(color, attenuation);
-			id->dir_fov.set(light_dir, fov);
-			float specular_intensity = m_scene->getPointLightSpecularIntensity(light_cmp);
-			id->specular.set(m_scene->getPointLightSpecularColor(light_cmp) 
-				* specular_intensity * specular_intensity, 1);
+			getPointLightData(light_cmp, &id->pos_radius);
 			++instance_data[buffer_idx];
 
 			int instance_count = int(instance_data[buffer_idx] - (Data*)instance_buffer[buffer_idx]->data);
@@ -1263,7 +1491,7 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 			m_is_current_light_global = false;
 			m_scene->getPointLightInfluencedGeometry(light, frustum, tmp_meshes);
 
-			renderMeshes(tmp_meshes);
+			renderMeshes(tmp_meshes, light_pos);
 		}
 	}
 
@@ -1741,7 +1969,8 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 
 		Array<ModelInstanceMesh> tmp_meshes(m_renderer.getEngine().getLIFOAllocator());
 		m_scene->getPointLightInfluencedGeometry(light, tmp_meshes);
-		renderMeshes(tmp_meshes);
+		Vec3 light_pos = m_scene->getUniverse().getPosition(m_scene->getPointLightEntity(light));
+		renderMeshes(tmp_meshes, light_pos);
 	}
 
 
@@ -1761,7 +1990,7 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 			{
 				Array<ModelInstanceMesh> tmp_meshes(frame_allocator);
 				m_scene->getPointLightInfluencedGeometry(light, frustum, tmp_meshes);
-				renderMeshes(tmp_meshes);
+				renderMeshes(tmp_meshes, frustum.position);
 			}
 
 			{
@@ -1810,7 +2039,15 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 
 	void setViewSeq()
 	{
-		bgfx::setViewSeq(m_current_view->bgfx_id, true);
+		setSequential(*m_current_view);
+	}
+
+
+	static void setSequential(View& view)
+	{
+		if (view.is_sequential) return;
+		bgfx::setViewSeq(view.bgfx_id, true);
+		view.is_sequential = true;
 	}
 
 
@@ -1945,8 +2182,9 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 		IAllocator& frame_allocator = m_renderer.getEngine().getLIFOAllocator();
 		m_is_current_light_global = true;
 
-		auto& meshes = m_scene->getModelInstanceInfos(frustum, lod_ref_point, layer_mask);
-		renderMeshes(meshes);
+		float screen_height = m_scene->getCameraScreenHeight(m_applied_camera);
+		auto& meshes = m_scene->getModelInstanceInfos(frustum, lod_ref_point, layer_mask, screen_height);
+		renderMeshes(meshes, frustum.position);
 
 		if (render_grass)
 		{
@@ -2020,117 +2258,6 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 	}
 
 
-	void renderSkinnedMesh(const ModelInstance& model_instance, const ModelInstanceMesh& info)
-	{
-		const Mesh& mesh = *info.mesh;
-		Material* material = mesh.material;
-		auto& shader_instance = mesh.material->getShaderInstance();
-
-		Matrix bone_mtx[128];
-
-		const Pose& pose = *model_instance.pose;
-		const Model& model = *model_instance.model;
-		Vec3* poss = pose.positions;
-		Quat* rots = pose.rotations;
-
-		ASSERT(pose.count <= lengthOf(bone_mtx));
-		for (int bone_index = 0, bone_count = pose.count; bone_index < bone_count; ++bone_index)
-		{
-			auto& bone = model.getBone(bone_index);
-			Transform tmp = {poss[bone_index], rots[bone_index]};
-			bone_mtx[bone_index] = (tmp * bone.inv_bind_transform).toMatrix();
-		}
-
-		int stride = model.getVertexDecl().getStride();
-		
-		int view_idx = m_layer_to_view_map[material->getRenderLayer()];
-		ASSERT(view_idx >= 0);
-		auto& view = m_views[view_idx >= 0 ? view_idx : 0];
-
-		if (!bgfx::isValid(shader_instance.getProgramHandle(view.pass_idx))) return;
-
-		bgfx::setUniform(m_bone_matrices_uniform, bone_mtx, pose.count);
-		executeCommandBuffer(material->getCommandBuffer(), material);
-		executeCommandBuffer(view.command_buffer.buffer, material);
-
-		bgfx::setTransform(&model_instance.matrix);
-		bgfx::setVertexBuffer(model_instance.model->getVerticesHandle(),
-			mesh.attribute_array_offset / stride,
-			mesh.attribute_array_size / stride);
-		bgfx::setIndexBuffer(model_instance.model->getIndicesHandle(), mesh.indices_offset, mesh.indices_count);
-		bgfx::setStencil(view.stencil, BGFX_STENCIL_NONE);
-		bgfx::setState(view.render_state | material->getRenderStates());
-		++m_stats.draw_call_count;
-		++m_stats.instance_count;
-		m_stats.triangle_count += mesh.indices_count / 3;
-		bgfx::submit(view.bgfx_id, shader_instance.getProgramHandle(view.pass_idx));
-	}
-
-
-	void renderMultilayerMesh(const ModelInstance& model_instance, const ModelInstanceMesh& info)
-	{
-		const Mesh& mesh = *info.mesh;
-		Material* material = mesh.material;
-
-		Matrix bone_mtx[128];
-		const Pose& pose = *model_instance.pose;
-		const Model& model = *model_instance.model;
-		Vec3* poss = pose.positions;
-		Quat* rots = pose.rotations;
-
-		ASSERT(pose.count <= lengthOf(bone_mtx));
-		for (int bone_index = 0, bone_count = pose.count; bone_index < bone_count; ++bone_index)
-		{
-			auto& bone = model.getBone(bone_index);
-			Transform tmp = { poss[bone_index], rots[bone_index] };
-			bone_mtx[bone_index] = (tmp * bone.inv_bind_transform).toMatrix();
-		}
-
-		int stride = model.getVertexDecl().getStride();
-		int layers_count = material->getLayersCount();
-		auto& shader_instance = mesh.material->getShaderInstance();
-
-		auto renderLayer = [&](View& view) {
-			bgfx::setUniform(m_bone_matrices_uniform, bone_mtx, pose.count);
-			executeCommandBuffer(material->getCommandBuffer(), material);
-			executeCommandBuffer(view.command_buffer.buffer, material);
-
-			bgfx::setTransform(&model_instance.matrix);
-			bgfx::setVertexBuffer(model_instance.model->getVerticesHandle(),
-				mesh.attribute_array_offset / stride,
-				mesh.attribute_array_size / stride);
-			bgfx::setIndexBuffer(model_instance.model->getIndicesHandle(), mesh.indices_offset, mesh.indices_count);
-			bgfx::setStencil(view.stencil, BGFX_STENCIL_NONE);
-			bgfx::setState(view.render_state | material->getRenderStates());
-			++m_stats.draw_call_count;
-			++m_stats.instance_count;
-			m_stats.triangle_count += mesh.indices_count / 3;
-			bgfx::submit(view.bgfx_id, shader_instance.getProgramHandle(view.pass_idx));
-		};
-
-		int view_idx = m_layer_to_view_map[material->getRenderLayer()];
-		if (view_idx >= 0 && !m_is_rendering_in_shadowmap)
-		{
-			auto& view = m_views[view_idx];
-			if (bgfx::isValid(shader_instance.getProgramHandle(view.pass_idx)))
-			{
-				for (int i = 0; i < layers_count; ++i)
-				{
-					Vec4 layer((i + 1) / (float)layers_count, 0, 0, 0);
-					bgfx::setUniform(m_layer_uniform, &layer);
-					renderLayer(view);
-				}
-			}
-		}
-
-		static const int default_layer = m_renderer.getLayer("default");
-		int default_view_idx = m_layer_to_view_map[default_layer];
-		if (default_view_idx < 0) return;
-		View& default_view = m_views[default_view_idx];
-		renderLayer(default_view);
-	}
-
-
 	void setScissor(int x, int y, int width, int height) override
 	{
 		bgfx::setScissor(x, y, width, height);
@@ -2203,42 +2330,6 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 	}
 
 
-	void renderRigidMesh(const ModelInstance& model_instance, const ModelInstanceMesh& info)
-	{
-		int instance_idx = info.mesh->instance_idx;
-		if (instance_idx == -1)
-		{
-			instance_idx = m_instance_data_idx;
-			m_instance_data_idx = (m_instance_data_idx + 1) % lengthOf(m_instances_data);
-			if (m_instances_data[instance_idx].buffer)
-			{
-				finishInstances(instance_idx);
-			}
-			InstanceData& data = m_instances_data[instance_idx];
-			if (!bgfx::checkAvailInstanceDataBuffer(InstanceData::MAX_INSTANCE_COUNT, sizeof(Matrix)))
-			{
-				g_log_warning.log("Renderer") << "Could not allocate instance data buffer";
-				return;
-			}
-			data.buffer =
-				bgfx::allocInstanceDataBuffer(InstanceData::MAX_INSTANCE_COUNT, sizeof(Matrix));
-			data.instance_count = 0;
-			data.mesh = info.mesh;
-			data.model = model_instance.model;
-			info.mesh->instance_idx = instance_idx;
-		}
-		InstanceData& data = m_instances_data[instance_idx];
-		float* mtcs = (float*)data.buffer->data;
-		copyMemory(&mtcs[data.instance_count * 16], &model_instance.matrix, sizeof(model_instance.matrix));
-		++data.instance_count;
-
-		if (data.instance_count == InstanceData::MAX_INSTANCE_COUNT)
-		{
-			finishInstances(instance_idx);
-		}
-	}
-
-
 	void executeCommandBuffer(const u8* data, Material* material) const
 	{
 		const u8* ip = data;
@@ -2305,6 +2396,106 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 	}
 
 
+	// worker thread counterpart of executeCommandBuffer, appends textures and uniforms to the stream,
+	// they are replayed by applyDrawState on the main thread
+	void decodeCommandBuffer(const u8* data, DrawPacketStream& stream, DrawState& state) const
+	{
+		const u8* ip = data;
+		for (;;)
+		{
+			switch ((BufferCommands)*ip)
+			{
+				case BufferCommands::END:
+					return;
+				case BufferCommands::SET_TEXTURE:
+				{
+					auto cmd = (SetTextureCommand*)ip;
+					stream.textures.push({cmd->stage, cmd->uniform, cmd->texture});
+					++state.texture_count;
+					ip += sizeof(*cmd);
+					break;
+				}
+				case BufferCommands::SET_UNIFORM_TIME:
+				{
+					auto cmd = (SetUniformTimeCommand*)ip;
+					stream.uniforms.push({cmd->uniform, &m_uniform_time, 1});
+					++state.uniform_count;
+					ip += sizeof(*cmd);
+					break;
+				}
+				case BufferCommands::SET_UNIFORM_VEC4:
+				{
+					auto cmd = (SetUniformVec4Command*)ip;
+					stream.uniforms.push({cmd->uniform, &cmd->value, 1});
+					++state.uniform_count;
+					ip += sizeof(*cmd);
+					break;
+				}
+				case BufferCommands::SET_UNIFORM_ARRAY:
+				{
+					auto cmd = (SetUniformArrayCommand*)ip;
+					ip += sizeof(*cmd);
+					stream.uniforms.push({cmd->uniform, ip, cmd->count});
+					++state.uniform_count;
+					ip += cmd->size;
+					break;
+				}
+				case BufferCommands::SET_GLOBAL_SHADOWMAP:
+				{
+					auto handle = m_global_light_shadowmap->getRenderbufferHandle(0);
+					stream.textures.push({u8(15 - m_global_textures_count), m_tex_shadowmap_uniform, handle});
+					++state.texture_count;
+					ip += 1;
+					break;
+				}
+				case BufferCommands::SET_LOCAL_SHADOWMAP:
+				{
+					auto cmd = (SetLocalShadowmapCommand*)ip;
+					state.shadowmap_define = bgfx::isValid(cmd->texture) ? 1 : 0;
+					stream.textures.push({u8(15 - m_global_textures_count), m_tex_shadowmap_uniform, cmd->texture});
+					++state.texture_count;
+					ip += sizeof(*cmd);
+					break;
+				}
+				default:
+					ASSERT(false);
+					break;
+			}
+		}
+	}
+
+
+	DrawState decodeDrawState(Material* material, const View& view, DrawPacketStream& stream) const
+	{
+		DrawState state;
+		state.first_texture = stream.textures.size();
+		state.texture_count = 0;
+		state.first_uniform = stream.uniforms.size();
+		state.uniform_count = 0;
+		state.shadowmap_define = -1;
+		decodeCommandBuffer(material->getCommandBuffer(), stream, state);
+		decodeCommandBuffer(view.command_buffer.buffer, stream, state);
+		return state;
+	}
+
+
+	// setDefine is not thread safe, so it's the only part of the state not resolved by workers
+	void applyDrawState(const DrawPacketStream& stream, const DrawState& state, Material* material) const
+	{
+		if (state.shadowmap_define >= 0) material->setDefine(m_has_shadowmap_define_idx, state.shadowmap_define != 0);
+		for (int i = 0; i < state.texture_count; ++i)
+		{
+			const DrawTexture& texture = stream.textures[state.first_texture + i];
+			bgfx::setTexture(texture.stage, texture.uniform, texture.texture);
+		}
+		for (int i = 0; i < state.uniform_count; ++i)
+		{
+			const DrawUniform& uniform = stream.uniforms[state.first_uniform + i];
+			bgfx::setUniform(uniform.uniform, uniform.value, uniform.count);
+		}
+	}
+
+
 	void renderTerrain(const TerrainInfo& info)
 	{
 		auto& inst = m_terrain_instances[info.m_index];
@@ -2401,7 +2592,6 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 		copyMemory(idb->data, grass.instance_data, sizeof(GrassInfo::InstanceData) * grass.instance_count);
 		const Mesh& mesh = grass.model->getMesh(0);
 		Material* material = mesh.material;
-		int stride = grass.model->getVertexDecl().getStride();
 
 		int view_idx = m_layer_to_view_map[material->getRenderLayer()];
 		ASSERT(view_idx >= 0);
@@ -2412,9 +2602,11 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 		auto max_grass_distance = Vec4(grass.type_distance, 0, 0, 0);
 		bgfx::setUniform(m_grass_max_dist_uniform, &max_grass_distance);
 
-		bgfx::setVertexBuffer(
-			grass.model->getVerticesHandle(), mesh.attribute_array_offset / stride, mesh.attribute_array_size / stride);
-		bgfx::setIndexBuffer(grass.model->getIndicesHandle(), mesh.indices_offset, mesh.indices_count);
+		if (!grass.model->setMeshBuffers(mesh))
+		{
+			bgfx::discard();
+			return;
+		}
 		bgfx::setStencil(view.stencil, BGFX_STENCIL_NONE);
 		bgfx::setState(view.render_state | material->getRenderStates());
 		bgfx::setInstanceDataBuffer(idb, grass.instance_count);
@@ -2450,61 +2642,477 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 	}
 
 
-	void renderMeshes(const Array<ModelInstanceMesh>& meshes)
+	// 16 bit identifier for sort keys, collisions only make the order less optimal
+	static u64 getSortID(const void* ptr)
+	{
+		u32 hash = u32((uintptr)ptr >> 4);
+		hash ^= hash >> 16;
+		return hash & 0xffff;
+	}
+
+
+	// from the most significant bits:
+	// opaque: view 8 | 0 | program 12 | material 16 | mesh 16 | depth 11
+	// translucent: view 8 | 1 | inverted depth 24 | program 12 | material 16 | unused 3
+	// opaque meshes are grouped by state and then rendered front to back, translucent ones back to front
+	u64 getSortKey(const ModelInstance& model_instance, const Mesh& mesh, const Vec3& sort_origin) const
+	{
+		Material* material = mesh.material;
+		int view_idx = m_layer_to_view_map[material->getRenderLayer()];
+		const View& view = m_views[view_idx >= 0 ? view_idx : 0];
+		u64 program = material->getShaderInstance().getProgramHandle(view.pass_idx).idx & 0xfff;
+		float squared_distance = (model_instance.matrix.getTranslation() - sort_origin).squaredLength();
+		// bits of positive floats are ordered the same way as the floats
+		u32 depth;
+		copyMemory(&depth, &squared_distance, sizeof(depth));
+
+		u64 key = u64(view_idx >= 0 ? view_idx : 0) << 56;
+		if (((view.render_state | material->getRenderStates()) & BGFX_STATE_BLEND_MASK) != 0)
+		{
+			key |= 1ULL << 55;
+			key |= u64(~depth >> 7 & 0xffffff) << 31;
+			key |= program << 19;
+			key |= getSortID(material) << 3;
+			return key;
+		}
+		key |= program << 43;
+		key |= getSortID(material) << 27;
+		key |= getSortID(&mesh) << 11;
+		key |= depth >> 20 & 0x7ff;
+		return key;
+	}
+
+
+	void renderMeshes(const Array<ModelInstanceMesh>& meshes, const Vec3& sort_origin)
 	{
 		PROFILE_FUNCTION();
 		if(meshes.empty()) return;
 
-		ModelInstance* model_instances = m_scene->getModelInstances();
 		PROFILE_INT("mesh count", meshes.size());
-		for(auto& mesh : meshes)
+		m_render_queue.clear();
+		m_render_queue.reserve(meshes.size());
+		for (auto& mesh : meshes)
 		{
-			ModelInstance& model_instance = model_instances[mesh.model_instance.index];
-			switch (model_instance.type)
-			{
-				case ModelInstance::RIGID:
-					renderRigidMesh(model_instance, mesh);
-					break;
-				case ModelInstance::SKINNED:
-					renderSkinnedMesh(model_instance, mesh);
-					break;
-				case ModelInstance::MULTILAYER:
-					renderMultilayerMesh(model_instance, mesh);
-					break;
-			}
+			m_render_queue.push(&mesh);
 		}
-		finishInstances();
+		renderQueue(sort_origin);
 	}
 
 
-	void renderMeshes(const Array<Array<ModelInstanceMesh>>& meshes)
+	void renderMeshes(const Array<Array<ModelInstanceMesh>>& meshes, const Vec3& sort_origin)
 	{
 		PROFILE_FUNCTION();
 		int mesh_count = 0;
 		for (auto& submeshes : meshes)
 		{
-			if(submeshes.empty()) continue;
-			ModelInstance* model_instances = m_scene->getModelInstances();
 			mesh_count += submeshes.size();
+		}
+		m_render_queue.clear();
+		m_render_queue.reserve(mesh_count);
+		for (auto& submeshes : meshes)
+		{
 			for (auto& mesh : submeshes)
 			{
-				ModelInstance& model_instance = model_instances[mesh.model_instance.index];
-				switch (model_instance.type)
+				m_render_queue.push(&mesh);
+			}
+		}
+		renderQueue(sort_origin);
+		PROFILE_INT("mesh count", mesh_count);
+	}
+
+
+	// turns the sorted range [from, to) of m_render_queue into draw packets, called from worker threads;
+	// the sort keys place rigid meshes with the same mesh next to each other, so each such run
+	// becomes one instanced packet
+	void generateDrawPackets(int from, int to, int default_view_idx, DrawPacketStream& stream)
+	{
+		PROFILE_FUNCTION();
+		stream.packets.clear();
+		stream.instance_matrices.clear();
+		stream.bone_matrices.clear();
+		stream.textures.clear();
+		stream.uniforms.clear();
+		const ModelInstance* model_instances = m_scene->getModelInstances();
+		const Material* prev_material = nullptr;
+		int prev_view_idx = -1;
+		DrawState prev_state = {};
+		for (int i = from; i < to; ++i)
+		{
+			const ModelInstanceMesh& info = *m_render_queue[m_sort_values[i]];
+			const ModelInstance& model_instance = model_instances[info.model_instance.index];
+			const Mesh& mesh = *info.mesh;
+			if (model_instance.type == ModelInstance::RIGID && !stream.packets.empty())
+			{
+				DrawPacket& packet = stream.packets.back();
+				if (packet.type == DrawPacket::INSTANCED && packet.mesh == &mesh)
 				{
-					case ModelInstance::RIGID:
-						renderRigidMesh(model_instance, mesh);
-						break;
-					case ModelInstance::SKINNED:
-						renderSkinnedMesh(model_instance, mesh);
-						break;
-					case ModelInstance::MULTILAYER:
-						renderMultilayerMesh(model_instance, mesh);
-						break;
+					stream.instance_matrices.push(model_instance.matrix);
+					++packet.matrix_count;
+					continue;
 				}
 			}
+
+			Material* material = mesh.material;
+			int view_idx = m_layer_to_view_map[material->getRenderLayer()];
+			ASSERT(view_idx >= 0);
+			if (view_idx < 0) view_idx = 0;
+			const View& view = m_views[view_idx];
+
+			DrawPacket packet;
+			packet.view_idx = (u8)view_idx;
+			packet.bone_matrices = nullptr;
+			packet.model = model_instance.model;
+			packet.mesh = &mesh;
+			packet.render_state = view.render_state | material->getRenderStates();
+			packet.program = material->getShaderInstance().getProgramHandle(view.pass_idx);
+			// packets are sorted by material, so consecutive ones can share the decoded state
+			if (material != prev_material || view_idx != prev_view_idx)
+			{
+				prev_state = decodeDrawState(material, view, stream);
+				prev_material = material;
+				prev_view_idx = view_idx;
+			}
+			packet.state = prev_state;
+			if (model_instance.type == ModelInstance::RIGID)
+			{
+				packet.type = DrawPacket::INSTANCED;
+				packet.matrix_count = 1;
+				packet.matrices_offset = stream.instance_matrices.size();
+				stream.instance_matrices.push(model_instance.matrix);
+				stream.packets.push(packet);
+				continue;
+			}
+
+			bool is_skinned = model_instance.type == ModelInstance::SKINNED;
+			if (is_skinned && !bgfx::isValid(packet.program)) continue;
+
+			const Pose& pose = *model_instance.pose;
+			const Model& model = *model_instance.model;
+			ASSERT(pose.count <= DrawPacket::MAX_BONE_COUNT);
+			packet.type = is_skinned ? DrawPacket::SKINNED : DrawPacket::MULTILAYER;
+			if (!is_skinned && default_view_idx >= 0)
+			{
+				packet.default_view_state = decodeDrawState(material, m_views[default_view_idx], stream);
+			}
+			packet.matrix_count = pose.count;
+			packet.matrices_offset = stream.bone_matrices.size();
+			stream.bone_matrices.push(model_instance.matrix);
+			packet.bone_matrices = m_scene->getSkinningMatrices(info.model_instance);
+			if (!packet.bone_matrices && pose.count > 0)
+			{
+				stream.bone_matrices.resize(packet.matrices_offset + 1 + pose.count);
+				pose.computeSkinningMatrices(model, &stream.bone_matrices[packet.matrices_offset + 1]);
+			}
+			stream.packets.push(packet);
 		}
-		finishInstances();
-		PROFILE_INT("mesh count", mesh_count);
+	}
+
+
+	// instances start at first_instance of stream_idx stream and can continue in the next streams;
+	// they are a continuous range of instance_buffer, if it's not valid, there is one draw call
+	// per MAX_INSTANCE_COUNT instances, each with its own transient instance buffer
+	void submitInstances(const DrawPacket& packet,
+		bgfx::DynamicVertexBufferHandle instance_buffer,
+		int stream_idx,
+		int first_instance,
+		int instance_count)
+	{
+		const Mesh& mesh = *packet.mesh;
+		Material* material = mesh.material;
+		const View& view = m_views[packet.view_idx];
+		const DrawPacketStream& state_stream = m_packet_streams[stream_idx];
+		bool is_buffered = bgfx::isValid(instance_buffer);
+		int max_count = is_buffered ? instance_count : InstanceData::MAX_INSTANCE_COUNT;
+		for (int i = 0; i < instance_count; i += max_count)
+		{
+			int count = Math::minimum(instance_count - i, max_count);
+
+			applyDrawState(state_stream, packet.state, material);
+			if (!packet.model->setMeshBuffers(mesh))
+			{
+				bgfx::discard();
+				return;
+			}
+			if (is_buffered)
+			{
+				int start = m_packet_streams[stream_idx].first_instance + first_instance;
+				bgfx::setInstanceDataBuffer(instance_buffer, start, count);
+			}
+			else if (!setTransientInstances(stream_idx, first_instance, count))
+			{
+				bgfx::discard();
+				g_log_warning.log("Renderer") << "Could not allocate instance data buffer";
+				return;
+			}
+
+			bgfx::setStencil(view.stencil, BGFX_STENCIL_NONE);
+			bgfx::setState(packet.render_state);
+			++m_stats.draw_call_count;
+			m_stats.instance_count += count;
+			m_stats.triangle_count += count * mesh.indices_count / 3;
+			bgfx::submit(view.bgfx_id, packet.program);
+		}
+	}
+
+
+	// copies count matrices to a transient buffer, first_instance and stream_idx are moved past them
+	bool setTransientInstances(int& stream_idx, int& first_instance, int count)
+	{
+		if (!bgfx::checkAvailInstanceDataBuffer(count, sizeof(Matrix))) return false;
+
+		const bgfx::InstanceDataBuffer* instance_buffer = bgfx::allocInstanceDataBuffer(count, sizeof(Matrix));
+		u8* dst = instance_buffer->data;
+		int remaining = count;
+		while (remaining > 0)
+		{
+			const Array<Matrix>& matrices = m_packet_streams[stream_idx].instance_matrices;
+			int copy_count = Math::minimum(remaining, matrices.size() - first_instance);
+			if (copy_count > 0)
+			{
+				copyMemory(dst, &matrices[first_instance], copy_count * sizeof(Matrix));
+				dst += copy_count * sizeof(Matrix);
+				remaining -= copy_count;
+				first_instance += copy_count;
+			}
+			if (first_instance == matrices.size())
+			{
+				++stream_idx;
+				first_instance = 0;
+			}
+		}
+		bgfx::setInstanceDataBuffer(instance_buffer, count);
+		return true;
+	}
+
+
+	// uploads matrices of all instanced packets at once, returns an invalid handle if there is no free buffer
+	bgfx::DynamicVertexBufferHandle uploadInstances(int stream_count)
+	{
+		int instance_count = 0;
+		for (int i = 0; i < stream_count; ++i)
+		{
+			DrawPacketStream& stream = m_packet_streams[i];
+			stream.first_instance = instance_count;
+			instance_count += stream.instance_matrices.size();
+		}
+		if (instance_count == 0 || m_instance_buffer_idx >= lengthOf(m_instance_buffers)) return BGFX_INVALID_HANDLE;
+
+		bgfx::DynamicVertexBufferHandle& handle = m_instance_buffers[m_instance_buffer_idx];
+		++m_instance_buffer_idx;
+		if (!bgfx::isValid(handle))
+		{
+			handle = bgfx::createDynamicVertexBuffer(instance_count, m_instance_decl, BGFX_BUFFER_ALLOW_RESIZE);
+			if (!bgfx::isValid(handle)) return handle;
+		}
+
+		const bgfx::Memory* mem = bgfx::alloc(instance_count * sizeof(Matrix));
+		u8* dst = mem->data;
+		for (int i = 0; i < stream_count; ++i)
+		{
+			const Array<Matrix>& matrices = m_packet_streams[i].instance_matrices;
+			if (matrices.empty()) continue;
+			copyMemory(dst, &matrices[0], matrices.size() * sizeof(Matrix));
+			dst += matrices.size() * sizeof(Matrix);
+		}
+		bgfx::updateDynamicVertexBuffer(handle, 0, mem);
+		return handle;
+	}
+
+
+	void submitSkinnedPacket(const DrawPacket& packet,
+		const DrawPacketStream& stream,
+		const DrawState& state,
+		const View& view,
+		u64 render_state,
+		bgfx::ProgramHandle program)
+	{
+		const Mesh& mesh = *packet.mesh;
+		Material* material = mesh.material;
+		const Matrix* matrices = &stream.bone_matrices[packet.matrices_offset];
+		const Matrix* bone_matrices = packet.bone_matrices ? packet.bone_matrices : matrices + 1;
+		bgfx::setUniform(m_bone_matrices_uniform, bone_matrices, packet.matrix_count);
+		applyDrawState(stream, state, material);
+
+		bgfx::setTransform(matrices);
+		if (!packet.model->setMeshBuffers(mesh))
+		{
+			bgfx::discard();
+			return;
+		}
+		bgfx::setStencil(view.stencil, BGFX_STENCIL_NONE);
+		bgfx::setState(render_state);
+		++m_stats.draw_call_count;
+		++m_stats.instance_count;
+		m_stats.triangle_count += mesh.indices_count / 3;
+		bgfx::submit(view.bgfx_id, program);
+	}
+
+
+	void submitDrawPacket(const DrawPacket& packet, const DrawPacketStream& stream, int default_view_idx)
+	{
+		const Mesh& mesh = *packet.mesh;
+		Material* material = mesh.material;
+		const View& view = m_views[packet.view_idx];
+		switch (packet.type)
+		{
+			case DrawPacket::INSTANCED:
+				ASSERT(false); // submitted by submitInstances
+				break;
+			case DrawPacket::SKINNED:
+				submitSkinnedPacket(packet, stream, packet.state, view, packet.render_state, packet.program);
+				break;
+			case DrawPacket::MULTILAYER:
+			{
+				ShaderInstance& shader_instance = material->getShaderInstance();
+				int layers_count = material->getLayersCount();
+				int view_idx = m_layer_to_view_map[material->getRenderLayer()];
+				if (view_idx >= 0 && !m_is_rendering_in_shadowmap && bgfx::isValid(packet.program))
+				{
+					for (int i = 0; i < layers_count; ++i)
+					{
+						Vec4 layer((i + 1) / (float)layers_count, 0, 0, 0);
+						bgfx::setUniform(m_layer_uniform, &layer);
+						submitSkinnedPacket(packet, stream, packet.state, view, packet.render_state, packet.program);
+					}
+				}
+
+				if (default_view_idx < 0) return;
+				View& default_view = m_views[default_view_idx];
+				setSequential(default_view);
+				submitSkinnedPacket(packet,
+					stream,
+					packet.default_view_state,
+					default_view,
+					default_view.render_state | material->getRenderStates(),
+					shader_instance.getProgramHandle(default_view.pass_idx));
+				break;
+			}
+		}
+	}
+
+
+	// sorts meshes in m_render_queue by their sort keys and renders them
+	void renderQueue(const Vec3& sort_origin)
+	{
+		PROFILE_FUNCTION();
+		int count = m_render_queue.size();
+		if (count == 0) return;
+
+		ModelInstance* model_instances = m_scene->getModelInstances();
+		m_sort_keys.resize(count);
+		m_sort_values.resize(count);
+		m_tmp_sort_keys.resize(count);
+		m_tmp_sort_values.resize(count);
+		int unsorted_state_changes = 0;
+		const Material* prev_material = nullptr;
+		m_skinned_instances.clear();
+		for (int i = 0; i < count; ++i)
+		{
+			const ModelInstanceMesh& mesh = *m_render_queue[i];
+			const ModelInstance& model_instance = model_instances[mesh.model_instance.index];
+			m_sort_keys[i] = getSortKey(model_instance, *mesh.mesh, sort_origin);
+			m_sort_values[i] = (u32)i;
+			if (mesh.mesh->material != prev_material) ++unsorted_state_changes;
+			prev_material = mesh.mesh->material;
+			if (model_instance.type != ModelInstance::RIGID) m_skinned_instances.push(mesh.model_instance);
+		}
+		// only instances which are really rendered are skinned, the scene skips the ones done by previous queues
+		if (!m_skinned_instances.empty())
+		{
+			m_scene->computeSkinningMatrices(&m_skinned_instances[0], m_skinned_instances.size());
+		}
+
+		MTJD::Manager& mtjd_manager = m_renderer.getEngine().getMTJDManager();
+		radixSort(&m_sort_keys[0],
+			&m_sort_values[0],
+			&m_tmp_sort_keys[0],
+			&m_tmp_sort_values[0],
+			count,
+			mtjd_manager,
+			m_allocator);
+
+		int job_count = Math::minimum(
+			(int)mtjd_manager.getCpuThreadsCount(), (count + MIN_MESHES_PER_PACKET_JOB - 1) / MIN_MESHES_PER_PACKET_JOB);
+		job_count = Math::maximum(job_count, 1);
+		while (m_packet_streams.size() < job_count) m_packet_streams.emplace(m_allocator);
+		static const int default_layer = m_renderer.getLayer("default");
+		int default_view_idx = m_layer_to_view_map[default_layer];
+		m_uniform_time.set(m_scene->getTime(), 0, 0, 0);
+		if (job_count == 1)
+		{
+			generateDrawPackets(0, count, default_view_idx, m_packet_streams[0]);
+		}
+		else
+		{
+			int chunk_size = (count + job_count - 1) / job_count;
+			for (int i = 0; i < job_count; ++i)
+			{
+				MTJD::Job* job = MTJD::makeJob(mtjd_manager,
+					[this, i, chunk_size, count, default_view_idx]() {
+						generateDrawPackets(i * chunk_size,
+							Math::minimum(count, (i + 1) * chunk_size),
+							default_view_idx,
+							m_packet_streams[i]);
+					},
+					m_allocator);
+				job->addDependency(&m_packets_sync_point);
+				mtjd_manager.schedule(job);
+			}
+			m_packets_sync_point.sync();
+		}
+
+		int state_changes = 0;
+		prev_material = nullptr;
+		{
+			PROFILE_BLOCK("submit");
+			bgfx::DynamicVertexBufferHandle instance_buffer = uploadInstances(job_count);
+			// instanced packets of the same mesh can continue from one stream to the next one,
+			// their matrices are copied from all the streams so they are merged
+			const DrawPacket* group = nullptr;
+			int group_stream_idx = 0;
+			int group_first_instance = 0;
+			int group_instance_count = 0;
+			auto flushGroup = [&]() {
+				if (group)
+				{
+					submitInstances(
+						*group, instance_buffer, group_stream_idx, group_first_instance, group_instance_count);
+				}
+				group = nullptr;
+			};
+			for (int i = 0; i < job_count; ++i)
+			{
+				const DrawPacketStream& stream = m_packet_streams[i];
+				for (const DrawPacket& packet : stream.packets)
+				{
+					// bgfx would sort by its own key, losing the order given by getSortKey
+					setSequential(m_views[packet.view_idx]);
+					if (packet.type == DrawPacket::INSTANCED)
+					{
+						if (group && group->mesh == packet.mesh)
+						{
+							group_instance_count += packet.matrix_count;
+							continue;
+						}
+						flushGroup();
+						group = &packet;
+						group_stream_idx = i;
+						group_first_instance = packet.matrices_offset;
+						group_instance_count = packet.matrix_count;
+					}
+					else
+					{
+						flushGroup();
+						submitDrawPacket(packet, stream, default_view_idx);
+					}
+					if (packet.mesh->material != prev_material) ++state_changes;
+					prev_material = packet.mesh->material;
+				}
+			}
+			flushGroup();
+		}
+		m_stats.state_change_count += state_changes;
+		m_stats.state_changes_saved += unsorted_state_changes - state_changes;
 	}
 
 
@@ -2556,6 +3164,7 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 		m_pass_idx = -1;
 		m_current_framebuffer = m_default_framebuffer;
 		m_instance_data_idx = 0;
+		m_instance_buffer_idx = 0;
 		m_point_light_shadowmaps.clear();
 		clearLayerToViewMap();
 		for (int i = 0; i < lengthOf(m_terrain_instances); ++i)
@@ -2716,6 +3325,20 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 	FrameBuffer* m_global_light_shadowmap;
 	InstanceData m_instances_data[128];
 	int m_instance_data_idx;
+	Array<const ModelInstanceMesh*> m_render_queue;
+	Array<u64> m_sort_keys;
+	Array<u32> m_sort_values;
+	Array<ComponentHandle> m_skinned_instances;
+	Array<u64> m_tmp_sort_keys;
+	Array<u32> m_tmp_sort_values;
+	Array<DrawPacketStream> m_packet_streams;
+	MTJD::Group m_packets_sync_point;
+	// one per renderQueue call in a frame, matrices of all instanced packets of the call
+	bgfx::DynamicVertexBufferHandle m_instance_buffers[32];
+	int m_instance_buffer_idx;
+	bgfx::VertexDecl m_instance_decl;
+	// value of SET_UNIFORM_TIME commands decoded by generateDrawPackets
+	Vec4 m_uniform_time;
 	ComponentHandle m_applied_camera;
 	bgfx::VertexBufferHandle m_cube_vb;
 	bgfx::IndexBufferHandle m_cube_ib;
@@ -2747,6 +3370,10 @@ struct PipelineImpl LUMIX_FINAL : public Pipeline
 	bgfx::UniformHandle m_terrain_matrix_uniform;
 	bgfx::UniformHandle m_decal_matrix_uniform;
 	bgfx::UniformHandle m_emitter_matrix_uniform;
+	bgfx::UniformHandle m_light_clusters_params_uniform;
+	LightClustersTexture m_light_clusters_texture;
+	LightClustersTexture m_light_cluster_indices_texture;
+	LightClustersTexture m_clustered_lights_texture;
 	bgfx::UniformHandle m_tex_shadowmap_uniform;
 	bgfx::UniformHandle m_cam_view_uniform;
 	bgfx::UniformHandle m_cam_proj_uniform;
@@ -2961,6 +3588,7 @@ void Pipeline::registerLuaAPI(lua_State* L)
 	REGISTER_FUNCTION(bindFramebufferTexture);
 	REGISTER_FUNCTION(bindTexture);
 	REGISTER_FUNCTION(bindEnvironmentMaps);
+	REGISTER_FUNCTION(bindLightClusters);
 	REGISTER_FUNCTION(applyCamera);
 
 	REGISTER_FUNCTION(disableBlending);
@@ -64,6 +64,9 @@ class LUMIX_RENDERER_API Pipeline
 			int draw_call_count;
 			int instance_count;
 			int triangle_count;
+			// material switches between consecutive meshes, after and before sorting by the render queue
+			int state_change_count;
+			int state_changes_saved;
 		};
 
 		struct CustomCommandHandler
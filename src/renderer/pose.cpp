@@ -1,29 +1,33 @@
 #include "renderer/pose.h"
+#include "engine/iallocator.h"
+#include "engine/math_utils.h"
 #include "engine/matrix.h"
-#include "engine/quat.h"
 #include "engine/profiler.h"
-#include "engine/vec.h"
 #include "renderer/model.h"
+#include "renderer/pose_simd.h"
 
 
 namespace Lumix
 {
 
 
+static const int POSE_ARRAY_COUNT = 7;
+
+
 Pose::Pose(IAllocator& allocator)
 	: allocator(allocator)
 {
-	positions = nullptr;
-	rotations = nullptr;
+	pos_x = pos_y = pos_z = nullptr;
+	rot_x = rot_y = rot_z = rot_w = nullptr;
 	count = 0;
+	version = 0;
 	is_absolute = false;
 }
 
 
 Pose::~Pose()
 {
-	allocator.deallocate(positions);
-	allocator.deallocate(rotations);
+	allocator.deallocate_aligned(pos_x);
 }
 
 
@@ -31,60 +35,274 @@ void Pose::blend(Pose& rhs, float weight)
 {
 	ASSERT(count == rhs.count);
 	if (weight <= 0.001f) return;
+	++version;
 	weight = Math::clamp(weight, 0.0f, 1.0f);
-	float inv = 1.0f - weight;
-	for (int i = 0, c = count; i < c; ++i)
+	// padding bones are identities in both poses, so they are blended too
+	int i = 0;
+#ifdef __AVX__
+	float8 t8 = f8Splat(weight);
+	for (int c = (count + 3) & ~3; i + 8 <= c; i += 8)
+	{
+		Vec3x8 pos = lerpVec3x8(loadVec3x8(pos_x + i, pos_y + i, pos_z + i),
+			loadVec3x8(rhs.pos_x + i, rhs.pos_y + i, rhs.pos_z + i),
+			t8);
+		Quatx8 rot = nlerpQuatx8(loadQuatx8(rot_x + i, rot_y + i, rot_z + i, rot_w + i),
+			loadQuatx8(rhs.rot_x + i, rhs.rot_y + i, rhs.rot_z + i, rhs.rot_w + i),
+			t8);
+		storeVec3x8(pos, pos_x + i, pos_y + i, pos_z + i);
+		storeQuatx8(rot, rot_x + i, rot_y + i, rot_z + i, rot_w + i);
+	}
+#endif
+	float4 t = f4Splat(weight);
+	for (int c = count; i < c; i += 4)
 	{
-		positions[i] = positions[i] * inv + rhs.positions[i] * weight;
-		nlerp(rotations[i], rhs.rotations[i], &rotations[i], weight);
+		Vec3x4 pos = lerpVec3x4(loadVec3x4(pos_x + i, pos_y + i, pos_z + i),
+			loadVec3x4(rhs.pos_x + i, rhs.pos_y + i, rhs.pos_z + i),
+			t);
+		Quatx4 rot = nlerpQuatx4(loadQuatx4(rot_x + i, rot_y + i, rot_z + i, rot_w + i),
+			loadQuatx4(rhs.rot_x + i, rhs.rot_y + i, rhs.rot_z + i, rhs.rot_w + i),
+			t);
+		storeVec3x4(pos, pos_x + i, pos_y + i, pos_z + i);
+		storeQuatx4(rot, rot_x + i, rot_y + i, rot_z + i, rot_w + i);
 	}
 }
 
 
 void Pose::resize(int count)
 {
+	++version;
 	is_absolute = false;
-	allocator.deallocate(positions);
-	allocator.deallocate(rotations);
+	allocator.deallocate_aligned(pos_x);
 	this->count = count;
 	if (count)
 	{
-		positions = static_cast<Vec3*>(allocator.allocate(sizeof(Vec3) * count));
-		rotations = static_cast<Quat*>(allocator.allocate(sizeof(Quat) * count));
+		int padded_count = (count + 3) & ~3;
+		float* mem = static_cast<float*>(
+			allocator.allocate_aligned(sizeof(float) * padded_count * POSE_ARRAY_COUNT, 16));
+		pos_x = mem;
+		pos_y = mem + padded_count;
+		pos_z = mem + padded_count * 2;
+		rot_x = mem + padded_count * 3;
+		rot_y = mem + padded_count * 4;
+		rot_z = mem + padded_count * 5;
+		rot_w = mem + padded_count * 6;
+		for (int i = count; i < padded_count; ++i)
+		{
+			setPosition(i, Vec3(0, 0, 0));
+			setRotation(i, Quat(0, 0, 0, 1));
+		}
 	}
 	else
 	{
-		positions = nullptr;
-		rotations = nullptr;
+		pos_x = pos_y = pos_z = nullptr;
+		rot_x = rot_y = rot_z = rot_w = nullptr;
 	}
 }
 
 
+static void gatherBones(const Pose& pose, const int* bones, Vec3x4* pos, Quatx4* rot)
+{
+	LUMIX_ALIGN_BEGIN(16) float lanes[7][4] LUMIX_ALIGN_END(16);
+	for (int j = 0; j < 4; ++j)
+	{
+		int bone = bones[j];
+		lanes[0][j] = pose.pos_x[bone];
+		lanes[1][j] = pose.pos_y[bone];
+		lanes[2][j] = pose.pos_z[bone];
+		lanes[3][j] = pose.rot_x[bone];
+		lanes[4][j] = pose.rot_y[bone];
+		lanes[5][j] = pose.rot_z[bone];
+		lanes[6][j] = pose.rot_w[bone];
+	}
+	*pos = loadVec3x4(lanes[0], lanes[1], lanes[2]);
+	*rot = loadQuatx4(lanes[3], lanes[4], lanes[5], lanes[6]);
+}
+
+
+static void computeAbsolute(Pose& pose, const int* parents, int bone)
+{
+	int parent = parents[bone];
+	Quat parent_rot = pose.getRotation(parent);
+	pose.setPosition(bone, parent_rot.rotate(pose.getPosition(bone)) + pose.getPosition(parent));
+	pose.setRotation(bone, parent_rot * pose.getRotation(bone));
+}
+
+
+// the inverse of computeAbsolute, i.e. parent's inverted transform * bone's transform
+static void computeRelative(Pose& pose, const int* parents, int bone)
+{
+	int parent = parents[bone];
+	Quat inv_parent_rot = pose.getRotation(parent).conjugated();
+	pose.setPosition(bone, inv_parent_rot.rotate(pose.getPosition(bone) - pose.getPosition(parent)));
+	pose.setRotation(bone, inv_parent_rot * pose.getRotation(bone));
+}
+
+
 void Pose::computeAbsolute(Model& model)
+{
+	computeAbsolute(model.getBoneParents(), model.getFirstNonrootBoneIndex());
+}
+
+
+void Pose::computeRelative(Model& model)
+{
+	computeRelative(model.getBoneParents(), model.getFirstNonrootBoneIndex());
+}
+
+
+void Pose::computeAbsolute(const int* parents, int first_nonroot_bone)
 {
 	PROFILE_FUNCTION();
 	if (is_absolute) return;
-	for (int i = model.getFirstNonrootBoneIndex(); i < count; ++i)
+	is_absolute = true;
+	++version;
+	if (first_nonroot_bone < 0) return;
+	int i = first_nonroot_bone;
+	for (; i < count && (i & 3) != 0; ++i) Lumix::computeAbsolute(*this, parents, i);
+	for (; i + 4 <= count; i += 4)
 	{
-		int parent = model.getBone(i).parent_idx;
-		positions[i] = rotations[parent].rotate(positions[i]) + positions[parent];
-		rotations[i] = rotations[parent] * rotations[i];
+		const int* group_parents = parents + i;
+		// a parent in the same group would not be absolute yet
+		if (group_parents[0] >= i || group_parents[1] >= i || group_parents[2] >= i || group_parents[3] >= i)
+		{
+			for (int j = 0; j < 4; ++j) Lumix::computeAbsolute(*this, parents, i + j);
+			continue;
+		}
+
+		Vec3x4 parent_pos;
+		Quatx4 parent_rot;
+		gatherBones(*this, group_parents, &parent_pos, &parent_rot);
+		Vec3x4 pos = loadVec3x4(pos_x + i, pos_y + i, pos_z + i);
+		Quatx4 rot = loadQuatx4(rot_x + i, rot_y + i, rot_z + i, rot_w + i);
+		storeVec3x4(addVec3x4(rotateVec3x4(parent_rot, pos), parent_pos), pos_x + i, pos_y + i, pos_z + i);
+		storeQuatx4(mulQuatx4(parent_rot, rot), rot_x + i, rot_y + i, rot_z + i, rot_w + i);
 	}
-	is_absolute = true;
+	for (; i < count; ++i) Lumix::computeAbsolute(*this, parents, i);
 }
 
 
-void Pose::computeRelative(Model& model)
+void Pose::computeRelative(const int* parents, int first_nonroot_bone)
 {
 	PROFILE_FUNCTION();
 	if (!is_absolute) return;
-	for (int i = count - 1; i >= model.getFirstNonrootBoneIndex(); --i)
+	is_absolute = false;
+	++version;
+	if (first_nonroot_bone < 0) return;
+	int i = count - 1;
+	for (; i >= first_nonroot_bone && ((i + 1) & 3) != 0; --i) Lumix::computeRelative(*this, parents, i);
+	// parents are read before anything in the group is written, so a parent in the same group
+	// is still absolute, the same as when bones are processed one by one from the last one
+	for (; i - 3 >= first_nonroot_bone; i -= 4)
 	{
-		int parent = model.getBone(i).parent_idx;
-		positions[i] = -rotations[parent].rotate(positions[i] - positions[parent]);
-		rotations[i] = rotations[i] * -rotations[parent];
+		int group = i - 3;
+		Vec3x4 parent_pos;
+		Quatx4 parent_rot;
+		gatherBones(*this, parents + group, &parent_pos, &parent_rot);
+		// the same as Quat::conjugated
+		Quatx4 inv_parent_rot = {parent_rot.x, parent_rot.y, parent_rot.z, f4Sub(f4Splat(0), parent_rot.w)};
+		Vec3x4 pos = loadVec3x4(pos_x + group, pos_y + group, pos_z + group);
+		Quatx4 rot = loadQuatx4(rot_x + group, rot_y + group, rot_z + group, rot_w + group);
+		storeVec3x4(rotateVec3x4(inv_parent_rot, subVec3x4(pos, parent_pos)),
+			pos_x + group,
+			pos_y + group,
+			pos_z + group);
+		storeQuatx4(mulQuatx4(inv_parent_rot, rot), rot_x + group, rot_y + group, rot_z + group, rot_w + group);
 	}
-	is_absolute = false;
+	for (; i >= first_nonroot_bone; --i) Lumix::computeRelative(*this, parents, i);
+}
+
+
+// inv_bind(i) returns the inverse bind transform of bone i
+template <typename InvBind>
+static void computeSkinningMatrices(const Pose& pose, InvBind inv_bind, Matrix* matrices)
+{
+	int count = pose.count;
+	for (int i = 0; i < count; i += 4)
+	{
+		LUMIX_ALIGN_BEGIN(16) float lanes[7][4] LUMIX_ALIGN_END(16);
+		int lane_count = Math::minimum(count - i, 4);
+		for (int j = 0; j < 4; ++j)
+		{
+			// unused lanes repeat the last bone
+			const Transform& bone_inv_bind = inv_bind(i + Math::minimum(j, lane_count - 1));
+			lanes[0][j] = bone_inv_bind.pos.x;
+			lanes[1][j] = bone_inv_bind.pos.y;
+			lanes[2][j] = bone_inv_bind.pos.z;
+			lanes[3][j] = bone_inv_bind.rot.x;
+			lanes[4][j] = bone_inv_bind.rot.y;
+			lanes[5][j] = bone_inv_bind.rot.z;
+			lanes[6][j] = bone_inv_bind.rot.w;
+		}
+
+		// Transform{pos, rot} * inv_bind
+		Quatx4 rot = loadQuatx4(pose.rot_x + i, pose.rot_y + i, pose.rot_z + i, pose.rot_w + i);
+		Vec3x4 inv_bind_pos = loadVec3x4(lanes[0], lanes[1], lanes[2]);
+		Quatx4 inv_bind_rot = loadQuatx4(lanes[3], lanes[4], lanes[5], lanes[6]);
+		Quatx4 q = mulQuatx4(rot, inv_bind_rot);
+		Vec3x4 p = addVec3x4(rotateVec3x4(rot, inv_bind_pos), loadVec3x4(pose.pos_x + i, pose.pos_y + i, pose.pos_z + i));
+
+		// the same as Quat::toMatrix
+		float4 fx = f4Add(q.x, q.x);
+		float4 fy = f4Add(q.y, q.y);
+		float4 fz = f4Add(q.z, q.z);
+		float4 fwx = f4Mul(fx, q.w);
+		float4 fwy = f4Mul(fy, q.w);
+		float4 fwz = f4Mul(fz, q.w);
+		float4 fxx = f4Mul(fx, q.x);
+		float4 fxy = f4Mul(fy, q.x);
+		float4 fxz = f4Mul(fz, q.x);
+		float4 fyy = f4Mul(fy, q.y);
+		float4 fyz = f4Mul(fz, q.y);
+		float4 fzz = f4Mul(fz, q.z);
+		float4 one = f4Splat(1.0f);
+
+		LUMIX_ALIGN_BEGIN(16) float out[12][4] LUMIX_ALIGN_END(16);
+		f4Store(out[0], f4Sub(one, f4Add(fyy, fzz)));
+		f4Store(out[1], f4Add(fxy, fwz));
+		f4Store(out[2], f4Sub(fxz, fwy));
+		f4Store(out[3], f4Sub(fxy, fwz));
+		f4Store(out[4], f4Sub(one, f4Add(fxx, fzz)));
+		f4Store(out[5], f4Add(fyz, fwx));
+		f4Store(out[6], f4Add(fxz, fwy));
+		f4Store(out[7], f4Sub(fyz, fwx));
+		f4Store(out[8], f4Sub(one, f4Add(fxx, fyy)));
+		storeVec3x4(p, out[9], out[10], out[11]);
+
+		for (int j = 0; j < lane_count; ++j)
+		{
+			Matrix& mtx = matrices[i + j];
+			mtx.m11 = out[0][j];
+			mtx.m12 = out[1][j];
+			mtx.m13 = out[2][j];
+			mtx.m14 = 0;
+			mtx.m21 = out[3][j];
+			mtx.m22 = out[4][j];
+			mtx.m23 = out[5][j];
+			mtx.m24 = 0;
+			mtx.m31 = out[6][j];
+			mtx.m32 = out[7][j];
+			mtx.m33 = out[8][j];
+			mtx.m34 = 0;
+			mtx.m41 = out[9][j];
+			mtx.m42 = out[10][j];
+			mtx.m43 = out[11][j];
+			mtx.m44 = 1;
+		}
+	}
+}
+
+
+void Pose::computeSkinningMatrices(const Model& model, Matrix* matrices) const
+{
+	Lumix::computeSkinningMatrices(
+		*this, [&model](int bone) -> const Transform& { return model.getBone(bone).inv_bind_transform; }, matrices);
+}
+
+
+void Pose::computeSkinningMatrices(const Transform* inv_bind_transforms, Matrix* matrices) const
+{
+	Lumix::computeSkinningMatrices(
+		*this, [inv_bind_transforms](int bone) -> const Transform& { return inv_bind_transforms[bone]; }, matrices);
 }
 
 
@@ -2,6 +2,8 @@
 
 
 #include "engine/lumix.h"
+#include "engine/quat.h"
+#include "engine/vec.h"
 
 
 namespace Lumix
@@ -11,8 +13,7 @@ namespace Lumix
 class IAllocator;
 struct Matrix;
 class Model;
-struct Quat;
-struct Vec3;
+struct Transform;
 
 
 struct LUMIX_RENDERER_API Pose
@@ -23,14 +24,49 @@ struct LUMIX_RENDERER_API Pose
 	void resize(int count);
 	void computeAbsolute(Model& model);
 	void computeRelative(Model& model);
+	// parents[i] is the index of bone i's parent, bones before first_nonroot_bone are roots
+	void computeAbsolute(const int* parents, int first_nonroot_bone);
+	void computeRelative(const int* parents, int first_nonroot_bone);
 	void blend(Pose& rhs, float weight);
+	// pose * inverse bind pose of each bone, four bones at a time
+	void computeSkinningMatrices(const Model& model, Matrix* matrices) const;
+	void computeSkinningMatrices(const Transform* inv_bind_transforms, Matrix* matrices) const;
+
+	Vec3 getPosition(int bone) const { return {pos_x[bone], pos_y[bone], pos_z[bone]}; }
+	Quat getRotation(int bone) const { return {rot_x[bone], rot_y[bone], rot_z[bone], rot_w[bone]}; }
+
+	void setPosition(int bone, const Vec3& pos)
+	{
+		++version;
+		pos_x[bone] = pos.x;
+		pos_y[bone] = pos.y;
+		pos_z[bone] = pos.z;
+	}
+
+	void setRotation(int bone, const Quat& rot)
+	{
+		++version;
+		rot_x[bone] = rot.x;
+		rot_y[bone] = rot.y;
+		rot_z[bone] = rot.z;
+		rot_w[bone] = rot.w;
+	}
 
 	IAllocator& allocator;
 	bool is_absolute;
 	i32 count;
-	Vec3* positions;
-	Quat* rotations;
-	
+	// changes whenever the bones change, code writing to the arrays directly must increment it
+	u32 version;
+	// structure of arrays, so bones can be processed four at a time; each array is 16 byte aligned
+	// and padded with identity transforms to a multiple of 4 bones
+	float* pos_x;
+	float* pos_y;
+	float* pos_z;
+	float* rot_x;
+	float* rot_y;
+	float* rot_z;
+	float* rot_w;
+
 	private:
 		Pose(const Pose&);
 		void operator =(const Pose&);
@@ -0,0 +1,207 @@
+#pragma once
+
+
+#include "engine/simd.h"
+
+
+namespace Lumix
+{
+
+
+// four Vec3s, one per lane
+struct Vec3x4
+{
+	float4 x, y, z;
+};
+
+
+// four Quats, one per lane
+struct Quatx4
+{
+	float4 x, y, z, w;
+};
+
+
+LUMIX_FORCE_INLINE Vec3x4 loadVec3x4(const float* x, const float* y, const float* z)
+{
+	return {f4Load(x), f4Load(y), f4Load(z)};
+}
+
+
+LUMIX_FORCE_INLINE Quatx4 loadQuatx4(const float* x, const float* y, const float* z, const float* w)
+{
+	return {f4Load(x), f4Load(y), f4Load(z), f4Load(w)};
+}
+
+
+LUMIX_FORCE_INLINE void storeVec3x4(const Vec3x4& v, float* x, float* y, float* z)
+{
+	f4Store(x, v.x);
+	f4Store(y, v.y);
+	f4Store(z, v.z);
+}
+
+
+LUMIX_FORCE_INLINE void storeQuatx4(const Quatx4& q, float* x, float* y, float* z, float* w)
+{
+	f4Store(x, q.x);
+	f4Store(y, q.y);
+	f4Store(z, q.z);
+	f4Store(w, q.w);
+}
+
+
+// the same as Quat::operator*
+LUMIX_FORCE_INLINE Quatx4 mulQuatx4(const Quatx4& a, const Quatx4& b)
+{
+	return {f4Sub(f4Add(f4Add(f4Mul(a.w, b.x), f4Mul(b.w, a.x)), f4Mul(a.y, b.z)), f4Mul(b.y, a.z)),
+		f4Sub(f4Add(f4Add(f4Mul(a.w, b.y), f4Mul(b.w, a.y)), f4Mul(a.z, b.x)), f4Mul(b.z, a.x)),
+		f4Sub(f4Add(f4Add(f4Mul(a.w, b.z), f4Mul(b.w, a.z)), f4Mul(a.x, b.y)), f4Mul(b.x, a.y)),
+		f4Sub(f4Sub(f4Sub(f4Mul(a.w, b.w), f4Mul(a.x, b.x)), f4Mul(a.y, b.y)), f4Mul(a.z, b.z))};
+}
+
+
+// the same as Quat::rotate
+LUMIX_FORCE_INLINE Vec3x4 rotateVec3x4(const Quatx4& q, const Vec3x4& v)
+{
+	Vec3x4 uv = {f4Sub(f4Mul(q.y, v.z), f4Mul(q.z, v.y)),
+		f4Sub(f4Mul(q.z, v.x), f4Mul(q.x, v.z)),
+		f4Sub(f4Mul(q.x, v.y), f4Mul(q.y, v.x))};
+	Vec3x4 uuv = {f4Sub(f4Mul(q.y, uv.z), f4Mul(q.z, uv.y)),
+		f4Sub(f4Mul(q.z, uv.x), f4Mul(q.x, uv.z)),
+		f4Sub(f4Mul(q.x, uv.y), f4Mul(q.y, uv.x))};
+	float4 two = f4Splat(2.0f);
+	float4 two_w = f4Mul(q.w, two);
+	return {f4Add(f4Add(v.x, f4Mul(uv.x, two_w)), f4Mul(uuv.x, two)),
+		f4Add(f4Add(v.y, f4Mul(uv.y, two_w)), f4Mul(uuv.y, two)),
+		f4Add(f4Add(v.z, f4Mul(uv.z, two_w)), f4Mul(uuv.z, two))};
+}
+
+
+LUMIX_FORCE_INLINE Vec3x4 addVec3x4(const Vec3x4& a, const Vec3x4& b)
+{
+	return {f4Add(a.x, b.x), f4Add(a.y, b.y), f4Add(a.z, b.z)};
+}
+
+
+LUMIX_FORCE_INLINE Vec3x4 subVec3x4(const Vec3x4& a, const Vec3x4& b)
+{
+	return {f4Sub(a.x, b.x), f4Sub(a.y, b.y), f4Sub(a.z, b.z)};
+}
+
+
+LUMIX_FORCE_INLINE float4 dotVec3x4(const Vec3x4& a, const Vec3x4& b)
+{
+	return f4Add(f4Add(f4Mul(a.x, b.x), f4Mul(a.y, b.y)), f4Mul(a.z, b.z));
+}
+
+
+LUMIX_FORCE_INLINE Vec3x4 crossVec3x4(const Vec3x4& a, const Vec3x4& b)
+{
+	return {f4Sub(f4Mul(a.y, b.z), f4Mul(a.z, b.y)),
+		f4Sub(f4Mul(a.z, b.x), f4Mul(a.x, b.z)),
+		f4Sub(f4Mul(a.x, b.y), f4Mul(a.y, b.x))};
+}
+
+
+// the same as lerp(const Vec3&, const Vec3&, Vec3*, float)
+LUMIX_FORCE_INLINE Vec3x4 lerpVec3x4(const Vec3x4& a, const Vec3x4& b, float4 t)
+{
+	float4 inv = f4Sub(f4Splat(1.0f), t);
+	return {f4Add(f4Mul(a.x, inv), f4Mul(b.x, t)),
+		f4Add(f4Mul(a.y, inv), f4Mul(b.y, t)),
+		f4Add(f4Mul(a.z, inv), f4Mul(b.z, t))};
+}
+
+
+// the same as nlerp(const Quat&, const Quat&, Quat*, float)
+LUMIX_FORCE_INLINE Quatx4 nlerpQuatx4(const Quatx4& a, const Quatx4& b, float4 t)
+{
+	float4 inv = f4Sub(f4Splat(1.0f), t);
+	float4 dot = f4Add(f4Add(f4Mul(a.x, b.x), f4Mul(a.y, b.y)), f4Add(f4Mul(a.z, b.z), f4Mul(a.w, b.w)));
+	t = f4Select(f4CmpLT(dot, f4Splat(0)), f4Sub(f4Splat(0), t), t);
+	Quatx4 res = {f4Add(f4Mul(a.x, inv), f4Mul(b.x, t)),
+		f4Add(f4Mul(a.y, inv), f4Mul(b.y, t)),
+		f4Add(f4Mul(a.z, inv), f4Mul(b.z, t)),
+		f4Add(f4Mul(a.w, inv), f4Mul(b.w, t))};
+	float4 length_sq = f4Add(f4Add(f4Mul(res.x, res.x), f4Mul(res.y, res.y)),
+		f4Add(f4Mul(res.z, res.z), f4Mul(res.w, res.w)));
+	float4 inv_length = f4Div(f4Splat(1.0f), f4Sqrt(length_sq));
+	return {f4Mul(res.x, inv_length), f4Mul(res.y, inv_length), f4Mul(res.z, inv_length), f4Mul(res.w, inv_length)};
+}
+
+
+
+#ifdef __AVX__
+// eight Vec3s, one per lane
+struct Vec3x8
+{
+	float8 x, y, z;
+};
+
+
+// eight Quats, one per lane
+struct Quatx8
+{
+	float8 x, y, z, w;
+};
+
+
+LUMIX_FORCE_INLINE Vec3x8 loadVec3x8(const float* x, const float* y, const float* z)
+{
+	return {f8LoadUnaligned(x), f8LoadUnaligned(y), f8LoadUnaligned(z)};
+}
+
+
+LUMIX_FORCE_INLINE Quatx8 loadQuatx8(const float* x, const float* y, const float* z, const float* w)
+{
+	return {f8LoadUnaligned(x), f8LoadUnaligned(y), f8LoadUnaligned(z), f8LoadUnaligned(w)};
+}
+
+
+LUMIX_FORCE_INLINE void storeVec3x8(const Vec3x8& v, float* x, float* y, float* z)
+{
+	f8StoreUnaligned(x, v.x);
+	f8StoreUnaligned(y, v.y);
+	f8StoreUnaligned(z, v.z);
+}
+
+
+LUMIX_FORCE_INLINE void storeQuatx8(const Quatx8& q, float* x, float* y, float* z, float* w)
+{
+	f8StoreUnaligned(x, q.x);
+	f8StoreUnaligned(y, q.y);
+	f8StoreUnaligned(z, q.z);
+	f8StoreUnaligned(w, q.w);
+}
+
+
+// the same as lerpVec3x4
+LUMIX_FORCE_INLINE Vec3x8 lerpVec3x8(const Vec3x8& a, const Vec3x8& b, float8 t)
+{
+	float8 inv = f8Sub(f8Splat(1.0f), t);
+	return {f8Add(f8Mul(a.x, inv), f8Mul(b.x, t)),
+		f8Add(f8Mul(a.y, inv), f8Mul(b.y, t)),
+		f8Add(f8Mul(a.z, inv), f8Mul(b.z, t))};
+}
+
+
+// the same as nlerpQuatx4
+LUMIX_FORCE_INLINE Quatx8 nlerpQuatx8(const Quatx8& a, const Quatx8& b, float8 t)
+{
+	float8 inv = f8Sub(f8Splat(1.0f), t);
+	float8 dot = f8Add(f8Add(f8Mul(a.x, b.x), f8Mul(a.y, b.y)), f8Add(f8Mul(a.z, b.z), f8Mul(a.w, b.w)));
+	t = f8Select(f8CmpLT(dot, f8Splat(0)), f8Sub(f8Splat(0), t), t);
+	Quatx8 res = {f8Add(f8Mul(a.x, inv), f8Mul(b.x, t)),
+		f8Add(f8Mul(a.y, inv), f8Mul(b.y, t)),
+		f8Add(f8Mul(a.z, inv), f8Mul(b.z, t)),
+		f8Add(f8Mul(a.w, inv), f8Mul(b.w, t))};
+	float8 length_sq = f8Add(f8Add(f8Mul(res.x, res.x), f8Mul(res.y, res.y)),
+		f8Add(f8Mul(res.z, res.z), f8Mul(res.w, res.w)));
+	float8 inv_length = f8Div(f8Splat(1.0f), f8Sqrt(length_sq));
+	return {f8Mul(res.x, inv_length), f8Mul(res.y, inv_length), f8Mul(res.z, inv_length), f8Mul(res.w, inv_length)};
+}
+#endif
+
+
+} // namespace Lumix
@@ -0,0 +1,431 @@
+#include "ray_cast_bvh.h"
+#include "engine/math_utils.h"
+#include "engine/profiler.h"
+#include "renderer/pose_simd.h"
+
+#include <cfloat>
+
+
+namespace Lumix
+{
+
+
+// leaves have at most one triangle per SIMD lane
+static const int MAX_LEAF_TRIANGLES = 4;
+static const int SAH_BIN_COUNT = 16;
+// deeper ranges are split in the middle, it keeps the tree shallow enough for the traversal stack
+static const int MAX_SAH_DEPTH = 48;
+static const int STACK_SIZE = 256;
+
+
+struct RayCastBVH::BuildTriangle
+{
+	AABB aabb;
+	Vec3 centroid;
+	u32 first_index;
+	u32 vertex_offset;
+	int mesh;
+};
+
+
+static float getSurfaceArea(const AABB& aabb)
+{
+	Vec3 size = aabb.max - aabb.min;
+	return 2 * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+
+// splits triangles in two non-empty ranges, returns the beginning of the second range
+int RayCastBVH::splitTriangles(BuildTriangle* triangles, int begin, int end, int depth)
+{
+	int mid = (begin + end) / 2;
+	if (triangles[begin].mesh != triangles[end - 1].mesh)
+	{
+		// leaves do not mix meshes, triangles are sorted by mesh, so the split is at a mesh boundary
+		int split = -1;
+		for (int i = begin + 1; i < end; ++i)
+		{
+			if (triangles[i].mesh == triangles[i - 1].mesh) continue;
+			if (split < 0 || Math::abs(i - mid) < Math::abs(split - mid)) split = i;
+		}
+		return split;
+	}
+	if (depth > MAX_SAH_DEPTH) return mid;
+
+	AABB centroids(triangles[begin].centroid, triangles[begin].centroid);
+	for (int i = begin + 1; i < end; ++i) centroids.addPoint(triangles[i].centroid);
+	Vec3 size = centroids.max - centroids.min;
+	int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+	float axis_min = (&centroids.min.x)[axis];
+	float axis_size = (&size.x)[axis];
+	if (axis_size <= 0) return mid;
+
+	// surface area heuristic evaluated at the boundaries of bins along the longest axis
+	struct Bin
+	{
+		AABB aabb;
+		int count;
+	};
+	Bin bins[SAH_BIN_COUNT];
+	for (Bin& bin : bins) bin.count = 0;
+	float scale = SAH_BIN_COUNT / axis_size;
+	auto getBin = [&](const BuildTriangle& triangle) {
+		int bin = int(((&triangle.centroid.x)[axis] - axis_min) * scale);
+		return Math::minimum(bin, SAH_BIN_COUNT - 1);
+	};
+	for (int i = begin; i < end; ++i)
+	{
+		Bin& bin = bins[getBin(triangles[i])];
+		if (bin.count == 0) bin.aabb = triangles[i].aabb;
+		else bin.aabb.merge(triangles[i].aabb);
+		++bin.count;
+	}
+
+	float right_areas[SAH_BIN_COUNT];
+	int right_counts[SAH_BIN_COUNT];
+	AABB right_aabb;
+	int right_count = 0;
+	for (int i = SAH_BIN_COUNT - 1; i > 0; --i)
+	{
+		if (bins[i].count > 0)
+		{
+			if (right_count == 0) right_aabb = bins[i].aabb;
+			else right_aabb.merge(bins[i].aabb);
+			right_count += bins[i].count;
+		}
+		right_areas[i] = right_count > 0 ? getSurfaceArea(right_aabb) : 0;
+		right_counts[i] = right_count;
+	}
+
+	int best_bin = -1;
+	float best_cost = FLT_MAX;
+	AABB left_aabb;
+	int left_count = 0;
+	for (int i = 1; i < SAH_BIN_COUNT; ++i)
+	{
+		const Bin& bin = bins[i - 1];
+		if (bin.count > 0)
+		{
+			if (left_count == 0) left_aabb = bin.aabb;
+			else left_aabb.merge(bin.aabb);
+			left_count += bin.count;
+		}
+		if (left_count == 0 || right_counts[i] == 0) continue;
+		float cost = left_count * getSurfaceArea(left_aabb) + right_counts[i] * right_areas[i];
+		if (cost < best_cost)
+		{
+			best_cost = cost;
+			best_bin = i;
+		}
+	}
+	if (best_bin < 0) return mid;
+
+	int i = begin;
+	int j = end - 1;
+	while (i <= j)
+	{
+		if (getBin(triangles[i]) < best_bin)
+		{
+			++i;
+		}
+		else
+		{
+			Math::swap(triangles[i], triangles[j]);
+			--j;
+		}
+	}
+	return i;
+}
+
+
+// depth is the number of binary splits above the range, each node splits twice
+i32 RayCastBVH::buildNode(BuildTriangle* triangles, int begin, int end, int depth)
+{
+	struct Range
+	{
+		int begin;
+		int end;
+	};
+	Range ranges[4];
+	int range_count = 0;
+	auto isLeaf = [triangles](int range_begin, int range_end) {
+		return range_end - range_begin <= MAX_LEAF_TRIANGLES &&
+			   triangles[range_begin].mesh == triangles[range_end - 1].mesh;
+	};
+	if (isLeaf(begin, end))
+	{
+		ranges[range_count++] = {begin, end};
+	}
+	else
+	{
+		int mid = splitTriangles(triangles, begin, end, depth);
+		Range halves[] = {{begin, mid}, {mid, end}};
+		for (const Range& half : halves)
+		{
+			if (isLeaf(half.begin, half.end))
+			{
+				ranges[range_count++] = half;
+				continue;
+			}
+			int quarter = splitTriangles(triangles, half.begin, half.end, depth + 1);
+			ranges[range_count++] = {half.begin, quarter};
+			ranges[range_count++] = {quarter, half.end};
+		}
+	}
+
+	int node_idx = m_nodes.size();
+	Node& new_node = m_nodes.emplace();
+	setMemory(&new_node, 0, sizeof(new_node));
+	new_node.child_count = range_count;
+	for (int i = 0; i < range_count; ++i)
+	{
+		const Range& range = ranges[i];
+		AABB aabb = triangles[range.begin].aabb;
+		for (int j = range.begin + 1; j < range.end; ++j) aabb.merge(triangles[j].aabb);
+
+		i32 child;
+		if (isLeaf(range.begin, range.end))
+		{
+			child = ~m_leaves.size();
+			Leaf& leaf = m_leaves.emplace();
+			leaf.first_triangle = range.begin;
+			leaf.vertex_offset = triangles[range.begin].vertex_offset;
+			leaf.triangle_count = u16(range.end - range.begin);
+			leaf.mesh = u16(triangles[range.begin].mesh);
+		}
+		else
+		{
+			child = buildNode(triangles, range.begin, range.end, depth + 2);
+		}
+
+		// the recursion could have moved the node
+		Node& node = m_nodes[node_idx];
+		node.min_x[i] = aabb.min.x;
+		node.min_y[i] = aabb.min.y;
+		node.min_z[i] = aabb.min.z;
+		node.max_x[i] = aabb.max.x;
+		node.max_y[i] = aabb.max.y;
+		node.max_z[i] = aabb.max.z;
+		node.children[i] = child;
+	}
+	return node_idx;
+}
+
+
+RayCastBVH::RayCastBVH(IAllocator& allocator)
+	: m_allocator(allocator)
+	, m_vertices(nullptr)
+	, m_indices(nullptr)
+	, m_are_indices16(false)
+	, m_nodes(allocator)
+	, m_leaves(allocator)
+	, m_triangles(allocator)
+{
+}
+
+
+void RayCastBVH::clear()
+{
+	m_vertices = nullptr;
+	m_indices = nullptr;
+	m_nodes.clear();
+	m_leaves.clear();
+	m_triangles.clear();
+}
+
+
+void RayCastBVH::build(const Vec3* vertices,
+	const void* indices,
+	bool are_indices16,
+	const Mesh* meshes,
+	int mesh_count)
+{
+	PROFILE_FUNCTION();
+	clear();
+	m_vertices = vertices;
+	m_indices = indices;
+	m_are_indices16 = are_indices16;
+
+	Array<BuildTriangle> triangles(m_allocator);
+	const u16* indices16 = (const u16*)indices;
+	const u32* indices32 = (const u32*)indices;
+	for (int mesh_index = 0; mesh_index < mesh_count; ++mesh_index)
+	{
+		const Mesh& mesh = meshes[mesh_index];
+		int indices_end = mesh.indices_offset + mesh.indices_count;
+		for (int i = mesh.indices_offset; i < indices_end; i += 3)
+		{
+			BuildTriangle& triangle = triangles.emplace();
+			for (int j = 0; j < 3; ++j)
+			{
+				u32 index = are_indices16 ? indices16[i + j] : indices32[i + j];
+				const Vec3& vertex = vertices[mesh.vertex_offset + index];
+				if (j == 0) triangle.aabb.set(vertex, vertex);
+				else triangle.aabb.addPoint(vertex);
+			}
+			triangle.centroid = (triangle.aabb.min + triangle.aabb.max) * 0.5f;
+			triangle.first_index = i;
+			triangle.vertex_offset = mesh.vertex_offset;
+			triangle.mesh = mesh_index;
+		}
+	}
+	if (triangles.empty()) return;
+
+	buildNode(&triangles[0], 0, triangles.size(), 0);
+	m_triangles.resize(triangles.size());
+	for (int i = 0; i < triangles.size(); ++i)
+	{
+		m_triangles[i] = triangles[i].first_index;
+	}
+}
+
+
+// Moller-Trumbore test of a ray against up to 4 triangles, returns the lane of the nearest hit
+// closer than max_t, -1 if there is none
+static int castRay4(const Vec3x4& p0,
+	const Vec3x4& p1,
+	const Vec3x4& p2,
+	int lane_mask,
+	const Vec3x4& origin,
+	const Vec3x4& dir,
+	float max_t,
+	float* t)
+{
+	float4 zero = f4Splat(0);
+	Vec3x4 edge1 = subVec3x4(p1, p0);
+	Vec3x4 edge2 = subVec3x4(p2, p0);
+	Vec3x4 pvec = crossVec3x4(dir, edge2);
+	float4 det = dotVec3x4(edge1, pvec);
+	// parallel rays have det == 0, it's replaced by 1 so there is no division by zero
+	// and the lanes are masked out
+	float4 is_positive = f4CmpLT(zero, det);
+	float4 is_negative = f4CmpLT(det, zero);
+	int mask = lane_mask & (f4MoveMask(is_positive) | f4MoveMask(is_negative));
+	if (mask == 0) return -1;
+
+	float4 one = f4Splat(1.0f);
+	det = f4Select(is_positive, det, f4Select(is_negative, det, one));
+	float4 inv_det = f4Div(one, det);
+	Vec3x4 tvec = subVec3x4(origin, p0);
+	float4 u = f4Mul(dotVec3x4(tvec, pvec), inv_det);
+	Vec3x4 qvec = crossVec3x4(tvec, edge1);
+	float4 v = f4Mul(dotVec3x4(dir, qvec), inv_det);
+	float4 hit_t = f4Mul(dotVec3x4(edge2, qvec), inv_det);
+	mask &= ~f4MoveMask(f4CmpLT(u, zero));
+	mask &= ~f4MoveMask(f4CmpLT(v, zero));
+	mask &= ~f4MoveMask(f4CmpLT(one, f4Add(u, v)));
+	mask &= ~f4MoveMask(f4CmpLT(hit_t, zero));
+	mask &= f4MoveMask(f4CmpLT(hit_t, f4Splat(max_t)));
+	if (mask == 0) return -1;
+
+	LUMIX_ALIGN_BEGIN(16) float ts[4] LUMIX_ALIGN_END(16);
+	f4Store(ts, hit_t);
+	int lane = -1;
+	for (int i = 0; i < 4; ++i)
+	{
+		if ((mask & (1 << i)) && (lane < 0 || ts[i] < ts[lane])) lane = i;
+	}
+	*t = ts[lane];
+	return lane;
+}
+
+
+int RayCastBVH::castRay(const Vec3& origin, const Vec3& dir, float* t) const
+{
+	if (m_nodes.empty()) return -1;
+
+	Vec3 inv_dir(1 / (dir.x == 0 ? 0.00000001f : dir.x),
+		1 / (dir.y == 0 ? 0.00000001f : dir.y),
+		1 / (dir.z == 0 ? 0.00000001f : dir.z));
+
+	Vec3x4 origin4 = {f4Splat(origin.x), f4Splat(origin.y), f4Splat(origin.z)};
+	Vec3x4 dir4 = {f4Splat(dir.x), f4Splat(dir.y), f4Splat(dir.z)};
+	Vec3x4 inv_dir4 = {f4Splat(inv_dir.x), f4Splat(inv_dir.y), f4Splat(inv_dir.z)};
+	float4 zero = f4Splat(0);
+	const u16* indices16 = (const u16*)m_indices;
+	const u32* indices32 = (const u32*)m_indices;
+	float max_t = FLT_MAX;
+	int hit_mesh = -1;
+
+	struct StackItem
+	{
+		i32 child;
+		float t;
+	};
+	StackItem stack[STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = {0, 0};
+	while (stack_size > 0)
+	{
+		StackItem item = stack[--stack_size];
+		if (item.t > max_t) continue;
+
+		if (item.child < 0)
+		{
+			const Leaf& leaf = m_leaves[~item.child];
+			LUMIX_ALIGN_BEGIN(16) float lanes[9][4] LUMIX_ALIGN_END(16);
+			for (int i = 0; i < 4; ++i)
+			{
+				// unused lanes repeat the last triangle
+				u32 first_index = m_triangles[leaf.first_triangle + Math::minimum(i, leaf.triangle_count - 1)];
+				for (int j = 0; j < 3; ++j)
+				{
+					u32 index = m_are_indices16 ? indices16[first_index + j] : indices32[first_index + j];
+					const Vec3& vertex = m_vertices[leaf.vertex_offset + index];
+					lanes[j * 3][i] = vertex.x;
+					lanes[j * 3 + 1][i] = vertex.y;
+					lanes[j * 3 + 2][i] = vertex.z;
+				}
+			}
+			float hit_t;
+			int lane = castRay4(loadVec3x4(lanes[0], lanes[1], lanes[2]),
+				loadVec3x4(lanes[3], lanes[4], lanes[5]),
+				loadVec3x4(lanes[6], lanes[7], lanes[8]),
+				(1 << leaf.triangle_count) - 1,
+				origin4,
+				dir4,
+				max_t,
+				&hit_t);
+			if (lane >= 0)
+			{
+				max_t = hit_t;
+				hit_mesh = leaf.mesh;
+			}
+			continue;
+		}
+
+		const Node& node = m_nodes[item.child];
+		float4 t1x = f4Mul(f4Sub(f4LoadUnaligned(node.min_x), origin4.x), inv_dir4.x);
+		float4 t2x = f4Mul(f4Sub(f4LoadUnaligned(node.max_x), origin4.x), inv_dir4.x);
+		float4 t1y = f4Mul(f4Sub(f4LoadUnaligned(node.min_y), origin4.y), inv_dir4.y);
+		float4 t2y = f4Mul(f4Sub(f4LoadUnaligned(node.max_y), origin4.y), inv_dir4.y);
+		float4 t1z = f4Mul(f4Sub(f4LoadUnaligned(node.min_z), origin4.z), inv_dir4.z);
+		float4 t2z = f4Mul(f4Sub(f4LoadUnaligned(node.max_z), origin4.z), inv_dir4.z);
+		float4 t_enter = f4Max(f4Max(f4Min(t1x, t2x), f4Min(t1y, t2y)), f4Max(f4Min(t1z, t2z), zero));
+		float4 t_exit = f4Min(f4Min(f4Max(t1x, t2x), f4Max(t1y, t2y)), f4Min(f4Max(t1z, t2z), f4Splat(max_t)));
+		int mask = ~f4MoveMask(f4CmpLT(t_exit, t_enter)) & ((1 << node.child_count) - 1);
+		if (mask == 0) continue;
+
+		LUMIX_ALIGN_BEGIN(16) float ts[4] LUMIX_ALIGN_END(16);
+		f4Store(ts, t_enter);
+		// sorted from the farthest, so the nearest child is popped first
+		StackItem children[4];
+		int child_count = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			if ((mask & (1 << i)) == 0) continue;
+			int j = child_count++;
+			for (; j > 0 && children[j - 1].t < ts[i]; --j) children[j] = children[j - 1];
+			children[j] = {node.children[i], ts[i]};
+		}
+		ASSERT(stack_size + child_count <= STACK_SIZE);
+		for (int i = 0; i < child_count; ++i) stack[stack_size++] = children[i];
+	}
+	if (hit_mesh >= 0) *t = max_t;
+	return hit_mesh;
+}
+
+
+
+
+} // namespace Lumix
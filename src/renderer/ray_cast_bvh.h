@@ -0,0 +1,75 @@
+#pragma once
+
+
+#include "engine/array.h"
+#include "engine/geometry.h"
+
+
+namespace Lumix
+{
+	class IAllocator;
+
+
+	// static 4-ary bounding volume hierarchy over triangles of a model's meshes; bounds of a node's
+	// children are stored per axis, so a ray is tested against all of them at once, and leaves have
+	// up to 4 triangles of one mesh, tested against a ray at once
+	class LUMIX_RENDERER_API RayCastBVH
+	{
+	public:
+		struct Mesh
+		{
+			int indices_offset;
+			int indices_count;
+			// indices of the mesh are relative to this vertex
+			u32 vertex_offset;
+		};
+
+		explicit RayCastBVH(IAllocator& allocator);
+
+		void clear();
+		// vertices and indices are not copied, they must stay valid until the tree is cleared
+		void build(const Vec3* vertices, const void* indices, bool are_indices16, const Mesh* meshes, int mesh_count);
+		bool empty() const { return m_nodes.empty(); }
+		// returns the index of the mesh with the nearest triangle hit by origin + dir * t, t >= 0,
+		// -1 if there is none; both sides of triangles are hit
+		int castRay(const Vec3& origin, const Vec3& dir, float* t) const;
+
+	private:
+		struct BuildTriangle;
+
+		struct Node
+		{
+			float min_x[4];
+			float min_y[4];
+			float min_z[4];
+			float max_x[4];
+			float max_y[4];
+			float max_z[4];
+			// index of a node, or ~index of a leaf
+			i32 children[4];
+			int child_count;
+		};
+
+		struct Leaf
+		{
+			// the first item in m_triangles
+			u32 first_triangle;
+			u32 vertex_offset;
+			u16 triangle_count;
+			u16 mesh;
+		};
+
+		i32 buildNode(BuildTriangle* triangles, int begin, int end, int depth);
+		static int splitTriangles(BuildTriangle* triangles, int begin, int end, int depth);
+
+		IAllocator& m_allocator;
+		const Vec3* m_vertices;
+		const void* m_indices;
+		bool m_are_indices16;
+		// the first node is the root
+		Array<Node> m_nodes;
+		Array<Leaf> m_leaves;
+		// offsets of the triangles' first indices, grouped by leaves
+		Array<u32> m_triangles;
+	};
+} // namespace Lumix
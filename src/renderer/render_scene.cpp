@@ -17,6 +17,7 @@
 #include "engine/plugin_manager.h"
 #include "engine/profiler.h"
 #include "engine/property_register.h"
+#include "engine/radix_sort.h"
 #include "engine/resource_manager.h"
 #include "engine/resource_manager_base.h"
 #include "engine/timer.h"
@@ -27,14 +28,17 @@
 
 #include "renderer/culling_system.h"
 #include "renderer/frame_buffer.h"
+#include "renderer/instance_bvh.h"
 #include "renderer/material.h"
 #include "renderer/material_manager.h"
 #include "renderer/model.h"
+#include "renderer/occlusion_buffer.h"
 #include "renderer/particle_system.h"
 #include "renderer/pipeline.h"
 #include "renderer/pose.h"
 #include "renderer/renderer.h"
 #include "renderer/shader.h"
+#include "renderer/sphere_grid.h"
 #include "renderer/terrain.h"
 #include "renderer/texture.h"
 #include "renderer/texture_manager.h"
@@ -76,6 +80,39 @@ static const ResourceType MATERIAL_TYPE("material");
 static const ResourceType TEXTURE_TYPE("texture");
 static const ResourceType MODEL_TYPE("model");
 static bool is_opengl = false;
+// static model instances are batched in cubic cells of this size
+static const float STATIC_BATCH_CELL_SIZE = 32.0f;
+// model instances are found by point lights in a grid of cubic cells of this size
+static const float LIGHT_INFLUENCE_CELL_SIZE = 16.0f;
+// with fewer rays, a batch of ray casts runs on one thread
+static const int MIN_RAYS_PER_CAST_JOB = 32;
+// with fewer model instances in visible static batches, their infos are filled on one thread
+static const int MIN_STATIC_INSTANCES_PER_JOB = 256;
+
+
+// skinning matrices of a model instance in RenderSceneImpl::m_skinning_matrices,
+// they are valid only in the frame they were computed in and for the same version of the same pose
+struct SkinningMatricesRange
+{
+	int offset;
+	u32 frame_index;
+	const Pose* pose;
+	u32 pose_version;
+};
+
+
+// static model instances in one cell, they are culled as one object
+struct StaticBatch
+{
+	explicit StaticBatch(IAllocator& allocator)
+		: model_instances(allocator)
+	{
+	}
+
+	Sphere sphere;
+	u64 layer_mask;
+	Array<ComponentHandle> model_instances;
+};
 
 
 struct Decal : public DecalInfo
@@ -171,6 +208,9 @@ private:
 		RenderSceneImpl& m_scene;
 	};
 
+	// the biggest on-screen size of each material
+	typedef HashMap<Material*, int, HashFunc<void*>> MipRequests;
+
 public:
 	RenderSceneImpl(Renderer& renderer,
 		Engine& engine,
@@ -182,6 +222,10 @@ public:
 		m_universe.entityTransformed().unbind<RenderSceneImpl, &RenderSceneImpl::onEntityMoved>(this);
 		m_universe.entityDestroyed().unbind<RenderSceneImpl, &RenderSceneImpl::onEntityDestroyed>(this);
 		CullingSystem::destroy(*m_culling_system);
+		CullingSystem::destroy(*m_static_batch_culling);
+		LightClusterBuilder::destroy(*m_light_cluster_builder);
+		OcclusionBuffer::destroy(*m_occlusion_buffer);
+		SphereGrid::destroy(*m_light_influence_grid);
 	}
 
 
@@ -236,7 +280,13 @@ public:
 			}
 		}
 		m_model_instances.clear();
+		m_occluders.clear();
+		m_static_batches.clear();
+		m_are_static_batches_dirty = false;
 		m_culling_system->clear();
+		m_static_batch_culling->clear();
+		m_light_influence_grid->clear();
+		m_instance_bvh.clear();
 
 		for (auto& probe : m_environment_probes)
 		{
@@ -473,7 +523,7 @@ public:
 		Transform parent_entity_transform = m_universe.getTransform(bone_attachment.parent_entity);
 		int idx = bone_attachment.bone_index;
 		if (idx < 0 || idx > parent_pose->count) return;
-		Transform bone_transform = {parent_pose->positions[idx], parent_pose->rotations[idx]};
+		Transform bone_transform = {parent_pose->getPosition(idx), parent_pose->getRotation(idx)};
 		m_universe.setTransform(
 			bone_attachment.entity, parent_entity_transform * bone_transform * bone_attachment.relative_transform);
 	}
@@ -496,7 +546,7 @@ public:
 		if (!pose) return;
 		ASSERT(pose->is_absolute);
 		if (attachment.bone_index >= pose->count) return;
-		Transform bone_transform = {pose->positions[attachment.bone_index], pose->rotations[attachment.bone_index]};
+		Transform bone_transform = {pose->getPosition(attachment.bone_index), pose->getRotation(attachment.bone_index)};
 
 		Transform inv_parent_transform = m_universe.getTransform(attachment.parent_entity) * bone_transform;
 		inv_parent_transform = inv_parent_transform.inverted();
@@ -711,6 +761,7 @@ public:
 						serializer.writeString(r.meshes[i].material->getPath().c_str());
 					}
 				}
+				serializer.write(r.flags);
 			}
 			
 		}
@@ -998,6 +1049,7 @@ public:
 			r.custom_meshes = false;
 			r.meshes = nullptr;
 			r.mesh_count = 0;
+			r.flags = 0;
 
 			if(r.entity != INVALID_ENTITY)
 			{
@@ -1031,6 +1083,13 @@ public:
 					}
 				}
 
+				if (version > RenderSceneVersion::MODEL_INSTANCE_FLAGS)
+				{
+					serializer.read(r.flags);
+					if (r.flags & ModelInstance::OCCLUDER) m_occluders.push(cmp);
+					if (r.flags & ModelInstance::STATIC) m_are_static_batches_dirty = true;
+				}
+
 				m_universe.addComponent(r.entity, MODEL_INSTANCE_TYPE, this, cmp);
 			}
 		}
@@ -1043,7 +1102,6 @@ public:
 		m_point_lights.resize(size);
 		for (int i = 0; i < size; ++i)
 		{
-			m_light_influenced_geometry.push(Array<ComponentHandle>(m_allocator));
 			PointLight& light = m_point_lights[i];
 			if (version > RenderSceneVersion::SPECULAR_INTENSITY)
 			{
@@ -1171,21 +1229,10 @@ public:
 	void destroyModelInstance(ComponentHandle component)
 	{
 		m_model_instance_destroyed.invoke(component);
-		for (int i = 0; i < m_light_influenced_geometry.size(); ++i)
-		{
-			Array<ComponentHandle>& influenced_geometry = m_light_influenced_geometry[i];
-			for (int j = 0; j < influenced_geometry.size(); ++j)
-			{
-				if (influenced_geometry[j] == component)
-				{
-					influenced_geometry.erase(j);
-					break;
-				}
-			}
-		}
-
 		setModel(component, nullptr);
 		auto& model_instance = m_model_instances[component.index];
+		if (model_instance.flags & ModelInstance::OCCLUDER) m_occluders.eraseItemFast(component);
+		markStaticBatchesDirty(model_instance);
 		Entity entity = model_instance.entity;
 		LUMIX_DELETE(m_allocator, model_instance.pose);
 		model_instance.pose = nullptr;
@@ -1222,7 +1269,6 @@ public:
 		Entity entity = m_point_lights[index].m_entity;
 		m_point_lights.eraseFast(index);
 		m_point_lights_map.erase(component);
-		m_light_influenced_geometry.eraseFast(index);
 		if (index < m_point_lights.size())
 		{
 			m_point_lights_map[m_point_lights[index].m_component] = index;
@@ -1868,22 +1914,6 @@ public:
 	}
 
 
-	Frustum getPointLightFrustum(ComponentHandle cmp) const
-	{
-		const PointLight& light = m_point_lights[m_point_lights_map[cmp]];
-		Frustum frustum;
-		frustum.computeOrtho(m_universe.getPosition(light.m_entity),
-			Vec3(1, 0, 0),
-			Vec3(0, 1, 0),
-			light.m_range,
-			light.m_range,
-			-light.m_range,
-			light.m_range);
-
-		return frustum;
-	}
-
-
 	void onEntityDestroyed(Entity entity)
 	{
 		for (auto& i : m_bone_attachments)
@@ -1912,27 +1942,10 @@ public:
 				float radius = m_universe.getScale(entity) * r.model->getBoundingRadius();
 				Vec3 position = m_universe.getPosition(entity);
 				m_culling_system->updateBoundingSphere({position, radius}, cmp);
+				if (m_light_influence_grid->isAdded(cmp)) m_light_influence_grid->update(cmp, {position, radius});
+				m_instance_bvh.update(cmp, {position, radius});
 			}
-
-			float bounding_radius = r.model ? r.model->getBoundingRadius() : 1;
-			for (int light_idx = 0, c = m_point_lights.size(); light_idx < c; ++light_idx)
-			{
-				for (int j = 0, c2 = m_light_influenced_geometry[light_idx].size(); j < c2; ++j)
-				{
-					if(m_light_influenced_geometry[light_idx][j] == cmp)
-					{
-						m_light_influenced_geometry[light_idx].eraseFast(j);
-						break;
-					}
-				}
-
-				Vec3 pos = m_universe.getPosition(r.entity);
-				Frustum frustum = getPointLightFrustum({light_idx});
-				if(frustum.isSphereInside(pos, bounding_radius))
-				{
-					m_light_influenced_geometry[light_idx].push(cmp);
-				}
-			}
+			markStaticBatchesDirty(r);
 		}
 
 		int decal_idx = m_decals.find(entity);
@@ -1941,15 +1954,6 @@ public:
 			updateDecalInfo(m_decals.at(decal_idx));
 		}
 
-		for (int i = 0, c = m_point_lights.size(); i < c; ++i)
-		{
-			if (m_point_lights[i].m_entity == entity)
-			{
-				detectLightInfluencedGeometry(m_point_lights[i].m_component);
-				break;
-			}
-		}
-
 		bool was_updating = m_is_updating_attachments;
 		m_is_updating_attachments = true;
 		for (auto& attachment : m_bone_attachments)
@@ -2145,7 +2149,7 @@ public:
 	Model* getModelInstanceModel(ComponentHandle cmp) override { return m_model_instances[cmp.index].model; }
 
 
-	static u64 getLayerMask(ModelInstance& model_instance)
+	static u64 getLayerMask(const ModelInstance& model_instance)
 	{
 		Model* model = model_instance.model;
 		if (!model->isReady()) return 1;
@@ -2166,12 +2170,16 @@ public:
 		Sphere sphere(m_universe.getPosition(model_instance.entity), model_instance.model->getBoundingRadius());
 		u64 layer_mask = getLayerMask(model_instance);
 		if(!m_culling_system->isAdded(cmp)) m_culling_system->addStatic(cmp, sphere, layer_mask);
+		if (!m_light_influence_grid->isAdded(cmp)) m_light_influence_grid->add(cmp, sphere);
+		markStaticBatchesDirty(model_instance);
 	}
 
 
 	void hideModelInstance(ComponentHandle cmp) override
 	{
 		m_culling_system->removeStatic(cmp);
+		m_light_influence_grid->remove(cmp);
+		markStaticBatchesDirty(m_model_instances[cmp.index]);
 	}
 
 
@@ -2205,9 +2213,177 @@ public:
 	}
 
 
+	void setModelInstanceOccluder(ComponentHandle cmp, bool is_occluder) override
+	{
+		ModelInstance& r = m_model_instances[cmp.index];
+		if (isModelInstanceOccluder(cmp) == is_occluder) return;
+
+		if (is_occluder)
+		{
+			r.flags |= ModelInstance::OCCLUDER;
+			m_occluders.push(cmp);
+		}
+		else
+		{
+			r.flags &= ~ModelInstance::OCCLUDER;
+			m_occluders.eraseItemFast(cmp);
+		}
+	}
+
+
+	bool isModelInstanceOccluder(ComponentHandle cmp) override
+	{
+		return (m_model_instances[cmp.index].flags & ModelInstance::OCCLUDER) != 0;
+	}
+
+
+	void setModelInstanceStatic(ComponentHandle cmp, bool is_static) override
+	{
+		ModelInstance& r = m_model_instances[cmp.index];
+		if (isModelInstanceStatic(cmp) == is_static) return;
+
+		m_are_static_batches_dirty = true;
+		if (is_static)
+		{
+			r.flags |= ModelInstance::STATIC;
+		}
+		else
+		{
+			r.flags &= ~ModelInstance::STATIC;
+		}
+	}
+
+
+	bool isModelInstanceStatic(ComponentHandle cmp) override
+	{
+		return (m_model_instances[cmp.index].flags & ModelInstance::STATIC) != 0;
+	}
+
+
+	void markStaticBatchesDirty(const ModelInstance& model_instance)
+	{
+		if (model_instance.flags & ModelInstance::STATIC) m_are_static_batches_dirty = true;
+	}
+
+
+	static u64 getStaticBatchCellKey(const Vec3& position)
+	{
+		auto cell = [](float x) { return u64((int)floorf(x / STATIC_BATCH_CELL_SIZE) & 0x1fffff); };
+		return (cell(position.x) << 42) | (cell(position.y) << 21) | cell(position.z);
+	}
+
+
+	// batched model instances are kept in the culling system, so other queries still see them,
+	// but with an empty layer mask, so they are skipped when the scene is culled for rendering;
+	// the batches themselves are culled by m_static_batch_culling, their indices are its handles
+	void updateStaticBatches()
+	{
+		if (!m_are_static_batches_dirty) return;
+
+		PROFILE_FUNCTION();
+		m_are_static_batches_dirty = false;
+		for (const StaticBatch& batch : m_static_batches)
+		{
+			for (ComponentHandle cmp : batch.model_instances)
+			{
+				ModelInstance& r = m_model_instances[cmp.index];
+				if (!isValid(r.entity) || !r.model || !r.model->isReady()) continue;
+				if (m_culling_system->isAdded(cmp)) m_culling_system->setLayerMask(cmp, getLayerMask(r));
+			}
+		}
+		m_static_batches.clear();
+		m_static_batch_culling->clear();
+
+		HashMap<u64, int> cells(m_allocator);
+		for (int i = 0, c = m_model_instances.size(); i < c; ++i)
+		{
+			ModelInstance& r = m_model_instances[i];
+			if (!isValid(r.entity) || (r.flags & ModelInstance::STATIC) == 0) continue;
+			if (!r.model || !r.model->isReady() || r.type != ModelInstance::RIGID) continue;
+			ComponentHandle cmp = {i};
+			if (!m_culling_system->isAdded(cmp)) continue;
+
+			u64 key = getStaticBatchCellKey(r.matrix.getTranslation());
+			auto iter = cells.find(key);
+			int batch_idx;
+			if (iter.isValid())
+			{
+				batch_idx = iter.value();
+			}
+			else
+			{
+				batch_idx = m_static_batches.size();
+				cells.insert(key, batch_idx);
+				m_static_batches.emplace(m_allocator).layer_mask = 0;
+			}
+			StaticBatch& batch = m_static_batches[batch_idx];
+			batch.model_instances.push(cmp);
+			batch.layer_mask |= getLayerMask(r);
+			m_culling_system->setLayerMask(cmp, 0);
+		}
+
+		for (StaticBatch& batch : m_static_batches)
+		{
+			Sphere first = m_culling_system->getSphere(batch.model_instances[0]);
+			AABB aabb(first.position, first.position);
+			for (ComponentHandle cmp : batch.model_instances)
+			{
+				Sphere sphere = m_culling_system->getSphere(cmp);
+				Vec3 radius(sphere.radius, sphere.radius, sphere.radius);
+				aabb.addPoint(sphere.position - radius);
+				aabb.addPoint(sphere.position + radius);
+			}
+			batch.sphere.position = (aabb.min + aabb.max) * 0.5f;
+			batch.sphere.radius = 0;
+			for (ComponentHandle cmp : batch.model_instances)
+			{
+				Sphere sphere = m_culling_system->getSphere(cmp);
+				float radius = (sphere.position - batch.sphere.position).length() + sphere.radius;
+				batch.sphere.radius = Math::maximum(batch.sphere.radius, radius);
+			}
+		}
+		for (int i = 0, c = m_static_batches.size(); i < c; ++i)
+		{
+			m_static_batch_culling->addStatic({i}, m_static_batches[i].sphere, m_static_batches[i].layer_mask);
+		}
+	}
+
+
+	// indices of static batches which are inside the frustum and have some of layer_mask
+	const CullingSystem::Results& cullStaticBatches(const Frustum& frustum, u64 layer_mask)
+	{
+		updateStaticBatches();
+		m_static_batch_culling->cullToFrustumAsync(frustum, layer_mask);
+		return m_static_batch_culling->getResult();
+	}
+
+
+	// batched model instances inside the frustum
+	void cullStaticBatches(const Frustum& frustum, Array<ComponentHandle>& model_instances)
+	{
+		for (const CullingSystem::Subresults& subresults : cullStaticBatches(frustum, ~0ULL))
+		{
+			for (ComponentHandle batch_idx : subresults)
+			{
+				for (ComponentHandle cmp : m_static_batches[batch_idx.index].model_instances)
+				{
+					Sphere sphere = m_culling_system->getSphere(cmp);
+					if (frustum.isSphereInside(sphere.position, sphere.radius)) model_instances.push(cmp);
+				}
+			}
+		}
+	}
+
+
 	void forceGrassUpdate(ComponentHandle cmp) override { m_terrains[{cmp.index}]->forceGrassUpdate(); }
 
 
+	void onTerrainHeightmapChanged(ComponentHandle cmp, int x, int z, int width, int height) override
+	{
+		m_terrains[{cmp.index}]->onHeightmapChanged(x, z, width, height);
+	}
+
+
 	void getTerrainInfos(Array<TerrainInfo>& infos, const Vec3& camera_pos) override
 	{
 		PROFILE_FUNCTION();
@@ -2261,6 +2437,63 @@ public:
 	}
 
 
+	// rays is an array of {origin = {x, y, z}, dir = {x, y, z}, max_distance = d, ignored = {entities}},
+	// max_distance and ignored are optional; returns an array with {entity = e, position = {x, y, z}}
+	// for rays which hit something and false for the others
+	static int LUA_castRays(lua_State* L)
+	{
+		auto* scene = LuaWrapper::checkArg<RenderSceneImpl*>(L, 1);
+		int ignored_count;
+		int count = LuaWrapper::checkRaysArg(L, 2, &ignored_count);
+
+		Array<RayCastQuery> queries(scene->m_allocator);
+		Array<RayCastModelHit> hits(scene->m_allocator);
+		Array<Entity> ignored_entities(scene->m_allocator);
+		Array<ComponentHandle> ignored(scene->m_allocator);
+		queries.resize(count);
+		hits.resize(count);
+		ignored_entities.resize(ignored_count);
+		ignored.resize(ignored_count);
+		int ignored_offset = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			RayCastQuery& query = queries[i];
+			Entity* entities = ignored_entities.begin() + ignored_offset;
+			int query_ignored_count =
+				LuaWrapper::toRay(L, 2, i, &query.origin, &query.dir, &query.max_distance, entities);
+			query.ignored_model_instances = ignored.begin() + ignored_offset;
+			query.ignored_model_instance_count = query_ignored_count;
+			for (int j = 0; j < query_ignored_count; ++j)
+			{
+				// model instances have the same index as their entities
+				ignored[ignored_offset + j] = {entities[j].index};
+			}
+			ignored_offset += query_ignored_count;
+		}
+		if (count > 0) scene->castRays(&queries[0], &hits[0], count);
+
+		lua_createtable(L, count, 0);
+		for (int i = 0; i < count; ++i)
+		{
+			const RayCastModelHit& hit = hits[i];
+			if (hit.m_is_hit)
+			{
+				lua_createtable(L, 0, 2);
+				LuaWrapper::push(L, hit.m_entity);
+				lua_setfield(L, -2, "entity");
+				LuaWrapper::push(L, hit.m_origin + hit.m_dir * hit.m_t);
+				lua_setfield(L, -2, "position");
+			}
+			else
+			{
+				lua_pushboolean(L, 0);
+			}
+			lua_rawseti(L, -2, i + 1);
+		}
+		return 1;
+	}
+
+
 	static bgfx::TextureHandle* LUA_getTextureHandle(RenderScene* scene, int resource_idx)
 	{
 		Resource* res = scene->getEngine().getLuaResource(resource_idx);
@@ -2468,6 +2701,24 @@ public:
 	void enableGrass(bool enabled) override { m_is_grass_enabled = enabled; }
 
 
+	bool isCullingHierarchyEnabled() const override { return m_culling_system->isHierarchyEnabled(); }
+
+
+	void enableCullingHierarchy(bool enabled) override { m_culling_system->enableHierarchy(enabled); }
+
+
+	bool isCullingCacheEnabled() const override { return m_culling_system->isCacheEnabled(); }
+
+
+	void enableCullingCache(bool enabled) override { m_culling_system->enableCache(enabled); }
+
+
+	bool isOcclusionCullingEnabled() const override { return m_is_occlusion_culling_enabled; }
+
+
+	void enableOcclusionCulling(bool enabled) override { m_is_occlusion_culling_enabled = enabled; }
+
+
 	void setGrassDensity(ComponentHandle cmp, int index, int density) override
 	{
 		m_terrains[{cmp.index}]->setGrassTypeDensity(index, density);
@@ -2550,46 +2801,181 @@ public:
 	}
 
 
+	// jobs collect the biggest screen size of each material, textures get it once after the jobs are done
+	static void requestTextureMips(MipRequests& requests, Material* material, int screen_size)
+	{
+		if (!material) return;
+		auto iter = requests.find(material);
+		if (!iter.isValid()) requests.insert(material, screen_size);
+		else if (iter.value() < screen_size) iter.value() = screen_size;
+	}
+
+
+	void flushTextureMipRequests()
+	{
+		PROFILE_FUNCTION();
+		for (MipRequests& requests : m_mip_requests)
+		{
+			for (auto iter = requests.begin(), end = requests.end(); iter != end; ++iter)
+			{
+				const Material* material = iter.key();
+				for (int i = 0, c = material->getTextureCount(); i < c; ++i)
+				{
+					Texture* texture = material->getTexture(i);
+					if (texture) texture->requestSize(iter.value());
+				}
+			}
+			requests.clear();
+		}
+	}
+
+
+	float getLODMultiplier(const Frustum& frustum) const
+	{
+		float lod_multiplier = m_lod_multiplier;
+		if (frustum.fov > 0)
+		{
+			float t = frustum.fov / Math::degreesToRadians(60.0f);
+			lod_multiplier *= t * t;
+		}
+		return lod_multiplier;
+	}
+
+
+	// pixels per unit of size at distance 1, used to request texture mips
+	static float getTextureScreenScale(const Frustum& frustum, float screen_height)
+	{
+		return frustum.fov > 0 ? screen_height * 0.5f / tanf(frustum.fov * 0.5f) : 0;
+	}
+
+
+	// LOD of all model instances in a batch is selected by the distance of the batch;
+	// batches are the culled ones, [from, to) of m_visible_static_batches
+	void fillStaticBatchInfos(int from,
+		int to,
+		Array<ModelInstanceMesh>& infos,
+		MipRequests& mip_requests,
+		const Frustum& frustum,
+		const Vec3& lod_ref_point,
+		u64 layer_mask,
+		float screen_scale,
+		bool is_occlusion_used)
+	{
+		PROFILE_FUNCTION();
+		float lod_multiplier = getLODMultiplier(frustum);
+		int visible_count = 0;
+		for (int i = from; i < to; ++i)
+		{
+			const StaticBatch& batch = m_static_batches[m_visible_static_batches[i].index];
+			if (is_occlusion_used && !m_occlusion_buffer->isVisible(batch.sphere)) continue;
+
+			++visible_count;
+			float distance = Math::maximum((batch.sphere.position - lod_ref_point).length(), 0.01f);
+			float squared_distance = distance * distance * lod_multiplier;
+			for (ComponentHandle cmp : batch.model_instances)
+			{
+				ModelInstance& model_instance = m_model_instances[cmp.index];
+				Model* model = model_instance.model;
+				int screen_size = 0;
+				if (screen_scale > 0)
+				{
+					float diameter = 2 * model->getBoundingRadius() * model_instance.matrix.getXVector().length();
+					screen_size = (int)Math::minimum(diameter * screen_scale / distance, 65536.0f);
+				}
+				LODMeshIndices lod = model->getLODMeshIndices(squared_distance);
+				for (int j = lod.from; j <= lod.to; ++j)
+				{
+					Mesh* mesh = &model_instance.meshes[j];
+					// instances of different layers share batches
+					if ((mesh->material->getRenderLayerMask() & layer_mask) == 0) continue;
+					auto& info = infos.emplace();
+					info.model_instance = cmp;
+					info.mesh = mesh;
+					if (screen_size > 0) requestTextureMips(mip_requests, mesh->material, screen_size);
+				}
+			}
+		}
+		PROFILE_INT("visible static batches", visible_count);
+	}
+
+
 	void fillTemporaryInfos(const CullingSystem::Results& results,
+		const CullingSystem::Results& static_results,
 		const Frustum& frustum,
-		const Vec3& lod_ref_point)
+		const Vec3& lod_ref_point,
+		u64 layer_mask,
+		float screen_height,
+		bool is_occlusion_used)
 	{
 		PROFILE_FUNCTION();
 		m_jobs.clear();
 
-		while (m_temporary_infos.size() < results.size())
+		// visible static batches are split into ranges with similar numbers of model instances
+		m_visible_static_batches.clear();
+		int static_instance_count = 0;
+		for (const CullingSystem::Subresults& subresults : static_results)
+		{
+			for (ComponentHandle batch_idx : subresults)
+			{
+				m_visible_static_batches.push(batch_idx);
+				static_instance_count += m_static_batches[batch_idx.index].model_instances.size();
+			}
+		}
+		int static_job_count = Math::clamp(static_instance_count / MIN_STATIC_INSTANCES_PER_JOB,
+			1,
+			(int)m_engine.getMTJDManager().getCpuThreadsCount());
+		int static_instances_per_job = (static_instance_count + static_job_count - 1) / static_job_count;
+
+		// the last ones are for static batches
+		int infos_count = results.size() + static_job_count;
+		while (m_temporary_infos.size() < infos_count)
 		{
 			m_temporary_infos.emplace(m_allocator);
 		}
-		while (m_temporary_infos.size() > results.size())
+		while (m_temporary_infos.size() > infos_count)
 		{
 			m_temporary_infos.pop();
 		}
+		while (m_mip_requests.size() < infos_count)
+		{
+			m_mip_requests.emplace(m_allocator);
+		}
+		float screen_scale = getTextureScreenScale(frustum, screen_height);
 
 		for (int subresult_index = 0; subresult_index < results.size(); ++subresult_index)
 		{
 			Array<ModelInstanceMesh>& subinfos = m_temporary_infos[subresult_index];
+			MipRequests& mip_requests = m_mip_requests[subresult_index];
 			subinfos.clear();
 			if (results[subresult_index].empty()) continue;
 
 			MTJD::Job* job = MTJD::makeJob(m_engine.getMTJDManager(),
-				[&subinfos, this, &results, subresult_index, &frustum, lod_ref_point]()
+				[&subinfos, &mip_requests, this, &results, subresult_index, &frustum, lod_ref_point, screen_scale, is_occlusion_used]()
 				{
 					PROFILE_BLOCK("Temporary Info Job");
 					PROFILE_INT("ModelInstance count", results[subresult_index].size());
 					Vec3 ref_point = lod_ref_point;
-					float lod_multiplier = m_lod_multiplier;
-					if (frustum.fov > 0)
-					{
-						float t = frustum.fov / Math::degreesToRadians(60.0f);
-						lod_multiplier *= t * t;
-					}
+					float lod_multiplier = getLODMultiplier(frustum);
 					const ComponentHandle* LUMIX_RESTRICT raw_subresults = &results[subresult_index][0];
 					ModelInstance* LUMIX_RESTRICT model_instances = &m_model_instances[0];
+					int occluded_count = 0;
 					for (int i = 0, c = results[subresult_index].size(); i < c; ++i)
 					{
+						if (is_occlusion_used && !m_occlusion_buffer->isVisible(m_culling_system->getSphere(raw_subresults[i])))
+						{
+							++occluded_count;
+							continue;
+						}
 						ModelInstance* LUMIX_RESTRICT model_instance = &model_instances[raw_subresults[i].index];
 						float squared_distance = (model_instance->matrix.getTranslation() - ref_point).squaredLength();
+						int screen_size = 0;
+						if (screen_scale > 0)
+						{
+							float diameter = 2 * model_instance->model->getBoundingRadius() *
+											 model_instance->matrix.getXVector().length();
+							float distance = Math::maximum(sqrtf(squared_distance), 0.01f);
+							screen_size = (int)Math::minimum(diameter * screen_scale / distance, 65536.0f);
+						}
 						squared_distance *= lod_multiplier;
 
 						Model* LUMIX_RESTRICT model = model_instance->model;
@@ -2599,14 +2985,49 @@ public:
 							auto& info = subinfos.emplace();
 							info.model_instance = raw_subresults[i];
 							info.mesh = &model_instance->meshes[j];
+							if (screen_size > 0) requestTextureMips(mip_requests, info.mesh->material, screen_size);
 						}
 					}
+					PROFILE_INT("occluded", occluded_count);
+				},
+				m_allocator);
+			job->addDependency(&m_sync_point);
+			m_jobs.push(job);
+		}
+
+		int batch_idx = 0;
+		for (int i = 0; i < static_job_count; ++i)
+		{
+			Array<ModelInstanceMesh>& static_infos = m_temporary_infos[results.size() + i];
+			MipRequests& static_mip_requests = m_mip_requests[results.size() + i];
+			static_infos.clear();
+			int from = batch_idx;
+			int instance_count = 0;
+			while (batch_idx < m_visible_static_batches.size() && instance_count < static_instances_per_job)
+			{
+				instance_count += m_static_batches[m_visible_static_batches[batch_idx].index].model_instances.size();
+				++batch_idx;
+			}
+			if (batch_idx == from) continue;
+
+			MTJD::Job* job = MTJD::makeJob(m_engine.getMTJDManager(),
+				[&static_infos, &static_mip_requests, this, from, batch_idx, &frustum, lod_ref_point, layer_mask, screen_scale, is_occlusion_used]() {
+					fillStaticBatchInfos(from,
+						batch_idx,
+						static_infos,
+						static_mip_requests,
+						frustum,
+						lod_ref_point,
+						layer_mask,
+						screen_scale,
+						is_occlusion_used);
 				},
 				m_allocator);
 			job->addDependency(&m_sync_point);
 			m_jobs.push(job);
 		}
 		runJobs(m_jobs, m_sync_point);
+		if (screen_scale > 0) flushTextureMipRequests();
 	}
 
 
@@ -2689,6 +3110,41 @@ public:
 	}
 
 
+	bool getLightClusters(const Frustum& frustum, LightClusters* clusters) override
+	{
+		if (frustum.fov <= 0) return false;
+
+		PROFILE_FUNCTION();
+		Vec3 z_axis = frustum.direction.normalized();
+		Vec3 x_axis = crossProduct(z_axis, frustum.up).normalized();
+		Vec3 y_axis = crossProduct(x_axis, z_axis);
+
+		m_clustered_lights.clear();
+		m_clustered_light_spheres.clear();
+		for (const PointLight& light : m_point_lights)
+		{
+			Vec3 pos = m_universe.getPosition(light.m_entity);
+			if (!frustum.isSphereInside(pos, light.m_range)) continue;
+			// light indices are 16 bit
+			if (m_clustered_lights.size() == 0xffff) break;
+
+			Vec3 rel_pos = pos - frustum.position;
+			m_clustered_lights.push(light.m_component);
+			m_clustered_light_spheres.emplace(
+				Vec3(dotProduct(rel_pos, x_axis), dotProduct(rel_pos, y_axis), dotProduct(rel_pos, z_axis)),
+				light.m_range);
+		}
+
+		m_light_cluster_builder->build(frustum,
+			m_clustered_light_spheres.empty() ? nullptr : &m_clustered_light_spheres[0],
+			m_clustered_light_spheres.size(),
+			clusters);
+		clusters->lights = m_clustered_lights.empty() ? nullptr : &m_clustered_lights[0];
+		clusters->light_count = m_clustered_lights.size();
+		return true;
+	}
+
+
 	Entity getCameraEntity(ComponentHandle camera) const override { return {camera.index}; }
 
 
@@ -2710,10 +3166,9 @@ public:
 	{
 		PROFILE_FUNCTION();
 
-		int light_index = m_point_lights_map[light_cmp];
-		for (int j = 0, cj = m_light_influenced_geometry[light_index].size(); j < cj; ++j)
+		const Array<ComponentHandle>& influenced_geometry = getPointLightInfluencedModelInstances(light_cmp);
+		for (ComponentHandle model_instance_cmp : influenced_geometry)
 		{
-			ComponentHandle model_instance_cmp = m_light_influenced_geometry[light_index][j];
 			ModelInstance& model_instance = m_model_instances[model_instance_cmp.index];
 			const Sphere& sphere = m_culling_system->getSphere(model_instance_cmp);
 			if (frustum.isSphereInside(sphere.position, sphere.radius))
@@ -2733,25 +3188,36 @@ public:
 	{
 		PROFILE_FUNCTION();
 
-		int light_index = m_point_lights_map[light_cmp];
-		auto& geoms = m_light_influenced_geometry[light_index];
-		for (int j = 0, cj = geoms.size(); j < cj; ++j)
+		const Array<ComponentHandle>& influenced_geometry = getPointLightInfluencedModelInstances(light_cmp);
+		for (ComponentHandle model_instance_cmp : influenced_geometry)
 		{
-			const ModelInstance& model_instance = m_model_instances[geoms[j].index];
+			const ModelInstance& model_instance = m_model_instances[model_instance_cmp.index];
 			for (int k = 0, kc = model_instance.model->getMeshCount(); k < kc; ++k)
 			{
 				auto& info = infos.emplace();
 				info.mesh = &model_instance.model->getMesh(k);
-				info.model_instance = geoms[j];
+				info.model_instance = model_instance_cmp;
 			}
 		}
 	}
 
 
+	// valid until the next call; callers fill arrays from the frame allocator, so this can not use it
+	const Array<ComponentHandle>& getPointLightInfluencedModelInstances(ComponentHandle light_cmp)
+	{
+		const PointLight& light = m_point_lights[m_point_lights_map[light_cmp]];
+		m_light_influence_query.clear();
+		m_light_influence_grid->query(
+			{m_universe.getPosition(light.m_entity), light.m_range}, m_light_influence_query);
+		return m_light_influence_query;
+	}
+
+
 	void getModelInstanceEntities(const Frustum& frustum, Array<Entity>& entities) override
 	{
 		PROFILE_FUNCTION();
 
+		updateStaticBatches();
 		const CullingSystem::Results* results = cull(frustum, ~0ULL);
 		if (!results) return;
 
@@ -2762,24 +3228,164 @@ public:
 				entities.push(m_model_instances[model_instance_cmp.index].entity);
 			}
 		}
+
+		Array<ComponentHandle> batched(m_allocator);
+		cullStaticBatches(frustum, batched);
+		for (ComponentHandle model_instance_cmp : batched)
+		{
+			entities.push(m_model_instances[model_instance_cmp.index].entity);
+		}
+	}
+
+
+	void computeSkinningMatrices(const ComponentHandle* model_instances, int count) override
+	{
+		PROFILE_FUNCTION();
+		u32 frame_index = m_renderer.getFrameIndex();
+		if (m_skinning_frame_index != frame_index)
+		{
+			m_skinning_frame_index = frame_index;
+			m_skinning_matrices.clear();
+		}
+		while (m_skinning_ranges.size() < m_model_instances.size())
+		{
+			SkinningMatricesRange& range = m_skinning_ranges.emplace();
+			range.offset = -1;
+			range.frame_index = frame_index - 1;
+			range.pose = nullptr;
+			range.pose_version = 0;
+		}
+
+		m_skinned_model_instances.clear();
+		int matrix_count = m_skinning_matrices.size();
+		for (int i = 0; i < count; ++i)
+		{
+			int index = model_instances[i].index;
+			const ModelInstance& r = m_model_instances[index];
+			if (!isValid(r.entity) || !r.pose || !r.model || !r.model->isReady()) continue;
+			SkinningMatricesRange& range = m_skinning_ranges[index];
+			if (isSkinningMatricesRangeValid(range, *r.pose)) continue;
+
+			range.offset = matrix_count;
+			range.frame_index = frame_index;
+			range.pose = r.pose;
+			range.pose_version = r.pose->version;
+			matrix_count += r.pose->count;
+			m_skinned_model_instances.push(index);
+		}
+		if (m_skinned_model_instances.empty()) return;
+		// pointers returned by getSkinningMatrices before this are not valid anymore
+		m_skinning_matrices.resize(matrix_count);
+
+		MTJD::Manager& mtjd_manager = m_engine.getMTJDManager();
+		int instance_count = m_skinned_model_instances.size();
+		int new_matrix_count = matrix_count - m_skinning_ranges[m_skinned_model_instances[0]].offset;
+		int job_count = Math::maximum(1, Math::minimum((int)mtjd_manager.getCpuThreadsCount(), new_matrix_count / 1024));
+		int chunk_size = (instance_count + job_count - 1) / job_count;
+		auto computeChunk = [this, chunk_size, instance_count](int job) {
+			PROFILE_BLOCK("Skinning Matrices Job");
+			for (int i = job * chunk_size, end = Math::minimum(instance_count, (job + 1) * chunk_size); i < end; ++i)
+			{
+				int index = m_skinned_model_instances[i];
+				const ModelInstance& r = m_model_instances[index];
+				r.pose->computeSkinningMatrices(*r.model, &m_skinning_matrices[m_skinning_ranges[index].offset]);
+			}
+		};
+		if (job_count == 1)
+		{
+			computeChunk(0);
+			return;
+		}
+
+		m_jobs.clear();
+		for (int i = 0; i < job_count; ++i)
+		{
+			MTJD::Job* job = MTJD::makeJob(mtjd_manager, [&computeChunk, i]() { computeChunk(i); }, m_allocator);
+			job->addDependency(&m_sync_point);
+			m_jobs.push(job);
+		}
+		runJobs(m_jobs, m_sync_point);
+	}
+
+
+	bool isSkinningMatricesRangeValid(const SkinningMatricesRange& range, const Pose& pose) const
+	{
+		return range.offset >= 0 && range.frame_index == m_skinning_frame_index && range.pose == &pose &&
+			   range.pose_version == pose.version;
+	}
+
+
+	const Matrix* getSkinningMatrices(ComponentHandle cmp) const override
+	{
+		if (cmp.index >= m_skinning_ranges.size()) return nullptr;
+		const SkinningMatricesRange& range = m_skinning_ranges[cmp.index];
+		const Pose* pose = m_model_instances[cmp.index].pose;
+		if (!pose || !isSkinningMatricesRangeValid(range, *pose)) return nullptr;
+		return &m_skinning_matrices[range.offset];
 	}
 
 
 	Array<Array<ModelInstanceMesh>>& getModelInstanceInfos(const Frustum& frustum,
 		const Vec3& lod_ref_point,
-		u64 layer_mask) override
+		u64 layer_mask,
+		float screen_height) override
 	{
 		PROFILE_FUNCTION();
 
 		for(auto& i : m_temporary_infos) i.clear();
+		const CullingSystem::Results& static_results = cullStaticBatches(frustum, layer_mask);
 		const CullingSystem::Results* results = cull(frustum, layer_mask);
 		if (!results) return m_temporary_infos;
 
-		fillTemporaryInfos(*results, frustum, lod_ref_point);
+		bool is_occlusion_used = m_is_occlusion_culling_enabled && frustum.fov > 0 && rasterizeOccluders(frustum, layer_mask);
+		fillTemporaryInfos(*results, static_results, frustum, lod_ref_point, layer_mask, screen_height, is_occlusion_used);
 		return m_temporary_infos;
 	}
 
 
+	// rasterizes the lowest LOD of occluders inside the frustum, returns false if there is nothing to test against
+	bool rasterizeOccluders(const Frustum& frustum, u64 layer_mask)
+	{
+		PROFILE_FUNCTION();
+		if (m_occluders.empty()) return false;
+
+		m_occlusion_buffer->begin(frustum);
+		for (ComponentHandle cmp : m_occluders)
+		{
+			const ModelInstance& r = m_model_instances[cmp.index];
+			// skinned meshes do not match their bind pose geometry
+			if (!r.model || !r.model->isReady() || r.pose) continue;
+			// batched static occluders have an empty layer mask in the culling system
+			if ((getLayerMask(r) & layer_mask) == 0) continue;
+			Sphere sphere = m_culling_system->getSphere(cmp);
+			if (!frustum.isSphereInside(sphere.position, sphere.radius)) continue;
+
+			Model& model = *r.model;
+			if (model.getVertices().empty() || model.getLODCount() == 0) continue;
+			const Model::LOD& lod = model.getLODs()[model.getLODCount() - 1];
+			int stride = model.getVertexDecl().getStride();
+			for (int i = lod.from_mesh; i <= lod.to_mesh; ++i)
+			{
+				const Mesh& mesh = model.getMesh(i);
+				// indices are relative to the first vertex of the mesh
+				const Vec3* vertices = &model.getVertices()[mesh.attribute_array_offset / stride];
+				if (model.areIndices16())
+				{
+					m_occlusion_buffer->addOccluder(
+						vertices, model.getIndices16() + mesh.indices_offset, mesh.indices_count, r.matrix);
+				}
+				else
+				{
+					m_occlusion_buffer->addOccluder(
+						vertices, model.getIndices32() + mesh.indices_offset, mesh.indices_count, r.matrix);
+				}
+			}
+		}
+		m_occlusion_buffer->rasterize();
+		return m_occlusion_buffer->getTriangleCount() > 0;
+	}
+
+
 	void setCameraSlot(ComponentHandle cmp, const char* slot) override
 	{
 		auto& camera = m_cameras[{cmp.index}];
@@ -3496,42 +4102,54 @@ public:
 	RayCastModelHit castRay(const Vec3& origin, const Vec3& dir, ComponentHandle ignored_model_instance) override
 	{
 		PROFILE_FUNCTION();
+		RayCastQuery query;
+		query.origin = origin;
+		query.dir = dir;
+		query.max_distance = FLT_MAX;
+		query.ignored_model_instances = &ignored_model_instance;
+		query.ignored_model_instance_count = 1;
+		return castRay(query);
+	}
+
+
+	RayCastModelHit castRay(const RayCastQuery& query)
+	{
 		RayCastModelHit hit;
 		hit.m_is_hit = false;
-		float cur_dist = FLT_MAX;
+		const Vec3& origin = query.origin;
+		const Vec3& dir = query.dir;
+		float ray_max_t = query.max_distance == FLT_MAX ? FLT_MAX : query.max_distance / dir.length();
 		Universe& universe = getUniverse();
-		for (int i = 0; i < m_model_instances.size(); ++i)
-		{
-			auto& r = m_model_instances[i];
-			if (ignored_model_instance.index == i || !r.model) continue;
+		m_instance_bvh.castRay(origin, dir, ray_max_t, [&](ComponentHandle cmp, float max_t) -> float {
+			for (int i = 0; i < query.ignored_model_instance_count; ++i)
+			{
+				if (query.ignored_model_instances[i] == cmp) return max_t;
+			}
 
+			auto& r = m_model_instances[cmp.index];
 			const Vec3& pos = r.matrix.getTranslation();
-			float radius = r.model->getBoundingRadius();
-			float scale = universe.getScale(r.entity);
-			float dist = (pos - origin).length();
-			if (dist - radius * scale > cur_dist) continue;
-			
+			float radius = r.model->getBoundingRadius() * universe.getScale(r.entity);
 			Vec3 intersection;
-			if (dotProduct(pos - origin, pos - origin) < radius * radius ||
-				Math::getRaySphereIntersection(origin, dir, pos, radius * scale, intersection))
+			if (dotProduct(pos - origin, pos - origin) >= radius * radius &&
+				!Math::getRaySphereIntersection(origin, dir, pos, radius, intersection))
 			{
-				RayCastModelHit new_hit = r.model->castRay(origin, dir, r.matrix);
-				if (new_hit.m_is_hit && (!hit.m_is_hit || new_hit.m_t < hit.m_t))
-				{
-					new_hit.m_component = {i};
-					new_hit.m_entity = r.entity;
-					new_hit.m_component_type = MODEL_INSTANCE_TYPE;
-					hit = new_hit;
-					hit.m_is_hit = true;
-					cur_dist = dir.length() * hit.m_t;
-				}
+				return max_t;
 			}
-		}
+
+			RayCastModelHit new_hit = r.model->castRay(origin, dir, r.matrix);
+			if (!new_hit.m_is_hit || new_hit.m_t >= max_t) return max_t;
+
+			new_hit.m_component = cmp;
+			new_hit.m_entity = r.entity;
+			new_hit.m_component_type = MODEL_INSTANCE_TYPE;
+			hit = new_hit;
+			return hit.m_t;
+		});
 
 		for (auto* terrain : m_terrains)
 		{
 			RayCastModelHit terrain_hit = terrain->castRay(origin, dir);
-			if (terrain_hit.m_is_hit && (!hit.m_is_hit || terrain_hit.m_t < hit.m_t))
+			if (terrain_hit.m_is_hit && terrain_hit.m_t < ray_max_t && (!hit.m_is_hit || terrain_hit.m_t < hit.m_t))
 			{
 				terrain_hit.m_component = {terrain->getEntity().index};
 				terrain_hit.m_component_type = TERRAIN_TYPE;
@@ -3543,6 +4161,51 @@ public:
 		return hit;
 	}
 
+
+	void castRays(const RayCastQuery* queries, RayCastModelHit* hits, int count) override
+	{
+		PROFILE_FUNCTION();
+		if (count <= 0) return;
+
+		// similar rays visit the same nodes, so they are cast one after another
+		m_ray_sort_keys.resize(count);
+		m_ray_sort_values.resize(count);
+		m_tmp_ray_sort_keys.resize(count);
+		m_tmp_ray_sort_values.resize(count);
+		for (int i = 0; i < count; ++i)
+		{
+			m_ray_sort_keys[i] = Math::getRaySortKey(queries[i].origin, queries[i].dir);
+			m_ray_sort_values[i] = i;
+		}
+		radixSort(&m_ray_sort_keys[0], &m_ray_sort_values[0], &m_tmp_ray_sort_keys[0], &m_tmp_ray_sort_values[0], count);
+
+		MTJD::Manager& mtjd_manager = m_engine.getMTJDManager();
+		int job_count = Math::clamp(count / MIN_RAYS_PER_CAST_JOB, 1, (int)mtjd_manager.getCpuThreadsCount());
+		int rays_per_job = (count + job_count - 1) / job_count;
+		auto castJobRays = [this, queries, hits, count, rays_per_job](int job) {
+			PROFILE_BLOCK("Ray Cast Job");
+			for (int i = job * rays_per_job, end = Math::minimum(count, (job + 1) * rays_per_job); i < end; ++i)
+			{
+				u32 query_idx = m_ray_sort_values[i];
+				hits[query_idx] = castRay(queries[query_idx]);
+			}
+		};
+		if (job_count == 1)
+		{
+			castJobRays(0);
+			return;
+		}
+
+		m_jobs.clear();
+		for (int i = 0; i < job_count; ++i)
+		{
+			MTJD::Job* job = MTJD::makeJob(mtjd_manager, [&castJobRays, i]() { castJobRays(i); }, m_allocator);
+			job->addDependency(&m_sync_point);
+			m_jobs.push(job);
+		}
+		runJobs(m_jobs, m_sync_point);
+	}
+
 	
 	Vec4 getShadowmapCascades(ComponentHandle cmp) override
 	{
@@ -3837,11 +4500,10 @@ public:
 		LUMIX_DELETE(m_allocator, r.pose);
 		r.pose = nullptr;
 
-		for (int i = 0; i < m_point_lights.size(); ++i)
-		{
-			m_light_influenced_geometry[i].eraseItemFast(component);
-		}
 		m_culling_system->removeStatic(component);
+		m_light_influence_grid->remove(component);
+		m_instance_bvh.remove(component);
+		markStaticBatchesDirty(r);
 	}
 
 
@@ -3874,6 +4536,9 @@ public:
 		float scale = m_universe.getScale(r.entity);
 		Sphere sphere(r.matrix.getTranslation(), bounding_radius * scale);
 		m_culling_system->addStatic(component, sphere, getLayerMask(r));
+		m_light_influence_grid->update(component, sphere);
+		m_instance_bvh.update(component, sphere);
+		markStaticBatchesDirty(r);
 		ASSERT(!r.pose);
 		if (model->getBoneCount() > 0)
 		{
@@ -3908,18 +4573,6 @@ public:
 			r.meshes = &r.model->getMesh(0);
 			r.mesh_count = r.model->getMeshCount();
 		}
-
-		for (int i = 0; i < m_point_lights.size(); ++i)
-		{
-			PointLight& light = m_point_lights[i];
-			Vec3 t = r.matrix.getTranslation();
-			float radius = r.model->getBoundingRadius();
-			if ((t - m_universe.getPosition(light.m_entity)).squaredLength() <
-				(radius + light.m_range) * (radius + light.m_range))
-			{
-				m_light_influenced_geometry[i].push(component);
-			}
-		}
 	}
 
 
@@ -4064,6 +4717,8 @@ public:
 			if (old_model->isReady())
 			{
 				m_culling_system->removeStatic(component);
+				m_light_influence_grid->remove(component);
+				m_instance_bvh.remove(component);
 			}
 			old_model->getResourceManager().unload(*old_model);
 		}
@@ -4087,25 +4742,6 @@ public:
 	IAllocator& getAllocator() override { return m_allocator; }
 
 
-	void detectLightInfluencedGeometry(ComponentHandle cmp)
-	{
-		Frustum frustum = getPointLightFrustum(cmp);
-		m_culling_system->cullToFrustum(frustum, 0xffffFFFF);
-		const CullingSystem::Results& results = m_culling_system->getResult();
-		auto& influenced_geometry = m_light_influenced_geometry[cmp.index];
-		influenced_geometry.clear();
-		for (int i = 0; i < results.size(); ++i)
-		{
-			const CullingSystem::Subresults& subresult = results[i];
-			influenced_geometry.reserve(influenced_geometry.size() + subresult.size());
-			for (int j = 0, c = subresult.size(); j < c; ++j)
-			{
-				influenced_geometry.push(subresult[j]);
-			}
-		}
-	}
-
-
 	int getParticleEmitterAttractorCount(ComponentHandle cmp) override
 	{
 		auto* module = getEmitterModule<ParticleEmitter::AttractorModule>(cmp);
@@ -4287,7 +4923,6 @@ public:
 	ComponentHandle createPointLight(Entity entity)
 	{
 		PointLight& light = m_point_lights.emplace();
-		m_light_influenced_geometry.emplace(m_allocator);
 		light.m_entity = entity;
 		light.m_diffuse_color.set(1, 1, 1);
 		light.m_diffuse_intensity = 1;
@@ -4303,8 +4938,6 @@ public:
 
 		m_universe.addComponent(entity, POINT_LIGHT_TYPE, this, light.m_component);
 
-		detectLightInfluencedGeometry(light.m_component);
-
 		return light.m_component;
 	}
 
@@ -4382,6 +5015,7 @@ public:
 		r.pose = nullptr;
 		r.custom_meshes = false;
 		r.mesh_count = 0;
+		r.flags = 0;
 		r.matrix = m_universe.getMatrix(entity);
 		ComponentHandle cmp = {entity.index};
 		m_universe.addComponent(entity, MODEL_INSTANCE_TYPE, this, cmp);
@@ -4421,9 +5055,33 @@ private:
 	Renderer& m_renderer;
 	Engine& m_engine;
 	CullingSystem* m_culling_system;
+	CullingSystem* m_static_batch_culling;
+	OcclusionBuffer* m_occlusion_buffer;
+	// the same spheres as in the culling system, queried by point lights
+	SphereGrid* m_light_influence_grid;
+	Array<ComponentHandle> m_light_influence_query;
+	Array<u64> m_ray_sort_keys;
+	Array<u32> m_ray_sort_values;
+	Array<u64> m_tmp_ray_sort_keys;
+	Array<u32> m_tmp_ray_sort_values;
+	// all model instances with a ready model, including hidden ones, for ray casts
+	InstanceBVH m_instance_bvh;
+	Array<ComponentHandle> m_occluders;
+	Array<StaticBatch> m_static_batches;
+	// indices of static batches culled by the last getModelInstanceInfos
+	Array<ComponentHandle> m_visible_static_batches;
+	bool m_are_static_batches_dirty;
+	Array<Matrix> m_skinning_matrices;
+	Array<SkinningMatricesRange> m_skinning_ranges;
+	// model instances whose matrices are being computed by computeSkinningMatrices
+	Array<int> m_skinned_model_instances;
+	u32 m_skinning_frame_index;
+	LightClusterBuilder* m_light_cluster_builder;
+	Array<ComponentHandle> m_clustered_lights;
+	// in view space
+	Array<Sphere> m_clustered_light_spheres;
 
 	ComponentHandle m_point_light_last_cmp;
-	Array<Array<ComponentHandle>> m_light_influenced_geometry;
 	ComponentHandle m_active_global_light_cmp;
 	ComponentHandle m_global_light_last_cmp;
 	HashMap<ComponentHandle, int> m_point_lights_map;
@@ -4443,6 +5101,8 @@ private:
 	Array<DebugPoint> m_debug_points;
 
 	Array<Array<ModelInstanceMesh>> m_temporary_infos;
+	// one per job of fillTemporaryInfos
+	Array<MipRequests> m_mip_requests;
 	MTJD::Group m_sync_point;
 	Array<MTJD::Job*> m_jobs;
 
@@ -4450,6 +5110,7 @@ private:
 	float m_lod_multiplier;
 	bool m_is_updating_attachments;
 	bool m_is_grass_enabled;
+	bool m_is_occlusion_culling_enabled;
 	bool m_is_game_running;
 
 	AssociativeArray<Model*, ModelLoadedCallback> m_model_loaded_callbacks;
@@ -4513,16 +5174,32 @@ RenderSceneImpl::RenderSceneImpl(Renderer& renderer,
 	, m_allocator(allocator)
 	, m_model_loaded_callbacks(m_allocator)
 	, m_model_instances(m_allocator)
+	, m_light_influence_query(m_allocator)
+	, m_ray_sort_keys(m_allocator)
+	, m_ray_sort_values(m_allocator)
+	, m_tmp_ray_sort_keys(m_allocator)
+	, m_tmp_ray_sort_values(m_allocator)
+	, m_instance_bvh(m_allocator)
+	, m_occluders(m_allocator)
+	, m_static_batches(m_allocator)
+	, m_visible_static_batches(m_allocator)
+	, m_are_static_batches_dirty(false)
+	, m_skinning_matrices(m_allocator)
+	, m_skinning_ranges(m_allocator)
+	, m_skinned_model_instances(m_allocator)
+	, m_skinning_frame_index(0xffffFFFF)
+	, m_clustered_lights(m_allocator)
+	, m_clustered_light_spheres(m_allocator)
 	, m_cameras(m_allocator)
 	, m_terrains(m_allocator)
 	, m_point_lights(m_allocator)
-	, m_light_influenced_geometry(m_allocator)
 	, m_global_lights(m_allocator)
 	, m_decals(m_allocator)
 	, m_debug_triangles(m_allocator)
 	, m_debug_lines(m_allocator)
 	, m_debug_points(m_allocator)
 	, m_temporary_infos(m_allocator)
+	, m_mip_requests(m_allocator)
 	, m_sync_point(true, m_allocator)
 	, m_jobs(m_allocator)
 	, m_active_global_light_cmp(INVALID_COMPONENT)
@@ -4531,6 +5208,7 @@ RenderSceneImpl::RenderSceneImpl(Renderer& renderer,
 	, m_model_instance_created(m_allocator)
 	, m_model_instance_destroyed(m_allocator)
 	, m_is_grass_enabled(true)
+	, m_is_occlusion_culling_enabled(true)
 	, m_is_game_running(false)
 	, m_particle_emitters(m_allocator)
 	, m_point_lights_map(m_allocator)
@@ -4544,6 +5222,10 @@ RenderSceneImpl::RenderSceneImpl(Renderer& renderer,
 	m_universe.entityTransformed().bind<RenderSceneImpl, &RenderSceneImpl::onEntityMoved>(this);
 	m_universe.entityDestroyed().bind<RenderSceneImpl, &RenderSceneImpl::onEntityDestroyed>(this);
 	m_culling_system = CullingSystem::create(m_engine.getMTJDManager(), m_allocator);
+	m_static_batch_culling = CullingSystem::create(m_engine.getMTJDManager(), m_allocator);
+	m_light_cluster_builder = LightClusterBuilder::create(m_engine.getMTJDManager(), m_allocator);
+	m_occlusion_buffer = OcclusionBuffer::create(m_engine.getMTJDManager(), m_allocator);
+	m_light_influence_grid = SphereGrid::create(LIGHT_INFLUENCE_CELL_SIZE, m_allocator);
 	m_model_instances.reserve(5000);
 
 	for (auto& i : COMPONENT_INFOS)
@@ -4627,6 +5309,9 @@ void RenderScene::registerLuaAPI(lua_State* L)
 	REGISTER_FUNCTION(setTerrainHeightAt);
 	REGISTER_FUNCTION(hideModelInstance);
 	REGISTER_FUNCTION(showModelInstance);
+	REGISTER_FUNCTION(enableCullingHierarchy);
+	REGISTER_FUNCTION(enableCullingCache);
+	REGISTER_FUNCTION(enableOcclusionCulling);
 
 #undef REGISTER_FUNCTION
 
@@ -4658,6 +5343,7 @@ void RenderScene::registerLuaAPI(lua_State* L)
 	REGISTER_FUNCTION(emitParticle);
 
 	LuaWrapper::createSystemFunction(L, "Renderer", "castCameraRay", &RenderSceneImpl::LUA_castCameraRay);
+	LuaWrapper::createSystemFunction(L, "Renderer", "castRays", &RenderSceneImpl::LUA_castRays);
 
 	#undef REGISTER_FUNCTION
 }
@@ -4,6 +4,7 @@
 #include "engine/lumix.h"
 #include "engine/matrix.h"
 #include "engine/iplugin.h"
+#include "renderer/light_clusters.h"
 
 
 struct lua_State;
@@ -58,6 +59,7 @@ enum class RenderSceneVersion : i32
 	NEW_GRASS,
 	LAYERS,
 	PBR,
+	MODEL_INSTANCE_FLAGS,
 
 	LATEST,
 	INVALID = -1,
@@ -94,6 +96,15 @@ struct ModelInstance
 		SKINNED,
 		MULTILAYER
 	};
+
+	enum Flags : u8
+	{
+		// rasterized into the occlusion buffer, hides objects behind it
+		OCCLUDER = 1 << 0,
+		// never moves, merged with its neighbours into a static batch which is culled as one object
+		STATIC = 1 << 1
+	};
+
 	Type type;
 	Matrix matrix;
 	Model* model;
@@ -102,6 +113,7 @@ struct ModelInstance
 	Mesh* meshes;
 	bool custom_meshes;
 	i8 mesh_count;
+	u8 flags;
 };
 
 
@@ -112,6 +124,19 @@ struct ModelInstanceMesh
 };
 
 
+struct RayCastQuery
+{
+	Vec3 origin;
+	// normalized
+	Vec3 dir;
+	// hits further away are ignored, FLT_MAX if the ray is not limited
+	float max_distance;
+	// the ray goes through these model instances, they can be null if there are none
+	const ComponentHandle* ignored_model_instances;
+	int ignored_model_instance_count;
+};
+
+
 struct GrassInfo
 {
 	struct InstanceData
@@ -164,6 +189,9 @@ public:
 	static void registerLuaAPI(lua_State* L);
 
 	virtual RayCastModelHit castRay(const Vec3& origin, const Vec3& dir, ComponentHandle ignore) = 0;
+	// independent rays cast on all worker threads, hits[i] is the nearest hit of queries[i];
+	// the scene must not change until it returns
+	virtual void castRays(const RayCastQuery* queries, RayCastModelHit* hits, int count) = 0;
 	virtual RayCastModelHit castRayTerrain(ComponentHandle terrain, const Vec3& origin, const Vec3& dir) = 0;
 	virtual void getRay(ComponentHandle camera, float x, float y, Vec3& origin, Vec3& dir) = 0;
 
@@ -339,9 +367,21 @@ public:
 	virtual Path getModelInstanceMaterial(ComponentHandle cmp, int index) = 0;
 	virtual int getModelInstanceMaterialsCount(ComponentHandle cmp) = 0;
 	virtual void setModelInstancePath(ComponentHandle cmp, const Path& path) = 0;
+	virtual void setModelInstanceOccluder(ComponentHandle cmp, bool is_occluder) = 0;
+	virtual bool isModelInstanceOccluder(ComponentHandle cmp) = 0;
+	virtual void setModelInstanceStatic(ComponentHandle cmp, bool is_static) = 0;
+	virtual bool isModelInstanceStatic(ComponentHandle cmp) = 0;
+	// computes skinning matrices of the skinned model instances, the ones already computed in this frame
+	// for the current version of their pose are skipped
+	virtual void computeSkinningMatrices(const ComponentHandle* model_instances, int count) = 0;
+	// nullptr if the matrices were not computed in this frame or the pose has changed since then;
+	// valid until the next computeSkinningMatrices
+	virtual const Matrix* getSkinningMatrices(ComponentHandle cmp) const = 0;
+	// screen_height is the height of the viewport in pixels, texture mips are requested for it; 0 = no requests
 	virtual Array<Array<ModelInstanceMesh>>& getModelInstanceInfos(const Frustum& frustum,
 		const Vec3& lod_ref_point,
-		u64 layer_mask) = 0;
+		u64 layer_mask,
+		float screen_height = 0) = 0;
 	virtual void getModelInstanceEntities(const Frustum& frustum, Array<Entity>& entities) = 0;
 	virtual Entity getModelInstanceEntity(ComponentHandle cmp) = 0;
 	virtual ComponentHandle getFirstModelInstance() = 0;
@@ -358,6 +398,7 @@ public:
 		Array<GrassInfo>& infos,
 		ComponentHandle camera) = 0;
 	virtual void forceGrassUpdate(ComponentHandle cmp) = 0;
+	virtual void onTerrainHeightmapChanged(ComponentHandle cmp, int x, int z, int width, int height) = 0;
 	virtual void getTerrainInfos(Array<TerrainInfo>& infos, const Vec3& camera_pos) = 0;
 	virtual float getTerrainHeightAt(ComponentHandle cmp, float x, float z) = 0;
 	virtual Vec3 getTerrainNormalAt(ComponentHandle cmp, float x, float z) = 0;
@@ -380,6 +421,12 @@ public:
 	virtual float getGrassDistance(ComponentHandle cmp, int index) = 0;
 	virtual void setGrassDistance(ComponentHandle cmp, int index, float value) = 0;
 	virtual void enableGrass(bool enabled) = 0;
+	virtual bool isCullingHierarchyEnabled() const = 0;
+	virtual void enableCullingHierarchy(bool enabled) = 0;
+	virtual bool isCullingCacheEnabled() const = 0;
+	virtual void enableCullingCache(bool enabled) = 0;
+	virtual bool isOcclusionCullingEnabled() const = 0;
+	virtual void enableOcclusionCulling(bool enabled) = 0;
 	virtual void setGrassPath(ComponentHandle cmp, int index, const Path& path) = 0;
 	virtual Path getGrassPath(ComponentHandle cmp, int index) = 0;
 	virtual void setGrassDensity(ComponentHandle cmp, int index, int density) = 0;
@@ -390,6 +437,8 @@ public:
 
 	virtual int getClosestPointLights(const Vec3& pos, ComponentHandle* lights, int max_lights) = 0;
 	virtual void getPointLights(const Frustum& frustum, Array<ComponentHandle>& lights) = 0;
+	// valid until the next call, works only with perspective frustums
+	virtual bool getLightClusters(const Frustum& frustum, LightClusters* clusters) = 0;
 	virtual void getPointLightInfluencedGeometry(ComponentHandle light_cmp,
 		Array<ModelInstanceMesh>& infos) = 0;
 	virtual void getPointLightInfluencedGeometry(ComponentHandle light_cmp,
@@ -287,6 +287,12 @@ static void registerProperties(IAllocator& allocator)
 	PropertyRegister::add("renderable",
 		LUMIX_NEW(allocator, ResourcePropertyDescriptor<RenderScene>)(
 			"Source", &RenderScene::getModelInstancePath, &RenderScene::setModelInstancePath, "Mesh (*.msh)", MODEL_TYPE));
+	PropertyRegister::add("renderable",
+		LUMIX_NEW(allocator, BoolPropertyDescriptor<RenderScene>)(
+			"Occluder", &RenderScene::isModelInstanceOccluder, &RenderScene::setModelInstanceOccluder));
+	PropertyRegister::add("renderable",
+		LUMIX_NEW(allocator, BoolPropertyDescriptor<RenderScene>)(
+			"Static", &RenderScene::isModelInstanceStatic, &RenderScene::setModelInstanceStatic));
 
 	auto model_instance_material = LUMIX_NEW(allocator, ArrayDescriptor<RenderScene>)(
 		"Materials", &RenderScene::getModelInstanceMaterialsCount, nullptr, nullptr, allocator);
@@ -589,6 +595,7 @@ struct RendererImpl LUMIX_FINAL : public Renderer
 
 		m_current_pass_hash = crc32("MAIN");
 		m_view_counter = 0;
+		m_frame_index = 0;
 		m_mat_color_uniform =
 			bgfx::createUniform("u_materialColor", bgfx::UniformType::Vec4);
 		m_roughness_metallic_uniform =
@@ -788,6 +795,13 @@ struct RendererImpl LUMIX_FINAL : public Renderer
 		PROFILE_FUNCTION();
 		bgfx::frame(capture);
 		m_view_counter = 0;
+		++m_frame_index;
+	}
+
+
+	u32 getFrameIndex() const override
+	{
+		return m_frame_index;
 	}
 
 
@@ -826,6 +840,7 @@ struct RendererImpl LUMIX_FINAL : public Renderer
 	ModelManager m_model_manager;
 	u32 m_current_pass_hash;
 	int m_view_counter;
+	u32 m_frame_index;
 	Shader* m_default_shader;
 	BGFXAllocator m_bgfx_allocator;
 	bgfx::VertexDecl m_basic_vertex_decl;
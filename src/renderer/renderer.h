@@ -32,6 +32,8 @@ class LUMIX_RENDERER_API Renderer : public IPlugin
 		virtual void resize(int width, int height) = 0;
 		virtual int getViewCounter() const = 0;
 		virtual void viewCounterAdd() = 0;
+		// incremented by each frame()
+		virtual u32 getFrameIndex() const = 0;
 		virtual void makeScreenshot(const Path& filename) = 0;
 		virtual int getPassIdx(const char* pass) = 0;
 		virtual const char* getPassName(int idx) = 0;
@@ -0,0 +1,318 @@
+#include "sphere_grid.h"
+#include "engine/array.h"
+#include "engine/geometry.h"
+#include "engine/hash_map.h"
+#include "engine/math_utils.h"
+#include "engine/profiler.h"
+#include "engine/vec.h"
+#include <cmath>
+
+
+namespace Lumix
+{
+
+
+// bigger spheres are kept in one list tested by every query, instead of being added to many cells
+static const i64 MAX_CELLS_PER_SPHERE = 64;
+
+
+struct CellRange
+{
+	int min[3];
+	int max[3];
+
+	i64 getCellCount() const
+	{
+		return i64(max[0] - min[0] + 1) * i64(max[1] - min[1] + 1) * i64(max[2] - min[2] + 1);
+	}
+
+	bool operator==(const CellRange& rhs) const
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			if (min[i] != rhs.min[i] || max[i] != rhs.max[i]) return false;
+		}
+		return true;
+	}
+};
+
+
+class SphereGridImpl LUMIX_FINAL : public SphereGrid
+{
+public:
+	struct Cell
+	{
+		explicit Cell(IAllocator& allocator)
+			: model_instances(allocator)
+		{
+		}
+
+		int coords[3];
+		Array<ComponentHandle> model_instances;
+	};
+
+
+	struct Entry
+	{
+		Sphere sphere;
+		CellRange cells;
+		bool is_added;
+		bool is_large;
+	};
+
+
+	SphereGridImpl(float cell_size, IAllocator& allocator)
+		: m_allocator(allocator)
+		, m_inv_cell_size(1 / cell_size)
+		, m_cells(allocator)
+		, m_cell_map(allocator)
+		, m_entries(allocator)
+		, m_large(allocator)
+	{
+	}
+
+
+	~SphereGridImpl()
+	{
+		clear();
+	}
+
+
+	IAllocator& getAllocator() { return m_allocator; }
+
+
+	static u64 getCellKey(int x, int y, int z)
+	{
+		return (u64(x & 0x1fffff) << 42) | (u64(y & 0x1fffff) << 21) | u64(z & 0x1fffff);
+	}
+
+
+	CellRange getCellRange(const Sphere& sphere) const
+	{
+		CellRange range;
+		for (int i = 0; i < 3; ++i)
+		{
+			float center = (&sphere.position.x)[i];
+			range.min[i] = (int)floorf((center - sphere.radius) * m_inv_cell_size);
+			range.max[i] = (int)floorf((center + sphere.radius) * m_inv_cell_size);
+		}
+		return range;
+	}
+
+
+	void clear() override
+	{
+		for (Cell* cell : m_cells)
+		{
+			LUMIX_DELETE(m_allocator, cell);
+		}
+		m_cells.clear();
+		m_cell_map.clear();
+		m_entries.clear();
+		m_large.clear();
+	}
+
+
+	bool isAdded(ComponentHandle model_instance) const override
+	{
+		return model_instance.index < m_entries.size() && m_entries[model_instance.index].is_added;
+	}
+
+
+	void add(ComponentHandle model_instance, const Sphere& sphere) override
+	{
+		ASSERT(!isAdded(model_instance));
+		while (m_entries.size() <= model_instance.index)
+		{
+			Entry& entry = m_entries.emplace();
+			entry.is_added = false;
+			entry.is_large = false;
+		}
+
+		Entry& entry = m_entries[model_instance.index];
+		entry.sphere = sphere;
+		entry.cells = getCellRange(sphere);
+		entry.is_added = true;
+		entry.is_large = entry.cells.getCellCount() > MAX_CELLS_PER_SPHERE;
+		if (entry.is_large)
+		{
+			m_large.push(model_instance);
+			return;
+		}
+
+		const CellRange& range = entry.cells;
+		for (int z = range.min[2]; z <= range.max[2]; ++z)
+		{
+			for (int y = range.min[1]; y <= range.max[1]; ++y)
+			{
+				for (int x = range.min[0]; x <= range.max[0]; ++x)
+				{
+					getOrCreateCell(x, y, z).model_instances.push(model_instance);
+				}
+			}
+		}
+	}
+
+
+	void remove(ComponentHandle model_instance) override
+	{
+		if (!isAdded(model_instance)) return;
+
+		Entry& entry = m_entries[model_instance.index];
+		entry.is_added = false;
+		if (entry.is_large)
+		{
+			m_large.eraseItemFast(model_instance);
+			return;
+		}
+
+		const CellRange& range = entry.cells;
+		for (int z = range.min[2]; z <= range.max[2]; ++z)
+		{
+			for (int y = range.min[1]; y <= range.max[1]; ++y)
+			{
+				for (int x = range.min[0]; x <= range.max[0]; ++x)
+				{
+					auto iter = m_cell_map.find(getCellKey(x, y, z));
+					ASSERT(iter.isValid());
+					int cell_idx = iter.value();
+					Cell* cell = m_cells[cell_idx];
+					cell->model_instances.eraseItemFast(model_instance);
+					if (cell->model_instances.empty()) destroyCell(cell_idx);
+				}
+			}
+		}
+	}
+
+
+	void update(ComponentHandle model_instance, const Sphere& sphere) override
+	{
+		if (isAdded(model_instance))
+		{
+			Entry& entry = m_entries[model_instance.index];
+			if (!entry.is_large && entry.cells == getCellRange(sphere))
+			{
+				entry.sphere = sphere;
+				return;
+			}
+			remove(model_instance);
+		}
+		add(model_instance, sphere);
+	}
+
+
+	void query(const Sphere& sphere, Array<ComponentHandle>& model_instances) const override
+	{
+		PROFILE_FUNCTION();
+		CellRange range = getCellRange(sphere);
+
+		auto queryCell = [&](const Cell& cell) {
+			for (ComponentHandle model_instance : cell.model_instances)
+			{
+				const Entry& entry = m_entries[model_instance.index];
+				// a sphere in more cells is reported only from the first cell shared with the query
+				bool is_first_shared_cell = true;
+				for (int i = 0; i < 3; ++i)
+				{
+					if (cell.coords[i] != Math::maximum(entry.cells.min[i], range.min[i])) is_first_shared_cell = false;
+				}
+				if (is_first_shared_cell && intersects(entry.sphere, sphere)) model_instances.push(model_instance);
+			}
+		};
+
+		if (range.getCellCount() <= m_cells.size())
+		{
+			for (int z = range.min[2]; z <= range.max[2]; ++z)
+			{
+				for (int y = range.min[1]; y <= range.max[1]; ++y)
+				{
+					for (int x = range.min[0]; x <= range.max[0]; ++x)
+					{
+						auto iter = m_cell_map.find(getCellKey(x, y, z));
+						if (iter.isValid()) queryCell(*m_cells[iter.value()]);
+					}
+				}
+			}
+		}
+		else
+		{
+			// the query covers more cells than there are, so only the existing ones are visited
+			for (const Cell* cell : m_cells)
+			{
+				bool is_in_range = true;
+				for (int i = 0; i < 3; ++i)
+				{
+					if (cell->coords[i] < range.min[i] || cell->coords[i] > range.max[i]) is_in_range = false;
+				}
+				if (is_in_range) queryCell(*cell);
+			}
+		}
+
+		for (ComponentHandle model_instance : m_large)
+		{
+			if (intersects(m_entries[model_instance.index].sphere, sphere)) model_instances.push(model_instance);
+		}
+	}
+
+private:
+	static bool intersects(const Sphere& a, const Sphere& b)
+	{
+		float radius = a.radius + b.radius;
+		return (a.position - b.position).squaredLength() <= radius * radius;
+	}
+
+
+	Cell& getOrCreateCell(int x, int y, int z)
+	{
+		u64 key = getCellKey(x, y, z);
+		auto iter = m_cell_map.find(key);
+		if (iter.isValid()) return *m_cells[iter.value()];
+
+		Cell* cell = LUMIX_NEW(m_allocator, Cell)(m_allocator);
+		cell->coords[0] = x;
+		cell->coords[1] = y;
+		cell->coords[2] = z;
+		m_cell_map.insert(key, m_cells.size());
+		m_cells.push(cell);
+		return *cell;
+	}
+
+
+	void destroyCell(int cell_idx)
+	{
+		Cell* cell = m_cells[cell_idx];
+		m_cell_map.erase(getCellKey(cell->coords[0], cell->coords[1], cell->coords[2]));
+		LUMIX_DELETE(m_allocator, cell);
+		m_cells.eraseFast(cell_idx);
+		if (cell_idx < m_cells.size())
+		{
+			const Cell* moved = m_cells[cell_idx];
+			m_cell_map[getCellKey(moved->coords[0], moved->coords[1], moved->coords[2])] = cell_idx;
+		}
+	}
+
+
+private:
+	IAllocator& m_allocator;
+	float m_inv_cell_size;
+	Array<Cell*> m_cells;
+	HashMap<u64, int> m_cell_map;
+	// indexed by model instance
+	Array<Entry> m_entries;
+	Array<ComponentHandle> m_large;
+};
+
+
+SphereGrid* SphereGrid::create(float cell_size, IAllocator& allocator)
+{
+	return LUMIX_NEW(allocator, SphereGridImpl)(cell_size, allocator);
+}
+
+
+void SphereGrid::destroy(SphereGrid& grid)
+{
+	LUMIX_DELETE(static_cast<SphereGridImpl&>(grid).getAllocator(), &grid);
+}
+
+
+} // namespace Lumix
@@ -0,0 +1,33 @@
+#pragma once
+
+
+#include "engine/lumix.h"
+
+
+namespace Lumix
+{
+	class IAllocator;
+	struct Sphere;
+	template <typename T> class Array;
+
+
+	// bounding spheres of model instances in a sparse grid of cubic cells, finds the spheres touching
+	// another sphere without testing all of them; moving a sphere only touches the cells it leaves and enters
+	class LUMIX_RENDERER_API SphereGrid
+	{
+	public:
+		SphereGrid() { }
+		virtual ~SphereGrid() { }
+
+		static SphereGrid* create(float cell_size, IAllocator& allocator);
+		static void destroy(SphereGrid& grid);
+
+		virtual void clear() = 0;
+		virtual bool isAdded(ComponentHandle model_instance) const = 0;
+		virtual void add(ComponentHandle model_instance, const Sphere& sphere) = 0;
+		virtual void remove(ComponentHandle model_instance) = 0;
+		virtual void update(ComponentHandle model_instance, const Sphere& sphere) = 0;
+		// appends every model instance whose sphere intersects the sphere, each of them once
+		virtual void query(const Sphere& sphere, Array<ComponentHandle>& model_instances) const = 0;
+	};
+} // namespace Lumix
@@ -137,17 +137,20 @@ struct TerrainQuad
 		return (size > 17 ? 2.25f : 1.25f) * Math::SQRT2 * size;
 	}
 
-	bool getInfos(Array<TerrainInfo>& infos, const Vec3& camera_pos, Terrain* terrain, const Matrix& world_matrix)
+	bool getInfos(Array<TerrainInfo>& infos,
+		const Vec3& camera_pos,
+		Terrain* terrain,
+		Shader& shader,
+		const Matrix& world_matrix)
 	{
 		float squared_dist = getSquaredDistance(camera_pos);
 		float r = getRadiusOuter(m_size);
 		if (squared_dist > r * r && m_lod > 1) return false;
 
 		Vec3 morph_const(r, getRadiusInner(m_size), 0);
-		Shader& shader = *terrain->getMesh()->material->getShader();
 		for (int i = 0; i < CHILD_COUNT; ++i)
 		{
-			if (!m_children[i] || !m_children[i]->getInfos(infos, camera_pos, terrain, world_matrix))
+			if (!m_children[i] || !m_children[i]->getInfos(infos, camera_pos, terrain, shader, world_matrix))
 			{
 				TerrainInfo& data = infos.emplace();
 				data.m_morph_const = morph_const;
@@ -188,6 +191,7 @@ Terrain::Terrain(Renderer& renderer, Entity entity, RenderScene& scene, IAllocat
 	, m_grass_quads(m_allocator)
 	, m_last_camera_position(m_allocator)
 	, m_grass_types(m_allocator)
+	, m_height_pyramid(m_allocator)
 	, m_renderer(renderer)
 	, m_vertices_handle(BGFX_INVALID_HANDLE)
 	, m_indices_handle(BGFX_INVALID_HANDLE)
@@ -305,15 +309,13 @@ AABB Terrain::getAABB() const
 {
 	Vec3 min(0, 0, 0);
 	Vec3 max(m_width * m_scale.x, 0, m_height * m_scale.z);
-	for (int j = 0; j < m_height; ++j)
+	if (!m_height_pyramid.isEmpty())
 	{
-		for (int i = 0; i < m_width; ++i)
-		{
-			float height = getHeight(i, j);
-			if (height > max.y) max.y = height;
-		}
+		u16 min_height, max_height;
+		m_height_pyramid.getHeightRange(&min_height, &max_height);
+		min.y = min_height * m_scale.y / 65535.0f;
+		max.y = max_height * m_scale.y / 65535.0f;
 	}
-			
 	return AABB(min, max);
 }
 
@@ -650,7 +652,8 @@ void Terrain::getInfos(Array<TerrainInfo>& infos, const Vec3& camera_pos)
 	Vec3 local_camera_pos = inv_matrix.transform(camera_pos);
 	local_camera_pos.x /= m_scale.x;
 	local_camera_pos.z /= m_scale.z;
-	m_root->getInfos(infos, local_camera_pos, this, matrix);
+	Shader& shader = *m_mesh->material->getShader();
+	m_root->getInfos(infos, local_camera_pos, this, shader, matrix);
 }
 
 
@@ -713,7 +716,7 @@ float Terrain::getHeight(int x, int z) const
 
 	Texture* t = m_heightmap;
 	ASSERT(t->bytes_per_pixel == 2);
-	int idx = Math::clamp(x, 0, m_width) + Math::clamp(z, 0, m_height) * m_width;
+	int idx = Math::clamp(x, 0, m_width - 1) + Math::clamp(z, 0, m_height - 1) * m_width;
 	return m_scale.y * DIV64K * ((u16*)t->getData())[idx];
 }
 
@@ -726,119 +729,40 @@ void Terrain::setHeight(int x, int z, float h)
 
 	Texture* t = m_heightmap;
 	ASSERT(t->bytes_per_pixel == 2);
-	int idx = Math::clamp(x, 0, m_width) + Math::clamp(z, 0, m_height) * m_width;
+	x = Math::clamp(x, 0, m_width - 1);
+	z = Math::clamp(z, 0, m_height - 1);
+	int idx = x + z * m_width;
 	((u16*)t->getData())[idx] = (u16)(h * (65535.0f / m_scale.y));
+	onHeightmapChanged(x, z, 1, 1);
 }
 
 
-bool getRayTriangleIntersection(const Vec3& local_origin, const Vec3& local_dir, const Vec3& p0, const Vec3& p1, const Vec3& p2, float& out)
+void Terrain::onHeightmapChanged(int x, int z, int width, int height)
 {
-	Vec3 normal = crossProduct(p1 - p0, p2 - p0);
-	float q = dotProduct(normal, local_dir);
-	if (q == 0)
-	{
-		return false;
-	}
-	float d = -dotProduct(normal, p0);
-	float t = -(dotProduct(normal, local_origin) + d) / q;
-	if (t < 0)
-	{
-		return false;
-	}
-	Vec3 hit_point = local_origin + local_dir * t;
-
-	Vec3 edge0 = p1 - p0;
-	Vec3 VP0 = hit_point - p0;
-	if (dotProduct(normal, crossProduct(edge0, VP0)) < 0)
-	{
-		return false;
-	}
-
-	Vec3 edge1 = p2 - p1;
-	Vec3 VP1 = hit_point - p1;
-	if (dotProduct(normal, crossProduct(edge1, VP1)) < 0)
-	{
-		return false;
-	}
-
-	Vec3 edge2 = p0 - p2;
-	Vec3 VP2 = hit_point - p2;
-	if (dotProduct(normal, crossProduct(edge2, VP2)) < 0)
-	{
-		return false;
-	}
+	if (!m_heightmap) return;
 
-	out = t;
-	return true;
+	m_height_pyramid.update(x, z, width, height);
 }
 
 
 RayCastModelHit Terrain::castRay(const Vec3& origin, const Vec3& dir)
 {
+	PROFILE_FUNCTION();
 	RayCastModelHit hit;
 	hit.m_is_hit = false;
-	if (m_root)
-	{
-		Matrix mtx = m_scene.getUniverse().getMatrix(m_entity);
-		mtx.fastInverse();
-		Vec3 rel_origin = mtx.transform(origin);
-		Vec3 rel_dir = mtx * Vec4(dir, 0);
-		Vec3 start;
-		Vec3 size(m_root->m_size * m_scale.x, m_scale.y * 65535.0f, m_root->m_size * m_scale.x);
-		if (Math::getRayAABBIntersection(rel_origin, rel_dir, m_root->m_min, size, start))
-		{
-			int hx = (int)(start.x / m_scale.x);
-			int hz = (int)(start.z / m_scale.x);
-
-			float next_x = fabs(rel_dir.x) < 0.01f ? hx : ((hx + (rel_dir.x < 0 ? 0 : 1)) * m_scale.x - rel_origin.x) / rel_dir.x;
-			float next_z = fabs(rel_dir.z) < 0.01f ? hz : ((hz + (rel_dir.z < 0 ? 0 : 1)) * m_scale.x - rel_origin.z) / rel_dir.z;
+	if (!m_root || m_height_pyramid.isEmpty()) return hit;
 
-			float delta_x = fabs(rel_dir.x) < 0.01f ? 0 : m_scale.x / Math::abs(rel_dir.x);
-			float delta_z = fabs(rel_dir.z) < 0.01f ? 0 : m_scale.x / Math::abs(rel_dir.z);
-			int step_x = (int)Math::signum(rel_dir.x);
-			int step_z = (int)Math::signum(rel_dir.z);
-
-			while (hx >= 0 && hz >= 0 && hx + step_x < m_width && hz + step_z < m_height)
-			{
-				float t;
-				float x = hx * m_scale.x;
-				float z = hz * m_scale.x;
-				Vec3 p0(x, getHeight(x, z), z);
-				Vec3 p1(x + m_scale.x, getHeight(x + m_scale.x, z), z);
-				Vec3 p2(x + m_scale.x, getHeight(x + m_scale.x, z + m_scale.x), z + m_scale.x);
-				Vec3 p3(x, getHeight(x, z + m_scale.x), z + m_scale.x);
-				if (getRayTriangleIntersection(rel_origin, rel_dir, p0, p1, p2, t))
-				{
-					hit.m_is_hit = true;
-					hit.m_origin = origin;
-					hit.m_dir = dir;
-					hit.m_t = t;
-					return hit;
-				}
-				if (getRayTriangleIntersection(rel_origin, rel_dir, p0, p2, p3, t))
-				{
-					hit.m_is_hit = true;
-					hit.m_origin = origin;
-					hit.m_dir = dir;
-					hit.m_t = t;
-					return hit;
-				}
-				if (next_x < next_z)
-				{
-					next_x += delta_x;
-					hx += step_x;
-				}
-				else
-				{
-					next_z += delta_z;
-					hz += step_z;
-				}
-				if (delta_x == 0 && delta_z == 0)
-				{
-					return hit;
-				}
-			}
-		}
+	Matrix mtx = m_scene.getUniverse().getMatrix(m_entity);
+	mtx.fastInverse();
+	Vec3 rel_origin = mtx.transform(origin);
+	Vec3 rel_dir = mtx * Vec4(dir, 0);
+	float t;
+	if (m_height_pyramid.castRay(rel_origin, rel_dir, m_scale, &t))
+	{
+		hit.m_is_hit = true;
+		hit.m_origin = origin;
+		hit.m_dir = dir;
+		hit.m_t = t;
 	}
 	return hit;
 }
@@ -941,19 +865,32 @@ void Terrain::onMaterialLoaded(Resource::State, Resource::State new_state, Resou
 
 		if (is_data_ready)
 		{
-			LUMIX_DELETE(m_allocator, m_root);
 			if (m_heightmap && m_splatmap)
 			{
 				m_width = m_heightmap->width;
 				m_height = m_heightmap->height;
-				m_root = generateQuadTree((float)m_width);
+				// the quadtree depends only on the size, heights are in the height pyramid
+				if (!m_root || m_root->m_size != (float)m_width)
+				{
+					LUMIX_DELETE(m_allocator, m_root);
+					m_root = generateQuadTree((float)m_width);
+				}
+				ASSERT(m_heightmap->bytes_per_pixel == 2);
+				m_height_pyramid.build((const u16*)m_heightmap->getData(), m_width, m_height);
+			}
+			else
+			{
+				LUMIX_DELETE(m_allocator, m_root);
+				m_root = nullptr;
+				m_height_pyramid.clear();
 			}
 		}
 	}
 	else
 	{
-		LUMIX_DELETE(m_allocator, m_root);
-		m_root = nullptr;
+		// the quadtree is kept for a reload of a heightmap of the same size; getInfos does not run
+		// until the material is ready and castRay does not run without the height pyramid
+		m_height_pyramid.clear();
 	}
 }
 
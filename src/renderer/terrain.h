@@ -6,6 +6,7 @@
 #include "engine/matrix.h"
 #include "engine/resource.h"
 #include "engine/vec.h"
+#include "renderer/height_pyramid.h"
 #include <bgfx/bgfx.h>
 
 
@@ -103,6 +104,8 @@ class Terrain
 
 		float getHeight(int x, int z) const;
 		void setHeight(int x, int z, float height);
+		// heightmap samples in the rectangle were changed
+		void onHeightmapChanged(int x, int z, int width, int height);
 		void setXZScale(float scale) { m_scale.x = scale; m_scale.z = scale; }
 		void setYScale(float scale) { m_scale.y = scale; }
 		void setGrassTypePath(int index, const Path& path);
@@ -150,6 +153,7 @@ class Terrain
 		Texture* m_detail_texture;
 		RenderScene& m_scene;
 		Array<GrassType*> m_grass_types;
+		HeightPyramid m_height_pyramid;
 		AssociativeArray<ComponentHandle, Array<GrassQuad*> > m_grass_quads;
 		AssociativeArray<ComponentHandle, Vec3> m_last_camera_position;
 		bool m_force_grass_update;
@@ -36,6 +36,29 @@ struct TGAHeader
 #pragma pack()
 
 
+// owns decoded data of a texture until bgfx is done with it, so the data is not copied once more
+struct StagingMemory
+{
+	explicit StagingMemory(IAllocator& _allocator)
+		: allocator(_allocator)
+		, data(_allocator)
+	{
+	}
+
+	IAllocator& allocator;
+	Array<u8> data;
+};
+
+
+// called by bgfx, possibly on the render thread
+static void releaseStagingMemory(void*, void* user_data)
+{
+	auto* staging = (StagingMemory*)user_data;
+	IAllocator& allocator = staging->allocator;
+	LUMIX_DELETE(allocator, staging);
+}
+
+
 Texture::Texture(const Path& path, ResourceManagerBase& resource_manager, IAllocator& _allocator)
 	: Resource(path, resource_manager, _allocator)
 	, data_reference(0)
@@ -44,6 +67,21 @@ Texture::Texture(const Path& path, ResourceManagerBase& resource_manager, IAlloc
 	, bytes_per_pixel(-1)
 	, depth(-1)
 	, layers(1)
+	, m_staging(_allocator)
+	, m_staging_format(StagingFormat::NONE)
+	, m_is_streamable(false)
+	, m_was_requested(false)
+	, m_full_size(0)
+	, m_full_mips(0)
+	, m_mip_skip(0)
+	, m_stream_skip(0)
+	, m_stream_async(FS::FileSystem::INVALID_ASYNC)
+	, m_stream_header(_allocator)
+	, m_mip_offsets(_allocator)
+	, m_storage_size(0)
+	, m_requested_size(0)
+	, m_last_requested_size(0)
+	, m_last_request_frame(0)
 {
 	bgfx_flags = 0;
 	is_cubemap = false;
@@ -336,7 +374,7 @@ void Texture::onDataUpdated(int x, int y, int w, int h)
 }
 
 
-bool loadRaw(Texture& texture, FS::IFile& file)
+static bool decodeRaw(Texture& texture, FS::IFile& file, Array<u8>& staging)
 {
 	PROFILE_FUNCTION();
 	size_t size = file.size();
@@ -351,32 +389,23 @@ bool loadRaw(Texture& texture, FS::IFile& file)
 	}
 
 	const u16* src_mem = (const u16*)file.getBuffer();
-	const bgfx::Memory* mem = bgfx::alloc(texture.width * texture.height * sizeof(float));
-	float* dst_mem = (float*)mem->data;
+	staging.resize(texture.width * texture.height * sizeof(float));
+	float* dst_mem = (float*)&staging[0];
 
 	for (int i = 0; i < texture.width * texture.height; ++i)
 	{
 		dst_mem[i] = src_mem[i] / 65535.0f;
 	}
 
-	texture.handle = bgfx::createTexture2D((uint16_t)texture.width,
-		(uint16_t)texture.height,
-		false,
-		1,
-		bgfx::TextureFormat::R32F,
-		texture.bgfx_flags,
-		nullptr);
-	// update must be here because texture is immutable otherwise 
-	bgfx::updateTexture2D(texture.handle, 0, 0, 0, 0, (uint16_t)texture.width, (uint16_t)texture.height, mem);
 	texture.depth = 1;
 	texture.layers = 1;
 	texture.mips = 1;
 	texture.is_cubemap = false;
-	return bgfx::isValid(texture.handle);
+	return true;
 }
 
 
-static bool loadTGA(Texture& texture, FS::IFile& file)
+static bool decodeTGA(Texture& texture, FS::IFile& file, Array<u8>& staging)
 {
 	PROFILE_FUNCTION();
 	TGAHeader header;
@@ -400,12 +429,8 @@ static bool loadTGA(Texture& texture, FS::IFile& file)
 	texture.height = header.height;
 	int pixel_count = texture.width * texture.height;
 	texture.is_cubemap = false;
-	TextureManager& manager = static_cast<TextureManager&>(texture.getResourceManager());
-	if (texture.data_reference)
-	{
-		texture.data.resize(image_size);
-	}
-	u8* image_dest = texture.data_reference ? &texture.data[0] : (u8*)manager.getBuffer(image_size);
+	staging.resize(image_size);
+	u8* image_dest = &staging[0];
 
 	bool is_rle = header.dataType == 10;
 	if (is_rle)
@@ -466,28 +491,228 @@ static bool loadTGA(Texture& texture, FS::IFile& file)
 			}
 		}
 	}
+	if (texture.data_reference)
+	{
+		texture.data.resize(image_size);
+		copyMemory(&texture.data[0], image_dest, image_size);
+	}
 	texture.bytes_per_pixel = 4;
 	texture.mips = 1;
-	texture.handle = bgfx::createTexture2D(
-		header.width,
-		header.height,
-		false,
-		0,
-		bgfx::TextureFormat::RGBA8,
-		texture.bgfx_flags,
-		nullptr);
-	// update must be here because texture is immutable otherwise 
-	bgfx::updateTexture2D(texture.handle,
-		0,
-		0,
-		0,
-		0,
-		header.width,
-		header.height,
-		bgfx::copy(image_dest, header.width * header.height * 4));
 	texture.depth = 1;
 	texture.layers = 1;
-	return bgfx::isValid(texture.handle);
+	return true;
+}
+
+
+static const u32 DDS_MAGIC = 0x20534444; // "DDS "
+static const u32 DDS_HEADER_SIZE = 128;
+static const u32 DDSD_PITCH = 0x8;
+static const u32 DDSD_LINEARSIZE = 0x80000;
+static const u32 DDPF_FOURCC = 0x4;
+static const u8 KTX_MAGIC[] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const u32 KTX_HEADER_SIZE = 64;
+
+
+static u32 makeFourCC(char a, char b, char c, char d)
+{
+	return u32(a) | (u32(b) << 8) | (u32(c) << 16) | (u32(d) << 24);
+}
+
+
+// size of a DDS mip, 0 if the format is not known
+static u32 getDDSMipSize(const u8* header, int width, int height)
+{
+	auto read = [header](int offset) { return *(const u32*)(header + offset); };
+
+	u32 block_size = 0;
+	u32 pixel_size = 0;
+	if (read(80) & DDPF_FOURCC)
+	{
+		u32 fourcc = read(84);
+		if (fourcc == makeFourCC('D', 'X', 'T', '1') || fourcc == makeFourCC('A', 'T', 'I', '1') ||
+			fourcc == makeFourCC('B', 'C', '4', 'U') || fourcc == makeFourCC('B', 'C', '4', 'S'))
+		{
+			block_size = 8;
+		}
+		else if (fourcc == makeFourCC('D', 'X', 'T', '2') || fourcc == makeFourCC('D', 'X', 'T', '3') ||
+				 fourcc == makeFourCC('D', 'X', 'T', '4') || fourcc == makeFourCC('D', 'X', 'T', '5') ||
+				 fourcc == makeFourCC('A', 'T', 'I', '2') || fourcc == makeFourCC('B', 'C', '5', 'U') ||
+				 fourcc == makeFourCC('B', 'C', '5', 'S'))
+		{
+			block_size = 16;
+		}
+		else
+		{
+			// D3DFORMAT values
+			switch (fourcc)
+			{
+				case 111: pixel_size = 2; break; // R16F
+				case 112: case 114: pixel_size = 4; break; // G16R16F, R32F
+				case 36: case 110: case 113: case 115: pixel_size = 8; break; // A16B16G16R16, Q16W16V16U16, A16B16G16R16F, G32R32F
+				case 116: pixel_size = 16; break; // A32B32G32R32F
+				default: return 0;
+			}
+		}
+	}
+	else
+	{
+		u32 bit_count = read(88);
+		if (bit_count == 0 || bit_count % 8 != 0) return 0;
+		pixel_size = bit_count / 8;
+	}
+
+	if (block_size > 0) return block_size * Math::maximum(1, (width + 3) / 4) * Math::maximum(1, (height + 3) / 4);
+	return pixel_size * width * height;
+}
+
+
+// only plain 2D mipmapped textures are streamed, returns size of the top mip, mip count, size of the header
+// and file offsets of the mips, so streaming can read just the needed mips
+static bool getStreamingInfo(const u8* data,
+	size_t size,
+	int* full_size,
+	int* mips,
+	u32* header_size,
+	Array<u32>& mip_offsets)
+{
+	static const u32 DDS_FOURCC_DX10 = 0x30315844; // "DX10"
+	static const u32 DDSCAPS2_CUBEMAP = 0x200;
+	static const u32 DDSCAPS2_VOLUME = 0x200000;
+	static const u32 KTX_ENDIANNESS = 0x04030201;
+
+	auto read = [data](size_t offset) { return *(const u32*)(data + offset); };
+
+	mip_offsets.clear();
+	if (size >= DDS_HEADER_SIZE && read(0) == DDS_MAGIC)
+	{
+		if (read(84) == DDS_FOURCC_DX10) return false;
+		if (read(112) & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME)) return false;
+		int width = (int)read(16);
+		int height = (int)read(12);
+		*full_size = Math::maximum(width, height);
+		*mips = (int)read(28);
+		*header_size = DDS_HEADER_SIZE;
+		if (*mips <= 1) return false;
+
+		size_t offset = DDS_HEADER_SIZE;
+		for (int i = 0; i < *mips; ++i)
+		{
+			u32 mip_size = getDDSMipSize(data, Math::maximum(1, width >> i), Math::maximum(1, height >> i));
+			if (mip_size == 0) return false;
+			mip_offsets.push((u32)offset);
+			offset += mip_size;
+		}
+		mip_offsets.push((u32)offset);
+		return offset <= size;
+	}
+
+	if (size >= KTX_HEADER_SIZE && compareMemory(data, KTX_MAGIC, sizeof(KTX_MAGIC)) == 0)
+	{
+		if (read(12) != KTX_ENDIANNESS) return false;
+		if (read(44) > 1 || read(48) > 0 || read(52) != 1) return false;
+		*full_size = Math::maximum((int)read(36), (int)read(40));
+		*mips = (int)read(56);
+		*header_size = KTX_HEADER_SIZE + read(60);
+		if (*mips <= 1) return false;
+
+		// each mip is its size followed by its data padded to 4 bytes
+		size_t offset = *header_size;
+		for (int i = 0; i < *mips; ++i)
+		{
+			if (offset + 4 > size) return false;
+			mip_offsets.push((u32)offset);
+			u32 image_size = read(offset);
+			offset += 4 + ((image_size + 3) & ~3);
+		}
+		mip_offsets.push((u32)offset);
+		return offset <= size;
+	}
+
+	return false;
+}
+
+
+// makes the header describe a file starting with the mip skip
+static void patchStreamHeader(u8* header, int skip, int mip_count, u32 top_mip_size)
+{
+	auto read = [header](int offset) { return *(const u32*)(header + offset); };
+	auto write = [header](int offset, u32 value) { copyMemory(header + offset, &value, sizeof(value)); };
+	if (read(0) == DDS_MAGIC)
+	{
+		u32 mip_width = Math::maximum(1U, read(16) >> skip);
+		write(12, Math::maximum(1U, read(12) >> skip));
+		write(16, mip_width);
+		write(28, (u32)mip_count);
+		if (read(8) & DDSD_LINEARSIZE) write(20, top_mip_size);
+		else if (read(8) & DDSD_PITCH) write(20, (mip_width * read(88) + 7) / 8);
+	}
+	else
+	{
+		write(36, Math::maximum(1U, read(36) >> skip));
+		if (read(40) > 0) write(40, Math::maximum(1U, read(40) >> skip));
+		write(56, (u32)mip_count);
+	}
+}
+
+
+void Texture::requestSize(int pixels)
+{
+	if (m_is_streamable && m_requested_size < pixels) m_requested_size = pixels;
+}
+
+
+void Texture::stream(int skip)
+{
+	ASSERT(m_stream_async == FS::FileSystem::INVALID_ASYNC);
+
+	m_stream_skip = skip;
+	FS::FileSystem& fs = m_resource_manager.getOwner().getFileSystem();
+	FS::ReadCallback cb;
+	cb.bind<Texture, &Texture::onStreamLoaded>(this);
+	u32 offset = m_mip_offsets[skip];
+	m_stream_async = fs.readAsync(fs.getDefaultDevice(),
+		getPath(),
+		offset,
+		m_mip_offsets.back() - offset,
+		cb,
+		FS::FileSystem::Priority::LOW);
+}
+
+
+// the file read by stream() has only mips from m_stream_skip on, they get the original header
+// with the size and the mip count of the top streamed mip
+void Texture::onStreamLoaded(FS::IFile& file, bool success)
+{
+	m_stream_async = FS::FileSystem::INVALID_ASYNC;
+	if (!success || !isReady()) return;
+	if (file.size() != m_mip_offsets.back() - m_mip_offsets[m_stream_skip]) return;
+
+	PROFILE_FUNCTION();
+	int header_size = m_stream_header.size();
+	const bgfx::Memory* mem = bgfx::alloc(u32(header_size + file.size()));
+	copyMemory(mem->data, &m_stream_header[0], header_size);
+	copyMemory(mem->data + header_size, file.getBuffer(), file.size());
+
+	patchStreamHeader(mem->data,
+		m_stream_skip,
+		m_full_mips - m_stream_skip,
+		m_mip_offsets[m_stream_skip + 1] - m_mip_offsets[m_stream_skip]);
+
+	bgfx::TextureInfo info;
+	auto new_handle = bgfx::createTexture(mem, bgfx_flags, 0, &info);
+	if (!bgfx::isValid(new_handle))
+	{
+		g_log_warning.log("Renderer") << "Could not stream texture " << getPath().c_str();
+		return;
+	}
+
+	bgfx::destroyTexture(handle);
+	handle = new_handle;
+	width = info.width;
+	height = info.height;
+	mips = info.numMips;
+	m_mip_skip = m_stream_skip;
+	m_storage_size = info.storageSize;
 }
 
 
@@ -504,50 +729,51 @@ void Texture::addDataReference()
 void Texture::removeDataReference()
 {
 	--data_reference;
-	if (data_reference == 0)
+	// the decode job may be filling the data right now, it's released in finalize then
+	if (data_reference == 0 && !isDecoding())
 	{
 		data.clear();
 	}
 }
 
 
-static bool loadDDSorKTX(Texture& texture, FS::IFile& file)
-{
-	bgfx::TextureInfo info;
-	const auto* mem = bgfx::copy(file.getBuffer(), (u32)file.size());
-	texture.handle = bgfx::createTexture(mem, texture.bgfx_flags, 0, &info);
-	texture.width = info.width;
-	texture.mips = info.numMips;
-	texture.height = info.height;
-	texture.depth = info.depth;
-	texture.layers = info.numLayers;
-	texture.is_cubemap = info.cubeMap;
-	return bgfx::isValid(texture.handle);
-}
-
-
-bool Texture::load(FS::IFile& file)
+bool Texture::decode(FS::IFile& file)
 {
 	PROFILE_FUNCTION();
 
 	const char* path = getPath().c_str();
 	size_t len = getPath().length();
-	bool loaded = false;
+	bool decoded = false;
 	if (len > 3 && (equalStrings(path + len - 4, ".dds") || equalStrings(path + len - 4, ".ktx")))
 	{
-		loaded = loadDDSorKTX(*this, file);
+		m_staging_format = StagingFormat::CONTAINER;
+		m_staging.resize((int)file.size());
+		copyMemory(&m_staging[0], file.getBuffer(), file.size());
+		u32 header_size;
+		m_is_streamable = data_reference == 0 &&
+			getStreamingInfo(
+				&m_staging[0], m_staging.size(), &m_full_size, &m_full_mips, &header_size, m_mip_offsets);
+		if (m_is_streamable)
+		{
+			m_stream_header.resize(header_size);
+			copyMemory(&m_stream_header[0], &m_staging[0], header_size);
+		}
+		decoded = true;
 	}
 	else if (len > 3 && equalStrings(path + len - 4, ".raw"))
 	{
-		loaded = loadRaw(*this, file);
+		m_staging_format = StagingFormat::R32F;
+		decoded = decodeRaw(*this, file, m_staging);
 	}
 	else
 	{
-		loaded = loadTGA(*this, file);
+		m_staging_format = StagingFormat::RGBA8;
+		decoded = decodeTGA(*this, file, m_staging);
 	}
-	if (!loaded)
+	if (!decoded)
 	{
 		g_log_warning.log("Renderer") << "Error loading texture " << path;
+		m_staging.clear();
 		return false;
 	}
 
@@ -556,6 +782,62 @@ bool Texture::load(FS::IFile& file)
 }
 
 
+bool Texture::finalize()
+{
+	PROFILE_FUNCTION();
+	ASSERT(!m_staging.empty());
+
+	auto* staging = LUMIX_NEW(allocator, StagingMemory)(allocator);
+	staging->data.swap(m_staging);
+	const bgfx::Memory* mem =
+		bgfx::makeRef(&staging->data[0], staging->data.size(), releaseStagingMemory, staging);
+	m_storage_size = staging->data.size();
+	if (data_reference == 0) data.clear();
+	switch (m_staging_format)
+	{
+		case StagingFormat::CONTAINER:
+		{
+			// streamed textures start with the smallest mips, TextureManager streams in the rest
+			auto& manager = static_cast<TextureManager&>(m_resource_manager);
+			m_is_streamable = m_is_streamable && manager.isStreamingEnabled();
+			m_mip_skip = m_is_streamable ? manager.getInitialMipSkip(*this) : 0;
+
+			bgfx::TextureInfo info;
+			handle = bgfx::createTexture(mem, bgfx_flags, (u8)m_mip_skip, &info);
+			width = info.width;
+			mips = info.numMips;
+			height = info.height;
+			depth = info.depth;
+			layers = info.numLayers;
+			is_cubemap = info.cubeMap;
+			m_storage_size = info.storageSize;
+			break;
+		}
+		case StagingFormat::R32F:
+		case StagingFormat::RGBA8:
+		{
+			auto format = m_staging_format == StagingFormat::R32F ? bgfx::TextureFormat::R32F
+																	: bgfx::TextureFormat::RGBA8;
+			handle = bgfx::createTexture2D(
+				(uint16_t)width, (uint16_t)height, false, 1, format, bgfx_flags, nullptr);
+			// update must be here because texture is immutable otherwise
+			bgfx::updateTexture2D(handle, 0, 0, 0, 0, (uint16_t)width, (uint16_t)height, mem);
+			break;
+		}
+		default: ASSERT(false); break;
+	}
+	m_staging_format = StagingFormat::NONE;
+
+	if (!bgfx::isValid(handle))
+	{
+		g_log_warning.log("Renderer") << "Error loading texture " << getPath().c_str();
+		return false;
+	}
+	if (m_is_streamable) static_cast<TextureManager&>(m_resource_manager).addStreamed(*this);
+	return true;
+}
+
+
 void Texture::unload(void)
 {
 	if (bgfx::isValid(handle))
@@ -564,6 +846,23 @@ void Texture::unload(void)
 		handle = BGFX_INVALID_HANDLE;
 	}
 	data.clear();
+	m_staging.clear();
+	m_staging_format = StagingFormat::NONE;
+
+	if (m_stream_async != FS::FileSystem::INVALID_ASYNC)
+	{
+		m_resource_manager.getOwner().getFileSystem().cancelAsync(m_stream_async);
+		m_stream_async = FS::FileSystem::INVALID_ASYNC;
+	}
+	if (m_is_streamable) static_cast<TextureManager&>(m_resource_manager).removeStreamed(*this);
+	m_is_streamable = false;
+	m_stream_header.clear();
+	m_mip_offsets.clear();
+	m_was_requested = false;
+	m_mip_skip = 0;
+	m_storage_size = 0;
+	m_requested_size = 0;
+	m_last_request_frame = 0;
 }
 
 
@@ -10,11 +10,14 @@ namespace Lumix
 namespace FS
 {
 	class FileSystem;
+	class IFile;
 }
 
 
 class LUMIX_RENDERER_API Texture LUMIX_FINAL : public Resource
 {
+	friend class TextureManager;
+
 	public:
 		Texture(const Path& path, ResourceManagerBase& resource_manager, IAllocator& allocator);
 		~Texture();
@@ -32,6 +35,11 @@ class LUMIX_RENDERER_API Texture LUMIX_FINAL : public Resource
 		void setFlag(u32 flag, bool value);
 		u32 getPixelNearest(int x, int y) const;
 		u32 getPixel(float x, float y) const;
+		// main thread only, pixels = on-screen size of the object using the texture
+		void requestSize(int pixels);
+		bool isStreamable() const { return m_is_streamable; }
+		int getResidentMipSkip() const { return m_mip_skip; }
+		int getMipCount() const { return m_full_mips; }
 
 		static unsigned int compareTGA(IAllocator& allocator, FS::IFile* file1, FS::IFile* file2, int difference);
 
@@ -50,8 +58,40 @@ class LUMIX_RENDERER_API Texture LUMIX_FINAL : public Resource
 		Array<u8> data;
 
 	private:
+		enum class StagingFormat : u8
+		{
+			NONE,
+			RGBA8,
+			R32F,
+			CONTAINER // dds or ktx, parsed by bgfx
+		};
+
 		void unload(void) override;
-		bool load(FS::IFile& file) override;
+		bool hasDecodePhase() const override { return true; }
+		bool decode(FS::IFile& file) override;
+		bool finalize() override;
+		void stream(int skip);
+		void onStreamLoaded(FS::IFile& file, bool success);
+
+	private:
+		Array<u8> m_staging;
+		StagingFormat m_staging_format;
+
+		bool m_is_streamable;
+		bool m_was_requested;
+		int m_full_size;
+		int m_full_mips;
+		int m_mip_skip;
+		int m_stream_skip;
+		u32 m_stream_async;
+		// header of the file, patched to describe only the streamed mips
+		Array<u8> m_stream_header;
+		// file offset of each mip and of the end of the last mip
+		Array<u32> m_mip_offsets;
+		u32 m_storage_size;
+		int m_requested_size;
+		int m_last_requested_size;
+		u32 m_last_request_frame;
 };
 
 
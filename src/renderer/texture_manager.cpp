@@ -1,6 +1,9 @@
 #include "engine/lumix.h"
 #include "renderer/texture_manager.h"
 
+#include "engine/fs/file_system.h"
+#include "engine/math_utils.h"
+#include "engine/profiler.h"
 #include "engine/resource.h"
 #include "renderer/texture.h"
 
@@ -9,9 +12,14 @@ namespace Lumix
 	TextureManager::TextureManager(IAllocator& allocator)
 		: ResourceManagerBase(allocator)
 		, m_allocator(allocator)
+		, m_streaming_budget(512 * 1024 * 1024)
+		, m_frame(0)
+		, m_mip_bias(0)
+		, m_streamed(allocator)
 	{
 		m_buffer = nullptr;
 		m_buffer_size = -1;
+		setMemory(&m_streaming_stats, 0, sizeof(m_streaming_stats));
 	}
 
 
@@ -31,6 +39,18 @@ namespace Lumix
 		LUMIX_DELETE(m_allocator, static_cast<Texture*>(&resource));
 	}
 
+	void TextureManager::addStreamed(Texture& texture)
+	{
+		m_streamed.push(&texture);
+	}
+
+
+	void TextureManager::removeStreamed(Texture& texture)
+	{
+		m_streamed.eraseItemFast(&texture);
+	}
+
+
 	u8* TextureManager::getBuffer(i32 size)
 	{
 		if (m_buffer_size < size)
@@ -46,4 +66,123 @@ namespace Lumix
 		}
 		return m_buffer;
 	}
-}
\ No newline at end of file
+
+
+	int TextureManager::getInitialMipSkip(const Texture& texture) const
+	{
+		int skip = 0;
+		while (skip < texture.m_full_mips - 1 && (texture.m_full_size >> skip) > STREAMING_INITIAL_SIZE)
+		{
+			++skip;
+		}
+		return skip;
+	}
+
+
+	int TextureManager::getTargetMipSkip(const Texture& texture, int bias) const
+	{
+		if (!isStreamingEnabled()) return 0;
+		// textures nobody asked for, e.g. UI or terrain, are kept in full resolution
+		if (!texture.m_was_requested)
+		{
+			bool is_new = m_frame - texture.m_last_request_frame <= STREAMING_REQUEST_DELAY;
+			return is_new ? texture.m_mip_skip : 0;
+		}
+		if (m_frame - texture.m_last_request_frame > STREAMING_GRACE_FRAMES) return getInitialMipSkip(texture);
+
+		int skip = 0;
+		while (skip < texture.m_full_mips - 1 && (texture.m_full_size >> (skip + 1)) >= texture.m_last_requested_size)
+		{
+			++skip;
+		}
+		return Math::minimum(skip + bias, texture.m_full_mips - 1);
+	}
+
+
+	u64 TextureManager::getPredictedSize(int bias) const
+	{
+		u64 size = 0;
+		for (const Texture* texture : m_streamed)
+		{
+			int skip = getTargetMipSkip(*texture, bias);
+			int diff = 2 * (texture->m_mip_skip - skip);
+			u64 resident = texture->m_storage_size;
+			size += diff > 0 ? resident << diff : resident >> -diff;
+		}
+		return size;
+	}
+
+
+	void TextureManager::update()
+	{
+		PROFILE_FUNCTION();
+		ResourceManagerBase::update();
+
+		++m_frame;
+		for (Texture* texture : m_streamed)
+		{
+			// until the first request it's the frame the texture was loaded in
+			if (texture->m_last_request_frame == 0) texture->m_last_request_frame = m_frame;
+			int requested_size = texture->m_requested_size;
+			texture->m_requested_size = 0;
+			if (requested_size > 0)
+			{
+				texture->m_was_requested = true;
+				texture->m_last_requested_size = requested_size;
+				texture->m_last_request_frame = m_frame;
+			}
+		}
+
+		static const int MAX_MIP_BIAS = 15;
+		if (isStreamingEnabled())
+		{
+			while (m_mip_bias < MAX_MIP_BIAS && getPredictedSize(m_mip_bias) > m_streaming_budget) ++m_mip_bias;
+			while (m_mip_bias > 0 && getPredictedSize(m_mip_bias - 1) <= m_streaming_budget) --m_mip_bias;
+		}
+		else
+		{
+			m_mip_bias = 0;
+		}
+
+		StreamingStats stats;
+		setMemory(&stats, 0, sizeof(stats));
+		for (const Texture* texture : m_streamed)
+		{
+			if (texture->m_stream_async != FS::FileSystem::INVALID_ASYNC) ++stats.pending;
+		}
+
+		// dropping mips first frees memory for the textures which need more
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			for (Texture* texture : m_streamed)
+			{
+				if (stats.pending >= MAX_PENDING_STREAMS) break;
+				if (texture->m_stream_async != FS::FileSystem::INVALID_ASYNC) continue;
+
+				int skip = getTargetMipSkip(*texture, m_mip_bias);
+				bool is_drop = skip > texture->m_mip_skip;
+				if (skip == texture->m_mip_skip || is_drop != (pass == 0)) continue;
+
+				texture->stream(skip);
+				++stats.pending;
+			}
+		}
+
+		for (const Texture* texture : m_streamed)
+		{
+			stats.resident_bytes += texture->m_storage_size;
+			stats.requested_mips += texture->m_full_mips - getTargetMipSkip(*texture, m_mip_bias);
+			stats.resident_mips += texture->m_full_mips - texture->m_mip_skip;
+		}
+		stats.textures = m_streamed.size();
+		stats.budget = m_streaming_budget;
+		stats.mip_bias = m_mip_bias;
+		m_streaming_stats = stats;
+
+		PROFILE_INT("streamed textures", stats.textures);
+		PROFILE_INT("streamed textures KB", int(stats.resident_bytes / 1024));
+		PROFILE_INT("requested mips", stats.requested_mips);
+		PROFILE_INT("resident mips", stats.resident_mips);
+		PROFILE_INT("texture mip bias", m_mip_bias);
+	}
+}
@@ -1,24 +1,67 @@
 #pragma once
 
+#include "engine/array.h"
 #include "engine/resource_manager_base.h"
 
 namespace Lumix
 {
+	class Texture;
+
 	class LUMIX_RENDERER_API TextureManager LUMIX_FINAL : public ResourceManagerBase
 	{
+	public:
+		struct StreamingStats
+		{
+			u64 resident_bytes;
+			u64 budget;
+			u32 textures;
+			u32 requested_mips;
+			u32 resident_mips;
+			u32 pending;
+			int mip_bias;
+		};
+
+		static const int STREAMING_INITIAL_SIZE = 64;
+		static const u32 STREAMING_GRACE_FRAMES = 120;
+		static const u32 STREAMING_REQUEST_DELAY = 10;
+		static const int MAX_PENDING_STREAMS = 4;
+
 	public:
 		explicit TextureManager(IAllocator& allocator);
 		~TextureManager();
 
 		u8* getBuffer(i32 size);
+		void update() override;
+
+		// 0 = streaming disabled, textures are loaded with all mips
+		void setStreamingBudget(u64 budget) { m_streaming_budget = budget; }
+		u64 getStreamingBudget() const { return m_streaming_budget; }
+		bool isStreamingEnabled() const { return m_streaming_budget > 0; }
+		int getInitialMipSkip(const Texture& texture) const;
+		const StreamingStats& getStreamingStats() const { return m_streaming_stats; }
 
 	protected:
 		Resource* createResource(const Path& path) override;
 		void destroyResource(Resource& resource) override;
 
+	private:
+		friend class Texture;
+
+		// called by textures when they become ready for streaming and when they are unloaded
+		void addStreamed(Texture& texture);
+		void removeStreamed(Texture& texture);
+		int getTargetMipSkip(const Texture& texture, int bias) const;
+		u64 getPredictedSize(int bias) const;
+
 	private:
 		IAllocator& m_allocator;
 		u8* m_buffer;
 		i32 m_buffer_size;
+		u64 m_streaming_budget;
+		u32 m_frame;
+		int m_mip_bias;
+		// ready streamable textures, so update does not have to scan all textures
+		Array<Texture*> m_streamed;
+		StreamingStats m_streaming_stats;
 	};
-}
\ No newline at end of file
+}
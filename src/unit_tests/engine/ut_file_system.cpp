@@ -3,7 +3,11 @@
 #include "engine/fs/file_system.h"
 #include "engine/fs/disk_file_device.h"
 #include "engine/fs/file_events_device.h"
+#include "engine/fs/memory_file_device.h"
+#include "engine/mt/thread.h"
 #include "engine/path.h"
+#include "engine/string.h"
+#include <cstdio>
 
 namespace
 {
@@ -129,6 +133,144 @@ void UT_file_events_device(const char* params)
 };
 
 
+struct AsyncReadCounter
+{
+	void onRead(Lumix::FS::IFile& file, bool success)
+	{
+		// only canceled reads fail here and their file must not be accessed
+		if (!success)
+		{
+			++canceled;
+			return;
+		}
+		LUMIX_EXPECT(file.size() >= size_t(4));
+		++count;
+	}
+
+	int count = 0;
+	int canceled = 0;
+};
+
+
+struct AsyncRangeReader
+{
+	void onRead(Lumix::FS::IFile& file, bool success)
+	{
+		is_success = success;
+		size = file.size();
+		if (success && size <= sizeof(data)) Lumix::copyMemory(data, file.getBuffer(), size);
+	}
+
+	bool is_success = false;
+	size_t size = 0;
+	Lumix::u8 data[8];
+};
+
+
+void UT_file_system_async(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	Lumix::PathManager path_manager(allocator);
+	Lumix::FS::FileSystem* file_system = Lumix::FS::FileSystem::create(allocator);
+	Lumix::FS::DiskFileDevice disk_file_device("disk", "", allocator);
+	Lumix::FS::MemoryFileDevice memory_file_device(allocator);
+	file_system->mount(&disk_file_device);
+	file_system->mount(&memory_file_device);
+
+	Lumix::FS::DeviceList device_list;
+	file_system->fillDeviceList("memory:disk", device_list);
+
+	AsyncReadCounter counter;
+	Lumix::FS::ReadCallback cb;
+	cb.bind<AsyncReadCounter, &AsyncReadCounter::onRead>(&counter);
+
+	Lumix::Path path("unit_tests/file_system/selenitic.xml");
+	const int COUNT = 16;
+	Lumix::u32 ids[COUNT];
+	for (int i = 0; i < COUNT; ++i)
+	{
+		auto priority = i % 2 ? Lumix::FS::FileSystem::Priority::LOW : Lumix::FS::FileSystem::Priority::HIGH;
+		ids[i] = file_system->openAsync(device_list, path, Lumix::FS::Mode::OPEN_AND_READ, cb, priority);
+		LUMIX_EXPECT(ids[i] != Lumix::FS::FileSystem::INVALID_ASYNC);
+	}
+	file_system->cancelAsync(ids[COUNT - 1]);
+	LUMIX_EXPECT(counter.canceled == 1);
+	file_system->cancelAsync(ids[COUNT - 1]);
+	LUMIX_EXPECT(counter.canceled == 1);
+	file_system->setAsyncPriority(ids[COUNT - 3], Lumix::FS::FileSystem::Priority::HIGH);
+
+	while (file_system->hasWork())
+	{
+		Lumix::MT::sleep(1);
+		file_system->updateAsyncTransactions();
+	}
+
+	auto stats = file_system->getStats();
+	LUMIX_EXPECT(counter.count == COUNT - 1);
+	LUMIX_EXPECT(counter.canceled == 1);
+	LUMIX_EXPECT(stats.canceled == 1);
+	LUMIX_EXPECT(stats.failed == 0);
+	LUMIX_EXPECT(stats.completed + stats.canceled >= (Lumix::u32)COUNT - 1);
+	LUMIX_EXPECT(stats.bytes_read >= 4 * (Lumix::u64)(COUNT - 1));
+	LUMIX_EXPECT(stats.in_flight == 0);
+
+	// the memory device is skipped, only the range is read
+	Lumix::u8 expected[8];
+	Lumix::FS::IFile* file = file_system->open(device_list, path, Lumix::FS::Mode::OPEN_AND_READ);
+	LUMIX_EXPECT(file != nullptr);
+	LUMIX_EXPECT(file->seek(Lumix::FS::SeekMode::BEGIN, 3));
+	LUMIX_EXPECT(file->read(expected, sizeof(expected)));
+	file_system->close(*file);
+
+	AsyncRangeReader range_reader;
+	Lumix::FS::ReadCallback range_cb;
+	range_cb.bind<AsyncRangeReader, &AsyncRangeReader::onRead>(&range_reader);
+	Lumix::u32 id = file_system->readAsync(device_list, path, 3, sizeof(expected), range_cb);
+	LUMIX_EXPECT(id != Lumix::FS::FileSystem::INVALID_ASYNC);
+	while (file_system->hasWork())
+	{
+		Lumix::MT::sleep(1);
+		file_system->updateAsyncTransactions();
+	}
+	LUMIX_EXPECT(range_reader.is_success);
+	LUMIX_EXPECT(range_reader.size == sizeof(expected));
+	LUMIX_EXPECT(Lumix::compareMemory(range_reader.data, expected, sizeof(expected)) == 0);
+
+	// big enough to be read in many chunks, so it's canceled either in the queue or while it's read
+	Lumix::Path big_path("unit_tests/file_system/big.bin");
+	Lumix::FS::IFile* big_file = file_system->open(device_list, big_path, Lumix::FS::Mode::CREATE_AND_WRITE);
+	LUMIX_EXPECT(big_file != nullptr);
+	if (big_file)
+	{
+		Lumix::u8 chunk[64 * 1024] = {};
+		for (int i = 0; i < 16; ++i) big_file->write(chunk, sizeof(chunk));
+		file_system->close(*big_file);
+
+		AsyncReadCounter big_counter;
+		Lumix::FS::ReadCallback big_cb;
+		big_cb.bind<AsyncReadCounter, &AsyncReadCounter::onRead>(&big_counter);
+		Lumix::u32 big_id = file_system->openAsync(device_list, big_path, Lumix::FS::Mode::OPEN_AND_READ, big_cb);
+		LUMIX_EXPECT(big_id != Lumix::FS::FileSystem::INVALID_ASYNC);
+		Lumix::MT::sleep(1);
+		file_system->cancelAsync(big_id);
+		LUMIX_EXPECT(big_counter.canceled == 1);
+		while (file_system->hasWork())
+		{
+			Lumix::MT::sleep(1);
+			file_system->updateAsyncTransactions();
+		}
+		LUMIX_EXPECT(big_counter.canceled == 1);
+		LUMIX_EXPECT(big_counter.count == 0);
+		LUMIX_EXPECT(file_system->getStats().canceled == 2);
+		LUMIX_EXPECT(file_system->getStats().in_flight == 0);
+		remove(big_path.c_str());
+	}
+
+	Lumix::FS::FileSystem::destroy(file_system);
+}
+
+
 } // anonymous namespace
 
 REGISTER_TEST("unit_tests/engine/file_system/file_events_device", UT_file_events_device, "")
+REGISTER_TEST("unit_tests/engine/file_system/async", UT_file_system_async, "")
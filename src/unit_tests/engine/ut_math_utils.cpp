@@ -1,5 +1,6 @@
 #include "unit_tests/suite/lumix_unit_tests.h"
 #include "engine/math_utils.h"
+#include "engine/vec.h"
 
 
 void UT_math_utils_abs_signum(const char* params)
@@ -151,9 +152,34 @@ void UT_math_utils_min_max(const char* params)
 }
 
 
+void UT_math_utils_ray_sort_key(const char* params)
+{
+	using Lumix::Vec3;
+	using Lumix::Math::getRaySortKey;
+
+	Lumix::u64 key = getRaySortKey(Vec3(1, 1, 1), Vec3(1, 1, 1));
+	// the same cell and octant
+	LUMIX_EXPECT(getRaySortKey(Vec3(7, 0.5f, 3), Vec3(0.1f, 2, 0)) == key);
+	LUMIX_EXPECT(getRaySortKey(Vec3(1, 1, 1), Vec3(-1, 1, 1)) != key);
+	LUMIX_EXPECT(getRaySortKey(Vec3(9, 1, 1), Vec3(1, 1, 1)) != key);
+
+	// the octant is the most significant part, rays in the same octant are sorted by their origin's cell
+	Lumix::u64 negative_x = getRaySortKey(Vec3(1, 1, 1), Vec3(-1, 1, 1));
+	for (float x = -100; x < 100; x += 3)
+	{
+		LUMIX_EXPECT(getRaySortKey(Vec3(x, x, x), Vec3(1, 1, 1)) < negative_x);
+	}
+	// neighbouring cells share the high bits of the Morton code
+	Lumix::u64 near_key = getRaySortKey(Vec3(9, 1, 1), Vec3(1, 1, 1));
+	Lumix::u64 far_key = getRaySortKey(Vec3(1000, 1, 1), Vec3(1, 1, 1));
+	LUMIX_EXPECT((near_key ^ key) < (far_key ^ key));
+}
+
+
 REGISTER_TEST("unit_tests/engine/math_utils/abs_signum", UT_math_utils_abs_signum, "")
 REGISTER_TEST("unit_tests/engine/math_utils/clamp", UT_math_utils_clamp, "")
 REGISTER_TEST("unit_tests/engine/math_utils/math_utils_degrees_to_radians", UT_math_utils_degrees_to_radians, "")
 REGISTER_TEST("unit_tests/engine/math_utils/math_utils_ease_in_out", UT_math_utils_ease_in_out, "")
 REGISTER_TEST("unit_tests/engine/math_utils/is_pow_of_two", UT_math_utils_is_pow_of_two, "")
 REGISTER_TEST("unit_tests/engine/math_utils/min_max", UT_math_utils_min_max, "")
+REGISTER_TEST("unit_tests/engine/math_utils/ray_sort_key", UT_math_utils_ray_sort_key, "")
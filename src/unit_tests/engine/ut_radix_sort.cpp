@@ -0,0 +1,82 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "engine/array.h"
+#include "engine/radix_sort.h"
+#include "engine/mtjd/manager.h"
+
+namespace
+{
+
+
+Lumix::u64 random64(Lumix::u64& state)
+{
+	state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return state;
+}
+
+
+void sortAndCheck(int size, Lumix::u64 mask, Lumix::MTJD::Manager* mtjd_manager, Lumix::IAllocator& allocator)
+{
+	Lumix::Array<Lumix::u64> keys(allocator);
+	Lumix::Array<Lumix::u64> original_keys(allocator);
+	Lumix::Array<Lumix::u32> values(allocator);
+	Lumix::Array<Lumix::u64> tmp_keys(allocator);
+	Lumix::Array<Lumix::u32> tmp_values(allocator);
+	keys.resize(size);
+	values.resize(size);
+	tmp_keys.resize(size);
+	tmp_values.resize(size);
+	Lumix::u64 state = 42;
+	for (int i = 0; i < size; ++i)
+	{
+		keys[i] = random64(state) & mask;
+		values[i] = (Lumix::u32)i;
+	}
+	original_keys.resize(size);
+	for (int i = 0; i < size; ++i) original_keys[i] = keys[i];
+
+	if (mtjd_manager)
+	{
+		Lumix::radixSort(&keys[0], &values[0], &tmp_keys[0], &tmp_values[0], size, *mtjd_manager, allocator);
+	}
+	else
+	{
+		Lumix::radixSort(&keys[0], &values[0], &tmp_keys[0], &tmp_values[0], size);
+	}
+
+	bool is_sorted = true;
+	bool is_stable = true;
+	bool are_values_moved = true;
+	for (int i = 0; i < size; ++i)
+	{
+		if (original_keys[values[i]] != keys[i]) are_values_moved = false;
+		if (i == 0) continue;
+		if (keys[i - 1] > keys[i]) is_sorted = false;
+		if (keys[i - 1] == keys[i] && values[i - 1] > values[i]) is_stable = false;
+	}
+	LUMIX_EXPECT(is_sorted);
+	LUMIX_EXPECT(is_stable);
+	LUMIX_EXPECT(are_values_moved);
+}
+
+
+void UT_radix_sort(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	sortAndCheck(1, ~0ULL, nullptr, allocator);
+	sortAndCheck(1000, ~0ULL, nullptr, allocator);
+	// only a few digits differ, the rest of passes are skipped
+	sortAndCheck(1000, 0xff00000000000f00ULL, nullptr, allocator);
+	sortAndCheck(1000, 0, nullptr, allocator);
+
+	Lumix::MTJD::Manager* mtjd_manager = Lumix::MTJD::Manager::create(allocator);
+	sortAndCheck(1000, ~0ULL, mtjd_manager, allocator);
+	sortAndCheck(200000, ~0ULL, mtjd_manager, allocator);
+	sortAndCheck(200000, 0x0000ffff000000ffULL, mtjd_manager, allocator);
+	Lumix::MTJD::Manager::destroy(*mtjd_manager);
+}
+
+
+} // anonymous namespace
+
+REGISTER_TEST("unit_tests/engine/radix_sort", UT_radix_sort, "")
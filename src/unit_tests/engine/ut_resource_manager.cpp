@@ -0,0 +1,211 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "engine/fs/disk_file_device.h"
+#include "engine/fs/file_system.h"
+#include "engine/fs/os_file.h"
+#include "engine/mt/thread.h"
+#include "engine/mtjd/manager.h"
+#include "engine/path.h"
+#include "engine/resource.h"
+#include "engine/resource_manager.h"
+#include "engine/resource_manager_base.h"
+#include <cstdio>
+
+namespace
+{
+
+
+const Lumix::ResourceType TEST_TYPE("test");
+
+
+class TestResource LUMIX_FINAL : public Lumix::Resource
+{
+public:
+	TestResource(const Lumix::Path& path, Lumix::ResourceManagerBase& manager, Lumix::IAllocator& allocator)
+		: Resource(path, manager, allocator)
+	{
+	}
+
+	void unload() override {}
+
+	bool load(Lumix::FS::IFile& file) override
+	{
+		m_size = file.size();
+		return true;
+	}
+};
+
+
+class TestManager LUMIX_FINAL : public Lumix::ResourceManagerBase
+{
+public:
+	explicit TestManager(Lumix::IAllocator& allocator)
+		: ResourceManagerBase(allocator)
+		, m_allocator(allocator)
+	{
+	}
+
+protected:
+	Lumix::Resource* createResource(const Lumix::Path& path) override
+	{
+		return LUMIX_NEW(m_allocator, TestResource)(path, *this, m_allocator);
+	}
+
+	void destroyResource(Lumix::Resource& resource) override
+	{
+		LUMIX_DELETE(m_allocator, static_cast<TestResource*>(&resource));
+	}
+
+private:
+	Lumix::IAllocator& m_allocator;
+};
+
+
+void waitForResources(Lumix::FS::FileSystem& file_system, Lumix::ResourceManager& resource_manager)
+{
+	while (file_system.hasWork() || resource_manager.hasWork())
+	{
+		Lumix::MT::sleep(1);
+		file_system.updateAsyncTransactions();
+		resource_manager.update();
+	}
+}
+
+
+void UT_resource_manager_budget(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	Lumix::PathManager path_manager(allocator);
+	Lumix::FS::FileSystem* file_system = Lumix::FS::FileSystem::create(allocator);
+	Lumix::FS::DiskFileDevice disk_file_device("disk", "", allocator);
+	file_system->mount(&disk_file_device);
+	file_system->setDefaultDevice("disk");
+	Lumix::MTJD::Manager* mtjd_manager = Lumix::MTJD::Manager::create(allocator);
+
+	Lumix::ResourceManager resource_manager(allocator);
+	resource_manager.create(*file_system, *mtjd_manager);
+	TestManager manager(allocator);
+	manager.create(TEST_TYPE, resource_manager);
+
+	Lumix::Resource* a = manager.load(Lumix::Path("unit_tests/texture/1.tga"));
+	Lumix::Resource* b = manager.load(Lumix::Path("unit_tests/texture/2.tga"));
+	waitForResources(*file_system, resource_manager);
+	LUMIX_EXPECT(a->isReady());
+	LUMIX_EXPECT(b->isReady());
+	LUMIX_EXPECT(a->size() > 0);
+	LUMIX_EXPECT(manager.getStats().resident_bytes == a->size() + b->size());
+
+	manager.setBudget(a->size() + b->size());
+	manager.unload(*a);
+	manager.unload(*b);
+	resource_manager.update();
+	auto stats = manager.getStats();
+	LUMIX_EXPECT(a->isReady());
+	LUMIX_EXPECT(b->isReady());
+	LUMIX_EXPECT(stats.cached_count == 2);
+	LUMIX_EXPECT(stats.evictions == 0);
+
+	// hit, `a` becomes the most recently used
+	LUMIX_EXPECT(manager.load(Lumix::Path("unit_tests/texture/1.tga")) == a);
+	manager.unload(*a);
+
+	Lumix::Resource* c = manager.load(Lumix::Path("unit_tests/texture/3.tga"));
+	waitForResources(*file_system, resource_manager);
+	manager.unload(*c);
+	resource_manager.update();
+
+	stats = manager.getStats();
+	LUMIX_EXPECT(b->isEmpty());
+	LUMIX_EXPECT(a->isReady());
+	LUMIX_EXPECT(c->isReady());
+	LUMIX_EXPECT(stats.hits == 1);
+	LUMIX_EXPECT(stats.misses == 3);
+	LUMIX_EXPECT(stats.evictions == 1);
+	LUMIX_EXPECT(stats.cached_count == 2);
+	LUMIX_EXPECT(stats.resident_bytes <= stats.budget);
+	LUMIX_EXPECT(stats.resident_bytes == a->size() + c->size());
+
+	manager.setBudget(0);
+	LUMIX_EXPECT(a->isEmpty());
+	LUMIX_EXPECT(c->isEmpty());
+	LUMIX_EXPECT(manager.getStats().cached_count == 0);
+	LUMIX_EXPECT(manager.getStats().resident_bytes == 0);
+
+	manager.destroy();
+	resource_manager.destroy();
+	Lumix::MTJD::Manager::destroy(*mtjd_manager);
+	Lumix::FS::FileSystem::destroy(file_system);
+}
+
+
+void UT_resource_manager_prefetch(const char* params)
+{
+	Lumix::DefaultAllocator allocator;
+	Lumix::PathManager path_manager(allocator);
+	Lumix::FS::FileSystem* file_system = Lumix::FS::FileSystem::create(allocator);
+	Lumix::FS::DiskFileDevice disk_file_device("disk", "", allocator);
+	file_system->mount(&disk_file_device);
+	file_system->setDefaultDevice("disk");
+	Lumix::MTJD::Manager* mtjd_manager = Lumix::MTJD::Manager::create(allocator);
+
+	Lumix::ResourceManager resource_manager(allocator);
+	resource_manager.create(*file_system, *mtjd_manager);
+	TestManager manager(allocator);
+	manager.create(TEST_TYPE, resource_manager);
+
+	const char* manifest_file = "ut_resource_manager.prefetch";
+	remove(manifest_file);
+	Lumix::Path manifest_path(manifest_file);
+
+	// nothing is written unless recording is enabled
+	resource_manager.beginPrefetch(manifest_path);
+	Lumix::Resource* a = manager.load(Lumix::Path("unit_tests/texture/1.tga"));
+	waitForResources(*file_system, resource_manager);
+	resource_manager.update();
+	LUMIX_EXPECT(!resource_manager.isPrefetching());
+	LUMIX_EXPECT(!Lumix::FS::OsFile::fileExists(manifest_file));
+	manager.unload(*a);
+	manager.removeUnreferenced();
+
+	// first load records the manifest
+	resource_manager.enablePrefetchRecording(true);
+	resource_manager.beginPrefetch(manifest_path);
+	a = manager.load(Lumix::Path("unit_tests/texture/1.tga"));
+	Lumix::Resource* b = manager.load(Lumix::Path("unit_tests/texture/2.tga"));
+	waitForResources(*file_system, resource_manager);
+	resource_manager.update();
+	LUMIX_EXPECT(!resource_manager.isPrefetching());
+	LUMIX_EXPECT(Lumix::FS::OsFile::fileExists(manifest_file));
+	manager.unload(*a);
+	manager.unload(*b);
+	manager.removeUnreferenced();
+	LUMIX_EXPECT(manager.getResourceTable().empty());
+
+	// second load requests everything from the manifest up front
+	resource_manager.beginPrefetch(manifest_path);
+	LUMIX_EXPECT(resource_manager.isPrefetching());
+	LUMIX_EXPECT(manager.getResourceTable().size() == 2);
+	a = manager.load(Lumix::Path("unit_tests/texture/1.tga"));
+	b = manager.load(Lumix::Path("unit_tests/texture/2.tga"));
+	waitForResources(*file_system, resource_manager);
+	resource_manager.update();
+	LUMIX_EXPECT(!resource_manager.isPrefetching());
+	LUMIX_EXPECT(a->isReady());
+	LUMIX_EXPECT(b->isReady());
+	manager.unload(*a);
+	manager.unload(*b);
+	manager.removeUnreferenced();
+	LUMIX_EXPECT(manager.getResourceTable().empty());
+
+	manager.destroy();
+	resource_manager.destroy();
+	Lumix::MTJD::Manager::destroy(*mtjd_manager);
+	Lumix::FS::FileSystem::destroy(file_system);
+	remove(manifest_file);
+}
+
+
+} // anonymous namespace
+
+REGISTER_TEST("unit_tests/engine/resource_manager/budget", UT_resource_manager_budget, "")
+REGISTER_TEST("unit_tests/engine/resource_manager/prefetch", UT_resource_manager_prefetch, "")
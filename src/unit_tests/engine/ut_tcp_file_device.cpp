@@ -0,0 +1,161 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "engine/blob.h"
+#include "engine/crc32.h"
+#include "engine/fs/disk_file_device.h"
+#include "engine/fs/file_system.h"
+#include "engine/fs/os_file.h"
+#include "engine/fs/tcp_file_device.h"
+#include "engine/fs/tcp_file_server.h"
+#include "engine/log.h"
+#include "engine/mt/thread.h"
+#include "engine/path.h"
+#include "engine/string.h"
+#include "engine/timer.h"
+
+namespace
+{
+
+
+const char* const PROJECT_FILES[] = {
+	"unit_tests/file_system/selenitic.xml",
+	"unit_tests/texture/1.tga",
+	"unit_tests/texture/2.tga",
+	"unit_tests/texture/3.tga",
+	"unit_tests/texture/4.tga",
+	"unit_tests/texture/5.tga",
+	"unit_tests/texture/6.tga",
+	"unit_tests/texture/7.tga",
+	"unit_tests/texture/8.tga",
+};
+
+
+struct ProjectLoader
+{
+	void onRead(Lumix::FS::IFile& file, bool success)
+	{
+		LUMIX_EXPECT(success);
+		if (!success) return;
+
+		Lumix::OutputBlob blob(allocator);
+		file.getContents(blob);
+		// files complete in any order, so the checksum is a sum, xor would cancel out over even rounds
+		checksum += Lumix::crc32(blob.getData(), blob.getPos());
+		bytes += file.size();
+		++count;
+	}
+
+
+	float load(Lumix::FS::FileSystem& file_system, const char* device, int rounds)
+	{
+		Lumix::FS::DeviceList device_list;
+		file_system.fillDeviceList(device, device_list);
+		Lumix::FS::ReadCallback cb;
+		cb.bind<ProjectLoader, &ProjectLoader::onRead>(this);
+
+		Lumix::Timer* timer = Lumix::Timer::create(allocator);
+		for (int round = 0; round < rounds; ++round)
+		{
+			for (const char* path : PROJECT_FILES)
+			{
+				file_system.openAsync(device_list, Lumix::Path(path), Lumix::FS::Mode::OPEN_AND_READ, cb);
+			}
+		}
+		while (file_system.hasWork())
+		{
+			Lumix::MT::sleep(0);
+			file_system.updateAsyncTransactions();
+		}
+		float time = timer->getTimeSinceStart();
+		Lumix::Timer::destroy(timer);
+		return time;
+	}
+
+
+	Lumix::DefaultAllocator allocator;
+	Lumix::u64 checksum = 0;
+	size_t bytes = 0;
+	int count = 0;
+};
+
+
+void UT_tcp_file_device(const char* params)
+{
+	bool are_files_present = true;
+	for (const char* path : PROJECT_FILES)
+	{
+		bool exists = Lumix::FS::OsFile::fileExists(path);
+		LUMIX_EXPECT(exists);
+		are_files_present = are_files_present && exists;
+	}
+	if (!are_files_present) return;
+
+	Lumix::DefaultAllocator allocator;
+	Lumix::PathManager path_manager(allocator);
+
+	Lumix::FS::TCPFileServer server;
+	bool is_started = server.start("", allocator);
+	LUMIX_EXPECT(is_started);
+	if (!is_started) return;
+	Lumix::FS::TCPFileDevice tcp_file_device;
+	bool is_connected = tcp_file_device.connect("127.0.0.1", Lumix::FS::TCP_FILE_SERVER_PORT, allocator);
+	LUMIX_EXPECT(is_connected);
+	if (!is_connected)
+	{
+		server.stop();
+		return;
+	}
+
+	Lumix::FS::FileSystem* file_system = Lumix::FS::FileSystem::create(allocator);
+	Lumix::FS::DiskFileDevice disk_file_device("disk", "", allocator);
+	file_system->mount(&disk_file_device);
+	file_system->mount(&tcp_file_device);
+
+	const int ROUNDS = 8;
+	ProjectLoader disk_loader;
+	float disk_time = disk_loader.load(*file_system, "disk", ROUNDS);
+	ProjectLoader tcp_loader;
+	float tcp_time = tcp_loader.load(*file_system, "tcp", ROUNDS);
+
+	LUMIX_EXPECT(disk_loader.count == Lumix::lengthOf(PROJECT_FILES) * ROUNDS);
+	LUMIX_EXPECT(tcp_loader.count == disk_loader.count);
+	LUMIX_EXPECT(tcp_loader.bytes == disk_loader.bytes);
+	LUMIX_EXPECT(disk_loader.checksum != 0);
+	LUMIX_EXPECT(tcp_loader.checksum == disk_loader.checksum);
+	Lumix::g_log_info.log("unit") << "Loaded " << (Lumix::u32)disk_loader.bytes << " bytes, disk: "
+								  << disk_time * 1000 << " ms, tcp: " << tcp_time * 1000 << " ms";
+
+	Lumix::FS::DeviceList device_list;
+	file_system->fillDeviceList("tcp", device_list);
+	Lumix::Path path("unit_tests/file_system/selenitic2.xml");
+	Lumix::FS::IFile* file = file_system->open(device_list, path, Lumix::FS::Mode::CREATE_AND_WRITE);
+	LUMIX_EXPECT(file != nullptr);
+	const char text[] = "pipelined";
+	if (file)
+	{
+		LUMIX_EXPECT(file->write(text, sizeof(text)));
+		LUMIX_EXPECT(file->size() == sizeof(text));
+		file_system->close(*file);
+	}
+
+	file = file_system->open(device_list, path, Lumix::FS::Mode::OPEN_AND_READ);
+	LUMIX_EXPECT(file != nullptr);
+	if (file)
+	{
+		LUMIX_EXPECT(file->size() == sizeof(text));
+		char read_text[sizeof(text)];
+		LUMIX_EXPECT(file->seek(Lumix::FS::SeekMode::END, sizeof(text)));
+		LUMIX_EXPECT(file->read(read_text, sizeof(read_text)));
+		LUMIX_EXPECT(Lumix::compareString(read_text, text) == 0);
+		file_system->close(*file);
+	}
+
+	Lumix::FS::FileSystem::destroy(file_system);
+	tcp_file_device.disconnect();
+	server.stop();
+}
+
+
+} // anonymous namespace
+
+REGISTER_TEST("unit_tests/engine/file_system/tcp_file_device", UT_tcp_file_device, "")
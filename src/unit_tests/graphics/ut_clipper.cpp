@@ -1,7 +1,9 @@
 #include "unit_tests/suite/lumix_unit_tests.h"
 
 #include "engine/geometry.h"
+#include "engine/simd.h"
 #include "engine/timer.h"
+#include <cmath>
 #include "engine/log.h"
 
 #include "engine/mtjd/manager.h"
@@ -133,7 +135,284 @@ namespace
 
 		Lumix::CullingSystem::destroy(*culling_system);
 	}
+
+	float randomFloat(Lumix::u32& seed, float from, float to)
+	{
+		seed = seed * 1103515245 + 12345;
+		return from + (to - from) * ((seed >> 8) & 0xffFF) / 65535.0f;
+	}
+
+	void expectSameAsBruteForce(Lumix::CullingSystem& culling_system,
+		const Lumix::Frustum& frustum,
+		const Lumix::Array<Lumix::Sphere>& spheres,
+		const Lumix::Array<bool>& is_added,
+		Lumix::u64 layer_mask,
+		Lumix::IAllocator& allocator)
+	{
+		Lumix::Array<int> visible(allocator);
+		visible.resize(spheres.size());
+		for (int& i : visible) i = 0;
+
+		const Lumix::CullingSystem::Results& result = culling_system.getResult();
+		for (const Lumix::CullingSystem::Subresults& subresult : result)
+		{
+			for (Lumix::ComponentHandle cmp : subresult) ++visible[cmp.index];
+		}
+
+		for (int i = 0; i < spheres.size(); ++i)
+		{
+			bool expected = is_added[i] && (culling_system.getLayerMask({i}) & layer_mask) != 0 &&
+							frustum.isSphereInside(spheres[i].position, spheres[i].radius);
+			LUMIX_EXPECT(visible[i] == (expected ? 1 : 0));
+		}
+	}
+
+	void UT_culling_system_hierarchy(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::Array<Lumix::Sphere> spheres(allocator);
+		Lumix::Array<Lumix::ComponentHandle> model_instances(allocator);
+		Lumix::Array<bool> is_added(allocator);
+		Lumix::u32 seed = 0;
+		for (int i = 0; i < 20000; ++i)
+		{
+			Lumix::Vec3 pos(randomFloat(seed, -500, 500), randomFloat(seed, -20, 20), randomFloat(seed, -500, 500));
+			spheres.push(Lumix::Sphere(pos, randomFloat(seed, 0.5f, 10)));
+			model_instances.push({i});
+			is_added.push(true);
+		}
+
+		Lumix::Frustum frustum;
+		frustum.computePerspective(Lumix::Vec3(0, 0, 0),
+			Lumix::Vec3(1, 0, 1).normalized(),
+			Lumix::Vec3(0, 1, 0),
+			Lumix::Math::degreesToRadians(60),
+			16 / 9.0f,
+			0.1f,
+			300);
+
+		Lumix::MTJD::Manager* mtjd_manager = Lumix::MTJD::Manager::create(allocator);
+		Lumix::CullingSystem* culling_system = Lumix::CullingSystem::create(*mtjd_manager, allocator);
+		culling_system->insert(spheres, model_instances);
+		for (int i = 0; i < spheres.size(); i += 3) culling_system->setLayerMask({i}, 2);
+
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			culling_system->enableHierarchy(pass == 1);
+			culling_system->cullToFrustum(frustum, 1);
+			expectSameAsBruteForce(*culling_system, frustum, spheres, is_added, 1, allocator);
+			culling_system->cullToFrustumAsync(frustum, ~0ULL);
+			expectSameAsBruteForce(*culling_system, frustum, spheres, is_added, ~0ULL, allocator);
+		}
+
+		// moving and removed spheres must be handled by refitting the hierarchy
+		for (int i = 0; i < spheres.size(); i += 7)
+		{
+			spheres[i].position.x += randomFloat(seed, -100, 100);
+			spheres[i].position.z += randomFloat(seed, -100, 100);
+			culling_system->updateBoundingSphere(spheres[i], {i});
+		}
+		for (int i = 1; i < spheres.size(); i += 11)
+		{
+			culling_system->removeStatic({i});
+			is_added[i] = false;
+		}
+		culling_system->cullToFrustumAsync(frustum, ~0ULL);
+		expectSameAsBruteForce(*culling_system, frustum, spheres, is_added, ~0ULL, allocator);
+
+		// spheres added after the build are culled linearly until the next rebuild
+		for (int i = 1; i < spheres.size(); i += 2)
+		{
+			if (is_added[i]) continue;
+			culling_system->addStatic({i}, spheres[i], 1);
+			is_added[i] = true;
+		}
+		culling_system->cullToFrustum(frustum, 1);
+		expectSameAsBruteForce(*culling_system, frustum, spheres, is_added, 1, allocator);
+
+		Lumix::CullingSystem::destroy(*culling_system);
+		Lumix::MTJD::Manager::destroy(*mtjd_manager);
+	}
+
+	void UT_culling_system_cache(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::Array<Lumix::Sphere> spheres(allocator);
+		Lumix::Array<Lumix::ComponentHandle> model_instances(allocator);
+		Lumix::Array<bool> is_added(allocator);
+		Lumix::u32 seed = 0;
+		for (int i = 0; i < 20000; ++i)
+		{
+			Lumix::Vec3 pos(randomFloat(seed, -500, 500), randomFloat(seed, -20, 20), randomFloat(seed, -500, 500));
+			spheres.push(Lumix::Sphere(pos, randomFloat(seed, 0.5f, 10)));
+			model_instances.push({i});
+			is_added.push(true);
+		}
+
+		Lumix::MTJD::Manager* mtjd_manager = Lumix::MTJD::Manager::create(allocator);
+		Lumix::CullingSystem* culling_system = Lumix::CullingSystem::create(*mtjd_manager, allocator);
+		culling_system->insert(spheres, model_instances);
+		culling_system->enableCache(true);
+
+		// a slowly turning camera and a second view which jumps around every few frames
+		for (int frame = 0; frame < 60; ++frame)
+		{
+			Lumix::Frustum frustum;
+			float angle = frame * 0.01f;
+			frustum.computePerspective(Lumix::Vec3(frame * 0.1f, 0, 0),
+				Lumix::Vec3(cosf(angle), 0, sinf(angle)),
+				Lumix::Vec3(0, 1, 0),
+				Lumix::Math::degreesToRadians(60),
+				16 / 9.0f,
+				0.1f,
+				300);
+			culling_system->cullToFrustumAsync(frustum, ~0ULL);
+			expectSameAsBruteForce(*culling_system, frustum, spheres, is_added, ~0ULL, allocator);
+
+			Lumix::Frustum cut_frustum;
+			cut_frustum.computePerspective(Lumix::Vec3(0, 0, (frame / 5) * 50.0f),
+				Lumix::Vec3(-1, 0, 0),
+				Lumix::Vec3(0, 1, 0),
+				Lumix::Math::degreesToRadians(60),
+				16 / 9.0f,
+				0.1f,
+				300);
+			culling_system->cullToFrustum(cut_frustum, 1);
+			expectSameAsBruteForce(*culling_system, cut_frustum, spheres, is_added, 1, allocator);
+
+			int moved = (frame * 131) % spheres.size();
+			spheres[moved].position.x += 20;
+			culling_system->updateBoundingSphere(spheres[moved], {moved});
+		}
+
+		Lumix::CullingSystem::destroy(*culling_system);
+		Lumix::MTJD::Manager::destroy(*mtjd_manager);
+	}
+
+	// the previous culling path, one sphere splatted across the planes at a time
+	int cullReference(const Lumix::Array<Lumix::Sphere>& spheres,
+		const Lumix::Frustum& frustum,
+		Lumix::Array<Lumix::ComponentHandle>& results)
+	{
+		Lumix::float4 px = Lumix::f4Load(frustum.xs);
+		Lumix::float4 py = Lumix::f4Load(frustum.ys);
+		Lumix::float4 pz = Lumix::f4Load(frustum.zs);
+		Lumix::float4 pd = Lumix::f4Load(frustum.ds);
+		Lumix::float4 px2 = Lumix::f4Load(&frustum.xs[4]);
+		Lumix::float4 py2 = Lumix::f4Load(&frustum.ys[4]);
+		Lumix::float4 pz2 = Lumix::f4Load(&frustum.zs[4]);
+		Lumix::float4 pd2 = Lumix::f4Load(&frustum.ds[4]);
+
+		for (int i = 0, c = spheres.size(); i < c; ++i)
+		{
+			const Lumix::Sphere& sphere = spheres[i];
+			Lumix::float4 cx = Lumix::f4Splat(sphere.position.x);
+			Lumix::float4 cy = Lumix::f4Splat(sphere.position.y);
+			Lumix::float4 cz = Lumix::f4Splat(sphere.position.z);
+			Lumix::float4 r = Lumix::f4Splat(-sphere.radius);
+
+			Lumix::float4 t = Lumix::f4Mul(cx, px);
+			t = Lumix::f4Add(t, Lumix::f4Mul(cy, py));
+			t = Lumix::f4Add(t, Lumix::f4Mul(cz, pz));
+			t = Lumix::f4Add(t, pd);
+			t = Lumix::f4Sub(t, r);
+			if (Lumix::f4MoveMask(t)) continue;
+
+			t = Lumix::f4Mul(cx, px2);
+			t = Lumix::f4Add(t, Lumix::f4Mul(cy, py2));
+			t = Lumix::f4Add(t, Lumix::f4Mul(cz, pz2));
+			t = Lumix::f4Add(t, pd2);
+			t = Lumix::f4Sub(t, r);
+			if (Lumix::f4MoveMask(t)) continue;
+
+			results.push({i});
+		}
+		return results.size();
+	}
+
+	int getResultCount(Lumix::CullingSystem& culling_system)
+	{
+		int count = 0;
+		for (const Lumix::CullingSystem::Subresults& subresult : culling_system.getResult())
+		{
+			count += subresult.size();
+		}
+		return count;
+	}
+
+	void UT_culling_system_benchmark(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::Array<Lumix::Sphere> spheres(allocator);
+		Lumix::Array<Lumix::ComponentHandle> model_instances(allocator);
+		Lumix::u32 seed = 0;
+		// small enough to stay in cache, so the test measures culling and not memory bandwidth
+		for (int i = 0; i < 16384; ++i)
+		{
+			Lumix::Vec3 pos(randomFloat(seed, -500, 500), randomFloat(seed, -20, 20), randomFloat(seed, -500, 500));
+			spheres.push(Lumix::Sphere(pos, randomFloat(seed, 0.5f, 10)));
+			model_instances.push({i});
+		}
+
+		Lumix::Frustum frustum;
+		frustum.computePerspective(Lumix::Vec3(0, 0, 0),
+			Lumix::Vec3(1, 0, 1).normalized(),
+			Lumix::Vec3(0, 1, 0),
+			Lumix::Math::degreesToRadians(60),
+			16 / 9.0f,
+			0.1f,
+			300);
+
+		Lumix::MTJD::Manager* mtjd_manager = Lumix::MTJD::Manager::create(allocator);
+		Lumix::CullingSystem* culling_system = Lumix::CullingSystem::create(*mtjd_manager, allocator);
+		culling_system->insert(spheres, model_instances);
+		culling_system->enableHierarchy(false);
+
+		const int ROUNDS = 500;
+		Lumix::Array<Lumix::ComponentHandle> reference_results(allocator);
+		reference_results.reserve(spheres.size());
+		Lumix::Timer* timer = Lumix::Timer::create(allocator);
+		int reference_count = 0;
+		for (int i = 0; i < ROUNDS; ++i)
+		{
+			reference_results.clear();
+			reference_count = cullReference(spheres, frustum, reference_results);
+		}
+		float reference_time = timer->tick();
+
+		for (int i = 0; i < ROUNDS; ++i) culling_system->cullToFrustum(frustum, 1);
+		float simd_time = timer->tick();
+		LUMIX_EXPECT(getResultCount(*culling_system) == reference_count);
+
+		culling_system->enableHierarchy(true);
+		culling_system->cullToFrustum(frustum, 1);
+		timer->tick();
+		for (int i = 0; i < ROUNDS; ++i) culling_system->cullToFrustum(frustum, 1);
+		float hierarchy_time = timer->tick();
+		LUMIX_EXPECT(getResultCount(*culling_system) == reference_count);
+
+		// static camera, every leaf is reused
+		culling_system->enableCache(true);
+		culling_system->cullToFrustum(frustum, 1);
+		timer->tick();
+		for (int i = 0; i < ROUNDS; ++i) culling_system->cullToFrustum(frustum, 1);
+		float cache_time = timer->tick();
+		LUMIX_EXPECT(getResultCount(*culling_system) == reference_count);
+
+		Lumix::g_log_info.log("unit") << "Culling " << spheres.size() << " spheres, reference: "
+									  << reference_time * 1000000 / ROUNDS << " us, SoA SIMD: "
+									  << simd_time * 1000000 / ROUNDS << " us, hierarchy: "
+									  << hierarchy_time * 1000000 / ROUNDS << " us, cache: "
+									  << cache_time * 1000000 / ROUNDS << " us";
+
+		Lumix::Timer::destroy(timer);
+		Lumix::CullingSystem::destroy(*culling_system);
+		Lumix::MTJD::Manager::destroy(*mtjd_manager);
+	}
 }
 
 REGISTER_TEST("unit_tests/graphics/culling_system", UT_culling_system, "");
 REGISTER_TEST("unit_tests/graphics/culling_system_async", UT_culling_system_async, "");
+REGISTER_TEST("unit_tests/graphics/culling_system_hierarchy", UT_culling_system_hierarchy, "");
+REGISTER_TEST("unit_tests/graphics/culling_system_cache", UT_culling_system_cache, "");
+REGISTER_TEST("unit_tests/graphics/culling_system_benchmark", UT_culling_system_benchmark, "");
@@ -0,0 +1,144 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "engine/array.h"
+#include "engine/math_utils.h"
+
+#include "renderer/height_pyramid.h"
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+	const int WIDTH = 23;
+	const int HEIGHT = 18;
+
+
+	// tests the triangles of every cell
+	bool castRayCells(const Lumix::u16* heights, const Lumix::Vec3& origin, const Lumix::Vec3& dir, const Lumix::Vec3& scale, float* t)
+	{
+		float height_scale = scale.y / 65535.0f;
+		float nearest_t = FLT_MAX;
+		for (int j = 0; j < HEIGHT - 1; ++j)
+		{
+			for (int i = 0; i < WIDTH - 1; ++i)
+			{
+				Lumix::Vec3 p0(i * scale.x, heights[i + j * WIDTH] * height_scale, j * scale.z);
+				Lumix::Vec3 p1((i + 1) * scale.x, heights[i + 1 + j * WIDTH] * height_scale, j * scale.z);
+				Lumix::Vec3 p2((i + 1) * scale.x, heights[i + 1 + (j + 1) * WIDTH] * height_scale, (j + 1) * scale.z);
+				Lumix::Vec3 p3(i * scale.x, heights[i + (j + 1) * WIDTH] * height_scale, (j + 1) * scale.z);
+				float triangle_t;
+				if (Lumix::Math::getRayTriangleIntersection(origin, dir, p0, p1, p2, &triangle_t))
+				{
+					nearest_t = Lumix::Math::minimum(nearest_t, triangle_t);
+				}
+				if (Lumix::Math::getRayTriangleIntersection(origin, dir, p0, p2, p3, &triangle_t))
+				{
+					nearest_t = Lumix::Math::minimum(nearest_t, triangle_t);
+				}
+			}
+		}
+		*t = nearest_t;
+		return nearest_t < FLT_MAX;
+	}
+
+
+	void checkRays(const Lumix::HeightPyramid& pyramid, const Lumix::u16* heights, const Lumix::Vec3& scale)
+	{
+		Lumix::Vec3 center(WIDTH * scale.x * 0.5f, scale.y * 0.5f, HEIGHT * scale.z * 0.5f);
+		int hit_count = 0;
+		for (int i = 0; i < 400; ++i)
+		{
+			// from above, grazing, from below and from outside of the heightmap
+			float yaw = i * 0.37f;
+			float pitch = -1.4f + (i % 29) * 0.1f;
+			Lumix::Vec3 dir(cosf(pitch) * cosf(yaw), sinf(pitch), cosf(pitch) * sinf(yaw));
+			Lumix::Vec3 offset(((i * 7) % 31 - 15) * scale.x, ((i * 11) % 13 - 3) * scale.y * 0.1f, ((i * 5) % 23 - 11) * scale.z);
+			Lumix::Vec3 origin = center + offset - dir * 30;
+			if (i % 10 == 0) dir.y = 0;
+			if (i % 15 == 0) dir.set(0, -1, 0);
+
+			float expected_t;
+			bool expected_hit = castRayCells(heights, origin, dir, scale, &expected_t);
+			float t = -1;
+			bool hit = pyramid.castRay(origin, dir, scale, &t);
+			LUMIX_EXPECT(hit == expected_hit);
+			if (!hit || !expected_hit) continue;
+
+			LUMIX_EXPECT_CLOSE_EQ(t, expected_t, 0.001f);
+			++hit_count;
+		}
+		LUMIX_EXPECT(hit_count > 0);
+	}
+
+
+	void UT_height_pyramid(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::Array<Lumix::u16> heights(allocator);
+		heights.resize(WIDTH * HEIGHT);
+		for (int j = 0; j < HEIGHT; ++j)
+		{
+			for (int i = 0; i < WIDTH; ++i)
+			{
+				heights[i + j * WIDTH] = Lumix::u16(20000 + 15000 * sinf(i * 0.7f) * cosf(j * 0.5f) + (i * j * 977) % 4000);
+			}
+		}
+
+		Lumix::HeightPyramid pyramid(allocator);
+		LUMIX_EXPECT(pyramid.isEmpty());
+		float t;
+		LUMIX_EXPECT(!pyramid.castRay(Lumix::Vec3(1, 10, 1), Lumix::Vec3(0, -1, 0), Lumix::Vec3(1, 1, 1), &t));
+		pyramid.build(&heights[0], WIDTH, HEIGHT);
+		LUMIX_EXPECT(!pyramid.isEmpty());
+
+		Lumix::u16 min_height, max_height;
+		pyramid.getHeightRange(&min_height, &max_height);
+		Lumix::u16 expected_min = 0xffff;
+		Lumix::u16 expected_max = 0;
+		for (Lumix::u16 h : heights)
+		{
+			expected_min = Lumix::Math::minimum(expected_min, h);
+			expected_max = Lumix::Math::maximum(expected_max, h);
+		}
+		LUMIX_EXPECT(min_height == expected_min);
+		LUMIX_EXPECT(max_height == expected_max);
+
+		Lumix::Vec3 scale(2, 10, 1.5f);
+		checkRays(pyramid, &heights[0], scale);
+
+		// a peak on the last sample and one on the first sample of a block, both shared with neighbour blocks
+		heights[WIDTH - 1 + (HEIGHT - 1) * WIDTH] = 65535;
+		pyramid.update(WIDTH - 1, HEIGHT - 1, 1, 1);
+		heights[8 + 4 * WIDTH] = 65535;
+		pyramid.update(8, 4, 1, 1);
+		// a pit in a rectangle crossing blocks
+		for (int j = 9; j < 14; ++j)
+		{
+			for (int i = 3; i < 17; ++i)
+			{
+				heights[i + j * WIDTH] = 100;
+			}
+		}
+		pyramid.update(3, 9, 14, 5);
+		pyramid.getHeightRange(&min_height, &max_height);
+		LUMIX_EXPECT(min_height == 100);
+		LUMIX_EXPECT(max_height == 65535);
+		checkRays(pyramid, &heights[0], scale);
+
+		// rays straight down at the changed samples
+		Lumix::Vec3 origin(8 * scale.x, scale.y * 2, 4 * scale.z);
+		LUMIX_EXPECT(pyramid.castRay(origin, Lumix::Vec3(0, -1, 0), scale, &t));
+		LUMIX_EXPECT_CLOSE_EQ(t, scale.y, 0.001f);
+		origin.set((WIDTH - 1) * scale.x, scale.y * 2, (HEIGHT - 1) * scale.z);
+		LUMIX_EXPECT(pyramid.castRay(origin, Lumix::Vec3(0, -1, 0), scale, &t));
+		LUMIX_EXPECT_CLOSE_EQ(t, scale.y, 0.001f);
+		origin.set(10 * scale.x, scale.y * 2, 11 * scale.z);
+		LUMIX_EXPECT(pyramid.castRay(origin, Lumix::Vec3(0, -1, 0), scale, &t));
+		LUMIX_EXPECT_CLOSE_EQ(t, scale.y * 2 - 100 * scale.y / 65535.0f, 0.001f);
+
+		pyramid.clear();
+		LUMIX_EXPECT(pyramid.isEmpty());
+	}
+}
+
+REGISTER_TEST("unit_tests/graphics/height_pyramid", UT_height_pyramid, "");
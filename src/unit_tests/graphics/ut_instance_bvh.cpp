@@ -0,0 +1,127 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "engine/geometry.h"
+#include "engine/math_utils.h"
+
+#include "renderer/instance_bvh.h"
+
+#include <cfloat>
+
+namespace
+{
+	const int SPHERE_COUNT = 1000;
+
+
+	// the nearest sphere hit by the ray, tested one by one
+	int castRayBruteForce(const Lumix::Sphere* spheres,
+		const bool* is_removed,
+		const Lumix::Vec3& origin,
+		const Lumix::Vec3& dir)
+	{
+		int nearest = -1;
+		float nearest_t = FLT_MAX;
+		for (int i = 0; i < SPHERE_COUNT; ++i)
+		{
+			if (is_removed[i]) continue;
+			Lumix::Vec3 intersection;
+			if (!Lumix::Math::getRaySphereIntersection(
+					origin, dir, spheres[i].position, spheres[i].radius, intersection))
+			{
+				continue;
+			}
+			float t = Lumix::dotProduct(intersection - origin, dir);
+			if (t < nearest_t)
+			{
+				nearest_t = t;
+				nearest = i;
+			}
+		}
+		return nearest;
+	}
+
+
+	int castRay(const Lumix::InstanceBVH& bvh,
+		const Lumix::Sphere* spheres,
+		const Lumix::Vec3& origin,
+		const Lumix::Vec3& dir,
+		int* visited)
+	{
+		int nearest = -1;
+		*visited = 0;
+		bvh.castRay(origin, dir, FLT_MAX, [&](Lumix::ComponentHandle cmp, float max_t) -> float {
+			++*visited;
+			const Lumix::Sphere& sphere = spheres[cmp.index];
+			Lumix::Vec3 intersection;
+			if (!Lumix::Math::getRaySphereIntersection(origin, dir, sphere.position, sphere.radius, intersection))
+			{
+				return max_t;
+			}
+			float t = Lumix::dotProduct(intersection - origin, dir);
+			if (t >= max_t) return max_t;
+			nearest = cmp.index;
+			return t;
+		});
+		return nearest;
+	}
+
+
+	void UT_instance_bvh(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::InstanceBVH bvh(allocator);
+		Lumix::Sphere spheres[SPHERE_COUNT];
+		bool is_removed[SPHERE_COUNT] = {};
+
+		for (int i = 0; i < SPHERE_COUNT; ++i)
+		{
+			spheres[i] = Lumix::Sphere(Lumix::Math::randFloat(-500, 500),
+				Lumix::Math::randFloat(-50, 50),
+				Lumix::Math::randFloat(-500, 500),
+				Lumix::Math::randFloat(0.5f, 5));
+			bvh.add({i}, spheres[i]);
+		}
+		LUMIX_EXPECT(bvh.isAdded({0}));
+		LUMIX_EXPECT(!bvh.isAdded({SPHERE_COUNT}));
+		// a balanced tree of 1000 leaves
+		LUMIX_EXPECT(bvh.getHeight() < 30);
+
+		// moved spheres, some of them only a little, so they stay in their leaves
+		for (int i = 0; i < SPHERE_COUNT; i += 3)
+		{
+			float offset = i % 2 == 0 ? 0.1f : 100.0f;
+			spheres[i].position.x += offset;
+			bvh.update({i}, spheres[i]);
+		}
+		for (int i = 1; i < SPHERE_COUNT; i += 7)
+		{
+			bvh.remove({i});
+			is_removed[i] = true;
+		}
+		LUMIX_EXPECT(!bvh.isAdded({1}));
+		LUMIX_EXPECT(bvh.getHeight() < 30);
+
+		int max_visited = 0;
+		for (int i = 0; i < 200; ++i)
+		{
+			const Lumix::Sphere& target = spheres[(i * 13) % SPHERE_COUNT];
+			Lumix::Vec3 origin(Lumix::Math::randFloat(-600, 600), 100, Lumix::Math::randFloat(-600, 600));
+			Lumix::Vec3 dir = target.position - origin;
+			dir.normalize();
+
+			int visited;
+			int nearest = castRay(bvh, spheres, origin, dir, &visited);
+			LUMIX_EXPECT(nearest == castRayBruteForce(spheres, is_removed, origin, dir));
+			max_visited = Lumix::Math::maximum(max_visited, visited);
+		}
+		// only the spheres near the rays are visited
+		LUMIX_EXPECT(max_visited < SPHERE_COUNT / 4);
+
+		bvh.clear();
+		LUMIX_EXPECT(!bvh.isAdded({0}));
+		int visited;
+		LUMIX_EXPECT(castRay(bvh, spheres, Lumix::Vec3(0, 100, 0), Lumix::Vec3(0, -1, 0), &visited) == -1);
+		LUMIX_EXPECT(visited == 0);
+	}
+}
+
+REGISTER_TEST("unit_tests/graphics/instance_bvh", UT_instance_bvh, "");
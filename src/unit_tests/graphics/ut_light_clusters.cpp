@@ -0,0 +1,218 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "engine/array.h"
+#include "engine/geometry.h"
+#include "engine/math_utils.h"
+
+#include "engine/mtjd/manager.h"
+
+#include "renderer/light_clusters.h"
+#include <cmath>
+
+namespace
+{
+	// view space bounds of a cluster, x and y are x / z and y / z
+	struct ClusterBounds
+	{
+		float min_x, max_x;
+		float min_y, max_y;
+		float z_near, z_far;
+	};
+
+
+	ClusterBounds getClusterBounds(const Lumix::Frustum& frustum, int x, int y, int z)
+	{
+		float tan_y = tanf(frustum.fov * 0.5f);
+		float tan_x = tan_y * frustum.ratio;
+		float ratio = frustum.far_distance / frustum.near_distance;
+		ClusterBounds bounds;
+		bounds.min_x = tan_x * (2.0f * x / Lumix::LightClusters::SIZE_X - 1);
+		bounds.max_x = tan_x * (2.0f * (x + 1) / Lumix::LightClusters::SIZE_X - 1);
+		bounds.min_y = tan_y * (2.0f * y / Lumix::LightClusters::SIZE_Y - 1);
+		bounds.max_y = tan_y * (2.0f * (y + 1) / Lumix::LightClusters::SIZE_Y - 1);
+		bounds.z_near = frustum.near_distance * powf(ratio, z / (float)Lumix::LightClusters::SIZE_Z);
+		bounds.z_far = frustum.near_distance * powf(ratio, (z + 1) / (float)Lumix::LightClusters::SIZE_Z);
+		return bounds;
+	}
+
+
+	// clusters are assigned to the sphere's bounding box
+	bool isSphereBoxInClusterBox(const ClusterBounds& bounds, const Lumix::Sphere& sphere)
+	{
+		const Lumix::Vec3& point = sphere.position;
+		float min_x = Lumix::Math::minimum(bounds.min_x * bounds.z_near, bounds.min_x * bounds.z_far);
+		float max_x = Lumix::Math::maximum(bounds.max_x * bounds.z_near, bounds.max_x * bounds.z_far);
+		float min_y = Lumix::Math::minimum(bounds.min_y * bounds.z_near, bounds.min_y * bounds.z_far);
+		float max_y = Lumix::Math::maximum(bounds.max_y * bounds.z_near, bounds.max_y * bounds.z_far);
+		Lumix::Vec3 closest(Lumix::Math::clamp(point.x, min_x, max_x),
+			Lumix::Math::clamp(point.y, min_y, max_y),
+			Lumix::Math::clamp(point.z, bounds.z_near, bounds.z_far));
+		float radius = sphere.radius * 1.001f;
+		return fabsf(closest.x - point.x) <= radius && fabsf(closest.y - point.y) <= radius &&
+			   fabsf(closest.z - point.z) <= radius;
+	}
+
+
+	// samples points of the cluster, including its faces
+	bool isSphereInCluster(const ClusterBounds& bounds, const Lumix::Sphere& sphere)
+	{
+		static const int STEPS = 6;
+		// the sphere must really reach into the cluster, not just touch it
+		float radius_squared = sphere.radius * sphere.radius * 0.99f;
+		for (int k = 0; k <= STEPS; ++k)
+		{
+			float z = bounds.z_near + (bounds.z_far - bounds.z_near) * k / STEPS;
+			for (int j = 0; j <= STEPS; ++j)
+			{
+				float y = z * (bounds.min_y + (bounds.max_y - bounds.min_y) * j / STEPS);
+				for (int i = 0; i <= STEPS; ++i)
+				{
+					float x = z * (bounds.min_x + (bounds.max_x - bounds.min_x) * i / STEPS);
+					if ((Lumix::Vec3(x, y, z) - sphere.position).squaredLength() < radius_squared) return true;
+				}
+			}
+		}
+		return false;
+	}
+
+
+	bool contains(const Lumix::LightClusters& clusters, const Lumix::LightClusters::Cluster& cluster, int light)
+	{
+		for (Lumix::u32 i = 0; i < cluster.count; ++i)
+		{
+			if (clusters.light_indices[cluster.offset + i] == light) return true;
+		}
+		return false;
+	}
+
+
+	void checkClusters(const Lumix::Frustum& frustum,
+		const Lumix::Array<Lumix::Sphere>& spheres,
+		const Lumix::LightClusters& clusters)
+	{
+		LUMIX_EXPECT(clusters.near_distance == frustum.near_distance);
+		LUMIX_EXPECT(clusters.far_distance == frustum.far_distance);
+		for (int z = 0; z < Lumix::LightClusters::SIZE_Z; ++z)
+		{
+			for (int y = 0; y < Lumix::LightClusters::SIZE_Y; ++y)
+			{
+				for (int x = 0; x < Lumix::LightClusters::SIZE_X; ++x)
+				{
+					const Lumix::LightClusters::Cluster& cluster =
+						clusters.clusters[x + (y + z * Lumix::LightClusters::SIZE_Y) * Lumix::LightClusters::SIZE_X];
+					LUMIX_EXPECT(cluster.count <= (Lumix::u32)Lumix::LightClusters::MAX_LIGHTS_PER_CLUSTER);
+					LUMIX_EXPECT(cluster.offset + cluster.count <= (Lumix::u32)clusters.light_index_count);
+
+					ClusterBounds bounds = getClusterBounds(frustum, x, y, z);
+					int last_light = -1;
+					for (Lumix::u32 i = 0; i < cluster.count; ++i)
+					{
+						int light = clusters.light_indices[cluster.offset + i];
+						// sorted and unique
+						LUMIX_EXPECT(light > last_light);
+						last_light = light;
+						LUMIX_EXPECT(isSphereBoxInClusterBox(bounds, spheres[light]));
+					}
+
+					for (int light = 0; light < spheres.size(); ++light)
+					{
+						if (!isSphereInCluster(bounds, spheres[light])) continue;
+						if (contains(clusters, cluster, light)) continue;
+						// dropped only from a full cluster, which keeps the first lights
+						LUMIX_EXPECT(cluster.count == (Lumix::u32)Lumix::LightClusters::MAX_LIGHTS_PER_CLUSTER);
+						LUMIX_EXPECT(last_light < light);
+					}
+				}
+			}
+		}
+	}
+
+
+	void UT_light_clusters(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::MTJD::Manager* mtjd_manager = Lumix::MTJD::Manager::create(allocator);
+		Lumix::LightClusterBuilder* builder = Lumix::LightClusterBuilder::create(*mtjd_manager, allocator);
+
+		Lumix::Frustum frustum;
+		frustum.computePerspective(Lumix::Vec3(0, 0, 0),
+			Lumix::Vec3(0, 0, -1),
+			Lumix::Vec3(0, 1, 0),
+			Lumix::Math::degreesToRadians(60),
+			16 / 9.0f,
+			0.1f,
+			100);
+		float tan_y = tanf(frustum.fov * 0.5f);
+		float tan_x = tan_y * frustum.ratio;
+		float slice_ratio = powf(frustum.far_distance / frustum.near_distance, 1.0f / Lumix::LightClusters::SIZE_Z);
+
+		Lumix::Array<Lumix::Sphere> spheres(allocator);
+		Lumix::LightClusters clusters;
+		builder->build(frustum, nullptr, 0, &clusters);
+		checkClusters(frustum, spheres, clusters);
+		LUMIX_EXPECT(clusters.light_index_count == 0);
+
+		// on a slice boundary, on a tile boundary, at the frustum's corner
+		float z = frustum.near_distance * powf(slice_ratio, 10);
+		spheres.emplace(0, 0, z, 0.01f);
+		spheres.emplace(tan_x * z * 0.25f, tan_y * z * 0.5f, z * 1.1f, 0.05f);
+		spheres.emplace(tan_x * 20, tan_y * 20, 20, 0.5f);
+		// partly behind the near plane, partly behind the far plane
+		spheres.emplace(0.05f, -0.05f, 0, 0.2f);
+		spheres.emplace(-10, 5, 99, 3);
+		// outside of the frustum
+		spheres.emplace(0, 0, -5, 1);
+		spheres.emplace(tan_x * 10 + 2, 0, 10, 1);
+		spheres.emplace(0, 0, 110, 5);
+		// big ones
+		spheres.emplace(3, -2, 15, 8);
+		spheres.emplace(-1, 1, 2, 3);
+		// in a single cluster
+		ClusterBounds bounds = getClusterBounds(frustum, 5, 3, 12);
+		float center_z = (bounds.z_near + bounds.z_far) * 0.5f;
+		Lumix::Sphere single(
+			center_z * (bounds.min_x + bounds.max_x) * 0.5f, center_z * (bounds.min_y + bounds.max_y) * 0.5f, center_z, 0.01f);
+		spheres.push(single);
+		builder->build(frustum, &spheres[0], spheres.size(), &clusters);
+		checkClusters(frustum, spheres, clusters);
+		int single_count = 0;
+		for (int i = 0; i < Lumix::LightClusters::CLUSTER_COUNT; ++i)
+		{
+			if (contains(clusters, clusters.clusters[i], spheres.size() - 1)) ++single_count;
+		}
+		LUMIX_EXPECT(single_count == 1);
+		int cluster_idx = 5 + (3 + 12 * Lumix::LightClusters::SIZE_Y) * Lumix::LightClusters::SIZE_X;
+		LUMIX_EXPECT(contains(clusters, clusters.clusters[cluster_idx], spheres.size() - 1));
+
+		// overflow, more lights in one place than a cluster can hold
+		spheres.clear();
+		for (int i = 0; i < Lumix::LightClusters::MAX_LIGHTS_PER_CLUSTER + 6; ++i)
+		{
+			spheres.push(single);
+		}
+		spheres.emplace(single.position.x, single.position.y, single.position.z * 1.5f, 0.01f);
+		builder->build(frustum, &spheres[0], spheres.size(), &clusters);
+		checkClusters(frustum, spheres, clusters);
+		const Lumix::LightClusters::Cluster& full = clusters.clusters[cluster_idx];
+		LUMIX_EXPECT(full.count == (Lumix::u32)Lumix::LightClusters::MAX_LIGHTS_PER_CLUSTER);
+		LUMIX_EXPECT(clusters.light_indices[full.offset] == 0);
+		LUMIX_EXPECT(clusters.light_indices[full.offset + full.count - 1] == Lumix::LightClusters::MAX_LIGHTS_PER_CLUSTER - 1);
+
+		// enough lights to split the slices between several jobs
+		Lumix::Array<Lumix::Sphere> many(allocator);
+		for (int i = 0; i < 400; ++i)
+		{
+			float light_z = 0.5f + (i * 37 % 400) * 0.2f;
+			float x = tan_x * light_z * ((i * 13 % 100) / 50.0f - 1);
+			float y = tan_y * light_z * ((i * 29 % 100) / 50.0f - 1);
+			many.emplace(x, y, light_z, 0.3f + (i % 7) * 0.4f);
+		}
+		builder->build(frustum, &many[0], many.size(), &clusters);
+		checkClusters(frustum, many, clusters);
+
+		Lumix::LightClusterBuilder::destroy(*builder);
+		Lumix::MTJD::Manager::destroy(*mtjd_manager);
+	}
+}
+
+REGISTER_TEST("unit_tests/graphics/light_clusters", UT_light_clusters, "");
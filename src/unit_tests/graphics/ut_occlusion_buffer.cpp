@@ -0,0 +1,202 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "engine/array.h"
+#include "engine/geometry.h"
+#include "engine/math_utils.h"
+#include "engine/matrix.h"
+
+#include "engine/mtjd/manager.h"
+
+#include "renderer/culling_system.h"
+#include "renderer/occlusion_buffer.h"
+#include <cmath>
+
+namespace
+{
+	void UT_occlusion_buffer(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::MTJD::Manager* mtjd_manager = Lumix::MTJD::Manager::create(allocator);
+		Lumix::OcclusionBuffer* buffer = Lumix::OcclusionBuffer::create(*mtjd_manager, allocator);
+
+		Lumix::Frustum frustum;
+		frustum.computePerspective(Lumix::Vec3(0, 0, 0),
+			Lumix::Vec3(0, 0, -1),
+			Lumix::Vec3(0, 1, 0),
+			Lumix::Math::degreesToRadians(60),
+			2,
+			0.1f,
+			100);
+
+		// 8x8 wall 10 units in front of the camera
+		const Lumix::Vec3 vertices[] = {
+			Lumix::Vec3(-4, -4, -10), Lumix::Vec3(4, -4, -10), Lumix::Vec3(4, 4, -10), Lumix::Vec3(-4, 4, -10)};
+		const Lumix::u16 indices16[] = {0, 1, 2, 0, 2, 3};
+		const Lumix::u32 indices32[] = {0, 2, 1, 0, 3, 2};
+
+		buffer->begin(frustum);
+		LUMIX_EXPECT(buffer->isVisible(Lumix::Sphere(0, 0, -20, 1)));
+		buffer->addOccluder(vertices, indices16, Lumix::lengthOf(indices16), Lumix::Matrix::IDENTITY);
+		buffer->rasterize();
+		LUMIX_EXPECT(buffer->getTriangleCount() == 2);
+		const float* depth = buffer->getDepth();
+		// pixels on the shared diagonal are not fully covered by either triangle, so this one is off it
+		int center = (Lumix::OcclusionBuffer::HEIGHT / 2 - 10) * Lumix::OcclusionBuffer::WIDTH +
+					 Lumix::OcclusionBuffer::WIDTH / 2 - 10;
+		LUMIX_EXPECT_CLOSE_EQ(depth[center], 0.1f, 0.001f);
+		LUMIX_EXPECT(depth[0] == 0);
+
+		LUMIX_EXPECT(!buffer->isVisible(Lumix::Sphere(-3, 3, -20, 1)));
+		LUMIX_EXPECT(!buffer->isVisible(Lumix::Sphere(3.5f, 0, -20, 1)));
+		// in front of the wall
+		LUMIX_EXPECT(buffer->isVisible(Lumix::Sphere(0, 0, -5, 1)));
+		// partially sticks out from behind the wall
+		LUMIX_EXPECT(buffer->isVisible(Lumix::Sphere(7.5f, 0, -20, 1)));
+		LUMIX_EXPECT(buffer->isVisible(Lumix::Sphere(12, 0, -20, 1)));
+		// intersects the wall
+		LUMIX_EXPECT(buffer->isVisible(Lumix::Sphere(0, 0, -10, 1)));
+
+		// the same wall, moved to the right, with the opposite winding
+		Lumix::Matrix mtx = Lumix::Matrix::IDENTITY;
+		mtx.setTranslation(Lumix::Vec3(8, 0, 0));
+		buffer->begin(frustum);
+		buffer->addOccluder(vertices, indices32, Lumix::lengthOf(indices32), mtx);
+		buffer->rasterize();
+		LUMIX_EXPECT(buffer->isVisible(Lumix::Sphere(0, 0, -20, 1)));
+		LUMIX_EXPECT(!buffer->isVisible(Lumix::Sphere(13, 3, -20, 1)));
+
+		// the second mesh of a model, its indices are relative to its own first vertex
+		const Lumix::Vec3 model_vertices[] = {
+			Lumix::Vec3(-4, -4, 10), Lumix::Vec3(4, -4, 10), Lumix::Vec3(4, 4, 10), Lumix::Vec3(-4, 4, 10),
+			Lumix::Vec3(-4, -4, -10), Lumix::Vec3(4, -4, -10), Lumix::Vec3(4, 4, -10), Lumix::Vec3(-4, 4, -10)};
+		const int mesh_vertex_offset = 4;
+		buffer->begin(frustum);
+		buffer->addOccluder(model_vertices + mesh_vertex_offset, indices16, Lumix::lengthOf(indices16), Lumix::Matrix::IDENTITY);
+		buffer->rasterize();
+		LUMIX_EXPECT(buffer->getTriangleCount() == 2);
+		LUMIX_EXPECT(!buffer->isVisible(Lumix::Sphere(-3, 3, -20, 1)));
+
+		Lumix::OcclusionBuffer::destroy(*buffer);
+		Lumix::MTJD::Manager::destroy(*mtjd_manager);
+	}
+
+
+	bool isPointOccluded(const Lumix::Vec3& point, const Lumix::Vec3* vertices, const Lumix::u16* indices, int index_count)
+	{
+		float distance = point.length();
+		Lumix::Vec3 dir = point * (1 / distance);
+		for (int i = 0; i < index_count; i += 3)
+		{
+			float t;
+			if (Lumix::Math::getRayTriangleIntersection(
+					Lumix::Vec3(0, 0, 0), dir, vertices[indices[i]], vertices[indices[i + 1]], vertices[indices[i + 2]], &t) &&
+				t < distance)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+
+	// culls spheres the way RenderScene::getModelInstanceInfos does and checks that every sphere
+	// rejected by the occlusion buffer is really hidden, sampled by rays from the camera
+	void UT_occlusion_buffer_culling(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::MTJD::Manager* mtjd_manager = Lumix::MTJD::Manager::create(allocator);
+		Lumix::OcclusionBuffer* buffer = Lumix::OcclusionBuffer::create(*mtjd_manager, allocator);
+		Lumix::CullingSystem* culling_system = Lumix::CullingSystem::create(*mtjd_manager, allocator);
+
+		Lumix::Frustum frustum;
+		frustum.computePerspective(Lumix::Vec3(0, 0, 0),
+			Lumix::Vec3(0, 0, -1),
+			Lumix::Vec3(0, 1, 0),
+			Lumix::Math::degreesToRadians(60),
+			2,
+			0.1f,
+			100);
+
+		// tilted 8x8 wall made of 4x4 quads, so there are edges shared by triangles and depth changes over it
+		static const int GRID_SIZE = 4;
+		Lumix::Vec3 vertices[(GRID_SIZE + 1) * (GRID_SIZE + 1)];
+		for (int j = 0; j <= GRID_SIZE; ++j)
+		{
+			for (int i = 0; i <= GRID_SIZE; ++i)
+			{
+				float x = -4.0f + i * 8.0f / GRID_SIZE;
+				float y = -4.0f + j * 8.0f / GRID_SIZE;
+				vertices[j * (GRID_SIZE + 1) + i].set(x, y, -10 - 0.25f * x);
+			}
+		}
+		Lumix::u16 indices[GRID_SIZE * GRID_SIZE * 6];
+		int index_count = 0;
+		for (int j = 0; j < GRID_SIZE; ++j)
+		{
+			for (int i = 0; i < GRID_SIZE; ++i)
+			{
+				Lumix::u16 v = Lumix::u16(j * (GRID_SIZE + 1) + i);
+				Lumix::u16 quad[] = {v, Lumix::u16(v + 1), Lumix::u16(v + GRID_SIZE + 2),
+					v, Lumix::u16(v + GRID_SIZE + 2), Lumix::u16(v + GRID_SIZE + 1)};
+				for (Lumix::u16 index : quad) indices[index_count++] = index;
+			}
+		}
+
+		Lumix::Array<Lumix::Sphere> spheres(allocator);
+		Lumix::Array<Lumix::ComponentHandle> handles(allocator);
+		const float depths[] = {-9, -14, -25};
+		for (float depth : depths)
+		{
+			for (float y = -7; y <= 7; y += 0.5f)
+			{
+				for (float x = -7; x <= 7; x += 0.5f)
+				{
+					handles.push({spheres.size()});
+					spheres.emplace(x, y, depth, 0.4f);
+				}
+			}
+		}
+		culling_system->insert(spheres, handles);
+
+		buffer->begin(frustum);
+		buffer->addOccluder(vertices, indices, index_count, Lumix::Matrix::IDENTITY);
+		buffer->rasterize();
+		LUMIX_EXPECT(buffer->getTriangleCount() == index_count / 3);
+
+		culling_system->cullToFrustum(frustum, 1);
+		const Lumix::CullingSystem::Results& results = culling_system->getResult();
+		int occluded_count = 0;
+		for (const Lumix::CullingSystem::Subresults& subresults : results)
+		{
+			for (Lumix::ComponentHandle cmp : subresults)
+			{
+				Lumix::Sphere sphere = culling_system->getSphere(cmp);
+				if (buffer->isVisible(sphere)) continue;
+
+				++occluded_count;
+				static const int STEPS = 12;
+				for (int j = 0; j <= STEPS; ++j)
+				{
+					float pitch = Lumix::Math::PI * j / STEPS;
+					for (int i = 0; i < STEPS * 2; ++i)
+					{
+						float yaw = Lumix::Math::PI * i / STEPS;
+						Lumix::Vec3 dir(sinf(pitch) * cosf(yaw), cosf(pitch), sinf(pitch) * sinf(yaw));
+						Lumix::Vec3 point = sphere.position + dir * sphere.radius;
+						LUMIX_EXPECT(isPointOccluded(point, vertices, indices, index_count));
+					}
+				}
+			}
+		}
+		LUMIX_EXPECT(occluded_count > 0);
+		// in front of the wall
+		LUMIX_EXPECT(buffer->isVisible(Lumix::Sphere(0, 0, -9, 0.4f)));
+
+		Lumix::CullingSystem::destroy(*culling_system);
+		Lumix::OcclusionBuffer::destroy(*buffer);
+		Lumix::MTJD::Manager::destroy(*mtjd_manager);
+	}
+}
+
+REGISTER_TEST("unit_tests/graphics/occlusion_buffer", UT_occlusion_buffer, "");
+REGISTER_TEST("unit_tests/graphics/occlusion_buffer/culling", UT_occlusion_buffer_culling, "");
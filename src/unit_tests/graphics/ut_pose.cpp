@@ -0,0 +1,162 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "engine/math_utils.h"
+#include "engine/matrix.h"
+
+#include "renderer/pose.h"
+
+#include <cmath>
+
+namespace
+{
+	const int BONE_COUNT = 19;
+
+
+	Lumix::Quat randomRotation()
+	{
+		Lumix::Vec3 axis(Lumix::Math::randFloat(-1, 1), Lumix::Math::randFloat(-1, 1), Lumix::Math::randFloat(-1, 1));
+		if (axis.squaredLength() < 0.01f) axis.set(0, 1, 0);
+		axis.normalize();
+		return Lumix::Quat(axis, Lumix::Math::randFloat(-Lumix::Math::PI, Lumix::Math::PI));
+	}
+
+
+	Lumix::Transform getTransform(const Lumix::Pose& pose, int bone)
+	{
+		return {pose.getPosition(bone), pose.getRotation(bone)};
+	}
+
+
+	// q and -q are the same rotation
+	bool isSameRotation(const Lumix::Quat& a, const Lumix::Quat& b)
+	{
+		float dot = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+		return fabsf(dot) > 0.9999f;
+	}
+
+
+	bool isSameTransform(const Lumix::Transform& a, const Lumix::Transform& b)
+	{
+		return (a.pos - b.pos).length() < 0.001f && isSameRotation(a.rot, b.rot);
+	}
+
+
+	void UT_pose_absolute_relative(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+
+		// two roots; bone 6 and bone 14 have parents in their own group of four,
+		// so those groups are processed one bone at a time
+		const int parents[BONE_COUNT] = {-1, -1, 0, 1, 2, 3, 5, 2, 7, 8, 4, 0, 6, 6, 13, 9, 1, 16, 15};
+		const int first_nonroot_bone = 2;
+
+		Lumix::Transform relative[BONE_COUNT];
+		Lumix::Pose pose(allocator);
+		pose.resize(BONE_COUNT);
+		for (int i = 0; i < BONE_COUNT; ++i)
+		{
+			relative[i].pos.set(Lumix::Math::randFloat(-2, 2), Lumix::Math::randFloat(-2, 2), Lumix::Math::randFloat(-2, 2));
+			relative[i].rot = randomRotation();
+			pose.setPosition(i, relative[i].pos);
+			pose.setRotation(i, relative[i].rot);
+		}
+
+		// bones one by one, the same as Pose does outside of groups of four
+		Lumix::Transform absolute[BONE_COUNT];
+		for (int i = 0; i < BONE_COUNT; ++i)
+		{
+			absolute[i] = parents[i] < 0 ? relative[i] : absolute[parents[i]] * relative[i];
+		}
+
+		pose.computeAbsolute(parents, first_nonroot_bone);
+		LUMIX_EXPECT(pose.is_absolute);
+		for (int i = 0; i < BONE_COUNT; ++i)
+		{
+			LUMIX_EXPECT(isSameTransform(getTransform(pose, i), absolute[i]));
+		}
+
+		pose.computeRelative(parents, first_nonroot_bone);
+		LUMIX_EXPECT(!pose.is_absolute);
+		for (int i = 0; i < BONE_COUNT; ++i)
+		{
+			Lumix::Transform expected = parents[i] < 0 ? absolute[i] : absolute[parents[i]].inverted() * absolute[i];
+			LUMIX_EXPECT(isSameTransform(getTransform(pose, i), expected));
+			LUMIX_EXPECT(isSameTransform(getTransform(pose, i), relative[i]));
+		}
+
+		pose.computeAbsolute(parents, first_nonroot_bone);
+		for (int i = 0; i < BONE_COUNT; ++i)
+		{
+			LUMIX_EXPECT(isSameTransform(getTransform(pose, i), absolute[i]));
+		}
+	}
+
+
+	void UT_pose_blend(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::Pose a(allocator);
+		Lumix::Pose b(allocator);
+		a.resize(BONE_COUNT);
+		b.resize(BONE_COUNT);
+		Lumix::Transform expected[BONE_COUNT];
+		for (int i = 0; i < BONE_COUNT; ++i)
+		{
+			Lumix::Transform ta = {Lumix::Vec3(Lumix::Math::randFloat(-2, 2), 0, 1), randomRotation()};
+			Lumix::Transform tb = {Lumix::Vec3(0, Lumix::Math::randFloat(-2, 2), -1), randomRotation()};
+			a.setPosition(i, ta.pos);
+			a.setRotation(i, ta.rot);
+			b.setPosition(i, tb.pos);
+			b.setRotation(i, tb.rot);
+			Lumix::lerp(ta.pos, tb.pos, &expected[i].pos, 0.3f);
+			Lumix::nlerp(ta.rot, tb.rot, &expected[i].rot, 0.3f);
+		}
+
+		a.blend(b, 0.3f);
+		for (int i = 0; i < BONE_COUNT; ++i)
+		{
+			LUMIX_EXPECT(isSameTransform(getTransform(a, i), expected[i]));
+		}
+	}
+
+
+	void UT_pose_skinning_matrices(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::Pose pose(allocator);
+		pose.resize(BONE_COUNT);
+		Lumix::Transform inv_bind[BONE_COUNT];
+		for (int i = 0; i < BONE_COUNT; ++i)
+		{
+			pose.setPosition(i, Lumix::Vec3(Lumix::Math::randFloat(-2, 2), Lumix::Math::randFloat(-2, 2), 1));
+			pose.setRotation(i, randomRotation());
+			inv_bind[i].pos.set(0, Lumix::Math::randFloat(-2, 2), Lumix::Math::randFloat(-2, 2));
+			inv_bind[i].rot = randomRotation();
+		}
+
+		// one more than the bone count, it must stay untouched
+		Lumix::Matrix matrices[BONE_COUNT + 1];
+		matrices[BONE_COUNT] = Lumix::Matrix::IDENTITY;
+		pose.computeSkinningMatrices(inv_bind, matrices);
+		for (int i = 0; i < BONE_COUNT; ++i)
+		{
+			Lumix::Matrix expected = (getTransform(pose, i) * inv_bind[i]).toMatrix();
+			const float* expected_values = &expected.m11;
+			const float* values = &matrices[i].m11;
+			for (int j = 0; j < 16; ++j)
+			{
+				LUMIX_EXPECT_CLOSE_EQ(values[j], expected_values[j], 0.001f);
+			}
+		}
+		LUMIX_EXPECT(matrices[BONE_COUNT].m11 == 1);
+		LUMIX_EXPECT(matrices[BONE_COUNT].m41 == 0);
+
+		Lumix::u32 version = pose.version;
+		pose.setRotation(3, randomRotation());
+		LUMIX_EXPECT(pose.version != version);
+	}
+}
+
+REGISTER_TEST("unit_tests/graphics/pose/absolute_relative", UT_pose_absolute_relative, "");
+REGISTER_TEST("unit_tests/graphics/pose/blend", UT_pose_blend, "");
+REGISTER_TEST("unit_tests/graphics/pose/skinning_matrices", UT_pose_skinning_matrices, "");
@@ -0,0 +1,161 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "engine/math_utils.h"
+
+#include "renderer/ray_cast_bvh.h"
+
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+	const int MESH_COUNT = 3;
+	const int RANDOM_TRIANGLE_COUNT = 300;
+	// the last mesh ends with a triangle in the y = 100 plane and a triangle in the z = 100 plane
+	const int SPECIAL_TRIANGLE_COUNT = 2;
+	const int TRIANGLE_COUNT = RANDOM_TRIANGLE_COUNT + SPECIAL_TRIANGLE_COUNT;
+	const int RAY_COUNT = 2000;
+
+
+	struct Geometry
+	{
+		Lumix::Vec3 vertices[TRIANGLE_COUNT * 3];
+		Lumix::u16 indices16[TRIANGLE_COUNT * 3];
+		Lumix::u32 indices32[TRIANGLE_COUNT * 3];
+		Lumix::RayCastBVH::Mesh meshes[MESH_COUNT];
+	};
+
+
+	Lumix::Vec3 randomPoint(float size)
+	{
+		return Lumix::Vec3(Lumix::Math::randFloat(-size, size),
+			Lumix::Math::randFloat(-size, size),
+			Lumix::Math::randFloat(-size, size));
+	}
+
+
+	// every mesh has its own vertices, its indices start at 0 but the mesh does not start at vertex 0
+	void createGeometry(Geometry& geometry)
+	{
+		const int mesh_triangle_counts[MESH_COUNT] = {100, 120, RANDOM_TRIANGLE_COUNT - 220 + SPECIAL_TRIANGLE_COUNT};
+		int triangle = 0;
+		for (int mesh = 0; mesh < MESH_COUNT; ++mesh)
+		{
+			geometry.meshes[mesh].indices_offset = triangle * 3;
+			geometry.meshes[mesh].indices_count = mesh_triangle_counts[mesh] * 3;
+			geometry.meshes[mesh].vertex_offset = triangle * 3;
+			for (int i = 0; i < mesh_triangle_counts[mesh]; ++i, ++triangle)
+			{
+				Lumix::Vec3 center = randomPoint(20);
+				for (int j = 0; j < 3; ++j)
+				{
+					int index = triangle * 3 + j;
+					geometry.vertices[index] = center + randomPoint(3);
+					geometry.indices16[index] = Lumix::u16(i * 3 + j);
+					geometry.indices32[index] = i * 3 + j;
+				}
+			}
+		}
+
+		Lumix::Vec3* special = &geometry.vertices[RANDOM_TRIANGLE_COUNT * 3];
+		special[0].set(100, 100, 100);
+		special[1].set(110, 100, 100);
+		special[2].set(100, 100, 110);
+		special[3].set(100, 0, 100);
+		special[4].set(110, 0, 100);
+		special[5].set(100, 10, 100);
+	}
+
+
+	// the nearest triangle hit by the ray, tested one by one
+	int castRayBruteForce(const Geometry& geometry, const Lumix::Vec3& origin, const Lumix::Vec3& dir, float* t)
+	{
+		int nearest = -1;
+		*t = FLT_MAX;
+		for (int mesh = 0; mesh < MESH_COUNT; ++mesh)
+		{
+			const Lumix::RayCastBVH::Mesh& range = geometry.meshes[mesh];
+			for (int i = range.indices_offset; i < range.indices_offset + range.indices_count; i += 3)
+			{
+				const Lumix::Vec3* vertices = geometry.vertices + range.vertex_offset;
+				float triangle_t;
+				if (Lumix::Math::getRayTriangleIntersection(origin,
+						dir,
+						vertices[geometry.indices32[i]],
+						vertices[geometry.indices32[i + 1]],
+						vertices[geometry.indices32[i + 2]],
+						&triangle_t) &&
+					triangle_t < *t)
+				{
+					*t = triangle_t;
+					nearest = mesh;
+				}
+			}
+		}
+		return nearest;
+	}
+
+
+	void checkRayCasts(const Lumix::RayCastBVH& bvh, const Geometry& geometry)
+	{
+		int hit_count = 0;
+		for (int i = 0; i < RAY_COUNT; ++i)
+		{
+			Lumix::Vec3 origin = randomPoint(40);
+			Lumix::Vec3 dir = randomPoint(20) - origin;
+			float expected_t;
+			int expected_mesh = castRayBruteForce(geometry, origin, dir, &expected_t);
+			float t;
+			int mesh = bvh.castRay(origin, dir, &t);
+			LUMIX_EXPECT(mesh == expected_mesh);
+			if (mesh >= 0 && mesh == expected_mesh)
+			{
+				LUMIX_EXPECT_CLOSE_EQ(t, expected_t, 0.0001f * (1 + expected_t));
+				++hit_count;
+			}
+		}
+		// most rays go through the triangles
+		LUMIX_EXPECT(hit_count > RAY_COUNT / 4);
+
+		float t;
+		// edge-on, the ray lies in the plane of the triangle
+		LUMIX_EXPECT(bvh.castRay(Lumix::Vec3(90, 100, 102), Lumix::Vec3(1, 0, 0.1f), &t) == -1);
+		// the front and the back side
+		LUMIX_EXPECT(bvh.castRay(Lumix::Vec3(102, 2, 110), Lumix::Vec3(0, 0, -1), &t) == MESH_COUNT - 1);
+		LUMIX_EXPECT_CLOSE_EQ(t, 10, 0.0001f);
+		LUMIX_EXPECT(bvh.castRay(Lumix::Vec3(102, 2, 90), Lumix::Vec3(0, 0, 1), &t) == MESH_COUNT - 1);
+		LUMIX_EXPECT_CLOSE_EQ(t, 10, 0.0001f);
+		LUMIX_EXPECT(bvh.castRay(Lumix::Vec3(102, 101, 102), Lumix::Vec3(0, -1, 0), &t) == MESH_COUNT - 1);
+		LUMIX_EXPECT_CLOSE_EQ(t, 1, 0.0001f);
+		LUMIX_EXPECT(bvh.castRay(Lumix::Vec3(102, 99, 102), Lumix::Vec3(0, 1, 0), &t) == MESH_COUNT - 1);
+		LUMIX_EXPECT_CLOSE_EQ(t, 1, 0.0001f);
+		// the triangle is behind the origin
+		LUMIX_EXPECT(bvh.castRay(Lumix::Vec3(102, 2, 110), Lumix::Vec3(0, 0, 1), &t) == -1);
+	}
+
+
+	void UT_ray_cast_bvh(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Geometry* geometry = LUMIX_NEW(allocator, Geometry)();
+		createGeometry(*geometry);
+
+		Lumix::RayCastBVH bvh(allocator);
+		LUMIX_EXPECT(bvh.empty());
+		float t;
+		LUMIX_EXPECT(bvh.castRay(Lumix::Vec3(0, 0, 0), Lumix::Vec3(0, 0, 1), &t) == -1);
+
+		bvh.build(geometry->vertices, geometry->indices16, true, geometry->meshes, MESH_COUNT);
+		LUMIX_EXPECT(!bvh.empty());
+		checkRayCasts(bvh, *geometry);
+
+		bvh.build(geometry->vertices, geometry->indices32, false, geometry->meshes, MESH_COUNT);
+		checkRayCasts(bvh, *geometry);
+
+		bvh.clear();
+		LUMIX_EXPECT(bvh.empty());
+		LUMIX_DELETE(allocator, geometry);
+	}
+}
+
+REGISTER_TEST("unit_tests/graphics/ray_cast_bvh", UT_ray_cast_bvh, "");
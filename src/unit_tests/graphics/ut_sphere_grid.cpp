@@ -0,0 +1,78 @@
+#include "unit_tests/suite/lumix_unit_tests.h"
+
+#include "engine/array.h"
+#include "engine/geometry.h"
+
+#include "renderer/sphere_grid.h"
+
+namespace
+{
+	bool contains(const Lumix::Array<Lumix::ComponentHandle>& array, int index)
+	{
+		for (Lumix::ComponentHandle cmp : array)
+		{
+			if (cmp.index == index) return true;
+		}
+		return false;
+	}
+
+
+	void UT_sphere_grid(const char* params)
+	{
+		Lumix::DefaultAllocator allocator;
+		Lumix::SphereGrid* grid = Lumix::SphereGrid::create(10, allocator);
+		Lumix::Array<Lumix::ComponentHandle> result(allocator);
+
+		grid->add({0}, Lumix::Sphere(5, 2, 2, 1));
+		// spans several cells, but it is reported only once
+		grid->add({1}, Lumix::Sphere(20, 0, 0, 12));
+		// spans too many cells to be in them
+		grid->add({2}, Lumix::Sphere(-500, 0, 0, 100));
+		LUMIX_EXPECT(grid->isAdded({1}));
+		LUMIX_EXPECT(!grid->isAdded({3}));
+
+		grid->query(Lumix::Sphere(0, 0, 0, 2), result);
+		LUMIX_EXPECT(result.size() == 0);
+
+		grid->query(Lumix::Sphere(8, 0, 0, 5), result);
+		LUMIX_EXPECT(result.size() == 2);
+		LUMIX_EXPECT(contains(result, 0));
+		LUMIX_EXPECT(contains(result, 1));
+
+		result.clear();
+		grid->query(Lumix::Sphere(-450, 0, 0, 60), result);
+		LUMIX_EXPECT(result.size() == 1);
+		LUMIX_EXPECT(contains(result, 2));
+
+		// a query bigger than the whole grid
+		result.clear();
+		grid->query(Lumix::Sphere(0, 0, 0, 10000), result);
+		LUMIX_EXPECT(result.size() == 3);
+
+		grid->update({0}, Lumix::Sphere(105, 2, 2, 1));
+		result.clear();
+		grid->query(Lumix::Sphere(8, 0, 0, 5), result);
+		LUMIX_EXPECT(result.size() == 1);
+		LUMIX_EXPECT(contains(result, 1));
+		result.clear();
+		grid->query(Lumix::Sphere(100, 0, 0, 5), result);
+		LUMIX_EXPECT(result.size() == 1);
+		LUMIX_EXPECT(contains(result, 0));
+
+		grid->remove({1});
+		LUMIX_EXPECT(!grid->isAdded({1}));
+		result.clear();
+		grid->query(Lumix::Sphere(0, 0, 0, 10000), result);
+		LUMIX_EXPECT(result.size() == 2);
+		LUMIX_EXPECT(!contains(result, 1));
+
+		grid->clear();
+		result.clear();
+		grid->query(Lumix::Sphere(0, 0, 0, 10000), result);
+		LUMIX_EXPECT(result.size() == 0);
+
+		Lumix::SphereGrid::destroy(*grid);
+	}
+}
+
+REGISTER_TEST("unit_tests/graphics/sphere_grid", UT_sphere_grid, "");